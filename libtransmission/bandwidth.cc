@@ -8,11 +8,11 @@
 
 #include <algorithm>
 #include <cstring> /* memset() */
+#include <iterator>
 #include <vector>
 
 #include "transmission.h"
 #include "bandwidth.h"
-#include "crypto-utils.h" /* tr_rand_int_weak() */
 #include "log.h"
 #include "peer-io.h"
 #include "tr-assert.h"
@@ -31,36 +31,28 @@ unsigned int Bandwidth::getSpeedBytesPerSecond(RateControl& r, unsigned int inte
         now = tr_time_msec();
     }
 
-    if (now != r.cache_time_)
+    /* age out the transfers that have slid out of the window */
+    uint64_t const cutoff = now - interval_msec;
+
+    while (r.count_ > 0)
     {
-        uint64_t bytes = 0;
-        uint64_t const cutoff = now - interval_msec;
+        auto& oldest = r.transfers_[(r.newest_ + HistorySize + 1 - r.count_) % HistorySize];
 
-        for (int i = r.newest_; r.transfers_[i].date_ > cutoff;)
+        if (oldest.date_ > cutoff)
         {
-            bytes += r.transfers_[i].size_;
-
-            if (--i == -1)
-            {
-                i = HistorySize - 1; /* circular history */
-            }
-
-            if (i == r.newest_)
-            {
-                break; /* we've come all the way around */
-            }
+            break;
         }
 
-        r.cache_val_ = unsigned(bytes * 1000U / interval_msec);
-        r.cache_time_ = now;
+        r.bytes_ -= oldest.size_;
+        --r.count_;
     }
 
-    return r.cache_val_;
+    return unsigned(r.bytes_ * 1000U / interval_msec);
 }
 
 void Bandwidth::notifyBandwidthConsumedBytes(uint64_t const now, RateControl* r, size_t size)
 {
-    if (r->transfers_[r->newest_].date_ + GranularityMSec >= now)
+    if (r->count_ > 0 && r->transfers_[r->newest_].date_ + GranularityMSec >= now)
     {
         r->transfers_[r->newest_].size_ += size;
     }
@@ -71,12 +63,21 @@ void Bandwidth::notifyBandwidthConsumedBytes(uint64_t const now, RateControl* r,
             r->newest_ = 0;
         }
 
+        /* the history is circular, so the oldest transfer makes way */
+        if (r->count_ == HistorySize)
+        {
+            r->bytes_ -= r->transfers_[r->newest_].size_;
+        }
+        else
+        {
+            ++r->count_;
+        }
+
         r->transfers_[r->newest_].date_ = now;
         r->transfers_[r->newest_].size_ = size;
     }
 
-    /* invalidate cache_val*/
-    r->cache_time_ = 0;
+    r->bytes_ += size;
 }
 
 /***
@@ -164,89 +165,65 @@ void Bandwidth::allocateBandwidth(
     }
 }
 
-void Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir)
+size_t Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir, size_t first)
 {
     /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
-     * peers from starving the others. Loop through the peers, giving each a
-     * small chunk of bandwidth. Keep looping until we run out of bandwidth
+     * peers from starving the others. Go round the peers, giving each a
+     * weighted chunk of bandwidth. Keep going until we run out of bandwidth
      * and/or peers that can use it */
-    dbgmsg("%lu peers to go round-robin for %s", peerArray.size(), dir == TR_UP ? "upload" : "download");
+    dbgmsg("%zu peers to go round-robin for %s", std::size(peerArray), dir == TR_UP ? "upload" : "download");
 
-    size_t n = peerArray.size();
-    while (n > 0)
+    auto const quantum = [&peerArray](size_t i)
     {
-        int const i = tr_rand_int_weak(n); /* pick a peer at random */
+        auto const* const io = peerArray[i];
+        auto const size = io->socket.type == TR_PEER_SOCKET_TYPE_UTP ? UtpQuantum : TcpQuantum;
+        return size * priorityWeight(io->priority);
+    };
 
-        /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
-         * frame right away and leave enough buffered data for the next frame to go
-         * out in a timely manner. */
-        size_t const increment = 3000;
-
-        int const bytes_used = tr_peerIoFlush(peerArray[i], dir, increment);
-
-        dbgmsg("peer #%d of %zu used %d bytes in this pass", i, n, bytes_used);
+    auto const flush = [&peerArray, dir](size_t i, size_t offered)
+    {
+        int const bytes_used = tr_peerIoFlush(peerArray[i], dir, offered);
+        dbgmsg("peer #%zu used %d of %zu bytes in this pass", i, bytes_used, offered);
+        return size_t(std::max(bytes_used, 0));
+    };
 
-        if (bytes_used != int(increment))
-        {
-            /* peer is done writing for now; move it to the end of the list */
-            std::swap(peerArray[i], peerArray[n - 1]);
-            --n;
-        }
-    }
+    return roundRobin(std::size(peerArray), first, quantum, flush);
 }
 
 void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
 {
     TR_ASSERT(tr_isDirection(dir));
 
-    auto high = std::vector<tr_peerIo*>{};
-    auto low = std::vector<tr_peerIo*>{};
-    auto normal = std::vector<tr_peerIo*>{};
-    auto tmp = std::vector<tr_peerIo*>{};
+    auto peers = std::vector<tr_peerIo*>{};
 
     /* allocateBandwidth () is a helper function with two purposes:
      * 1. allocate bandwidth to b and its subtree
      * 2. accumulate an array of all the peerIos from b and its subtree. */
-    this->allocateBandwidth(TR_PRI_LOW, dir, period_msec, tmp);
+    this->allocateBandwidth(TR_PRI_LOW, dir, period_msec, peers);
 
-    for (auto* io : tmp)
+    for (auto* io : peers)
     {
         tr_peerIoRef(io);
         tr_peerIoFlushOutgoingProtocolMsgs(io);
-
-        switch (io->priority)
-        {
-        case TR_PRI_HIGH:
-            high.push_back(io);
-            [[fallthrough]];
-
-        case TR_PRI_NORMAL:
-            normal.push_back(io);
-            [[fallthrough]];
-
-        default:
-            low.push_back(io);
-        }
     }
 
     /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
-     * peers from starving the others. Loop through the peers, giving each a
-     * small chunk of bandwidth. Keep looping until we run out of bandwidth
-     * and/or peers that can use it */
-    phaseOne(high, dir);
-    phaseOne(normal, dir);
-    phaseOne(low, dir);
+     * peers from starving the others. Each pass starts one peer further along
+     * so that the same peer isn't always first in line. */
+    auto& first = this->next_first_peer_[dir];
+    auto const n_flushes = phaseOne(peers, dir, first++);
+    dbgmsg("%zu flushes to share %s bandwidth", n_flushes, dir == TR_UP ? "upload" : "download");
 
     /* Second phase of IO. To help us scale in high bandwidth situations,
      * enable on-demand IO for peers with bandwidth left to burn.
      * This on-demand IO is enabled until (1) the peer runs out of bandwidth,
      * or (2) the next Bandwidth::allocate () call, when we start over again. */
-    for (auto* io : tmp)
+    for (auto* io : peers)
     {
         tr_peerIoSetEnabled(io, dir, tr_peerIoHasBandwidthLeft(io, dir));
     }
 
-    for (auto* io : tmp)
+    for (auto* io : peers)
     {
         tr_peerIoUnref(io);
     }
@@ -273,8 +250,8 @@ unsigned int Bandwidth::clamp(uint64_t now, tr_direction dir, unsigned int byte_
                 now = tr_time_msec();
             }
 
-            auto const current = this->getRawSpeedBytesPerSecond(now, TR_DOWN);
-            auto const desired = this->getDesiredSpeedBytesPerSecond(TR_DOWN);
+            auto const current = this->getRawSpeedBytesPerSecond(now, dir);
+            auto const desired = this->getDesiredSpeedBytesPerSecond(dir);
             auto const r = desired >= 1 ? double(current) / desired : 0;
 
             if (r > 1.0)
@@ -12,7 +12,10 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <algorithm>
 #include <array>
+#include <cstddef> // size_t
+#include <numeric>
 #include <vector>
 
 #include "transmission.h"
@@ -63,6 +66,13 @@ class tr_peerIo;
  *   The peer-ios all have a pointer to their associated tr_bandwidth object,
  *   and call Bandwidth::clamp() before performing I/O to see how much
  *   bandwidth they can safely use.
+ *
+ * SCHEDULING
+ *
+ *   Bandwidth::allocate() shares each period's bandwidth among the peer-ios
+ *   in weighted rounds: every peer gets a quantum sized to its socket type
+ *   and scaled by its torrent's priority, and drops out of the rounds once
+ *   it can't use all of its quantum. See Bandwidth::roundRobin().
  */
 struct Bandwidth
 {
@@ -201,11 +211,87 @@ public:
         return this->band_[direction].honor_parent_limits_;
     }
 
+    /**
+     * @brief How many quanta a peer gets per round, by bandwidth priority
+     */
+    [[nodiscard]] static constexpr size_t priorityWeight(tr_priority_t priority)
+    {
+        switch (priority)
+        {
+        case TR_PRI_HIGH:
+            return 4;
+
+        case TR_PRI_NORMAL:
+            return 2;
+
+        default:
+            return 1;
+        }
+    }
+
+    /**
+     * @brief Shares bandwidth among `n_peers` peers in weighted rounds
+     *
+     * Each round, every peer still in the rounds is offered `quantum(i)` bytes
+     * by calling `flush(i, quantum(i))`, which returns how many bytes peer `i`
+     * actually used. A peer that uses less than it was offered is finished
+     * for now and leaves the rounds. Peers keep their relative order, and the
+     * first round starts with peer `first` so that nobody's always first in line.
+     *
+     * @return the number of times `flush` was called
+     */
+    template<typename QuantumFunc, typename FlushFunc>
+    static size_t roundRobin(size_t n_peers, size_t first, QuantumFunc const& quantum, FlushFunc const& flush)
+    {
+        auto peers = std::vector<size_t>(n_peers);
+        std::iota(std::begin(peers), std::end(peers), 0);
+        if (n_peers > 0)
+        {
+            std::rotate(std::begin(peers), std::begin(peers) + first % n_peers, std::end(peers));
+        }
+
+        size_t n_calls = 0;
+
+        while (!std::empty(peers))
+        {
+            // offer everyone a quantum, keeping the peers that used all of theirs
+            auto n_kept = size_t{ 0 };
+
+            for (auto const i : peers)
+            {
+                size_t const offered = quantum(i);
+                size_t const used = flush(i, offered);
+                ++n_calls;
+
+                if (used >= offered)
+                {
+                    peers[n_kept++] = i;
+                }
+            }
+
+            peers.resize(n_kept);
+        }
+
+        return n_calls;
+    }
+
+    /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
+     * frame right away and leave enough buffered data for the next frame to go
+     * out in a timely manner. */
+    static constexpr size_t UtpQuantum = 3000U;
+
+    /* a TCP socket can take a whole 16 KiB block message, plus its 13-byte
+     * header, in one write, so there's no need to dole it out in uTP-sized pieces */
+    static constexpr size_t TcpQuantum = 16384U + 13U;
+
     static constexpr size_t HistoryMSec = 2000U;
     static constexpr size_t IntervalMSec = HistoryMSec;
-    static constexpr size_t GranularityMSec = 200;
+    static constexpr size_t GranularityMSec = 50;
     static constexpr size_t HistorySize = (IntervalMSec / GranularityMSec);
 
+    /* A sliding window of recent transfers. `bytes_` is kept as the sum of
+     * the transfers still in the window, so neither recording a transfer nor
+     * asking for the speed has to walk the whole history. */
     struct RateControl
     {
         struct Transfer
@@ -214,9 +300,9 @@ public:
             uint64_t size_;
         };
         std::array<Transfer, HistorySize> transfers_;
-        uint64_t cache_time_;
-        unsigned int cache_val_;
-        int newest_;
+        uint64_t bytes_;
+        size_t newest_;
+        size_t count_;
     };
 
     struct Band
@@ -236,7 +322,7 @@ private:
 
     [[nodiscard]] unsigned int clamp(uint64_t now, tr_direction dir, unsigned int byte_count) const;
 
-    static void phaseOne(std::vector<tr_peerIo*>& peer_array, tr_direction dir);
+    static size_t phaseOne(std::vector<tr_peerIo*>& peer_array, tr_direction dir, size_t first);
 
     void allocateBandwidth(
         tr_priority_t parent_priority,
@@ -248,6 +334,7 @@ private:
     Bandwidth* parent_ = nullptr;
     std::vector<Bandwidth*> children_;
     tr_peerIo* peer_ = nullptr;
+    std::array<size_t, 2> next_first_peer_ = {};
     tr_priority_t priority_ = 0;
 };
 
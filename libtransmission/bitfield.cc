@@ -7,13 +7,22 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring> // memcpy()
 #include <vector>
 
 #include "transmission.h"
 
 #include "bitfield.h"
 #include "tr-assert.h"
-#include "utils.h" /* tr_new0() */
+#include "tr-macros.h"
+
+// pick the fastest popcount at runtime on x86
+#if (defined(__x86_64__) || defined(__i386__)) && (TR_GNUC_CHECK_VERSION(4, 9) || defined(__clang__))
+#define TR_BITFIELD_X86_DISPATCH
+#include <immintrin.h>
+#endif
 
 /****
 *****
@@ -22,63 +31,191 @@
 namespace
 {
 
+using Word = uint64_t;
+
+auto constexpr WordBits = size_t{ 64 };
+auto constexpr AllOnes = ~Word{};
+
 constexpr size_t getBytesNeeded(size_t bit_count)
 {
     return (bit_count >> 3) + ((bit_count & 7) != 0 ? 1 : 0);
 }
 
-static void setAllTrue(uint8_t* array, size_t bit_count)
+constexpr size_t getWordsNeeded(size_t bit_count)
 {
-    uint8_t constexpr Val = 0xFF;
-    size_t const n = getBytesNeeded(bit_count);
+    return (bit_count >> 6) + ((bit_count & 63) != 0 ? 1 : 0);
+}
 
-    if (n > 0)
+// converts between native and big-endian byte order, which is how the
+// words look in the raw BEP0003 bytes. It's its own inverse.
+Word bigEndian(Word word)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return word;
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap64(word);
+#else
+    auto bytes = std::array<uint8_t, sizeof(Word)>{};
+    for (size_t i = 0; i < sizeof(Word); ++i)
     {
-        std::fill_n(array, n, Val);
-        array[n - 1] = Val << (n * 8 - bit_count);
+        bytes[i] = uint8_t(word >> (56 - 8 * i));
     }
+
+    std::memcpy(&word, std::data(bytes), sizeof(word));
+    return word;
+#endif
 }
 
-constexpr int8_t const trueBitCount[256] = {
-    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 1, 2, 2, 3, 2,
-    3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3,
-    3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5,
-    6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4,
-    3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4,
-    5, 5, 6, 5, 6, 6, 7, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6,
-    6, 7, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
-};
+// The words hold the raw BEP0003 bytes just as they are, so raw() and
+// setRaw() are plain copies. Counting and combining words doesn't care
+// about byte order, but masks for particular bits are swapped to match.
+inline Word bitMask(size_t nth)
+{
+    return bigEndian(Word{ 1 } << (WordBits - 1 - (nth & 63)));
+}
 
-} // namespace
+// the bits at [begin, end) within a word, where begin < end <= 64
+inline Word spanMask(size_t begin, size_t end)
+{
+    return bigEndian((AllOnes >> begin) & (end < WordBits ? ~(AllOnes >> end) : AllOnes));
+}
 
-/****
-*****
-****/
+// std::popcount() is C++20. The builtin is only a win when it compiles
+// to an instruction; on x86 that's only when POPCNT is enabled, since
+// otherwise it's a libgcc call that's slower than the fallback below
+inline size_t popcount(Word word)
+{
+#if (__has_builtin(__builtin_popcountll) || TR_GNUC_CHECK_VERSION(3, 4)) && \
+    (defined(__POPCNT__) || !(defined(__x86_64__) || defined(__i386__)))
+    return __builtin_popcountll(word);
+#else
+    word -= (word >> 1) & UINT64_C(0x5555555555555555);
+    word = (word & UINT64_C(0x3333333333333333)) + ((word >> 2) & UINT64_C(0x3333333333333333));
+    word = (word + (word >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+    return size_t((word * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
 
-size_t tr_bitfield::countFlags() const
+// count the bits set in `a`, or in `a & b` if `b` isn't null
+size_t countWordsPortable(Word const* a, Word const* b, size_t n)
 {
     size_t ret = 0;
 
-    for (auto ch : flags_)
+    for (size_t i = 0; i < n; ++i)
     {
-        ret += trueBitCount[ch];
+        ret += popcount(b != nullptr ? a[i] & b[i] : a[i]);
     }
 
     return ret;
 }
 
+#ifdef TR_BITFIELD_X86_DISPATCH
+
+__attribute__((target("popcnt"))) size_t countWordsPopcnt(Word const* a, Word const* b, size_t n)
+{
+    size_t ret = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        ret += __builtin_popcountll(b != nullptr ? a[i] & b[i] : a[i]);
+    }
+
+    return ret;
+}
+
+// Muła's nibble lookup: count each byte's bits with a table lookup
+// on both of its nibbles, then sum the bytes 256 bits at a time
+__attribute__((target("avx2"))) size_t countWordsAvx2(Word const* a, Word const* b, size_t n)
+{
+    auto const lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    auto const low_mask = _mm256_set1_epi8(0x0F);
+    auto sums = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + i));
+        if (b != nullptr)
+        {
+            v = _mm256_and_si256(v, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + i)));
+        }
+
+        auto const lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_mask));
+        auto const hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums);
+    size_t ret = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    return ret + countWordsPopcnt(a + i, b != nullptr ? b + i : nullptr, n - i);
+}
+
+#endif
+
+// counting is what large bitfields spend their time on,
+// so use the best version that this CPU supports
+size_t countWords(Word const* a, Word const* b, size_t n)
+{
+    using CountWordsFunc = size_t (*)(Word const*, Word const*, size_t);
+
+    static CountWordsFunc const count_words = []() -> CountWordsFunc
+    {
+#ifdef TR_BITFIELD_X86_DISPATCH
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return countWordsAvx2;
+        }
+
+        if (__builtin_cpu_supports("popcnt"))
+        {
+            return countWordsPopcnt;
+        }
+#endif
+
+        return countWordsPortable;
+    }();
+
+    return count_words(a, b, n);
+}
+
+void setAllTrue(Word* array, size_t bit_count)
+{
+    size_t const n = getWordsNeeded(bit_count);
+
+    if (n > 0)
+    {
+        std::fill_n(array, n, AllOnes);
+        array[n - 1] = spanMask(0, bit_count - (n - 1) * WordBits);
+    }
+}
+
+} // namespace
+
+/****
+*****
+****/
+
+size_t tr_bitfield::countFlags() const
+{
+    return countWords(std::data(flags_), nullptr, std::size(flags_));
+}
+
 size_t tr_bitfield::countFlags(size_t begin, size_t end) const
 {
     size_t ret = 0;
-    size_t const first_byte = begin >> 3U;
-    size_t const last_byte = (end - 1) >> 3U;
+    size_t const first_word = begin >> 6U;
+    size_t const last_word = (end - 1) >> 6U;
 
     if (bit_count_ == 0)
     {
         return 0;
     }
 
-    if (first_byte >= std::size(flags_))
+    if (first_word >= std::size(flags_))
     {
         return 0;
     }
@@ -86,48 +223,34 @@ size_t tr_bitfield::countFlags(size_t begin, size_t end) const
     TR_ASSERT(begin < end);
     TR_ASSERT(!std::empty(flags_));
 
-    if (first_byte == last_byte)
-    {
-        uint8_t val = flags_[first_byte];
+    auto const first_mask = spanMask(begin & 63U, WordBits);
+    auto const last_mask = spanMask(0, ((end - 1) & 63U) + 1);
 
-        int i = begin - (first_byte * 8);
-        val <<= i;
-        val >>= i;
-        i = (last_byte + 1) * 8 - end;
-        val >>= i;
-        val <<= i;
-
-        ret += trueBitCount[val];
+    if (first_word == last_word)
+    {
+        ret += popcount(flags_[first_word] & first_mask & last_mask);
     }
     else
     {
-        size_t const walk_end = std::min(std::size(flags_), last_byte);
+        size_t const walk_end = std::min(std::size(flags_), last_word);
 
-        /* first byte */
-        size_t const first_shift = begin - (first_byte * 8);
-        uint8_t val = flags_[first_byte];
-        val <<= first_shift;
-        val >>= first_shift;
-        ret += trueBitCount[val];
+        /* first word */
+        ret += popcount(flags_[first_word] & first_mask);
 
-        /* middle bytes */
-        for (size_t i = first_byte + 1; i < walk_end; ++i)
+        /* middle words */
+        if (first_word + 1 < walk_end)
         {
-            ret += trueBitCount[flags_[i]];
+            ret += countWords(std::data(flags_) + first_word + 1, nullptr, walk_end - first_word - 1);
         }
 
-        /* last byte */
-        if (last_byte < std::size(flags_))
+        /* last word */
+        if (last_word < std::size(flags_))
         {
-            size_t const last_shift = (last_byte + 1) * 8 - end;
-            val = flags_[last_byte];
-            val >>= last_shift;
-            val <<= last_shift;
-            ret += trueBitCount[val];
+            ret += popcount(flags_[last_word] & last_mask);
         }
     }
 
-    TR_ASSERT(ret <= (begin - end));
+    TR_ASSERT(ret <= end - begin);
     return ret;
 }
 
@@ -148,13 +271,83 @@ size_t tr_bitfield::count(size_t begin, size_t end) const
 
 bool tr_bitfield::testFlag(size_t n) const
 {
-    if (n >> 3U >= std::size(flags_))
+    if (n >> 6U >= std::size(flags_))
     {
         return false;
     }
 
-    bool ret = (flags_[n >> 3U] << (n & 7U) & 0x80) != 0;
-    return ret;
+    return (flags_[n >> 6U] & bitMask(n)) != 0;
+}
+
+size_t tr_bitfield::countIntersection(tr_bitfield const& that) const
+{
+    if (hasNone() || that.hasNone())
+    {
+        return 0;
+    }
+
+    if (hasAll())
+    {
+        return that.count();
+    }
+
+    if (that.hasAll())
+    {
+        return count();
+    }
+
+    auto const n = std::min(std::size(flags_), std::size(that.flags_));
+    return countWords(std::data(flags_), std::data(that.flags_), n);
+}
+
+void tr_bitfield::intersect(tr_bitfield const& that)
+{
+    TR_ASSERT(size() == that.size());
+
+    if (hasNone() || that.hasAll())
+    {
+        return;
+    }
+
+    if (that.hasNone())
+    {
+        setHasNone();
+        return;
+    }
+
+    ensureBitsAlloced(bit_count_);
+
+    for (size_t i = 0, n = std::size(flags_); i < n; ++i)
+    {
+        flags_[i] &= i < std::size(that.flags_) ? that.flags_[i] : 0;
+    }
+
+    rebuildTrueCount();
+}
+
+void tr_bitfield::subtract(tr_bitfield const& that)
+{
+    TR_ASSERT(size() == that.size());
+
+    if (hasNone() || that.hasNone())
+    {
+        return;
+    }
+
+    if (that.hasAll())
+    {
+        setHasNone();
+        return;
+    }
+
+    ensureBitsAlloced(bit_count_);
+
+    for (size_t i = 0, n = std::min(std::size(flags_), std::size(that.flags_)); i < n; ++i)
+    {
+        flags_[i] &= ~that.flags_[i];
+    }
+
+    rebuildTrueCount();
 }
 
 /***
@@ -174,20 +367,24 @@ bool tr_bitfield::assertValid() const
 
 std::vector<uint8_t> tr_bitfield::raw() const
 {
-    auto const n = getBytesNeeded(bit_count_);
+    // if we don't know the bit count, it's as many bytes as have been used
+    auto const n = bit_count_ > 0 ? getBytesNeeded(bit_count_) : byte_count_;
 
-    if (!std::empty(flags_))
+    if (hasAll())
     {
-        return flags_;
-    }
+        auto raw = std::vector<uint8_t>(n, 0xFF);
 
-    auto raw = std::vector<uint8_t>(n);
+        if (n > 0 && (bit_count_ & 7U) != 0)
+        {
+            raw.back() = 0xFF << (8 - (bit_count_ & 7U));
+        }
 
-    if (hasAll())
-    {
-        setAllTrue(std::data(raw), std::size(raw));
+        return raw;
     }
 
+    auto const* const bytes = reinterpret_cast<uint8_t const*>(std::data(flags_));
+    auto raw = std::vector<uint8_t>(bytes, bytes + std::min(n, std::size(flags_) * sizeof(Word)));
+    raw.resize(n);
     return raw;
 }
 
@@ -195,11 +392,14 @@ void tr_bitfield::ensureBitsAlloced(size_t n)
 {
     bool const has_all = hasAll();
 
-    size_t const bytes_needed = has_all ? getBytesNeeded(std::max(n, true_count_)) : getBytesNeeded(n);
+    size_t const bits_needed = has_all ? std::max(n, true_count_) : n;
+    size_t const words_needed = getWordsNeeded(bits_needed);
+
+    byte_count_ = std::max(byte_count_, getBytesNeeded(bits_needed));
 
-    if (std::size(flags_) < bytes_needed)
+    if (std::size(flags_) < words_needed)
     {
-        flags_.resize(bytes_needed);
+        flags_.resize(words_needed);
 
         if (has_all)
         {
@@ -222,7 +422,8 @@ bool tr_bitfield::ensureNthBitAlloced(size_t nth)
 
 void tr_bitfield::freeArray()
 {
-    flags_ = std::vector<uint8_t>{};
+    flags_ = std::vector<Word>{};
+    byte_count_ = 0;
 }
 
 void tr_bitfield::setTrueCount(size_t n)
@@ -294,20 +495,24 @@ void tr_bitfield::setHasAll()
 
 void tr_bitfield::setRaw(uint8_t const* raw, size_t byte_count)
 {
-    flags_ = std::vector<uint8_t>(raw, raw + byte_count);
-
-    // ensure any excess bits at the end of the array are set to '0'.
-    if (byte_count == getBytesNeeded(bit_count_))
+    // ignore anything past the end of the bitfield
+    if (bit_count_ > 0)
     {
-        int const excess_bit_count = byte_count * 8 - bit_count_;
+        byte_count = std::min(byte_count, getBytesNeeded(bit_count_));
+    }
 
-        TR_ASSERT(excess_bit_count >= 0);
-        TR_ASSERT(excess_bit_count <= 7);
+    flags_.assign(getWordsNeeded(byte_count * 8), 0);
+    byte_count_ = byte_count;
 
-        if (excess_bit_count != 0)
-        {
-            flags_.back() &= 0xff << excess_bit_count;
-        }
+    if (byte_count > 0)
+    {
+        std::memcpy(std::data(flags_), raw, byte_count);
+    }
+
+    // ensure any excess bits at the end of the array are set to '0'.
+    if (bit_count_ > 0 && std::size(flags_) == getWordsNeeded(bit_count_))
+    {
+        flags_.back() &= spanMask(0, bit_count_ - (std::size(flags_) - 1) * WordBits);
     }
 
     rebuildTrueCount();
@@ -317,15 +522,15 @@ void tr_bitfield::setFromBools(bool const* flags, size_t n)
 {
     size_t trueCount = 0;
 
-    freeArray();
-    ensureBitsAlloced(n);
+    flags_.assign(getWordsNeeded(n), 0);
+    byte_count_ = getBytesNeeded(n);
 
     for (size_t i = 0; i < n; ++i)
     {
         if (flags[i])
         {
             ++trueCount;
-            flags_[i >> 3U] |= (0x80 >> (i & 7U));
+            flags_[i >> 6U] |= bitMask(i);
         }
     }
 
@@ -346,12 +551,12 @@ void tr_bitfield::set(size_t nth, bool value)
 
     if (value)
     {
-        flags_[nth >> 3U] |= 0x80 >> (nth & 7U);
+        flags_[nth >> 6U] |= bitMask(nth);
         incrementTrueCount(1);
     }
     else
     {
-        flags_[nth >> 3U] &= 0xff7f >> (nth & 7U);
+        flags_[nth >> 6U] &= ~bitMask(nth);
         decrementTrueCount(1);
     }
 }
@@ -380,26 +585,25 @@ void tr_bitfield::setSpan(size_t begin, size_t end, bool value)
         return;
     }
 
-    size_t walk = begin >> 3;
-    size_t const last_byte = end >> 3;
+    size_t walk = begin >> 6U;
+    size_t const last_word = end >> 6U;
+    auto const first_mask = spanMask(begin & 63U, WordBits);
+    auto const last_mask = spanMask(0, (end & 63U) + 1);
 
     if (value)
     {
-        unsigned char const first_mask = ~(0xff << (8 - (begin & 7)));
-        unsigned char const last_mask = 0xff << (7 - (end & 7));
-
-        if (walk == last_byte)
+        if (walk == last_word)
         {
             flags_[walk] |= first_mask & last_mask;
         }
         else
         {
             flags_[walk] |= first_mask;
-            flags_[last_byte] |= last_mask;
+            flags_[last_word] |= last_mask;
 
-            if (++walk < last_byte)
+            if (++walk < last_word)
             {
-                std::fill_n(std::begin(flags_) + walk, last_byte - walk, 0xff);
+                std::fill_n(std::begin(flags_) + walk, last_word - walk, AllOnes);
             }
         }
 
@@ -407,21 +611,18 @@ void tr_bitfield::setSpan(size_t begin, size_t end, bool value)
     }
     else
     {
-        unsigned char const first_mask = 0xff << (8 - (begin & 7));
-        unsigned char const last_mask = ~(0xff << (7 - (end & 7)));
-
-        if (walk == last_byte)
+        if (walk == last_word)
         {
-            flags_[walk] &= first_mask | last_mask;
+            flags_[walk] &= ~(first_mask & last_mask);
         }
         else
         {
-            flags_[walk] &= first_mask;
-            flags_[last_byte] &= last_mask;
+            flags_[walk] &= ~first_mask;
+            flags_[last_word] &= ~last_mask;
 
-            if (++walk < last_byte)
+            if (++walk < last_word)
             {
-                std::fill_n(std::begin(flags_) + walk, last_byte - walk, 0);
+                std::fill_n(std::begin(flags_) + walk, last_word - walk, 0);
             }
         }
 
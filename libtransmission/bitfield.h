@@ -38,6 +38,10 @@
  *
  * - "Have none" is another special case that has the same advantages
  *   and motivations as "Have all".
+ *
+ * The bits are kept in 64-bit words that hold the raw bytes as they
+ * are, so that counting and combining bitfields is done a word at a time
+ * and raw() and setRaw() are plain copies.
  */
 class tr_bitfield
 {
@@ -98,12 +102,22 @@ public:
         return size() == 0;
     }
 
+    // count the bits that are set in both this bitfield and `that`,
+    // e.g. how many of the pieces we want a peer has
+    [[nodiscard]] size_t countIntersection(tr_bitfield const& that) const;
+
+    // keep only the bits that are also set in `that` (AND)
+    void intersect(tr_bitfield const& that);
+
+    // clear the bits that are set in `that` (AND NOT)
+    void subtract(tr_bitfield const& that);
+
 #ifdef TR_ENABLE_ASSERTS
     bool assertValid() const;
 #endif
 
 private:
-    std::vector<uint8_t> flags_;
+    std::vector<uint64_t> flags_;
     [[nodiscard]] size_t countFlags() const;
     [[nodiscard]] size_t countFlags(size_t begin, size_t end) const;
     [[nodiscard]] bool testFlag(size_t bit) const;
@@ -120,6 +134,9 @@ private:
     size_t bit_count_ = 0;
     size_t true_count_ = 0;
 
+    // how many of flags_' bytes are in use, for raw() when bit_count_ is 0
+    size_t byte_count_ = 0;
+
     /* Special cases for when full or empty but we don't know the bitCount.
        This occurs when a magnet link's peers send have all / have none */
     bool have_all_hint_ = false;
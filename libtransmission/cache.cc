@@ -6,16 +6,23 @@
  *
  */
 
-#include <cstdlib> /* qsort() */
+#include <algorithm>
+#include <cstring> /* memcpy() */
+#include <functional> /* std::less */
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <event2/buffer.h>
 
 #include "transmission.h"
 #include "cache.h"
+#include "file.h" /* tr_sys_iovec_t */
 #include "inout.h"
 #include "log.h"
+#include "open-hash-table.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
-#include "ptrarray.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "trevent.h"
@@ -29,23 +36,152 @@
 *****
 ****/
 
+/* Block-sized slots carved out of larger slabs, so that caching a block
+ * doesn't need an allocation of its own. Slots are reused after they're
+ * flushed; slabs with no slots in use are freed by trim(). */
+class BlockSlabs
+{
+public:
+    uint8_t* acquire()
+    {
+        if (std::empty(free_))
+        {
+            auto& slab = slabs_.emplace_back(new uint8_t[SlotsPerSlab * MAX_BLOCK_SIZE]);
+
+            for (size_t i = SlotsPerSlab; i-- > 0;)
+            {
+                free_.push_back(slab.get() + i * MAX_BLOCK_SIZE);
+            }
+        }
+
+        auto* const slot = free_.back();
+        free_.pop_back();
+        return slot;
+    }
+
+    void release(uint8_t* slot)
+    {
+        free_.push_back(slot);
+    }
+
+    /* free the slabs whose slots are all unused */
+    void trim()
+    {
+        if (std::size(free_) < SlotsPerSlab)
+        {
+            return;
+        }
+
+        auto const by_address = [](auto const& a, auto const& b)
+        {
+            return std::less<uint8_t const*>{}(a.get(), b.get());
+        };
+        std::sort(std::begin(slabs_), std::end(slabs_), by_address);
+
+        /* count the unused slots in each slab */
+        auto const slabOf = [this](uint8_t const* slot)
+        {
+            auto const it = std::upper_bound(
+                std::begin(slabs_),
+                std::end(slabs_),
+                slot,
+                [](uint8_t const* a, auto const& b) { return std::less<uint8_t const*>{}(a, b.get()); });
+            return size_t(std::distance(std::begin(slabs_), it) - 1);
+        };
+        auto n_free = std::vector<size_t>(std::size(slabs_));
+        for (auto const* const slot : free_)
+        {
+            ++n_free[slabOf(slot)];
+        }
+
+        /* forget the empty slabs' slots, then the slabs themselves */
+        auto const is_empty = [&n_free](size_t i)
+        {
+            return n_free[i] == SlotsPerSlab;
+        };
+        free_.erase(
+            std::remove_if(std::begin(free_), std::end(free_), [&](uint8_t const* slot) { return is_empty(slabOf(slot)); }),
+            std::end(free_));
+
+        auto n_slabs = size_t{};
+        for (size_t i = 0, n = std::size(slabs_); i < n; ++i)
+        {
+            if (!is_empty(i))
+            {
+                slabs_[n_slabs++] = std::move(slabs_[i]);
+            }
+        }
+
+        slabs_.resize(n_slabs);
+    }
+
+    [[nodiscard]] size_t bytes() const
+    {
+        return std::size(slabs_) * SlotsPerSlab * MAX_BLOCK_SIZE;
+    }
+
+private:
+    static auto constexpr SlotsPerSlab = size_t{ 64 };
+
+    std::vector<std::unique_ptr<uint8_t[]>> slabs_;
+    std::vector<uint8_t*> free_;
+};
+
 struct cache_block
 {
-    tr_torrent* tor;
+    uint64_t key = 0;
+    tr_torrent* tor = nullptr;
 
-    tr_piece_index_t piece;
-    uint32_t offset;
-    uint32_t length;
+    tr_piece_index_t piece = 0;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+
+    time_t time = 0;
+    tr_block_index_t block = 0;
+
+    uint8_t* buf = nullptr;
+};
+
+static uint64_t getKey(int tor_id, uint32_t index)
+{
+    return (uint64_t(uint32_t(tor_id)) << 32) | index;
+}
+
+/* Fibonacci hashing, so that a torrent's neighbouring blocks spread out */
+static size_t hashKey(uint64_t key)
+{
+    return size_t((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
 
-    time_t time;
-    tr_block_index_t block;
+struct cache_block_traits
+{
+    static bool isUsed(cache_block const& cb)
+    {
+        return cb.tor != nullptr;
+    }
+
+    static size_t hash(cache_block const& cb)
+    {
+        return hashKey(cb.key);
+    }
+};
 
-    struct evbuffer* evbuf;
+/* a complete piece that was read from disk to be uploaded */
+struct read_piece
+{
+    int tor_id;
+    tr_piece_index_t piece;
+    std::vector<uint8_t> buf;
 };
 
 struct tr_cache
 {
-    tr_ptrArray blocks;
+    /* the write cache, keyed by torrent id and block index.
+     * Its slots move as it grows and shrinks, so don't hold onto them. */
+    OpenHashTable<cache_block, cache_block_traits> blocks;
+    /* each torrent's cached blocks, as sorted runs of contiguous block indices */
+    std::unordered_map<int, std::vector<tr_block_span_t>> torrent_runs;
+    BlockSlabs slabs;
     int max_blocks;
     size_t max_bytes;
 
@@ -53,70 +189,146 @@ struct tr_cache
     size_t disk_write_bytes;
     size_t cache_writes;
     size_t cache_write_bytes;
-};
 
-/****
-*****
-****/
+    /* the read cache: most-recently-used first, plus an index into it */
+    std::list<read_piece> read_pieces;
+    std::unordered_map<uint64_t, std::list<read_piece>::iterator> read_index;
+    size_t read_max_bytes;
+    size_t read_bytes;
+    uint64_t read_hits;
+    uint64_t read_misses;
+};
 
-struct run_info
+static cache_block* getBlock(tr_cache* cache, int tor_id, tr_block_index_t block)
 {
-    int pos;
-    int rank;
-    time_t last_block_time;
-    bool is_multi_piece;
-    bool is_piece_done;
-    unsigned int len;
-};
+    auto const key = getKey(tor_id, block);
+    return cache->blocks.find(hashKey(key), [key](cache_block const& cb) { return cb.key == key; });
+}
 
-/* return a count of how many contiguous blocks there are starting at this pos */
-static int getBlockRun(tr_cache const* cache, int pos, struct run_info* info)
+/* returns the first run that ends after `block` */
+template<typename Runs>
+static auto firstRunAfter(Runs& runs, tr_block_index_t block)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    struct cache_block const* const* blocks = (struct cache_block const* const*)tr_ptrArrayBase(&cache->blocks);
-    struct cache_block const* ref = blocks[pos];
-    tr_block_index_t block = ref->block;
-    int len = 0;
+    return std::upper_bound(
+        std::begin(runs),
+        std::end(runs),
+        block,
+        [](tr_block_index_t b, tr_block_span_t const& run) { return b < run.end; });
+}
 
-    for (int i = pos; i < n; ++i)
+/* returns true if any of the torrent's blocks in [begin, end) are cached */
+static bool hasCachedBlocks(tr_cache const* cache, int tor_id, tr_block_index_t begin, tr_block_index_t end)
+{
+    auto const it = cache->torrent_runs.find(tor_id);
+    if (it == std::end(cache->torrent_runs))
     {
-        struct cache_block const* b = blocks[i];
+        return false;
+    }
 
-        if (b->block != block)
-        {
-            break;
-        }
+    auto const run = firstRunAfter(it->second, begin);
+    return run != std::end(it->second) && run->begin < end;
+}
 
-        if (b->tor != ref->tor)
-        {
-            break;
-        }
+/* returns the torrent's cached runs, clipped to [begin, end) */
+static std::vector<tr_block_span_t> getTorrentRuns(
+    tr_cache const* cache,
+    int tor_id,
+    tr_block_index_t begin,
+    tr_block_index_t end)
+{
+    auto clipped = std::vector<tr_block_span_t>{};
 
-        ++block;
-        ++len;
+    auto const it = cache->torrent_runs.find(tor_id);
+    if (it == std::end(cache->torrent_runs))
+    {
+        return clipped;
     }
 
-    if (info != nullptr)
+    for (auto run = firstRunAfter(it->second, begin); run != std::end(it->second) && run->begin < end; ++run)
     {
-        struct cache_block const* b = blocks[pos + len - 1];
-        info->last_block_time = b->time;
-        info->is_piece_done = b->tor->hasPiece(b->piece);
-        info->is_multi_piece = b->piece != blocks[pos]->piece;
-        info->len = len;
-        info->pos = pos;
+        clipped.push_back({ std::max(run->begin, begin), std::min(run->end, end) });
     }
 
-    return len;
+    return clipped;
+}
+
+/* add a newly-cached block to its torrent's runs, joining its neighbours' runs if it can */
+static void addToRuns(std::vector<tr_block_span_t>& runs, tr_block_index_t block)
+{
+    auto const next = std::upper_bound(
+        std::begin(runs),
+        std::end(runs),
+        block,
+        [](tr_block_index_t b, tr_block_span_t const& run) { return b < run.begin; });
+    auto const prev = next != std::begin(runs) ? std::prev(next) : std::end(runs);
+    bool const joins_prev = prev != std::end(runs) && prev->end == block;
+    bool const joins_next = next != std::end(runs) && next->begin == block + 1;
+
+    TR_ASSERT(prev == std::end(runs) || prev->end <= block);
+
+    if (joins_prev && joins_next)
+    {
+        prev->end = next->end;
+        runs.erase(next);
+    }
+    else if (joins_prev)
+    {
+        prev->end = block + 1;
+    }
+    else if (joins_next)
+    {
+        next->begin = block;
+    }
+    else
+    {
+        runs.insert(next, { block, block + 1 });
+    }
 }
 
-/* higher rank comes before lower rank */
-static int compareRuns(void const* va, void const* vb)
+/* remove a span of blocks, all from the same run, from its torrent's runs */
+static void removeFromRuns(std::vector<tr_block_span_t>& runs, tr_block_span_t span)
 {
-    auto* a = static_cast<struct run_info const*>(va);
-    auto* b = static_cast<struct run_info const*>(vb);
-    return b->rank - a->rank;
+    auto const run = firstRunAfter(runs, span.begin);
+
+    TR_ASSERT(run != std::end(runs));
+    TR_ASSERT(run->begin <= span.begin);
+    TR_ASSERT(span.end <= run->end);
+
+    if (run->begin == span.begin && run->end == span.end)
+    {
+        runs.erase(run);
+    }
+    else if (run->begin == span.begin)
+    {
+        run->begin = span.end;
+    }
+    else if (run->end == span.end)
+    {
+        run->end = span.begin;
+    }
+    else
+    {
+        auto const tail = tr_block_span_t{ span.end, run->end };
+        run->end = span.begin;
+        runs.insert(std::next(run), tail);
+    }
 }
 
+/****
+*****
+****/
+
+struct run_info
+{
+    tr_torrent* tor;
+    tr_block_span_t span;
+    int rank;
+    time_t last_block_time;
+    bool is_multi_piece;
+    bool is_piece_done;
+    size_t len;
+};
+
 enum
 {
     MULTIFLAG = 0x1000,
@@ -126,83 +338,105 @@ enum
 
 /* Calculte runs
  *   - Stale runs, runs sitting in cache for a long time or runs not growing, get priority.
- *     Returns number of runs.
+ *     Returns the runs, highest rank first.
  */
-// TODO: return std::vector
-static int calcRuns(tr_cache const* cache, struct run_info* runs)
+static std::vector<run_info> calcRuns(tr_cache* cache)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    int i = 0;
     time_t const now = tr_time();
+    auto runs = std::vector<run_info>{};
 
-    for (int pos = 0; pos < n; pos += runs[i++].len)
+    for (auto const& [tor_id, tor_runs] : cache->torrent_runs)
     {
-        int rank = getBlockRun(cache, pos, &runs[i]);
+        for (auto const span : tor_runs)
+        {
+            auto const* const first = getBlock(cache, tor_id, span.begin);
+            auto const* const last = getBlock(cache, tor_id, span.end - 1);
+
+            auto& run = runs.emplace_back();
+            run.tor = first->tor;
+            run.span = span;
+            run.len = span.end - span.begin;
+            run.last_block_time = last->time;
+            run.is_piece_done = last->tor->hasPiece(last->piece);
+            run.is_multi_piece = last->piece != first->piece;
+
+            int rank = run.len;
 
-        /* This adds ~2 to the relative length of a run for every minute it has
-         * languished in the cache. */
-        rank += (now - runs[i].last_block_time) / 32;
+            /* This adds ~2 to the relative length of a run for every minute it has
+             * languished in the cache. */
+            rank += (now - run.last_block_time) / 32;
 
-        /* Flushing stale blocks should be a top priority as the probability of them
-         * growing is very small, for blocks on piece boundaries, and nonexistant for
-         * blocks inside pieces. */
-        rank |= runs[i].is_piece_done ? DONEFLAG : 0;
+            /* Flushing stale blocks should be a top priority as the probability of them
+             * growing is very small, for blocks on piece boundaries, and nonexistant for
+             * blocks inside pieces. */
+            rank |= run.is_piece_done ? DONEFLAG : 0;
 
-        /* Move the multi piece runs higher */
-        rank |= runs[i].is_multi_piece ? MULTIFLAG : 0;
+            /* Move the multi piece runs higher */
+            rank |= run.is_multi_piece ? MULTIFLAG : 0;
 
-        runs[i].rank = rank;
+            run.rank = rank;
+        }
     }
 
-    qsort(runs, i, sizeof(struct run_info), compareRuns);
-    return i;
+    /* higher rank comes before lower rank */
+    std::sort(std::begin(runs), std::end(runs), [](auto const& a, auto const& b) { return a.rank > b.rank; });
+    return runs;
 }
 
-static int flushContiguous(tr_cache* cache, int pos, int n)
+/* write a run of contiguous blocks straight from their slots, then drop them */
+static int flushRun(tr_cache* cache, tr_torrent* tor, tr_block_span_t span)
 {
-    int err = 0;
-    uint8_t* buf = tr_new(uint8_t, n * MAX_BLOCK_SIZE);
-    uint8_t* walk = buf;
-    struct cache_block** blocks = (struct cache_block**)tr_ptrArrayBase(&cache->blocks);
-
-    struct cache_block* b = blocks[pos];
-    tr_torrent* tor = b->tor;
-    tr_piece_index_t const piece = b->piece;
-    uint32_t const offset = b->offset;
+    auto const n = size_t{ span.end - span.begin };
+    auto iov = std::vector<tr_sys_iovec_t>(n);
+    size_t len = 0;
 
-    for (int i = 0; i < n; ++i)
+    for (size_t i = 0; i < n; ++i)
     {
-        b = blocks[pos + i];
-        evbuffer_copyout(b->evbuf, walk, b->length);
-        walk += b->length;
-        evbuffer_free(b->evbuf);
-        tr_free(b);
+        auto const* const cb = getBlock(cache, tor->uniqueId, span.begin + i);
+        iov[i].iov_base = cb->buf;
+        iov[i].iov_len = cb->length;
+        len += cb->length;
     }
 
-    tr_ptrArrayErase(&cache->blocks, pos, pos + n);
+    auto const* const first = getBlock(cache, tor->uniqueId, span.begin);
+    int const err = tr_ioWriteV(tor, first->piece, first->offset, std::data(iov), n);
 
-    err = tr_ioWrite(tor, piece, offset, walk - buf, buf);
-    tr_free(buf);
+    for (auto block = span.begin; block < span.end; ++block)
+    {
+        auto* const cb = getBlock(cache, tor->uniqueId, block);
+        cache->slabs.release(cb->buf);
+        cache->blocks.erase(cb);
+    }
+
+    removeFromRuns(cache->torrent_runs[tor->uniqueId], span);
 
     ++cache->disk_writes;
-    cache->disk_write_bytes += walk - buf;
+    cache->disk_write_bytes += len;
     return err;
 }
 
-static int flushRuns(tr_cache* cache, struct run_info* runs, int n)
+static int flushRuns(tr_cache* cache, std::vector<run_info> const& runs, size_t n)
 {
     int err = 0;
 
-    for (int i = 0; err == 0 && i < n; i++)
+    for (size_t i = 0; err == 0 && i < n; i++)
     {
-        err = flushContiguous(cache, runs[i].pos, runs[i].len);
+        err = flushRun(cache, runs[i].tor, runs[i].span);
+    }
+
+    return err;
+}
 
-        for (int j = i + 1; j < n; j++)
+/* flush every one of the torrent's cached blocks in [begin, end), in order */
+static int flushAll(tr_cache* cache, tr_torrent* tor, tr_block_index_t begin, tr_block_index_t end)
+{
+    int err = 0;
+
+    for (auto const span : getTorrentRuns(cache, tor->uniqueId, begin, end))
+    {
+        if (err == 0)
         {
-            if (runs[j].pos > runs[i].pos)
-            {
-                runs[j].pos -= runs[i].len;
-            }
+            err = flushRun(cache, tor, span);
         }
     }
 
@@ -213,16 +447,14 @@ static int cacheTrim(tr_cache* cache)
 {
     int err = 0;
 
-    if (tr_ptrArraySize(&cache->blocks) > cache->max_blocks)
+    if (std::size(cache->blocks) > size_t(cache->max_blocks))
     {
         /* Amount of cache that should be removed by the flush. This influences how large
          * runs can grow as well as how often flushes will happen. */
-        int const cacheCutoff = 1 + cache->max_blocks / 4;
-        struct run_info* runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int j = 0;
-
-        calcRuns(cache, runs);
+        size_t const cacheCutoff = 1 + cache->max_blocks / 4;
+        auto const runs = calcRuns(cache);
+        size_t i = 0;
+        size_t j = 0;
 
         while (j < cacheCutoff)
         {
@@ -230,7 +462,6 @@ static int cacheTrim(tr_cache* cache)
         }
 
         err = flushRuns(cache, runs, i);
-        tr_free(runs);
     }
 
     return err;
@@ -255,7 +486,9 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes)
     tr_formatter_mem_B(buf, cache->max_bytes, sizeof(buf));
     tr_logAddNamedDbg(MY_NAME, "Maximum cache size set to %s (%d blocks)", buf, cache->max_blocks);
 
-    return cacheTrim(cache);
+    int const err = cacheTrim(cache);
+    cache->slabs.trim();
+    return err;
 }
 
 int64_t tr_cacheGetLimit(tr_cache const* cache)
@@ -265,8 +498,7 @@ int64_t tr_cacheGetLimit(tr_cache const* cache)
 
 tr_cache* tr_cacheNew(int64_t max_bytes)
 {
-    tr_cache* cache = tr_new0(tr_cache, 1);
-    cache->blocks = {};
+    auto* const cache = new tr_cache{};
     cache->max_bytes = max_bytes;
     cache->max_blocks = getMaxBlocks(max_bytes);
     return cache;
@@ -278,79 +510,218 @@ void tr_cacheFree(tr_cache* cache)
     // e.g. if writing to disk failed due to disk full / permission error etc
     // then there is still going to be data sitting in the cache on shutdown.
     // Make this assertion smarter or remove it.
-    TR_ASSERT(tr_ptrArrayEmpty(&cache->blocks));
+    TR_ASSERT(std::size(cache->blocks) == 0);
 
-    tr_ptrArrayDestruct(&cache->blocks, nullptr);
-    tr_free(cache);
+    delete cache;
 }
 
 /***
 ****
 ***/
 
-static int cache_block_compare(void const* va, void const* vb)
+static struct cache_block* findBlock(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t offset)
+{
+    return getBlock(cache, torrent->uniqueId, torrent->blockOf(piece, offset));
+}
+
+/***
+****  Read cache
+***/
+
+static void readCacheErase(tr_cache* cache, std::list<read_piece>::iterator it)
+{
+    cache->read_bytes -= std::size(it->buf);
+    cache->read_index.erase(getKey(it->tor_id, it->piece));
+    cache->read_pieces.erase(it);
+}
+
+static void readCacheTrim(tr_cache* cache)
+{
+    while (cache->read_bytes > cache->read_max_bytes)
+    {
+        readCacheErase(cache, std::prev(std::end(cache->read_pieces)));
+    }
+}
+
+static void readCacheRemove(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece)
 {
-    auto const* a = static_cast<struct cache_block const*>(va);
-    auto const* b = static_cast<struct cache_block const*>(vb);
+    if (auto const it = cache->read_index.find(getKey(torrent->uniqueId, piece)); it != std::end(cache->read_index))
+    {
+        readCacheErase(cache, it->second);
+    }
+}
 
-    /* primary key: torrent id */
-    if (a->tor->uniqueId != b->tor->uniqueId)
+static void readCacheRemoveTorrent(tr_cache* cache, tr_torrent const* torrent)
+{
+    for (auto it = std::begin(cache->read_pieces); it != std::end(cache->read_pieces);)
+    {
+        auto const next = std::next(it);
+
+        if (it->tor_id == torrent->uniqueId)
+        {
+            readCacheErase(cache, it);
+        }
+
+        it = next;
+    }
+}
+
+/* find the piece in the read cache, reading it from disk if needed.
+ * returns nullptr if the piece shouldn't or couldn't be cached. */
+static read_piece const* readCacheGet(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece)
+{
+    // only cache pieces that are complete and checked,
+    // and only if several of them can fit in the cache
+    auto const piece_size = torrent->pieceSize(piece);
+    if (!torrent->hasPiece(piece) || piece_size > cache->read_max_bytes / 4)
     {
-        return a->tor->uniqueId < b->tor->uniqueId ? -1 : 1;
+        return nullptr;
     }
 
-    /* secondary key: block # */
-    if (a->block != b->block)
+    auto const key = getKey(torrent->uniqueId, piece);
+    if (auto const it = cache->read_index.find(key); it != std::end(cache->read_index))
     {
-        return a->block < b->block ? -1 : 1;
+        ++cache->read_hits;
+        cache->read_pieces.splice(std::begin(cache->read_pieces), cache->read_pieces, it->second);
+        return &cache->read_pieces.front();
     }
 
-    /* they're equal */
+    ++cache->read_misses;
+
+    // if some of the piece is still waiting to be written, what's on disk is stale
+    if (auto const [begin, end] = torrent->blockSpanForPiece(piece); hasCachedBlocks(cache, torrent->uniqueId, begin, end))
+    {
+        return nullptr;
+    }
+
+    auto buf = std::vector<uint8_t>(piece_size);
+    if (tr_ioRead(torrent, piece, 0, piece_size, std::data(buf)) != 0)
+    {
+        return nullptr;
+    }
+
+    cache->read_pieces.push_front({ torrent->uniqueId, piece, std::move(buf) });
+    cache->read_index.emplace(key, std::begin(cache->read_pieces));
+    cache->read_bytes += piece_size;
+    readCacheTrim(cache);
+    return &cache->read_pieces.front();
+}
+
+int tr_cacheSetReadLimit(tr_cache* cache, int64_t max_bytes)
+{
+    char buf[128];
+
+    cache->read_max_bytes = max_bytes;
+
+    tr_formatter_mem_B(buf, cache->read_max_bytes, sizeof(buf));
+    tr_logAddNamedDbg(MY_NAME, "Maximum read cache size set to %s", buf);
+
+    readCacheTrim(cache);
     return 0;
 }
 
-static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
+int64_t tr_cacheGetReadLimit(tr_cache const* cache)
 {
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = torrent->blockOf(piece, offset);
-    return static_cast<struct cache_block*>(tr_ptrArrayFindSorted(&cache->blocks, &key, cache_block_compare));
+    return cache->read_max_bytes;
 }
 
-int tr_cacheWriteBlock(
+tr_cache_stats tr_cacheGetStats(tr_cache const* cache)
+{
+    auto stats = tr_cache_stats{};
+    stats.read_hits = cache->read_hits;
+    stats.read_misses = cache->read_misses;
+    stats.read_bytes = cache->read_bytes;
+    stats.write_slab_bytes = cache->slabs.bytes();
+    return stats;
+}
+
+/***
+****
+***/
+
+/* find or add the cache entry for a block that's about to be written */
+static cache_block* getBlockForWrite(
     tr_cache* cache,
     tr_torrent* torrent,
     tr_piece_index_t piece,
     uint32_t offset,
-    uint32_t length,
-    struct evbuffer* writeme)
+    uint32_t length)
 {
     TR_ASSERT(tr_amInEventThread(torrent->session));
 
-    struct cache_block* cb = findBlock(cache, torrent, piece, offset);
+    TR_ASSERT(length <= MAX_BLOCK_SIZE);
+
+    auto const block = torrent->blockOf(piece, offset);
+    struct cache_block* cb = getBlock(cache, torrent->uniqueId, block);
 
     if (cb == nullptr)
     {
-        cb = tr_new(struct cache_block, 1);
-        cb->tor = torrent;
-        cb->piece = piece;
-        cb->offset = offset;
-        cb->length = length;
-        cb->block = torrent->blockOf(piece, offset);
-        cb->evbuf = evbuffer_new();
-        tr_ptrArrayInsertSorted(&cache->blocks, cb, cache_block_compare);
+        auto const key = getKey(torrent->uniqueId, block);
+        cb = &cache->blocks.add(hashKey(key));
+        *cb = cache_block{ key, torrent, piece, offset, length, 0, block, nullptr };
+        addToRuns(cache->torrent_runs[torrent->uniqueId], block);
     }
 
     TR_ASSERT(cb->length == length);
 
     cb->time = tr_time();
 
-    evbuffer_drain(cb->evbuf, evbuffer_get_length(cb->evbuf));
-    evbuffer_remove_buffer(writeme, cb->evbuf, cb->length);
+    readCacheRemove(cache, torrent, piece);
 
     cache->cache_writes++;
     cache->cache_write_bytes += cb->length;
 
+    return cb;
+}
+
+int tr_cacheWriteBlock(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t length,
+    struct evbuffer* writeme)
+{
+    struct cache_block* const cb = getBlockForWrite(cache, torrent, piece, offset, length);
+
+    if (cb->buf == nullptr)
+    {
+        cb->buf = cache->slabs.acquire();
+    }
+
+    evbuffer_remove(writeme, cb->buf, cb->length);
+
+    return cacheTrim(cache);
+}
+
+uint8_t* tr_cacheAcquireBlockBuffer(tr_cache* cache)
+{
+    return cache->slabs.acquire();
+}
+
+void tr_cacheReleaseBlockBuffer(tr_cache* cache, uint8_t* buf)
+{
+    cache->slabs.release(buf);
+}
+
+int tr_cacheWriteBlockBuffer(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t length,
+    uint8_t* buf)
+{
+    struct cache_block* const cb = getBlockForWrite(cache, torrent, piece, offset, length);
+
+    /* if an older copy of the block is waiting, this one replaces it */
+    if (cb->buf != nullptr)
+    {
+        cache->slabs.release(cb->buf);
+    }
+
+    cb->buf = buf;
+
     return cacheTrim(cache);
 }
 
@@ -367,7 +738,11 @@ int tr_cacheReadBlock(
 
     if (cb != nullptr)
     {
-        evbuffer_copyout(cb->evbuf, setme, len);
+        memcpy(setme, cb->buf, len);
+    }
+    else if (auto const* const rp = readCacheGet(cache, torrent, piece); rp != nullptr)
+    {
+        memcpy(setme, std::data(rp->buf) + offset, len);
     }
     else
     {
@@ -377,12 +752,78 @@ int tr_cacheReadBlock(
     return err;
 }
 
+int tr_cacheReadBlocks(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count)
+{
+    /* if any of the blocks are waiting to be written, read them one at a time */
+    bool any_dirty = false;
+    for (size_t i = 0, block_offset = offset; !any_dirty && i < iov_count; block_offset += iov[i++].iov_len)
+    {
+        any_dirty = findBlock(cache, torrent, piece, block_offset) != nullptr;
+    }
+
+    if (any_dirty)
+    {
+        int err = 0;
+
+        for (size_t i = 0; err == 0 && i < iov_count; offset += iov[i++].iov_len)
+        {
+            err = tr_cacheReadBlock(cache, torrent, piece, offset, iov[i].iov_len, static_cast<uint8_t*>(iov[i].iov_base));
+        }
+
+        return err;
+    }
+
+    if (auto const* const rp = readCacheGet(cache, torrent, piece); rp != nullptr)
+    {
+        for (size_t i = 0; i < iov_count; offset += iov[i++].iov_len)
+        {
+            memcpy(iov[i].iov_base, std::data(rp->buf) + offset, iov[i].iov_len);
+        }
+
+        return 0;
+    }
+
+    return tr_ioReadV(torrent, piece, offset, iov, iov_count);
+}
+
+bool tr_cacheCopyBlock(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme)
+{
+    struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
+
+    if (cb == nullptr)
+    {
+        return false;
+    }
+
+    memcpy(setme, cb->buf, len);
+    return true;
+}
+
+bool tr_cacheHasBlocks(tr_cache const* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
+{
+    auto const first = torrent->blockOf(piece, offset);
+    auto const last = torrent->blockOf(piece, offset + len - 1);
+    return hasCachedBlocks(cache, torrent->uniqueId, first, last + 1);
+}
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
 {
     int err = 0;
     struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
 
-    if (cb == nullptr)
+    if (cb == nullptr && cache->read_index.count(getKey(torrent->uniqueId, piece)) == 0)
     {
         err = tr_ioPrefetch(torrent, piece, offset, len);
     }
@@ -394,23 +835,15 @@ int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t
 ****
 ***/
 
-static int findBlockPos(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t block)
-{
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = block;
-    return tr_ptrArrayLowerBound(&cache->blocks, &key, cache_block_compare, nullptr);
-}
-
 int tr_cacheFlushDone(tr_cache* cache)
 {
     int err = 0;
 
-    if (tr_ptrArraySize(&cache->blocks) > 0)
+    if (std::size(cache->blocks) != 0)
     {
-        auto* const runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int const n = calcRuns(cache, runs);
+        auto runs = calcRuns(cache);
+        size_t i = 0;
+        size_t const n = std::size(runs);
 
         while (i < n && (runs[i].is_piece_done || runs[i].is_multi_piece))
         {
@@ -418,7 +851,6 @@ int tr_cacheFlushDone(tr_cache* cache)
         }
 
         err = flushRuns(cache, runs, i);
-        tr_free(runs);
     }
 
     return err;
@@ -428,48 +860,27 @@ int tr_cacheFlushFile(tr_cache* cache, tr_torrent* torrent, tr_file_index_t i)
 {
     auto const [begin, end] = tr_torGetFileBlockSpan(torrent, i);
 
-    int pos = findBlockPos(cache, torrent, begin);
     dbgmsg("flushing file %d from cache to disk: blocks [%zu...%zu)", (int)i, (size_t)begin, (size_t)end);
 
     /* flush out all the blocks in that file */
-    int err = 0;
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
-    {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
-
-        if (b->tor != torrent)
-        {
-            break;
-        }
-
-        if (b->block < begin || b->block >= end)
-        {
-            break;
-        }
-
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
-    }
-
-    return err;
+    return flushAll(cache, torrent, begin, end);
 }
 
 int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
 {
-    int err = 0;
-    int const pos = findBlockPos(cache, torrent, 0);
+    /* the torrent is stopping or its data is being deleted,
+     * so stop serving its pieces from memory */
+    readCacheRemoveTorrent(cache, torrent);
 
     /* flush out all the blocks in that torrent */
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
-    {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
+    int const err = flushAll(cache, torrent, 0, torrent->n_blocks);
 
-        if (b->tor != torrent)
-        {
-            break;
-        }
-
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
+    if (auto const it = cache->torrent_runs.find(torrent->uniqueId);
+        it != std::end(cache->torrent_runs) && std::empty(it->second))
+    {
+        cache->torrent_runs.erase(it);
     }
 
+    cache->slabs.trim();
     return err;
 }
@@ -12,6 +12,7 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include "file.h" /* tr_sys_iovec_t */
 #include "tr-macros.h"
 
 struct evbuffer;
@@ -33,6 +34,22 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes);
 
 int64_t tr_cacheGetLimit(tr_cache const*);
 
+/* the read cache keeps recently-uploaded pieces in memory,
+ * so that popular pieces aren't read from disk over and over */
+int tr_cacheSetReadLimit(tr_cache* cache, int64_t max_bytes);
+
+int64_t tr_cacheGetReadLimit(tr_cache const*);
+
+struct tr_cache_stats
+{
+    uint64_t read_hits;
+    uint64_t read_misses;
+    uint64_t read_bytes; /* how much the read cache is holding now */
+    uint64_t write_slab_bytes; /* how much memory the write cache has allocated for blocks */
+};
+
+tr_cache_stats tr_cacheGetStats(tr_cache const*);
+
 int tr_cacheWriteBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -41,6 +58,24 @@ int tr_cacheWriteBlock(
     uint32_t len,
     struct evbuffer* writeme);
 
+/* A block-sized buffer owned by the cache, so that a block can be received
+ * straight into it and then handed over with tr_cacheWriteBlockBuffer(),
+ * without being copied again. Buffers that don't get handed over are
+ * returned with tr_cacheReleaseBlockBuffer(). */
+uint8_t* tr_cacheAcquireBlockBuffer(tr_cache* cache);
+
+void tr_cacheReleaseBlockBuffer(tr_cache* cache, uint8_t* buf);
+
+/* like tr_cacheWriteBlock(), but the cache takes over `buf`
+ * (from tr_cacheAcquireBlockBuffer()) instead of copying from it */
+int tr_cacheWriteBlockBuffer(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* buf);
+
 int tr_cacheReadBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -49,6 +84,29 @@ int tr_cacheReadBlock(
     uint32_t len,
     uint8_t* setme);
 
+/* like tr_cacheReadBlock(), but reads a run of consecutive blocks from
+ * the same piece, one per buffer, with a single vectored read if possible. */
+int tr_cacheReadBlocks(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count);
+
+/* like tr_cacheReadBlock(), but never falls back to disk.
+ * returns false if the block isn't in the cache. */
+bool tr_cacheCopyBlock(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme);
+
+/* returns true if any part of the range is waiting to be written to disk */
+bool tr_cacheHasBlocks(tr_cache const* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
 
 /***
@@ -6,8 +6,10 @@
  *
  */
 
+#include <algorithm> /* std::copy() */
 #include <cstdarg>
 #include <cstring> /* memcpy(), memmove(), memset(), strcmp(), strlen() */
+#include <iterator> /* std::begin(), std::end() */
 #include <random> /* random_device, mt19937, uniform_int_distribution*/
 
 #include <arc4.h>
@@ -46,6 +48,105 @@ void tr_dh_align_key(uint8_t* key_buffer, size_t key_size, size_t buffer_size)
 ****
 ***/
 
+// The plain version, for short buffers. Everything is copied into locals
+// because the output is written through a byte pointer, which could alias
+// ctx->i and ctx->j and force them to be reloaded and stored for every byte.
+static void arc4_crypt_short(struct arc4_context* ctx, uint8_t const* src, uint8_t* dst, size_t data_length)
+{
+    auto* const s = ctx->s;
+    auto i = uint32_t{ ctx->i };
+    auto j = uint32_t{ ctx->j };
+
+    for (; data_length > 0; --data_length)
+    {
+        i = (i + 1) & 0xFF;
+        uint32_t const si = s[i];
+        j = (j + si) & 0xFF;
+        uint32_t const sj = s[j];
+        s[i] = uint8_t(sj);
+        s[j] = uint8_t(si);
+        *dst++ = *src++ ^ s[(si + sj) & 0xFF];
+    }
+
+    ctx->i = uint8_t(i);
+    ctx->j = uint8_t(j);
+}
+
+// For longer buffers, work on a copy of the table widened to 32 bits,
+// which avoids partial-register stalls on x86, and apply the keystream
+// eight bytes at a time. Copying the table in and out is only worth it
+// once there are a few dozen bytes to process.
+static void arc4_crypt_long(struct arc4_context* ctx, uint8_t const* src, uint8_t* dst, size_t data_length)
+{
+    uint32_t s[256];
+    std::copy(std::begin(ctx->s), std::end(ctx->s), std::begin(s));
+    auto i = uint32_t{ ctx->i };
+    auto j = uint32_t{ ctx->j };
+
+    auto const next = [&s, &i, &j]() -> uint64_t
+    {
+        i = (i + 1) & 0xFF;
+        uint32_t const si = s[i];
+        j = (j + si) & 0xFF;
+        uint32_t const sj = s[j];
+        s[i] = sj;
+        s[j] = si;
+        return s[(si + sj) & 0xFF];
+    };
+
+    for (; data_length >= 8; data_length -= 8, src += 8, dst += 8)
+    {
+        // unrolled by hand; compilers won't do it for a loop body this size
+        uint64_t key = next();
+        key |= next() << 8;
+        key |= next() << 16;
+        key |= next() << 24;
+        key |= next() << 32;
+        key |= next() << 40;
+        key |= next() << 48;
+        key |= next() << 56;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        key = __builtin_bswap64(key); // the first keystream byte goes first in memory
+#endif
+
+        uint64_t block;
+        memcpy(&block, src, sizeof(block));
+        block ^= key;
+        memcpy(dst, &block, sizeof(block));
+    }
+
+    for (; data_length > 0; --data_length)
+    {
+        *dst++ = *src++ ^ uint8_t(next());
+    }
+
+    std::copy(std::begin(s), std::end(s), std::begin(ctx->s));
+    ctx->i = uint8_t(i);
+    ctx->j = uint8_t(j);
+}
+
+void tr_arc4_process(struct arc4_context* ctx, void const* src_data, void* dst_data, size_t data_length)
+{
+    auto constexpr LongMinLength = size_t{ 64 };
+
+    auto const* const src = static_cast<uint8_t const*>(src_data);
+    auto* const dst = static_cast<uint8_t*>(dst_data);
+
+    if (data_length < LongMinLength)
+    {
+        arc4_crypt_short(ctx, src, dst, data_length);
+    }
+    else
+    {
+        arc4_crypt_long(ctx, src, dst, data_length);
+    }
+}
+
+/***
+****
+***/
+
 bool tr_sha1(uint8_t* hash, void const* data1, int data1_length, ...)
 {
     tr_sha1_ctx_t sha = tr_sha1_init();
@@ -23,6 +23,8 @@
 *** @{
 **/
 
+struct arc4_context;
+
 /** @brief Opaque SHA1 context type. */
 using tr_sha1_ctx_t = void*;
 /** @brief Opaque DH context type. */
@@ -104,6 +106,14 @@ void tr_dh_secret_free(tr_dh_secret_t handle);
  */
 void tr_dh_align_key(uint8_t* key_buffer, size_t key_size, size_t buffer_size);
 
+/**
+ * @brief Encrypt or decrypt a buffer with RC4; `src_data` and `dst_data` may be the same.
+ *
+ * Gives the same output as arc4_process(), but keeps the cipher state
+ * in registers and works on a wider copy of the table for big buffers.
+ */
+void tr_arc4_process(struct arc4_context* ctx, void const* src_data, void* dst_data, size_t data_length);
+
 /**
  * @brief Get X509 certificate store from SSL context.
  */
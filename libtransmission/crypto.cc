@@ -6,7 +6,13 @@
  *
  */
 
+#include <array>
+#include <condition_variable>
 #include <cstring> /* memcpy(), memmove(), memset() */
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <arc4.h>
 
@@ -40,16 +46,182 @@ static uint8_t const dh_G[] = { 2 };
 ***
 **/
 
-static void ensureKeyExists(tr_crypto* crypto)
+/* Making a DH key is the expensive part of an encrypted handshake,
+ * so keep a pool of them that a worker thread refills in the background.
+ * That way a burst of new connections doesn't stall the event thread. */
+
+namespace
+{
+
+struct dh_key
+{
+    tr_dh_ctx_t dh;
+    std::array<uint8_t, KEY_LEN> public_key;
+};
+
+auto constexpr KeyPoolSize = size_t{ 32 };
+
+/* start refilling once the pool drops below this */
+auto constexpr KeyPoolLowWater = KeyPoolSize / 2;
+
+/* the pooled keys and the thread that makes them. created by the first
+ * tr_cryptoKeyPoolInit() and torn down by the matching tr_cryptoKeyPoolClose() */
+struct key_pool
+{
+    std::vector<dh_key> keys;
+    std::thread thread;
+    bool wants_keys = true;
+    bool closing = false;
+};
+
+} // namespace
+
+static std::mutex key_pool_mutex_;
+static std::condition_variable keyPoolCv;
+static std::unique_ptr<key_pool> keyPool;
+static size_t keyPoolUsers = 0;
+static uint64_t keyPoolHits = 0;
+static uint64_t keyPoolMisses = 0;
+
+static bool makeKey(dh_key* setme)
+{
+    size_t public_key_length = 0;
+    setme->dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
+
+    if (setme->dh == nullptr || !tr_dh_make_key(setme->dh, DH_PRIVKEY_LEN, std::data(setme->public_key), &public_key_length))
+    {
+        tr_dh_free(setme->dh);
+        setme->dh = nullptr;
+        return false;
+    }
+
+    TR_ASSERT(public_key_length == KEY_LEN);
+    return true;
+}
+
+static void keyPoolThreadFunc(key_pool* pool)
+{
+    auto lock = std::unique_lock(key_pool_mutex_);
+
+    for (;;)
+    {
+        keyPoolCv.wait(lock, [pool]() { return pool->wants_keys || pool->closing; });
+
+        if (pool->closing)
+        {
+            break;
+        }
+
+        /* if making a key fails, don't try again until another one is taken */
+        pool->wants_keys = false;
+
+        while (!pool->closing && std::size(pool->keys) < KeyPoolSize)
+        {
+            lock.unlock();
+            auto key = dh_key{};
+            bool const ok = makeKey(&key);
+            lock.lock();
+
+            if (!ok)
+            {
+                break;
+            }
+
+            pool->keys.push_back(key);
+        }
+    }
+}
+
+static bool keyPoolTake(dh_key* setme)
+{
+    auto const lock = std::lock_guard(key_pool_mutex_);
+
+    bool const hit = keyPool && !std::empty(keyPool->keys);
+
+    if (hit)
+    {
+        *setme = keyPool->keys.back();
+        keyPool->keys.pop_back();
+        ++keyPoolHits;
+    }
+    else
+    {
+        ++keyPoolMisses;
+    }
+
+    if (keyPool && std::size(keyPool->keys) < KeyPoolLowWater)
+    {
+        keyPool->wants_keys = true;
+        keyPoolCv.notify_one();
+    }
+
+    return hit;
+}
+
+void tr_cryptoKeyPoolInit(void)
+{
+    auto const lock = std::lock_guard(key_pool_mutex_);
+
+    if (keyPoolUsers++ == 0)
+    {
+        keyPool = std::make_unique<key_pool>();
+        keyPool->thread = std::thread(keyPoolThreadFunc, keyPool.get());
+    }
+}
+
+void tr_cryptoKeyPoolClose(void)
+{
+    auto lock = std::unique_lock(key_pool_mutex_);
+
+    TR_ASSERT(keyPoolUsers > 0);
+
+    if (--keyPoolUsers > 0)
+    {
+        return;
+    }
+
+    /* from here on, handshakes make their own keys */
+    auto const pool = std::move(keyPool);
+    pool->closing = true;
+    keyPoolCv.notify_all();
+    lock.unlock();
+
+    pool->thread.join();
+
+    for (auto const& key : pool->keys)
+    {
+        tr_dh_free(key.dh);
+    }
+}
+
+tr_crypto_key_pool_stats tr_cryptoGetKeyPoolStats(void)
+{
+    auto const lock = std::lock_guard(key_pool_mutex_);
+
+    auto stats = tr_crypto_key_pool_stats{};
+    stats.hits = keyPoolHits;
+    stats.misses = keyPoolMisses;
+    stats.ready = keyPool ? std::size(keyPool->keys) : 0;
+    return stats;
+}
+
+/* returns false if there's no key and one couldn't be made */
+static bool ensureKeyExists(tr_crypto* crypto)
 {
     if (crypto->dh == nullptr)
     {
-        size_t public_key_length = 0;
-        crypto->dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
-        tr_dh_make_key(crypto->dh, DH_PRIVKEY_LEN, crypto->myPublicKey, &public_key_length);
+        /* if the pool has run dry, make one here rather than wait for it */
+        auto key = dh_key{};
+        if (!keyPoolTake(&key) && !makeKey(&key))
+        {
+            return false;
+        }
 
-        TR_ASSERT(public_key_length == KEY_LEN);
+        crypto->dh = key.dh;
+        memcpy(crypto->myPublicKey, std::data(key.public_key), KEY_LEN);
     }
+
+    return true;
 }
 
 void tr_cryptoConstruct(tr_crypto* crypto, uint8_t const* torrentHash, bool isIncoming)
@@ -74,14 +246,23 @@ void tr_cryptoDestruct(tr_crypto* crypto)
 
 bool tr_cryptoComputeSecret(tr_crypto* crypto, uint8_t const* peerPublicKey)
 {
-    ensureKeyExists(crypto);
+    if (!ensureKeyExists(crypto))
+    {
+        return false;
+    }
+
     crypto->mySecret = tr_dh_agree(crypto->dh, peerPublicKey, KEY_LEN);
     return crypto->mySecret != nullptr;
 }
 
 uint8_t const* tr_cryptoGetMyPublicKey(tr_crypto const* crypto, int* setme_len)
 {
-    ensureKeyExists((tr_crypto*)crypto);
+    if (!ensureKeyExists((tr_crypto*)crypto))
+    {
+        *setme_len = 0;
+        return nullptr;
+    }
+
     *setme_len = KEY_LEN;
     return crypto->myPublicKey;
 }
@@ -120,7 +301,7 @@ static void crypt_rc4(struct arc4_context* key, size_t buf_len, void const* buf_
         return;
     }
 
-    arc4_process(key, buf_in, buf_out, buf_len);
+    tr_arc4_process(key, buf_in, buf_out, buf_len);
 }
 
 void tr_cryptoDecryptInit(tr_crypto* crypto)
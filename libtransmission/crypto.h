@@ -42,6 +42,22 @@ struct tr_crypto
     bool torrentHashIsSet;
 };
 
+/** @brief Counters for the pool of pregenerated DH keys */
+struct tr_crypto_key_pool_stats
+{
+    uint64_t hits; /* keys that were ready when a handshake needed one */
+    uint64_t misses; /* keys that had to be made on the spot */
+    size_t ready; /* keys in the pool right now */
+};
+
+/** @brief start the worker thread that keeps a pool of DH keys ready. Each call needs a matching tr_cryptoKeyPoolClose() */
+void tr_cryptoKeyPoolInit(void);
+
+/** @brief when the last user is done with the pool, join its worker thread and free the keys */
+void tr_cryptoKeyPoolClose(void);
+
+tr_crypto_key_pool_stats tr_cryptoGetKeyPoolStats(void);
+
 /** @brief construct a new tr_crypto object */
 void tr_cryptoConstruct(tr_crypto* crypto, uint8_t const* torrentHash, bool isIncoming);
 
@@ -56,6 +72,7 @@ bool tr_cryptoHasTorrentHash(tr_crypto const* crypto);
 
 bool tr_cryptoComputeSecret(tr_crypto* crypto, uint8_t const* peerPublicKey);
 
+/** @brief returns our DH public key, or nullptr if one couldn't be made */
 uint8_t const* tr_cryptoGetMyPublicKey(tr_crypto const* crypto, int* setme_len);
 
 void tr_cryptoDecryptInit(tr_crypto* crypto);
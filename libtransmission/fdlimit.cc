@@ -7,9 +7,18 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <unistd.h> /* dup(), close() */
+#endif
+
+#include <event2/buffer.h>
 
 #include "transmission.h"
 #include "error.h"
@@ -121,7 +130,14 @@ struct tr_cached_file
     tr_sys_file_t fd;
     int torrent_id;
     tr_file_index_t file_index;
-    time_t used_at;
+
+    /* for sending the file's contents with sendfile(), if needed */
+    struct evbuffer_file_segment* segment;
+    uint64_t segment_length;
+
+    /* neighbors in the fileset's LRU list */
+    struct tr_cached_file* lru_prev;
+    struct tr_cached_file* lru_next;
 };
 
 static constexpr bool cached_file_is_open(struct tr_cached_file const* o)
@@ -137,6 +153,14 @@ static void cached_file_close(struct tr_cached_file* o)
 
     if (o != nullptr)
     {
+        /* evbuffers that still hold pieces of the segment keep their own
+         * reference to it, and to its copy of the file descriptor */
+        if (o->segment != nullptr)
+        {
+            evbuffer_file_segment_free(o->segment);
+            o->segment = nullptr;
+        }
+
         tr_sys_file_close(o->fd, nullptr);
         o->fd = TR_BAD_SYS_FILE;
     }
@@ -269,16 +293,105 @@ struct tr_fileset
 {
     struct tr_cached_file* begin;
     struct tr_cached_file const* end;
+
+    /* the open files, keyed by torrent id and file index */
+    std::unordered_map<uint64_t, tr_cached_file*> index;
+
+    /* every slot, most-recently-used first. closed slots are kept
+     * at the tail, so the tail is always the next one to reuse */
+    struct tr_cached_file* lru_head;
+    struct tr_cached_file* lru_tail;
+
+    tr_fd_stats stats;
+
+    /* how many dup()ed descriptors are held by file segments. segments
+     * can outlive the fileset, so they share ownership of the count */
+    std::shared_ptr<std::atomic<int>> segment_fds;
 };
 
+static uint64_t fileset_key(int torrent_id, tr_file_index_t i)
+{
+    return (uint64_t(uint32_t(torrent_id)) << 32) | i;
+}
+
+static void fileset_lru_unlink(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    if (o->lru_prev != nullptr)
+    {
+        o->lru_prev->lru_next = o->lru_next;
+    }
+    else
+    {
+        set->lru_head = o->lru_next;
+    }
+
+    if (o->lru_next != nullptr)
+    {
+        o->lru_next->lru_prev = o->lru_prev;
+    }
+    else
+    {
+        set->lru_tail = o->lru_prev;
+    }
+
+    o->lru_prev = o->lru_next = nullptr;
+}
+
+static void fileset_lru_push_front(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    o->lru_prev = nullptr;
+    o->lru_next = set->lru_head;
+
+    if (set->lru_head != nullptr)
+    {
+        set->lru_head->lru_prev = o;
+    }
+    else
+    {
+        set->lru_tail = o;
+    }
+
+    set->lru_head = o;
+}
+
+static void fileset_lru_push_back(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    o->lru_prev = set->lru_tail;
+    o->lru_next = nullptr;
+
+    if (set->lru_tail != nullptr)
+    {
+        set->lru_tail->lru_next = o;
+    }
+    else
+    {
+        set->lru_head = o;
+    }
+
+    set->lru_tail = o;
+}
+
+static void fileset_touch(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    if (set->lru_head != o)
+    {
+        fileset_lru_unlink(set, o);
+        fileset_lru_push_front(set, o);
+    }
+}
+
 static void fileset_construct(struct tr_fileset* set, int n)
 {
     set->begin = tr_new(struct tr_cached_file, n);
     set->end = set->begin + n;
+    set->lru_head = set->lru_tail = nullptr;
+    set->index.reserve(n);
+    set->segment_fds = std::make_shared<std::atomic<int>>(0);
 
     for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
     {
-        *o = { false, TR_BAD_SYS_FILE, 0, 0, 0 };
+        *o = { false, TR_BAD_SYS_FILE, 0, 0, nullptr, 0, nullptr, nullptr };
+        fileset_lru_push_back(set, o);
     }
 }
 
@@ -293,6 +406,8 @@ static void fileset_close_all(struct tr_fileset* set)
                 cached_file_close(o);
             }
         }
+
+        set->index.clear();
     }
 }
 
@@ -301,6 +416,20 @@ static void fileset_destruct(struct tr_fileset* set)
     fileset_close_all(set);
     tr_free(set->begin);
     set->end = set->begin = nullptr;
+    set->lru_head = set->lru_tail = nullptr;
+}
+
+/* close the file and move its slot to the back of the line for reuse */
+static void fileset_close_file(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    set->index.erase(fileset_key(o->torrent_id, o->file_index));
+    cached_file_close(o);
+
+    if (set->lru_tail != o)
+    {
+        fileset_lru_unlink(set, o);
+        fileset_lru_push_back(set, o);
+    }
 }
 
 static void fileset_close_torrent(struct tr_fileset* set, int torrent_id)
@@ -311,7 +440,7 @@ static void fileset_close_torrent(struct tr_fileset* set, int torrent_id)
         {
             if (o->torrent_id == torrent_id && cached_file_is_open(o))
             {
-                cached_file_close(o);
+                fileset_close_file(set, o);
             }
         }
     }
@@ -321,12 +450,9 @@ static struct tr_cached_file* fileset_lookup(struct tr_fileset* set, int torrent
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        if (auto const it = set->index.find(fileset_key(torrent_id, i)); it != std::end(set->index))
         {
-            if (torrent_id == o->torrent_id && i == o->file_index && cached_file_is_open(o))
-            {
-                return o;
-            }
+            return it->second;
         }
     }
 
@@ -335,32 +461,22 @@ static struct tr_cached_file* fileset_lookup(struct tr_fileset* set, int torrent
 
 static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
 {
-    struct tr_cached_file* cull = nullptr;
+    struct tr_cached_file* o = nullptr;
 
     if (set != nullptr && set->begin != nullptr)
     {
-        /* try to find an unused slot */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
-        {
-            if (!cached_file_is_open(o))
-            {
-                return o;
-            }
-        }
+        /* closed slots are at the tail; if there aren't any,
+         * the tail is the least recently used file, so recycle it */
+        o = set->lru_tail;
 
-        /* all slots are full... recycle the least recently used */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        if (cached_file_is_open(o))
         {
-            if (cull == nullptr || o->used_at < cull->used_at)
-            {
-                cull = o;
-            }
+            ++set->stats.evictions;
+            fileset_close_file(set, o);
         }
-
-        cached_file_close(cull);
     }
 
-    return cull;
+    return o;
 }
 
 /***
@@ -384,7 +500,7 @@ static void ensureSessionFdInfoExists(tr_session* session)
         int const FILE_CACHE_SIZE = 32;
 
         /* Create the local file cache */
-        auto* const i = tr_new0(struct tr_fdInfo, 1);
+        auto* const i = new tr_fdInfo{};
         fileset_construct(&i->fileset, FILE_CACHE_SIZE);
         session->fdInfo = i;
     }
@@ -396,7 +512,7 @@ void tr_fdClose(tr_session* session)
     {
         struct tr_fdInfo* i = session->fdInfo;
         fileset_destruct(&i->fileset);
-        tr_free(i);
+        delete i;
         session->fdInfo = nullptr;
     }
 }
@@ -428,23 +544,117 @@ void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
             tr_sys_file_flush(o->fd, nullptr);
         }
 
-        cached_file_close(o);
+        fileset_close_file(get_fileset(s), o);
     }
 }
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* s, int torrent_id, tr_file_index_t i, bool writable)
 {
-    struct tr_cached_file* o = fileset_lookup(get_fileset(s), torrent_id, i);
+    struct tr_fileset* set = get_fileset(s);
+    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
 
     if (o == nullptr || (writable && !o->is_writable))
     {
         return TR_BAD_SYS_FILE;
     }
 
-    o->used_at = tr_time();
+    ++set->stats.hits;
+    fileset_touch(set, o);
     return o->fd;
 }
 
+/* segments are only used where libevent sends them with sendfile().
+ * elsewhere it would read each segment, which is the whole file, into memory */
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100 && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define TR_FD_USE_SEGMENTS
+#endif
+
+#ifdef TR_FD_USE_SEGMENTS
+
+static void onSegmentFreed(struct evbuffer_file_segment const* /*seg*/, int /*flags*/, void* vcount)
+{
+    auto* const count = static_cast<std::shared_ptr<std::atomic<int>>*>(vcount);
+    --**count;
+    delete count;
+}
+
+#endif
+
+bool tr_fdFileAddSegment(
+    [[maybe_unused]] tr_session* s,
+    [[maybe_unused]] int torrent_id,
+    [[maybe_unused]] tr_file_index_t i,
+    [[maybe_unused]] uint64_t offset,
+    [[maybe_unused]] uint64_t length,
+    [[maybe_unused]] struct evbuffer* buf)
+{
+#ifdef TR_FD_USE_SEGMENTS
+
+    struct tr_fileset* const set = get_fileset(s);
+    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
+
+    if (o == nullptr)
+    {
+        return false;
+    }
+
+    /* the file may have grown since the segment was made */
+    if (o->segment != nullptr && o->segment_length < offset + length)
+    {
+        evbuffer_file_segment_free(o->segment);
+        o->segment = nullptr;
+    }
+
+    if (o->segment == nullptr)
+    {
+        auto info = tr_sys_path_info{};
+        if (!tr_sys_file_get_info(o->fd, &info, nullptr) || info.size < offset + length)
+        {
+            return false;
+        }
+
+        /* the segment closes its fd when the last evbuffer is done with it,
+         * which may be after the cached file's been closed. those fds count
+         * against the file limit, so past it the caller copies the data instead */
+        if (*set->segment_fds >= set->end - set->begin)
+        {
+            return false;
+        }
+
+        int const fd = dup(o->fd);
+        if (fd == -1)
+        {
+            return false;
+        }
+
+        /* never mmap() the file: a mapping outlives a truncation and faults */
+        o->segment = evbuffer_file_segment_new(fd, 0, info.size, EVBUF_FS_CLOSE_ON_FREE | EVBUF_FS_DISABLE_MMAP);
+        if (o->segment == nullptr)
+        {
+            close(fd);
+            return false;
+        }
+
+        ++*set->segment_fds;
+        evbuffer_file_segment_add_cleanup_cb(o->segment, onSegmentFreed, new std::shared_ptr(set->segment_fds));
+        o->segment_length = info.size;
+    }
+
+    return evbuffer_add_file_segment(buf, o->segment, offset, length) == 0;
+
+#else
+
+    return false;
+
+#endif
+}
+
+tr_fd_stats tr_fdGetStats(tr_session* session)
+{
+    struct tr_fileset const* set = get_fileset(session);
+    return set != nullptr ? set->stats : tr_fd_stats{};
+}
+
 void tr_fdTorrentClose(tr_session* session, int torrent_id)
 {
     auto const lock = session->unique_lock();
@@ -467,7 +677,7 @@ tr_sys_file_t tr_fdFileCheckout(
 
     if (o != nullptr && writable && !o->is_writable)
     {
-        cached_file_close(o); /* close it so we can reopen in rw mode */
+        fileset_close_file(set, o); /* close it so we can reopen in rw mode */
     }
     else if (o == nullptr)
     {
@@ -485,13 +695,15 @@ tr_sys_file_t tr_fdFileCheckout(
         }
 
         dbgmsg("opened '%s' writable %c", filename, writable ? 'y' : 'n');
+        ++set->stats.misses;
         o->is_writable = writable;
+        o->torrent_id = torrent_id;
+        o->file_index = i;
+        set->index.emplace(fileset_key(torrent_id, i), o);
     }
 
     dbgmsg("checking out '%s'", filename);
-    o->torrent_id = torrent_id;
-    o->file_index = i;
-    o->used_at = tr_time();
+    fileset_touch(set, o);
     return o->fd;
 }
 
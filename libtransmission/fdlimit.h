@@ -16,6 +16,8 @@
 #include "file.h"
 #include "net.h"
 
+struct evbuffer;
+
 /**
  * @addtogroup file_io File IO
  * @{
@@ -51,6 +53,30 @@ tr_sys_file_t tr_fdFileCheckout(
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* session, int torrent_id, tr_file_index_t file_num, bool doWrite);
 
+/**
+ * Appends part of an already-open file to `buf` as a file-backed segment,
+ * so that it can be sent without being read into memory first.
+ * `buf` must have EVBUFFER_FLAG_DRAINS_TO_FD set, and so must any evbuffer
+ * it's moved to. Returns false if the file isn't open, if too many
+ * descriptors are already held by segments, or if segments aren't supported.
+ */
+bool tr_fdFileAddSegment(
+    tr_session* session,
+    int torrent_id,
+    tr_file_index_t file_num,
+    uint64_t offset,
+    uint64_t length,
+    struct evbuffer* buf);
+
+struct tr_fd_stats
+{
+    uint64_t hits; /* lookups that found the file already open */
+    uint64_t misses; /* times a file had to be opened */
+    uint64_t evictions; /* open files closed to make room for another */
+};
+
+tr_fd_stats tr_fdGetStats(tr_session* session);
+
 /**
  * Closes a file that's being held by our file repository.
  *
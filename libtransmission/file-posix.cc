@@ -24,6 +24,7 @@
 #include <sys/mman.h> /* mmap(), munmap() */
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h> /* preadv(), pwritev() */
 #include <unistd.h> /* lseek(), write(), ftruncate(), pread(), pwrite(), pathconf(), etc */
 #include <vector>
 
@@ -797,6 +798,90 @@ bool tr_sys_file_read_at(
     return ret;
 }
 
+/* read into as many of the buffers as the system will fill in one call */
+static bool read_at_once(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    [[maybe_unused]] size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    tr_error** error)
+{
+#ifdef HAVE_PREADV
+
+    ssize_t const my_bytes_read = preadv(handle, iov, int(std::min(iov_count, size_t{ IOV_MAX })), offset);
+
+    if (my_bytes_read == -1)
+    {
+        set_system_error(error, errno);
+        return false;
+    }
+
+    *bytes_read = my_bytes_read;
+    return true;
+
+#else
+
+    return tr_sys_file_read_at(handle, iov->iov_base, iov->iov_len, offset, bytes_read, error);
+
+#endif
+}
+
+bool tr_sys_file_read_at_v(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+    /* seek requires signed offset, so it should be in mod range */
+    TR_ASSERT(offset < UINT64_MAX / 2);
+
+    uint64_t total = 0;
+    size_t i = 0;
+    uint64_t buf_offset = 0; /* how much of iov[i] has been filled */
+
+    while (i < iov_count)
+    {
+        auto my_bytes_read = uint64_t{};
+        auto* const buf = static_cast<uint8_t*>(iov[i].iov_base) + buf_offset;
+        bool const ok = buf_offset == 0 ?
+            read_at_once(handle, iov + i, iov_count - i, offset + total, &my_bytes_read, error) :
+            tr_sys_file_read_at(handle, buf, iov[i].iov_len - buf_offset, offset + total, &my_bytes_read, error);
+
+        if (!ok)
+        {
+            return false;
+        }
+
+        /* end of file */
+        if (my_bytes_read == 0 && iov[i].iov_len > buf_offset)
+        {
+            break;
+        }
+
+        total += my_bytes_read;
+
+        /* skip past the buffers that have been filled */
+        buf_offset += my_bytes_read;
+        while (i < iov_count && buf_offset >= iov[i].iov_len)
+        {
+            buf_offset -= iov[i].iov_len;
+            ++i;
+        }
+    }
+
+    if (bytes_read != nullptr)
+    {
+        *bytes_read = total;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_write(tr_sys_file_t handle, void const* buffer, uint64_t size, uint64_t* bytes_written, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -868,6 +953,90 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+/* write as many of the buffers as the system will take in one call */
+static bool write_at_once(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    [[maybe_unused]] size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+#ifdef HAVE_PWRITEV
+
+    ssize_t const my_bytes_written = pwritev(handle, iov, int(std::min(iov_count, size_t{ IOV_MAX })), offset);
+
+    if (my_bytes_written == -1)
+    {
+        set_system_error(error, errno);
+        return false;
+    }
+
+    *bytes_written = my_bytes_written;
+    return true;
+
+#else
+
+    return tr_sys_file_write_at(handle, iov->iov_base, iov->iov_len, offset, bytes_written, error);
+
+#endif
+}
+
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+    /* seek requires signed offset, so it should be in mod range */
+    TR_ASSERT(offset < UINT64_MAX / 2);
+
+    uint64_t total = 0;
+    size_t i = 0;
+    uint64_t buf_offset = 0; /* how much of iov[i] has been written */
+
+    while (i < iov_count)
+    {
+        auto my_bytes_written = uint64_t{};
+        auto const* const buf = static_cast<uint8_t const*>(iov[i].iov_base) + buf_offset;
+        bool const ok = buf_offset == 0 ?
+            write_at_once(handle, iov + i, iov_count - i, offset + total, &my_bytes_written, error) :
+            tr_sys_file_write_at(handle, buf, iov[i].iov_len - buf_offset, offset + total, &my_bytes_written, error);
+
+        if (!ok)
+        {
+            return false;
+        }
+
+        if (my_bytes_written == 0 && iov[i].iov_len > buf_offset)
+        {
+            set_system_error(error, EIO);
+            return false;
+        }
+
+        total += my_bytes_written;
+
+        /* skip past the buffers that have been written in full */
+        buf_offset += my_bytes_written;
+        while (i < iov_count && buf_offset >= iov[i].iov_len)
+        {
+            buf_offset -= iov[i].iov_len;
+            ++i;
+        }
+    }
+
+    if (bytes_written != nullptr)
+    {
+        *bytes_written = total;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
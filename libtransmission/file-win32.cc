@@ -1133,6 +1133,48 @@ bool tr_sys_file_read_at(
     return ret;
 }
 
+bool tr_sys_file_read_at_v(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+
+    uint64_t total = 0;
+    bool eof = false;
+
+    for (size_t i = 0; !eof && i < iov_count; ++i)
+    {
+        uint64_t buf_offset = 0;
+
+        while (!eof && buf_offset < iov[i].iov_len)
+        {
+            auto* const buf = static_cast<uint8_t*>(iov[i].iov_base) + buf_offset;
+            uint64_t my_bytes_read = 0;
+
+            if (!tr_sys_file_read_at(handle, buf, iov[i].iov_len - buf_offset, offset + total, &my_bytes_read, error))
+            {
+                return false;
+            }
+
+            eof = my_bytes_read == 0;
+            buf_offset += my_bytes_read;
+            total += my_bytes_read;
+        }
+    }
+
+    if (bytes_read != nullptr)
+    {
+        *bytes_read = total;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_write(tr_sys_file_t handle, void const* buffer, uint64_t size, uint64_t* bytes_written, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -1207,6 +1249,52 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < iov_count; ++i)
+    {
+        uint64_t buf_offset = 0;
+
+        while (buf_offset < iov[i].iov_len)
+        {
+            auto const* const buf = static_cast<uint8_t const*>(iov[i].iov_base) + buf_offset;
+            uint64_t my_bytes_written = 0;
+
+            if (!tr_sys_file_write_at(handle, buf, iov[i].iov_len - buf_offset, offset + total, &my_bytes_written, error))
+            {
+                return false;
+            }
+
+            if (my_bytes_written == 0)
+            {
+                set_system_error(error, ERROR_WRITE_FAULT);
+                return false;
+            }
+
+            buf_offset += my_bytes_written;
+            total += my_bytes_written;
+        }
+    }
+
+    if (bytes_written != nullptr)
+    {
+        *bytes_written = total;
+    }
+
+    return true;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -14,6 +14,8 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/uio.h> /* struct iovec */
 #endif
 
 #include "tr-macros.h"
@@ -37,6 +39,8 @@ using tr_sys_dir_t = void*;
 #define TR_NATIVE_EOL_STR "\n"
 /** @brief Platform-specific end-of-line sequence length. */
 #define TR_NATIVE_EOL_STR_SIZE 1
+/** @brief Platform-specific scatter/gather buffer type. */
+using tr_sys_iovec_t = struct iovec;
 
 #else
 
@@ -46,6 +50,12 @@ struct tr_sys_dir_win32;
 using tr_sys_dir_t = tr_sys_dir_win32*;
 #define TR_NATIVE_EOL_STR "\r\n"
 #define TR_NATIVE_EOL_STR_SIZE 2
+struct tr_sys_iovec_win32
+{
+    void* iov_base;
+    size_t iov_len;
+};
+using tr_sys_iovec_t = tr_sys_iovec_win32;
 
 #endif
 
@@ -404,6 +414,30 @@ bool tr_sys_file_read_at(
     uint64_t* bytes_read,
     struct tr_error** error);
 
+/**
+ * @brief Like `preadv()`, except that the position is undefined afterwards.
+ *        Not thread-safe. Unlike `tr_sys_file_read_at()`, this keeps reading
+ *        until every buffer has been filled or the end of file is reached.
+ *
+ * @param[in]  handle     Valid file descriptor.
+ * @param[in]  iov        Buffers to store read data to.
+ * @param[in]  iov_count  Number of buffers in `iov`.
+ * @param[in]  offset     File offset in bytes to start reading from.
+ * @param[out] bytes_read Number of bytes actually read. Optional, pass `nullptr`
+ *                        if you are not interested.
+ * @param[out] error      Pointer to error object. Optional, pass `nullptr` if
+ *                        you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_read_at_v(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_read,
+    struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `write()`.
  *
@@ -447,6 +481,30 @@ bool tr_sys_file_write_at(
     uint64_t* bytes_written,
     struct tr_error** error);
 
+/**
+ * @brief Like `pwritev()`, except that the position is undefined afterwards.
+ *        Not thread-safe. Unlike `tr_sys_file_write_at()`, this keeps writing
+ *        until every buffer has been written or an error occurs.
+ *
+ * @param[in]  handle        Valid file descriptor.
+ * @param[in]  iov           Buffers to get data being written from.
+ * @param[in]  iov_count     Number of buffers in `iov`.
+ * @param[in]  offset        File offset in bytes to start writing from.
+ * @param[out] bytes_written Number of bytes actually written. Optional, pass
+ *                           `nullptr` if you are not interested.
+ * @param[out] error         Pointer to error object. Optional, pass `nullptr`
+ *                          if you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fsync()`.
  *
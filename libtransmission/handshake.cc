@@ -291,8 +291,15 @@ static void sendYa(tr_handshake* handshake)
 
     int len = 0;
     uint8_t const* const public_key = tr_cryptoGetMyPublicKey(handshake->crypto, &len);
+
+    if (public_key == nullptr)
+    {
+        /* fail the handshake, but not until tr_handshakeNew() has returned it */
+        tr_timerAdd(handshake->timeout_timer, 0, 0);
+        return;
+    }
+
     TR_ASSERT(len == KEY_LEN);
-    TR_ASSERT(public_key != nullptr);
 
     char outbuf[KEY_LEN + PadA_MAXLEN];
     char* walk = outbuf;
@@ -734,6 +741,7 @@ static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
     uint8_t* walk = outbuf;
     int len = 0;
     uint8_t const* const myKey = tr_cryptoGetMyPublicKey(handshake->crypto, &len);
+    TR_ASSERT(myKey != nullptr); /* tr_cryptoComputeSecret() made it */
     walk = std::copy_n(myKey, len, walk);
     len = tr_rand_int(PadB_MAXLEN);
     tr_rand_buffer(walk, len);
@@ -31,39 +31,12 @@
 *****  Low-level IO functions
 ****/
 
-enum
-{
-    TR_IO_READ,
-    TR_IO_PREFETCH,
-    /* Any operations that require write access must follow TR_IO_WRITE. */
-    TR_IO_WRITE
-};
-
-/* returns 0 on success, or an errno on failure */
-static int readOrWriteBytes(
-    tr_session* session,
-    tr_torrent* tor,
-    int ioMode,
-    tr_file_index_t fileIndex,
-    uint64_t fileOffset,
-    void* buf,
-    size_t buflen)
+/* returns the file's descriptor, opening (and maybe creating) it if needed.
+ * on failure, returns TR_BAD_SYS_FILE and sets `setme_err` to an errno */
+static tr_sys_file_t getFileFd(tr_session* session, tr_torrent* tor, tr_file_index_t fileIndex, bool doWrite, int* setme_err)
 {
     int err = 0;
-    bool const doWrite = ioMode >= TR_IO_WRITE;
-
     auto const& file = tor->file(fileIndex);
-    TR_ASSERT(file.length == 0 || fileOffset < file.length);
-    TR_ASSERT(fileOffset + buflen <= file.length);
-
-    if (file.length == 0)
-    {
-        return 0;
-    }
-
-    /***
-    ****  Find the fd
-    ***/
 
     tr_sys_file_t fd = tr_fdFileGetCached(session, tr_torrentId(tor), fileIndex, doWrite);
 
@@ -110,40 +83,63 @@ static int readOrWriteBytes(
         tr_free(subpath);
     }
 
-    /***
-    ****  Use the fd
-    ***/
+    *setme_err = err;
+    return fd;
+}
+
+/* a run of buffers that all belong to the same file */
+struct io_extent
+{
+    tr_file_index_t file;
+    uint64_t file_offset;
+    size_t iov_begin;
+    size_t iov_end;
+};
+
+/* returns 0 on success, or an errno on failure */
+static int readOrWriteExtent(
+    tr_session* session,
+    tr_torrent* tor,
+    bool doWrite,
+    io_extent const& extent,
+    tr_sys_iovec_t const* iov)
+{
+    int err = 0;
+
+    auto const& file = tor->file(extent.file);
+    TR_ASSERT(file.length == 0 || extent.file_offset < file.length);
+
+    if (file.length == 0)
+    {
+        return 0;
+    }
+
+    tr_sys_file_t const fd = getFileFd(session, tor, extent.file, doWrite, &err);
 
     if (err == 0)
     {
         tr_error* error = nullptr;
+        auto const* const extent_iov = iov + extent.iov_begin;
+        size_t const extent_iov_count = extent.iov_end - extent.iov_begin;
 
-        if (ioMode == TR_IO_READ)
+        if (doWrite)
         {
-            if (!tr_sys_file_read_at(fd, buf, buflen, fileOffset, nullptr, &error))
+            if (!tr_sys_file_write_at_v(fd, extent_iov, extent_iov_count, extent.file_offset, nullptr, &error))
             {
                 err = error->code;
-                tr_logAddTorErr(tor, "read failed for \"%s\": %s", file.name, error->message);
+                tr_logAddTorErr(tor, "write failed for \"%s\": %s", file.name, error->message);
                 tr_error_free(error);
             }
         }
-        else if (ioMode == TR_IO_WRITE)
+        else
         {
-            if (!tr_sys_file_write_at(fd, buf, buflen, fileOffset, nullptr, &error))
+            if (!tr_sys_file_read_at_v(fd, extent_iov, extent_iov_count, extent.file_offset, nullptr, &error))
             {
                 err = error->code;
-                tr_logAddTorErr(tor, "write failed for \"%s\": %s", file.name, error->message);
+                tr_logAddTorErr(tor, "read failed for \"%s\": %s", file.name, error->message);
                 tr_error_free(error);
             }
         }
-        else if (ioMode == TR_IO_PREFETCH)
-        {
-            tr_sys_file_advise(fd, fileOffset, buflen, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
-        }
-        else
-        {
-            abort();
-        }
     }
 
     return err;
@@ -195,41 +191,100 @@ void tr_ioFindFileLocation(
     }
 }
 
-/* returns 0 on success, or an errno on failure */
-static int readOrWritePiece(
-    tr_torrent* tor,
-    int ioMode,
+/* split the buffers at file boundaries, so that each file can be
+ * read or written with a single vectored call */
+static void splitIntoExtents(
+    tr_torrent const* tor,
     tr_piece_index_t pieceIndex,
     uint32_t pieceOffset,
-    uint8_t* buf,
-    size_t buflen)
+    tr_sys_iovec_t const* iov,
+    size_t iov_count,
+    std::vector<tr_sys_iovec_t>& setme_iov,
+    std::vector<io_extent>& setme_extents)
 {
-    int err = 0;
-
-    if (pieceIndex >= tor->info.pieceCount)
+    uint64_t buflen = 0;
+    for (size_t i = 0; i < iov_count; ++i)
     {
-        return EINVAL;
+        buflen += iov[i].iov_len;
     }
 
     auto fileIndex = tr_file_index_t{};
     auto fileOffset = uint64_t{};
     tr_ioFindFileLocation(tor, pieceIndex, pieceOffset, &fileIndex, &fileOffset);
 
-    while (buflen != 0 && err == 0)
+    setme_iov.clear();
+    setme_iov.reserve(iov_count + 1);
+    setme_extents.clear();
+    size_t i = 0;
+    size_t iov_offset = 0; /* how much of iov[i] has been used */
+
+    while (buflen != 0)
     {
         auto const& file = tor->file(fileIndex);
-        uint64_t const bytesThisPass = std::min(uint64_t{ buflen }, uint64_t{ file.length - fileOffset });
+        uint64_t const bytesThisPass = std::min(buflen, uint64_t{ file.length - fileOffset });
+        auto& extent = setme_extents.emplace_back();
+        extent.file = fileIndex;
+        extent.file_offset = fileOffset;
+        extent.iov_begin = std::size(setme_iov);
+
+        /* gather the buffers, or parts of buffers, that belong in this file */
+        for (uint64_t left = bytesThisPass; left > 0;)
+        {
+            auto const n = std::min(left, uint64_t{ iov[i].iov_len - iov_offset });
 
-        err = readOrWriteBytes(tor->session, tor, ioMode, fileIndex, fileOffset, buf, bytesThisPass);
-        buf += bytesThisPass;
+            auto& segment = setme_iov.emplace_back();
+            segment.iov_base = static_cast<uint8_t*>(iov[i].iov_base) + iov_offset;
+            segment.iov_len = n;
+
+            left -= n;
+            iov_offset += n;
+            if (iov_offset == iov[i].iov_len)
+            {
+                ++i;
+                iov_offset = 0;
+            }
+        }
+
+        extent.iov_end = std::size(setme_iov);
         buflen -= bytesThisPass;
         fileIndex++;
         fileOffset = 0;
+    }
+}
+
+/* returns 0 on success, or an errno on failure */
+static int readOrWritePiece(
+    tr_torrent* tor,
+    bool doWrite,
+    tr_piece_index_t pieceIndex,
+    uint32_t pieceOffset,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count)
+{
+    int err = 0;
 
-        if (err != 0 && ioMode == TR_IO_WRITE && tor->error != TR_STAT_LOCAL_ERROR)
+    if (pieceIndex >= tor->info.pieceCount)
+    {
+        return EINVAL;
+    }
+
+    auto file_iov = std::vector<tr_sys_iovec_t>{};
+    auto extents = std::vector<io_extent>{};
+    splitIntoExtents(tor, pieceIndex, pieceOffset, iov, iov_count, file_iov, extents);
+
+    for (auto const& extent : extents)
+    {
+        err = readOrWriteExtent(tor->session, tor, doWrite, extent, std::data(file_iov));
+
+        if (err != 0)
         {
-            auto const path = tr_strvPath(tor->downloadDir, file.name);
-            tr_torrentSetLocalError(tor, "%s (%s)", tr_strerror(err), path.c_str());
+            if (doWrite && tor->error != TR_STAT_LOCAL_ERROR)
+            {
+                auto const path = tr_strvPath(tor->downloadDir, tor->file(extent.file).name);
+                tr_torrentSetLocalError(tor, "%s (%s)", tr_strerror(err), path.c_str());
+            }
+
+            break;
         }
     }
 
@@ -238,17 +293,100 @@ static int readOrWritePiece(
 
 int tr_ioRead(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t* buf)
 {
-    return readOrWritePiece(tor, TR_IO_READ, pieceIndex, begin, buf, len);
+    auto iov = tr_sys_iovec_t{};
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    return tr_ioReadV(tor, pieceIndex, begin, &iov, 1);
+}
+
+int tr_ioReadV(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, tr_sys_iovec_t const* iov, size_t iov_count)
+{
+    return readOrWritePiece(tor, false, pieceIndex, begin, iov, iov_count);
 }
 
 int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len)
 {
-    return readOrWritePiece(tor, TR_IO_PREFETCH, pieceIndex, begin, nullptr, len);
+    int err = 0;
+
+    if (pieceIndex >= tor->info.pieceCount)
+    {
+        return EINVAL;
+    }
+
+    auto fileIndex = tr_file_index_t{};
+    auto fileOffset = uint64_t{};
+    tr_ioFindFileLocation(tor, pieceIndex, begin, &fileIndex, &fileOffset);
+
+    for (uint64_t buflen = len; buflen != 0 && err == 0; ++fileIndex, fileOffset = 0)
+    {
+        auto const& file = tor->file(fileIndex);
+        uint64_t const bytesThisPass = std::min(buflen, uint64_t{ file.length - fileOffset });
+
+        if (bytesThisPass != 0)
+        {
+            tr_sys_file_t const fd = getFileFd(tor->session, tor, fileIndex, false, &err);
+
+            if (err == 0)
+            {
+                tr_sys_file_advise(fd, fileOffset, bytesThisPass, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
+            }
+        }
+
+        buflen -= bytesThisPass;
+    }
+
+    return err;
+}
+
+int tr_ioAddSegments(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, struct evbuffer* buf)
+{
+    int err = 0;
+
+    if (pieceIndex >= tor->info.pieceCount)
+    {
+        return EINVAL;
+    }
+
+    auto fileIndex = tr_file_index_t{};
+    auto fileOffset = uint64_t{};
+    tr_ioFindFileLocation(tor, pieceIndex, begin, &fileIndex, &fileOffset);
+
+    for (uint64_t buflen = len; buflen != 0 && err == 0; ++fileIndex, fileOffset = 0)
+    {
+        auto const& file = tor->file(fileIndex);
+        uint64_t const bytesThisPass = std::min(buflen, uint64_t{ file.length - fileOffset });
+
+        if (bytesThisPass != 0)
+        {
+            /* make sure the file's open, so that it can be added */
+            getFileFd(tor->session, tor, fileIndex, false, &err);
+
+            if (err == 0)
+            {
+                if (!tr_fdFileAddSegment(tor->session, tor->uniqueId, fileIndex, fileOffset, bytesThisPass, buf))
+                {
+                    err = ENOTSUP;
+                }
+            }
+        }
+
+        buflen -= bytesThisPass;
+    }
+
+    return err;
 }
 
 int tr_ioWrite(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, uint8_t const* buf)
 {
-    return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, (uint8_t*)buf, len);
+    auto iov = tr_sys_iovec_t{};
+    iov.iov_base = const_cast<uint8_t*>(buf);
+    iov.iov_len = len;
+    return tr_ioWriteV(tor, pieceIndex, begin, &iov, 1);
+}
+
+int tr_ioWriteV(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, tr_sys_iovec_t const* iov, size_t iov_count)
+{
+    return readOrWritePiece(tor, true, pieceIndex, begin, iov, iov_count);
 }
 
 /****
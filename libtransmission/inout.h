@@ -12,6 +12,8 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include "file.h" /* tr_sys_iovec_t */
+
 struct tr_torrent;
 
 /**
@@ -25,14 +27,46 @@ struct tr_torrent;
  */
 int tr_ioRead(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offset, uint32_t len, uint8_t* setme);
 
+/**
+ * Like tr_ioRead(), but scatters the data into several buffers,
+ * e.g. the payloads of a run of outgoing piece messages.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioReadV(
+    struct tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count);
+
 int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len);
 
+/**
+ * Appends the specified bytes to `buf` as file-backed segments, so that
+ * they can be sent from the page cache without being copied into memory.
+ * @return 0 on success, or an errno value on failure.
+ *         `buf` may have been partly filled on failure.
+ */
+int tr_ioAddSegments(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uint32_t len, struct evbuffer* buf);
+
 /**
  * Writes the block specified by the piece index, offset, and length.
  * @return 0 on success, or an errno value on failure.
  */
 int tr_ioWrite(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offset, uint32_t len, uint8_t const* writeme);
 
+/**
+ * Like tr_ioWrite(), but gathers the data from several buffers,
+ * e.g. a run of cached blocks, without copying them first.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioWriteV(
+    struct tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    tr_sys_iovec_t const* iov,
+    size_t iov_count);
+
 /**
  * @brief Test to see if the piece matches its metainfo's SHA1 checksum.
  */
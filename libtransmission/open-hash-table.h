@@ -0,0 +1,154 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#include <algorithm> // std::max
+#include <cstddef> // size_t
+#include <limits>
+#include <utility> // std::swap
+#include <vector>
+
+/**
+ * An open-addressed hash table with linear probing, for tables whose
+ * slots are small and cheap to copy. Erasing shifts the rest of the
+ * probe run back into place, so there are no tombstones to clean up.
+ *
+ * A default-constructed Slot is an unused one. Traits provides
+ * `static bool isUsed(Slot const&)` and `static size_t hash(Slot const&)`;
+ * the hash must stay the same for as long as the slot is in the table.
+ */
+template<typename Slot, typename Traits>
+class OpenHashTable
+{
+public:
+    [[nodiscard]] size_t size() const
+    {
+        return size_;
+    }
+
+    [[nodiscard]] size_t capacity() const
+    {
+        return std::size(slots_);
+    }
+
+    // returns the used slot for which `matches(slot)` is true, or nullptr
+    template<typename Matches>
+    [[nodiscard]] Slot* find(size_t hash, Matches matches)
+    {
+        auto const i = findIndex(hash, matches);
+        return i != NoIndex ? &slots_[i] : nullptr;
+    }
+
+    template<typename Matches>
+    [[nodiscard]] Slot const* find(size_t hash, Matches matches) const
+    {
+        auto const i = findIndex(hash, matches);
+        return i != NoIndex ? &slots_[i] : nullptr;
+    }
+
+    // returns an unused slot for a new entry, which the caller fills in
+    Slot& add(size_t hash)
+    {
+        if ((size_ + 1) * 4 > std::size(slots_) * 3)
+        {
+            rehash(std::max(std::size(slots_) * 2, MinCapacity));
+        }
+
+        ++size_;
+        return slots_[firstUnused(hash)];
+    }
+
+    void erase(Slot* slot)
+    {
+        auto i = size_t(slot - std::data(slots_));
+
+        for (auto j = (i + 1) & mask(); Traits::isUsed(slots_[j]); j = (j + 1) & mask())
+        {
+            // move slot j into the hole at i unless its home lies cyclically in (i, j]
+            auto const k = Traits::hash(slots_[j]) & mask();
+            auto const stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+
+            if (!stays)
+            {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+
+        slots_[i] = Slot{};
+        --size_;
+    }
+
+    void clear()
+    {
+        slots_.clear();
+        size_ = 0;
+    }
+
+private:
+    static auto constexpr MinCapacity = size_t{ 16 };
+    static auto constexpr NoIndex = std::numeric_limits<size_t>::max();
+
+    [[nodiscard]] size_t mask() const
+    {
+        return std::size(slots_) - 1;
+    }
+
+    template<typename Matches>
+    [[nodiscard]] size_t findIndex(size_t hash, Matches& matches) const
+    {
+        if (size_ == 0)
+        {
+            return NoIndex;
+        }
+
+        for (auto i = hash & mask();; i = (i + 1) & mask())
+        {
+            auto const& slot = slots_[i];
+
+            if (!Traits::isUsed(slot))
+            {
+                return NoIndex;
+            }
+
+            if (matches(slot))
+            {
+                return i;
+            }
+        }
+    }
+
+    [[nodiscard]] size_t firstUnused(size_t hash) const
+    {
+        auto i = hash & mask();
+        while (Traits::isUsed(slots_[i]))
+        {
+            i = (i + 1) & mask();
+        }
+
+        return i;
+    }
+
+    void rehash(size_t capacity)
+    {
+        auto old = std::vector<Slot>(capacity);
+        std::swap(old, slots_);
+
+        for (auto const& slot : old)
+        {
+            if (Traits::isUsed(slot))
+            {
+                slots_[firstUnused(Traits::hash(slot))] = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+};
@@ -16,6 +16,7 @@
 #include "bitfield.h"
 #include "history.h"
 #include "quark.h"
+#include "request-pipeline.h"
 
 /**
  * @addtogroup peers Peers
@@ -112,6 +113,9 @@ public:
 
     tr_recentHistory cancelsSentToClient;
     tr_recentHistory cancelsSentToPeer;
+
+    /* how long the peer takes to answer our requests */
+    RequestPipeline pipeline;
 };
 
 /** Update the tr_peer.progress field based on the 'have' bitset. */
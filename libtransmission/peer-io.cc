@@ -7,9 +7,12 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
+#include <iterator>
+#include <limits>
 
 #include <event2/event.h>
 #include <event2/buffer.h>
@@ -86,85 +89,22 @@ static size_t guessPacketOverhead(size_t d)
 ***
 **/
 
-struct tr_datatype
-{
-    struct tr_datatype* next;
-    size_t length;
-    bool isPieceData;
-};
-
-static struct tr_datatype* datatype_pool = nullptr;
-
-static struct tr_datatype* datatype_new(void)
-{
-    tr_datatype* ret = nullptr;
-
-    if (datatype_pool == nullptr)
-    {
-        ret = tr_new(struct tr_datatype, 1);
-    }
-    else
-    {
-        ret = datatype_pool;
-        datatype_pool = datatype_pool->next;
-    }
-
-    *ret = {};
-    return ret;
-}
-
-static void datatype_free(struct tr_datatype* datatype)
-{
-    datatype->next = datatype_pool;
-    datatype_pool = datatype;
-}
-
-static void peer_io_pull_datatype(tr_peerIo* io)
-{
-    auto* const tmp = io->outbuf_datatypes;
-
-    if (tmp != nullptr)
-    {
-        io->outbuf_datatypes = tmp->next;
-        datatype_free(tmp);
-    }
-}
-
-static void peer_io_push_datatype(tr_peerIo* io, struct tr_datatype* datatype)
-{
-    tr_datatype* tmp = io->outbuf_datatypes;
-
-    if (tmp != nullptr)
-    {
-        while (tmp->next != nullptr)
-        {
-            tmp = tmp->next;
-        }
-
-        tmp->next = datatype;
-    }
-    else
-    {
-        io->outbuf_datatypes = datatype;
-    }
-}
-
 /***
 ****
 ***/
 
 static void didWriteWrapper(tr_peerIo* io, unsigned int bytes_transferred)
 {
-    while (bytes_transferred != 0 && tr_isPeerIo(io) && io->outbuf_datatypes != nullptr)
+    while (bytes_transferred != 0 && tr_isPeerIo(io) && !std::empty(io->outbuf_datatypes))
     {
-        struct tr_datatype* next = io->outbuf_datatypes;
+        auto& next = io->outbuf_datatypes.front();
 
-        unsigned int const payload = std::min(uint64_t{ next->length }, uint64_t{ bytes_transferred });
+        unsigned int const payload = std::min(uint64_t{ next.length }, uint64_t{ bytes_transferred });
         /* For uTP sockets, the overhead is computed in utp_on_overhead. */
         unsigned int const overhead = io->socket.type == TR_PEER_SOCKET_TYPE_TCP ? guessPacketOverhead(payload) : 0;
         uint64_t const now = tr_time_msec();
 
-        io->bandwidth->notifyBandwidthConsumed(TR_UP, payload, next->isPieceData, now);
+        io->bandwidth->notifyBandwidthConsumed(TR_UP, payload, next.isPieceData, now);
 
         if (overhead > 0)
         {
@@ -173,17 +113,17 @@ static void didWriteWrapper(tr_peerIo* io, unsigned int bytes_transferred)
 
         if (io->didWrite != nullptr)
         {
-            io->didWrite(io, payload, next->isPieceData, io->userData);
+            io->didWrite(io, payload, next.isPieceData, io->userData);
         }
 
         if (tr_isPeerIo(io))
         {
             bytes_transferred -= payload;
-            next->length -= payload;
+            next.length -= payload;
 
-            if (next->length == 0)
+            if (next.length == 0)
             {
-                peer_io_pull_datatype(io);
+                io->outbuf_datatypes.pop_front();
             }
         }
     }
@@ -421,6 +361,218 @@ FAIL:
     }
 }
 
+/***
+****  Peer loops
+****
+****  Sockets polled by one of the session's peer loops are read from and
+****  written to by that loop's thread. Everything else -- bandwidth,
+****  decryption, and the peer's callbacks -- stays in the event thread,
+****  which gets each read or write's result via tr_runInEventThread().
+***/
+
+struct tr_peer_loop_result
+{
+    tr_peerIo* io;
+    unsigned int generation;
+    short event;
+    int res;
+    int err;
+};
+
+static bool io_on_peer_loop(tr_peerIo const* io)
+{
+    return io->loop_inbuf != nullptr;
+}
+
+static unsigned int loop_read_budget(tr_peerIo const* io)
+{
+    /* Limit the input buffer to 256K, so it doesn't grow too large */
+    unsigned int const max = 256 * 1024;
+    unsigned int const curlen = evbuffer_get_length(io->inbuf) + evbuffer_get_length(io->loop_inbuf);
+    unsigned int const howmuch = curlen >= max ? 0 : max - curlen;
+    return io->bandwidth->clamp(TR_DOWN, howmuch);
+}
+
+static unsigned int loop_write_budget(tr_peerIo const* io)
+{
+    return io->bandwidth->clamp(TR_UP, std::numeric_limits<unsigned int>::max());
+}
+
+static void loop_handle_read(tr_peerIo* io, int res, int e)
+{
+    bool const wanted = (io->pendingEvents & EV_READ) != 0;
+    io->pendingEvents &= ~EV_READ;
+
+    if (res > 0)
+    {
+        evbuffer_add_buffer(io->inbuf, io->loop_inbuf);
+
+        if (wanted)
+        {
+            tr_peerIoSetEnabled(io, TR_DOWN, true);
+        }
+
+        /* Invoke the user callback - must always be called last */
+        canReadWrapper(io);
+        return;
+    }
+
+    if (res == -1 && (e == EAGAIN || e == EINTR))
+    {
+        if (wanted)
+        {
+            tr_peerIoSetEnabled(io, TR_DOWN, true);
+        }
+
+        return;
+    }
+
+    short const what = BEV_EVENT_READING | (res == 0 ? BEV_EVENT_EOF : BEV_EVENT_ERROR);
+    char errstr[512];
+    dbgmsg(
+        io,
+        "peer loop read got an error. res is %d, what is %hd, errno is %d (%s)",
+        res,
+        what,
+        e,
+        tr_net_strerror(errstr, sizeof(errstr), e));
+
+    if (io->gotError != nullptr)
+    {
+        io->gotError(io, what, io->userData);
+    }
+}
+
+static void loop_handle_write(tr_peerIo* io, int res, int e)
+{
+    bool const wanted = (io->pendingEvents & EV_WRITE) != 0;
+    io->pendingEvents &= ~EV_WRITE;
+
+    /* nothing was queued, or there was no bandwidth */
+    if (res == 0)
+    {
+        return;
+    }
+
+    if (res > 0 || e == 0 || e == EAGAIN || e == EINTR || e == EINPROGRESS)
+    {
+        if (wanted && evbuffer_get_length(io->outbuf) != 0)
+        {
+            tr_peerIoSetEnabled(io, TR_UP, true);
+        }
+
+        if (res > 0)
+        {
+            didWriteWrapper(io, res);
+        }
+
+        return;
+    }
+
+    short const what = BEV_EVENT_WRITING | BEV_EVENT_ERROR;
+    char errstr[512];
+    dbgmsg(
+        io,
+        "peer loop write got an error. res is %d, what is %hd, errno is %d (%s)",
+        res,
+        what,
+        e,
+        tr_net_strerror(errstr, sizeof(errstr), e));
+
+    if (io->gotError != nullptr)
+    {
+        io->gotError(io, what, io->userData);
+    }
+}
+
+/* runs in the event thread */
+static void loop_result_cb(void* vresult)
+{
+    auto const result = *static_cast<tr_peer_loop_result*>(vresult);
+    delete static_cast<tr_peer_loop_result*>(vresult);
+
+    auto* const io = result.io;
+    int const pending = --io->loop_results_pending;
+
+    /* io_dtor() leaves it to the last result to free the io */
+    if (io->magic_number != PEER_IO_MAGIC_NUMBER)
+    {
+        if (pending == 0)
+        {
+            delete io;
+        }
+
+        return;
+    }
+
+    /* this is about a socket that tr_peerIoReconnect() has since closed */
+    if (result.generation != io->loop_generation)
+    {
+        return;
+    }
+
+    if (result.event == EV_READ)
+    {
+        loop_handle_read(io, result.res, result.err);
+    }
+    else
+    {
+        loop_handle_write(io, result.res, result.err);
+    }
+}
+
+/* runs in the peer loop's thread, so it mustn't touch anything but the
+ * socket, loop_inbuf, and outbuf, which is locked */
+static void loop_post_result(tr_peerIo* io, short event, int res, int err)
+{
+    ++io->loop_results_pending;
+
+    auto* const result = new tr_peer_loop_result{ io, io->loop_generation, event, res, err };
+    tr_runInEventThread(io->session, loop_result_cb, result);
+}
+
+static void loop_read_cb(evutil_socket_t fd, short /*event*/, void* vio)
+{
+    auto* io = static_cast<tr_peerIo*>(vio);
+
+    EVUTIL_SET_SOCKET_ERROR(0);
+    int const res = evbuffer_read(io->loop_inbuf, fd, int(io->loop_read_budget));
+    int const e = EVUTIL_SOCKET_ERROR();
+
+    loop_post_result(io, EV_READ, res, e);
+}
+
+static void loop_write_cb(evutil_socket_t fd, short /*event*/, void* vio)
+{
+    auto* io = static_cast<tr_peerIo*>(vio);
+
+    auto res = int{ 0 };
+    auto e = int{ 0 };
+
+    if (size_t const howmuch = std::min(size_t{ io->loop_write_budget }, evbuffer_get_length(io->outbuf)); howmuch > 0)
+    {
+        EVUTIL_SET_SOCKET_ERROR(0);
+        res = evbuffer_write_atmost(io->outbuf, fd, howmuch);
+        e = EVUTIL_SOCKET_ERROR();
+    }
+
+    loop_post_result(io, EV_WRITE, res, e);
+}
+
+static void io_new_events(tr_peerIo* io)
+{
+    if (io->event_base == nullptr)
+    {
+        io->event_base = io->session->event_base;
+    }
+
+    bool const on_loop = io->event_base != io->session->event_base;
+    auto const fd = io->socket.handle.tcp;
+
+    io->event_read = event_new(io->event_base, fd, EV_READ, on_loop ? loop_read_cb : event_read_cb, io);
+    io->event_write = event_new(io->event_base, fd, EV_WRITE, on_loop ? loop_write_cb : event_write_cb, io);
+}
+
 /**
 ***
 **/
@@ -641,8 +793,17 @@ static tr_peerIo* tr_peerIoNew(
     {
     case TR_PEER_SOCKET_TYPE_TCP:
         dbgmsg(io, "socket (tcp) is %" PRIdMAX, (intmax_t)socket.handle.tcp);
-        io->event_read = event_new(session->event_base, socket.handle.tcp, EV_READ, event_read_cb, io);
-        io->event_write = event_new(session->event_base, socket.handle.tcp, EV_WRITE, event_write_cb, io);
+        io->event_base = tr_eventGetPeerBase(session);
+
+        if (io->event_base != session->event_base)
+        {
+            /* the loop drains outbuf while we're filling it */
+            evbuffer_enable_locking(io->outbuf, nullptr);
+            io->loop_inbuf = evbuffer_new();
+            evbuffer_enable_locking(io->loop_inbuf, nullptr);
+        }
+
+        io_new_events(io);
         break;
 
 #ifdef WITH_UTP
@@ -740,26 +901,42 @@ static void event_enable(tr_peerIo* io, short event)
 
     if ((event & EV_READ) != 0 && (io->pendingEvents & EV_READ) == 0)
     {
-        dbgmsg(io, "enabling ready-to-read polling");
-
-        if (need_events)
+        /* peer loops can't check the bandwidth when the socket's ready,
+         * so decide now how much they may read */
+        if (need_events && io_on_peer_loop(io) && (io->loop_read_budget = loop_read_budget(io)) == 0)
         {
-            event_add(io->event_read, nullptr);
+            dbgmsg(io, "not enabling ready-to-read polling; no bandwidth left");
         }
+        else
+        {
+            dbgmsg(io, "enabling ready-to-read polling");
+
+            if (need_events)
+            {
+                event_add(io->event_read, nullptr);
+            }
 
-        io->pendingEvents |= EV_READ;
+            io->pendingEvents |= EV_READ;
+        }
     }
 
     if ((event & EV_WRITE) != 0 && (io->pendingEvents & EV_WRITE) == 0)
     {
-        dbgmsg(io, "enabling ready-to-write polling");
-
-        if (need_events)
+        if (need_events && io_on_peer_loop(io) && (io->loop_write_budget = loop_write_budget(io)) == 0)
         {
-            event_add(io->event_write, nullptr);
+            dbgmsg(io, "not enabling ready-to-write polling; no bandwidth left");
         }
+        else
+        {
+            dbgmsg(io, "enabling ready-to-write polling");
+
+            if (need_events)
+            {
+                event_add(io->event_write, nullptr);
+            }
 
-        io->pendingEvents |= EV_WRITE;
+            io->pendingEvents |= EV_WRITE;
+        }
     }
 }
 
@@ -827,6 +1004,20 @@ void tr_peerIoSetEnabled(tr_peerIo* io, tr_direction dir, bool isEnabled)
 
 static void io_close_socket(tr_peerIo* io)
 {
+    /* free the events first, so that a peer loop can't be
+     * using the socket when it's closed */
+    if (io->event_read != nullptr)
+    {
+        event_free(io->event_read);
+        io->event_read = nullptr;
+    }
+
+    if (io->event_write != nullptr)
+    {
+        event_free(io->event_write);
+        io->event_write = nullptr;
+    }
+
     switch (io->socket.type)
     {
     case TR_PEER_SOCKET_TYPE_NONE:
@@ -850,18 +1041,6 @@ static void io_close_socket(tr_peerIo* io)
     }
 
     io->socket = {};
-
-    if (io->event_read != nullptr)
-    {
-        event_free(io->event_read);
-        io->event_read = nullptr;
-    }
-
-    if (io->event_write != nullptr)
-    {
-        event_free(io->event_write);
-        io->event_write = nullptr;
-    }
 }
 
 static void io_dtor(void* vio)
@@ -878,13 +1057,13 @@ static void io_dtor(void* vio)
     io_close_socket(io);
     tr_cryptoDestruct(&io->crypto);
 
-    while (io->outbuf_datatypes != nullptr)
+    io->magic_number = ~0;
+
+    /* if a peer loop's results are still on their way, the last one frees it */
+    if (io->loop_results_pending == 0)
     {
-        peer_io_pull_datatype(io);
+        delete io;
     }
-
-    io->magic_number = ~0;
-    delete io;
 }
 
 static void tr_peerIoFree(tr_peerIo* io)
@@ -973,6 +1152,13 @@ int tr_peerIoReconnect(tr_peerIo* io)
 
     io_close_socket(io);
 
+    if (io_on_peer_loop(io))
+    {
+        /* anything the loop read or is about to report was from the old socket */
+        ++io->loop_generation;
+        evbuffer_drain(io->loop_inbuf, evbuffer_get_length(io->loop_inbuf));
+    }
+
     io->socket = tr_netOpenPeerSocket(session, &io->addr, io->port, io->isSeed);
 
     if (io->socket.type != TR_PEER_SOCKET_TYPE_TCP)
@@ -980,8 +1166,7 @@ int tr_peerIoReconnect(tr_peerIo* io)
         return -1;
     }
 
-    io->event_read = event_new(session->event_base, io->socket.handle.tcp, EV_READ, event_read_cb, io);
-    io->event_write = event_new(session->event_base, io->socket.handle.tcp, EV_WRITE, event_write_cb, io);
+    io_new_events(io);
 
     event_enable(io, pendingEvents);
     tr_netSetTOS(io->socket.handle.tcp, session->peerSocketTos(), io->addr.type);
@@ -1070,32 +1255,52 @@ static inline void processBuffer(
     void (*callback)(tr_crypto*, size_t, void const*, void*))
 {
     struct evbuffer_ptr pos;
-    struct evbuffer_iovec iovec;
+    auto iovecs = std::array<struct evbuffer_iovec, 16>{};
 
     evbuffer_ptr_set(buffer, &pos, offset, EVBUFFER_PTR_SET);
 
-    do
+    /* peek at the chunks in batches instead of seeking to each one */
+    while (size > 0)
     {
-        if (evbuffer_peek(buffer, size, &pos, &iovec, 1) <= 0)
+        auto const max_vecs = int(std::size(iovecs));
+        int const n_vecs = std::min(evbuffer_peek(buffer, size, &pos, std::data(iovecs), max_vecs), max_vecs);
+        if (n_vecs <= 0)
         {
             break;
         }
 
-        callback(crypto, iovec.iov_len, iovec.iov_base, iovec.iov_base);
+        size_t n_done = 0;
+        for (int i = 0; i < n_vecs && n_done < size; ++i)
+        {
+            auto const len = std::min(iovecs[i].iov_len, size - n_done);
+            callback(crypto, len, iovecs[i].iov_base, iovecs[i].iov_base);
+            n_done += len;
+        }
 
-        TR_ASSERT(size >= iovec.iov_len);
-        size -= iovec.iov_len;
-    } while (evbuffer_ptr_set(buffer, &pos, iovec.iov_len, EVBUFFER_PTR_ADD) == 0);
+        size -= n_done;
+        if (size > 0 && evbuffer_ptr_set(buffer, &pos, n_done, EVBUFFER_PTR_ADD) != 0)
+        {
+            break;
+        }
+    }
 
     TR_ASSERT(size == 0);
 }
 
 static void addDatatype(tr_peerIo* io, size_t byteCount, bool isPieceData)
 {
-    auto* const d = datatype_new();
-    d->isPieceData = isPieceData;
-    d->length = byteCount;
-    peer_io_push_datatype(io, d);
+    auto& datatypes = io->outbuf_datatypes;
+
+    /* consecutive writes of the same kind are accounted for together,
+       so a run of small protocol messages costs a single record */
+    if (!std::empty(datatypes) && datatypes.back().isPieceData == isPieceData)
+    {
+        datatypes.back().length += byteCount;
+    }
+    else
+    {
+        datatypes.push_back({ byteCount, isPieceData });
+    }
 }
 
 static inline void maybeEncryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_t offset, size_t size)
@@ -1116,6 +1321,16 @@ void tr_peerIoWriteBuf(tr_peerIo* io, struct evbuffer* buf, bool isPieceData)
 
 void tr_peerIoWriteBytes(tr_peerIo* io, void const* bytes, size_t byteCount, bool isPieceData)
 {
+    /* a peer loop may be draining outbuf, so it can't be written to in place */
+    if (io_on_peer_loop(io))
+    {
+        auto* const buf = evbuffer_new();
+        evbuffer_add(buf, bytes, byteCount);
+        tr_peerIoWriteBuf(io, buf, isPieceData);
+        evbuffer_free(buf);
+        return;
+    }
+
     struct evbuffer_iovec iovec;
     evbuffer_reserve_space(io->outbuf, byteCount, &iovec, 1);
 
@@ -1166,30 +1381,6 @@ void evbuffer_add_uint64(struct evbuffer* outbuf, uint64_t addme_hll)
 ****
 ***/
 
-static inline void maybeDecryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_t offset, size_t size)
-{
-    if (io->encryption_type == PEER_ENCRYPTION_RC4)
-    {
-        processBuffer(&io->crypto, buf, offset, size, &tr_cryptoDecrypt);
-    }
-}
-
-void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount)
-{
-    TR_ASSERT(tr_isPeerIo(io));
-    TR_ASSERT(evbuffer_get_length(inbuf) >= byteCount);
-
-    size_t const old_length = evbuffer_get_length(outbuf);
-
-    /* append it to outbuf */
-    struct evbuffer* tmp = evbuffer_new();
-    evbuffer_remove_buffer(inbuf, tmp, byteCount);
-    evbuffer_add_buffer(outbuf, tmp);
-    evbuffer_free(tmp);
-
-    maybeDecryptBuffer(io, outbuf, old_length, byteCount);
-}
-
 void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size_t byteCount)
 {
     TR_ASSERT(tr_isPeerIo(io));
@@ -1262,6 +1453,17 @@ static int tr_peerIoTryRead(tr_peerIo* io, size_t howmuch)
             break;
 
         case TR_PEER_SOCKET_TYPE_TCP:
+            /* the peer loop does this socket's reads */
+            if (io_on_peer_loop(io))
+            {
+                if (evbuffer_get_length(io->inbuf) != 0)
+                {
+                    canReadWrapper(io);
+                }
+
+                break;
+            }
+
             {
                 char err_buf[512];
 
@@ -1392,14 +1594,14 @@ int tr_peerIoFlushOutgoingProtocolMsgs(tr_peerIo* io)
 
     /* count up how many bytes are used by non-piece-data messages
        at the front of our outbound queue */
-    for (struct tr_datatype const* it = io->outbuf_datatypes; it != nullptr; it = it->next)
+    for (auto const& datatype : io->outbuf_datatypes)
     {
-        if (it->isPieceData)
+        if (datatype.isPieceData)
         {
             break;
         }
 
-        byteCount += it->length;
+        byteCount += datatype.length;
     }
 
     return tr_peerIoFlush(io, TR_UP, byteCount);
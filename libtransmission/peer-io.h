@@ -16,6 +16,9 @@
 ***
 **/
 
+#include <atomic>
+#include <deque>
+
 #include <event2/buffer.h>
 
 #include "transmission.h"
@@ -28,7 +31,6 @@
 class tr_peerIo;
 struct Bandwidth;
 struct evbuffer;
-struct tr_datatype;
 
 /**
  * @addtogroup networked_io Networked IO
@@ -55,6 +57,13 @@ using tr_did_write_cb = void (*)(tr_peerIo* io, size_t bytesWritten, bool wasPie
 
 using tr_net_error_cb = void (*)(tr_peerIo* io, short what, void* userData);
 
+/* how many bytes at the front of outbuf are, or aren't, piece data */
+struct tr_datatype
+{
+    size_t length;
+    bool isPieceData;
+};
+
 auto inline constexpr PEER_IO_MAGIC_NUMBER = 206745;
 
 class tr_peerIo
@@ -68,10 +77,19 @@ public:
         , port{ port_in }
         , isSeed{ is_seed_in }
     {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        /* let file-backed segments go out via sendfile() */
+        evbuffer_set_flags(outbuf, EVBUFFER_FLAG_DRAINS_TO_FD);
+#endif
     }
 
     ~tr_peerIo()
     {
+        if (loop_inbuf != nullptr)
+        {
+            evbuffer_free(loop_inbuf);
+        }
+
         evbuffer_free(outbuf);
         evbuffer_free(inbuf);
     }
@@ -103,11 +121,23 @@ public:
 
     evbuffer* const inbuf;
     evbuffer* const outbuf;
-    struct tr_datatype* outbuf_datatypes = nullptr;
+    std::deque<tr_datatype> outbuf_datatypes;
 
     struct event* event_read = nullptr;
     struct event* event_write = nullptr;
 
+    // When the socket is polled by one of the session's peer loops instead
+    // of the event thread, that loop only does the reads and writes; the
+    // results are handed back to the event thread to be acted on.
+    // See tr_eventGetPeerBase().
+    struct event_base* event_base = nullptr;
+    evbuffer* loop_inbuf = nullptr; // bytes read by the loop but not yet handed over
+    // these are set in the event thread and read in the loop's thread
+    std::atomic<unsigned int> loop_read_budget = 0;
+    std::atomic<unsigned int> loop_write_budget = 0;
+    std::atomic<unsigned int> loop_generation = 0; // bumped when the socket's replaced
+    std::atomic<int> loop_results_pending = 0;
+
     // TODO(ckerr): this could be narrowed to 1 byte
     tr_encryption_type encryption_type = PEER_ENCRYPTION_NONE;
 
@@ -266,6 +296,13 @@ constexpr bool tr_peerIoIsEncrypted(tr_peerIo const* io)
     return io != nullptr && io->encryption_type == PEER_ENCRYPTION_RC4;
 }
 
+/* true if piece data can be queued as file-backed segments and sent
+ * straight from the page cache, without being copied into userspace */
+constexpr bool tr_peerIoSupportsZeroCopy(tr_peerIo const* io)
+{
+    return io != nullptr && io->socket.type == TR_PEER_SOCKET_TYPE_TCP && io->encryption_type == PEER_ENCRYPTION_NONE;
+}
+
 void evbuffer_add_uint8(struct evbuffer* outbuf, uint8_t byte);
 void evbuffer_add_uint16(struct evbuffer* outbuf, uint16_t hs);
 void evbuffer_add_uint32(struct evbuffer* outbuf, uint32_t hl);
@@ -286,8 +323,6 @@ static inline void evbuffer_add_hton_64(struct evbuffer* buf, uint64_t val)
     evbuffer_add_uint64(buf, val);
 }
 
-void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount);
-
 void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size_t byteCount);
 
 static inline void tr_peerIoReadUint8(tr_peerIo* io, struct evbuffer* inbuf, uint8_t* setme)
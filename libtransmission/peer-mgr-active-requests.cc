@@ -7,54 +7,123 @@
  */
 
 #include <algorithm>
-#include <functional>
+#include <array>
+#include <cstdint>
+#include <limits>
 #include <memory>
-#include <numeric>
+#include <optional>
 #include <utility>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #define LIBTRANSMISSION_PEER_MODULE
 
+#include "open-hash-table.h"
 #include "peer-mgr-active-requests.h"
+#include "tr-assert.h"
+
+/**
+ * Every request lives in one flat array and is threaded onto three
+ * intrusive lists: one for its block, one for its peer, and one for
+ * the timing wheel bucket of when it was sent. The block and peer
+ * lists are found through small open-addressed tables, so dropping
+ * a peer or a block only touches the requests that belong to it, and
+ * finding old requests only walks the buckets that are old enough.
+ */
 
 namespace
 {
 
-struct peer_at
+auto constexpr NoIndex = std::numeric_limits<uint32_t>::max();
+
+struct Link
 {
-    tr_peer* peer;
-    time_t when;
+    uint32_t prev = NoIndex;
+    uint32_t next = NoIndex;
+};
 
-    peer_at(tr_peer* p, time_t w)
-        : peer{ p }
-        , when{ w }
+struct Chain
+{
+    uint32_t head = NoIndex;
+    uint32_t size = 0;
+};
+
+struct Request
+{
+    tr_block_index_t block = {};
+    tr_peer* peer = nullptr;
+    uint64_t when = {};
+
+    Link by_block;
+    Link by_peer;
+    Link by_time;
+};
+
+constexpr uint64_t keyBits(tr_block_index_t block)
+{
+    return block;
+}
+
+uint64_t keyBits(tr_peer const* peer)
+{
+    return reinterpret_cast<uintptr_t>(peer);
+}
+
+// maps a key to the head of its request list
+template<typename Key>
+class ChainIndex
+{
+public:
+    [[nodiscard]] Chain* find(Key key)
     {
+        auto* const slot = table_.find(hash(key), [key](Slot const& s) { return s.key == key; });
+        return slot != nullptr ? &slot->chain : nullptr;
     }
 
-    int compare(peer_at const& that) const // <=>
+    Chain& get(Key key)
     {
-        if (peer != that.peer)
+        if (auto* const chain = find(key); chain != nullptr)
         {
-            return peer < that.peer ? -1 : 1;
+            return *chain;
         }
 
-        return 0;
+        auto& slot = table_.add(hash(key));
+        slot = Slot{ key, Chain{}, true };
+        return slot.chain;
     }
 
-    bool operator==(peer_at const& that) const
+    void erase(Key key)
     {
-        return compare(that) == 0;
+        table_.erase(table_.find(hash(key), [key](Slot const& s) { return s.key == key; }));
     }
-};
 
-struct PeerAtHash
-{
-    std::size_t operator()(peer_at const& pa) const noexcept
+private:
+    struct Slot
     {
-        return std::hash<tr_peer*>{}(pa.peer);
+        Key key = {};
+        Chain chain;
+        bool used = false;
+    };
+
+    // Fibonacci hashing, so that aligned pointers still spread out
+    static size_t hash(Key key)
+    {
+        return size_t((keyBits(key) * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
     }
+
+    struct SlotTraits
+    {
+        static bool isUsed(Slot const& slot)
+        {
+            return slot.used;
+        }
+
+        static size_t hash(Slot const& slot)
+        {
+            return ChainIndex::hash(slot.key);
+        }
+    };
+
+    OpenHashTable<Slot, SlotTraits> table_;
 };
 
 } // namespace
@@ -62,46 +131,197 @@ struct PeerAtHash
 class ActiveRequests::Impl
 {
 public:
-    size_t size() const
+    // The timing wheel's resolution and span. Requests live for at
+    // most RequestPipeline::MaxTimeoutMsec, well within one turn of
+    // the wheel; older ones still work, they just share buckets.
+    static auto constexpr WheelTickMsec = uint64_t{ 1000 };
+    static auto constexpr WheelSize = size_t{ 128 };
+
+    [[nodiscard]] size_t size() const
     {
         return size_;
     }
 
-    size_t count(tr_peer const* peer) const
+    [[nodiscard]] size_t count(tr_block_index_t block)
     {
-        auto const it = count_.find(peer);
-        return it != std::end(count_) ? it->second : size_t{};
+        auto const* const chain = blocks_.find(block);
+        return chain != nullptr ? chain->size : 0;
     }
 
-    void incCount(tr_peer const* peer)
+    [[nodiscard]] size_t count(tr_peer const* peer)
     {
-        ++count_[peer];
+        auto const* const chain = peers_.find(peer);
+        return chain != nullptr ? chain->size : 0;
+    }
+
+    // return the index of the request for `block` to `peer`, or NoIndex
+    [[nodiscard]] uint32_t find(tr_block_index_t block, tr_peer const* peer)
+    {
+        auto const* const chain = blocks_.find(block);
+        auto idx = chain != nullptr ? chain->head : NoIndex;
+
+        // a block is requested from one peer, or from a couple in endgame
+        while (idx != NoIndex && requests_[idx].peer != peer)
+        {
+            idx = requests_[idx].by_block.next;
+        }
+
+        return idx;
+    }
+
+    bool add(tr_block_index_t block, tr_peer* peer, uint64_t when)
+    {
+        if (find(block, peer) != NoIndex)
+        {
+            return false;
+        }
+
+        auto idx = uint32_t{};
+        if (std::empty(free_))
+        {
+            idx = uint32_t(std::size(requests_));
+            requests_.emplace_back();
+        }
+        else
+        {
+            idx = free_.back();
+            free_.pop_back();
+        }
+
+        auto& req = requests_[idx];
+        req.block = block;
+        req.peer = peer;
+        req.when = when;
+
+        auto const tick = when / WheelTickMsec;
+        if (size_ == 0 || tick < oldest_tick_)
+        {
+            oldest_tick_ = tick;
+        }
+
+        link<&Request::by_block>(blocks_.get(block), idx);
+        link<&Request::by_peer>(peers_.get(peer), idx);
+        link<&Request::by_time>(wheel_[tick % WheelSize], idx);
         ++size_;
+
+        return true;
     }
 
-    void decCount(tr_peer const* peer)
+    void remove(uint32_t idx)
     {
-        auto it = count_.find(peer);
-        TR_ASSERT(it != std::end(count_));
-        TR_ASSERT(it->second > 0);
-        TR_ASSERT(size_ > 0);
+        auto const& req = requests_[idx];
+
+        unlink<&Request::by_time>(wheel_[(req.when / WheelTickMsec) % WheelSize], idx);
+
+        if (auto& chain = *blocks_.find(req.block); unlink<&Request::by_block>(chain, idx) == 0)
+        {
+            blocks_.erase(req.block);
+        }
 
-        if (it != std::end(count_))
+        if (auto& chain = *peers_.find(req.peer); unlink<&Request::by_peer>(chain, idx) == 0)
         {
-            if (--it->second == 0)
+            peers_.erase(req.peer);
+        }
+
+        free_.push_back(idx);
+        --size_;
+    }
+
+    // walk the requests for `key`, removing each one after calling `func` on it
+    template<typename Key, typename Func>
+    void removeAll(ChainIndex<Key>& index, Link Request::*links, Key key, Func func)
+    {
+        auto const* const chain = index.find(key);
+        auto idx = chain != nullptr ? chain->head : NoIndex;
+
+        while (idx != NoIndex)
+        {
+            auto const next = (requests_[idx].*links).next;
+            func(requests_[idx]);
+            remove(idx); // erases `key` from `index` after its last request
+            idx = next;
+        }
+    }
+
+    template<typename Func>
+    void forEachSentBefore(uint64_t when, Func func)
+    {
+        if (size_ == 0 || when == 0)
+        {
+            return;
+        }
+
+        // skip past buckets that have emptied out since we last looked
+        auto const last_tick = (when - 1) / WheelTickMsec;
+        while (oldest_tick_ < last_tick && wheel_[oldest_tick_ % WheelSize].size == 0)
+        {
+            ++oldest_tick_;
+        }
+
+        auto const end_tick = std::min(last_tick, oldest_tick_ + WheelSize - 1) + 1;
+        for (auto tick = oldest_tick_; tick < end_tick; ++tick)
+        {
+            for (auto idx = wheel_[tick % WheelSize].head; idx != NoIndex; idx = requests_[idx].by_time.next)
             {
-                count_.erase(it);
+                if (auto const& req = requests_[idx]; req.when < when)
+                {
+                    func(req);
+                }
             }
-            --size_;
         }
     }
 
-    std::unordered_map<tr_peer const*, size_t> count_;
-
-    std::unordered_map<tr_block_index_t, std::unordered_set<peer_at, PeerAtHash>> blocks_;
+    ChainIndex<tr_block_index_t> blocks_;
+    ChainIndex<tr_peer const*> peers_;
+    std::vector<Request> requests_;
 
 private:
+    template<Link Request::*L>
+    void link(Chain& chain, uint32_t idx)
+    {
+        auto& links = requests_[idx].*L;
+        links.prev = NoIndex;
+        links.next = chain.head;
+
+        if (chain.head != NoIndex)
+        {
+            (requests_[chain.head].*L).prev = idx;
+        }
+
+        chain.head = idx;
+        ++chain.size;
+    }
+
+    // returns how many requests are left in the chain
+    template<Link Request::*L>
+    uint32_t unlink(Chain& chain, uint32_t idx)
+    {
+        auto const& links = requests_[idx].*L;
+
+        if (links.prev != NoIndex)
+        {
+            (requests_[links.prev].*L).next = links.next;
+        }
+        else
+        {
+            chain.head = links.next;
+        }
+
+        if (links.next != NoIndex)
+        {
+            (requests_[links.next].*L).prev = links.prev;
+        }
+
+        TR_ASSERT(chain.size > 0);
+        return --chain.size;
+    }
+
+    std::array<Chain, WheelSize> wheel_ = {};
+    std::vector<uint32_t> free_;
     size_t size_ = 0;
+
+    // no request was sent before this tick
+    uint64_t oldest_tick_ = 0;
 };
 
 ActiveRequests::ActiveRequests()
@@ -111,33 +331,20 @@ ActiveRequests::ActiveRequests()
 
 ActiveRequests::~ActiveRequests() = default;
 
-bool ActiveRequests::add(tr_block_index_t block, tr_peer* peer, time_t when)
+bool ActiveRequests::add(tr_block_index_t block, tr_peer* peer, uint64_t when)
 {
-    bool const added = impl_->blocks_[block].emplace(peer, when).second;
-
-    if (added)
-    {
-        impl_->incCount(peer);
-    }
-
-    return added;
+    return impl_->add(block, peer, when);
 }
 
 // remove a request to `peer` for `block`
 bool ActiveRequests::remove(tr_block_index_t block, tr_peer const* peer)
 {
-    auto const it = impl_->blocks_.find(block);
-    auto const key = peer_at{ const_cast<tr_peer*>(peer), 0 };
-    auto const removed = it != std::end(impl_->blocks_) && it->second.erase(key) != 0;
+    auto const idx = impl_->find(block, peer);
+    auto const removed = idx != NoIndex;
 
     if (removed)
     {
-        impl_->decCount(peer);
-
-        if (std::empty(it->second))
-        {
-            impl_->blocks_.erase(it);
-        }
+        impl_->remove(idx);
     }
 
     return removed;
@@ -147,21 +354,9 @@ bool ActiveRequests::remove(tr_block_index_t block, tr_peer const* peer)
 std::vector<tr_block_index_t> ActiveRequests::remove(tr_peer const* peer)
 {
     auto removed = std::vector<tr_block_index_t>{};
-    removed.reserve(impl_->blocks_.size());
+    removed.reserve(impl_->count(peer));
 
-    auto const key = peer_at{ const_cast<tr_peer*>(peer), 0 };
-    for (auto const& [block, peers_at] : impl_->blocks_)
-    {
-        if (peers_at.count(key))
-        {
-            removed.push_back(block);
-        }
-    }
-
-    for (auto block : removed)
-    {
-        remove(block, peer);
-    }
+    impl_->removeAll(impl_->peers_, &Request::by_peer, peer, [&removed](auto const& req) { removed.push_back(req.block); });
 
     return removed;
 }
@@ -170,23 +365,9 @@ std::vector<tr_block_index_t> ActiveRequests::remove(tr_peer const* peer)
 std::vector<tr_peer*> ActiveRequests::remove(tr_block_index_t block)
 {
     auto removed = std::vector<tr_peer*>{};
+    removed.reserve(impl_->count(block));
 
-    if (auto it = impl_->blocks_.find(block); it != std::end(impl_->blocks_))
-    {
-        auto const n = std::size(it->second);
-        removed.resize(n);
-        std::transform(
-            std::begin(it->second),
-            std::end(it->second),
-            std::begin(removed),
-            [](auto const& sent) { return sent.peer; });
-        impl_->blocks_.erase(block);
-    }
-
-    for (auto* peer : removed)
-    {
-        impl_->decCount(peer);
-    }
+    impl_->removeAll(impl_->blocks_, &Request::by_block, block, [&removed](auto const& req) { removed.push_back(req.peer); });
 
     return removed;
 }
@@ -194,14 +375,25 @@ std::vector<tr_peer*> ActiveRequests::remove(tr_block_index_t block)
 // return true if there's an active request to `peer` for `block`
 bool ActiveRequests::has(tr_block_index_t block, tr_peer const* peer) const
 {
-    auto const it = impl_->blocks_.find(block);
-    return it != std::end(impl_->blocks_) && it->second.count(peer_at{ const_cast<tr_peer*>(peer), 0 });
+    return impl_->find(block, peer) != NoIndex;
+}
+
+// return when we requested `block` from `peer`, if we did
+std::optional<uint64_t> ActiveRequests::sentAt(tr_block_index_t block, tr_peer const* peer) const
+{
+    auto const idx = impl_->find(block, peer);
+    if (idx == NoIndex)
+    {
+        return {};
+    }
+
+    return impl_->requests_[idx].when;
 }
 
 // count how many peers we're asking for `block`
 size_t ActiveRequests::count(tr_block_index_t block) const
 {
-    return std::size(impl_->blocks_[block]);
+    return impl_->count(block);
 }
 
 // count how many active block requests we have to `peer`
@@ -217,21 +409,11 @@ size_t ActiveRequests::size() const
 }
 
 // returns the active requests sent before `when`
-std::vector<std::pair<tr_block_index_t, tr_peer*>> ActiveRequests::sentBefore(time_t when) const
+std::vector<std::pair<tr_block_index_t, tr_peer*>> ActiveRequests::sentBefore(uint64_t when) const
 {
     auto sent_before = std::vector<std::pair<tr_block_index_t, tr_peer*>>{};
-    sent_before.reserve(std::size(impl_->blocks_));
 
-    for (auto& [block, peers_at] : impl_->blocks_)
-    {
-        for (auto& sent : peers_at)
-        {
-            if (sent.when < when)
-            {
-                sent_before.emplace_back(block, sent.peer);
-            }
-        }
-    }
+    impl_->forEachSentBefore(when, [&sent_before](auto const& req) { sent_before.emplace_back(req.block, req.peer); });
 
     return sent_before;
 }
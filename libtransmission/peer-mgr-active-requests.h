@@ -13,8 +13,9 @@
 #endif
 
 #include <cstddef> // size_t
-#include <ctime> // time_t
+#include <cstdint> // uint64_t
 #include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -31,8 +32,9 @@ public:
     ActiveRequests();
     ~ActiveRequests();
 
-    // record that we've requested `block` from `peer`
-    bool add(tr_block_index_t block, tr_peer* peer, time_t when);
+    // record that we've requested `block` from `peer`.
+    // `when` is a timestamp, e.g. from tr_time_msec()
+    bool add(tr_block_index_t block, tr_peer* peer, uint64_t when);
 
     // erase any record of a request for `block` from `peer`
     bool remove(tr_block_index_t block, tr_peer const* peer);
@@ -46,6 +48,9 @@ public:
     // return true if there's a record of a request for `block` from `peer`
     [[nodiscard]] bool has(tr_block_index_t block, tr_peer const* peer) const;
 
+    // return when we requested `block` from `peer`, if we did
+    [[nodiscard]] std::optional<uint64_t> sentAt(tr_block_index_t block, tr_peer const* peer) const;
+
     // count how many peers we're asking for `block`
     [[nodiscard]] size_t count(tr_block_index_t block) const;
 
@@ -56,7 +61,7 @@ public:
     [[nodiscard]] size_t size() const;
 
     // returns the active requests sent before `when`
-    [[nodiscard]] std::vector<std::pair<tr_block_index_t, tr_peer*>> sentBefore(time_t when) const;
+    [[nodiscard]] std::vector<std::pair<tr_block_index_t, tr_peer*>> sentBefore(uint64_t when) const;
 
 private:
     class Impl;
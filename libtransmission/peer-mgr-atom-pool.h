@@ -0,0 +1,193 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <algorithm>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint64_t
+#include <ctime> // time_t
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "transmission.h" // tr_port
+#include "net.h" // tr_address
+#include "open-hash-table.h"
+#include "tr-assert.h"
+
+struct tr_peer;
+
+/**
+ * Peer information that should be kept even before we've connected and
+ * after we've disconnected. These are kept in a pool of peer_atoms to decide
+ * which ones would make good candidates for connecting to, and to watch out
+ * for banned peers.
+ *
+ * @see tr_peer
+ * @see tr_peerMsgs
+ */
+struct peer_atom
+{
+    uint8_t fromFirst; /* where the peer was first found */
+    uint8_t fromBest; /* the "best" value of where the peer has been found */
+    uint8_t flags; /* these match the added_f flags */
+    uint8_t flags2; /* flags that aren't defined in added_f */
+    int8_t blocklisted; /* -1 for unknown, true for blocklisted, false for not blocklisted */
+
+    tr_port port;
+    bool utp_failed; /* We recently failed to connect over uTP */
+    uint16_t numFails;
+    time_t time; /* when the peer's connection status last changed */
+    time_t piece_data_time;
+
+    time_t lastConnectionAttemptAt;
+    time_t lastConnectionAt;
+
+    /* similar to a TTL field, but less rigid --
+     * if the swarm is small, the atom will be kept past this date. */
+    time_t shelf_date;
+    tr_peer* peer; /* will be nullptr if not connected */
+    tr_address addr;
+
+    bool is_queued_candidate; /* true if it's in the swarm's waiting or ready candidates */
+};
+
+/**
+ * A swarm's peer_atoms. They're carved out of fixed-size chunks that are
+ * recycled through a free list, so peers can keep pointers to their atoms
+ * and discovering a new peer doesn't need its own malloc. An OpenHashTable
+ * of atom pointers finds atoms by address.
+ */
+class AtomPool
+{
+public:
+    AtomPool() = default;
+    AtomPool(AtomPool const&) = delete;
+    AtomPool& operator=(AtomPool const&) = delete;
+
+    [[nodiscard]] auto begin() const
+    {
+        return std::begin(atoms_);
+    }
+
+    [[nodiscard]] auto end() const
+    {
+        return std::end(atoms_);
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return std::size(atoms_);
+    }
+
+    [[nodiscard]] peer_atom* find(tr_address const* addr) const
+    {
+        auto const* const slot = index_.find(
+            hash(addr),
+            [addr](peer_atom const* atom) { return tr_address_compare(&atom->addr, addr) == 0; });
+        return slot != nullptr ? *slot : nullptr;
+    }
+
+    // returns a zeroed atom for `addr`, which must not already be in the pool
+    peer_atom* emplace(tr_address const* addr)
+    {
+        TR_ASSERT(find(addr) == nullptr);
+
+        if (std::empty(free_))
+        {
+            auto& chunk = chunks_.emplace_back(std::make_unique<peer_atom[]>(ChunkSize));
+            for (size_t i = ChunkSize; i > 0; --i)
+            {
+                free_.push_back(&chunk[i - 1]);
+            }
+        }
+
+        auto* const atom = free_.back();
+        free_.pop_back();
+        *atom = peer_atom{};
+        atom->addr = *addr;
+
+        index_.add(hash(addr)) = atom;
+        atoms_.push_back(atom);
+        return atom;
+    }
+
+    // Shrink the pool to `max` atoms, or as close as possible without
+    // dropping any that are in use. Of the rest, the best are kept.
+    template<typename InUse, typename Better>
+    void prune(size_t max, InUse in_use, Better better)
+    {
+        auto const first_unused = std::partition(std::begin(atoms_), std::end(atoms_), in_use);
+        auto const n_in_use = size_t(std::distance(std::begin(atoms_), first_unused));
+        auto keep_end = first_unused;
+
+        if (n_in_use < max)
+        {
+            keep_end += max - n_in_use;
+            std::nth_element(first_unused, keep_end, std::end(atoms_), better);
+        }
+
+        std::for_each(keep_end, std::end(atoms_), [this](auto* atom) { erase(atom); });
+        atoms_.erase(keep_end, std::end(atoms_));
+    }
+
+    void clear()
+    {
+        atoms_.clear();
+        index_.clear();
+        free_.clear();
+        chunks_.clear();
+    }
+
+private:
+    static auto constexpr ChunkSize = size_t{ 64 };
+
+    // FNV-1a
+    static size_t hash(tr_address const* addr)
+    {
+        auto const* const bytes = reinterpret_cast<uint8_t const*>(&addr->addr);
+        auto const n_bytes = addr->type == TR_AF_INET ? sizeof(addr->addr.addr4) : sizeof(addr->addr.addr6);
+        auto h = uint64_t{ 14695981039346656037ULL };
+        for (size_t i = 0; i < n_bytes; ++i)
+        {
+            h = (h ^ bytes[i]) * 1099511628211ULL;
+        }
+
+        return size_t(h);
+    }
+
+    struct SlotTraits
+    {
+        static bool isUsed(peer_atom const* atom)
+        {
+            return atom != nullptr;
+        }
+
+        static size_t hash(peer_atom const* atom)
+        {
+            return AtomPool::hash(&atom->addr);
+        }
+    };
+
+    // remove `atom` from the index and put it back on the free list
+    void erase(peer_atom* atom)
+    {
+        index_.erase(index_.find(hash(&atom->addr), [atom](peer_atom const* a) { return a == atom; }));
+        free_.push_back(atom);
+    }
+
+    std::vector<peer_atom*> atoms_;
+    OpenHashTable<peer_atom*, SlotTraits> index_;
+    std::vector<peer_atom*> free_;
+    std::vector<std::unique_ptr<peer_atom[]>> chunks_;
+};
@@ -0,0 +1,147 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+#include "crypto-utils.h" // tr_rand_int_weak()
+#include "peer-mgr-atom-pool.h"
+#include "peer-mgr-candidates.h"
+#include "tr-assert.h"
+
+class CandidateQueue::Impl
+{
+public:
+    void queue(peer_atom* atom)
+    {
+        if (!atom->is_queued_candidate)
+        {
+            atom->is_queued_candidate = true;
+            pushEntry(waiting_, 0, atom);
+        }
+    }
+
+    void rebuild(AtomPool const& pool)
+    {
+        waiting_.clear();
+        ready_.clear();
+
+        for (auto* const atom : pool)
+        {
+            atom->is_queued_candidate = true;
+            waiting_.push_back({ 0, atom });
+        }
+    }
+
+    peer_atom* next(SwarmInfo const& swarm_info, time_t now, uint64_t* setme_score)
+    {
+        // promote the atoms whose reconnect interval should be up by now
+        while (!std::empty(waiting_) && waiting_.front().key <= uint64_t(now))
+        {
+            auto* const atom = popEntry(waiting_).atom;
+            pushEntry(ready_, swarm_info.score(atom, tr_rand_int_weak(256)), atom);
+        }
+
+        while (!std::empty(ready_))
+        {
+            auto const [key, atom] = ready_.front();
+
+            if (auto const interval = swarm_info.reconnectIntervalSecs(atom, now); now - atom->time < interval)
+            {
+                popEntry(ready_);
+                pushEntry(waiting_, uint64_t(atom->time + interval), atom);
+            }
+            else if (!swarm_info.isCandidate(atom, now))
+            {
+                popEntry(ready_);
+                atom->is_queued_candidate = false;
+            }
+            else if (auto const score = swarm_info.score(atom, key & 0xFF); score != key)
+            {
+                // it's changed since it was queued, so it might not be the best anymore
+                popEntry(ready_);
+                pushEntry(ready_, score, atom);
+            }
+            else
+            {
+                *setme_score = score;
+                return atom;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void pop([[maybe_unused]] peer_atom const* atom)
+    {
+        TR_ASSERT(!std::empty(ready_));
+        TR_ASSERT(ready_.front().atom == atom);
+
+        popEntry(ready_).atom->is_queued_candidate = false;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t key;
+        peer_atom* atom;
+    };
+
+    static constexpr bool compare(Entry const& a, Entry const& b)
+    {
+        return a.key > b.key; // min-heap
+    }
+
+    static void pushEntry(std::vector<Entry>& heap, uint64_t key, peer_atom* atom)
+    {
+        heap.push_back({ key, atom });
+        std::push_heap(std::begin(heap), std::end(heap), compare);
+    }
+
+    static Entry popEntry(std::vector<Entry>& heap)
+    {
+        std::pop_heap(std::begin(heap), std::end(heap), compare);
+        auto const entry = heap.back();
+        heap.pop_back();
+        return entry;
+    }
+
+    std::vector<Entry> waiting_;
+    std::vector<Entry> ready_;
+};
+
+CandidateQueue::CandidateQueue()
+    : impl_{ std::make_unique<Impl>() }
+{
+}
+
+CandidateQueue::~CandidateQueue() = default;
+
+void CandidateQueue::queue(peer_atom* atom)
+{
+    impl_->queue(atom);
+}
+
+void CandidateQueue::rebuild(AtomPool const& pool)
+{
+    impl_->rebuild(pool);
+}
+
+peer_atom* CandidateQueue::next(SwarmInfo const& swarm_info, time_t now, uint64_t* setme_score)
+{
+    return impl_->next(swarm_info, now, setme_score);
+}
+
+void CandidateQueue::pop(peer_atom const* atom)
+{
+    impl_->pop(atom);
+}
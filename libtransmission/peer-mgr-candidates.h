@@ -0,0 +1,73 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <cstdint> // uint8_t, uint64_t
+#include <ctime> // time_t
+#include <memory>
+
+class AtomPool;
+struct peer_atom;
+
+/**
+ * The atoms in a swarm that we might make new connections to.
+ *
+ * Rather than looking at every atom each time we want to make new
+ * connections, an atom is queued when it's discovered or when we stop
+ * using it. It waits in one of two min-heaps until it reaches the
+ * front, and only then is it checked in full by next(): the waiting
+ * atoms are keyed by when their reconnect interval is up, and the
+ * ready ones by their candidate score. Atoms that fail the check are
+ * dropped until the next time they're queued.
+ *
+ * Changes that aren't signalled per atom, such as a blocklist change
+ * or a torrent starting, are picked up by rebuild().
+ */
+class CandidateQueue
+{
+public:
+    struct SwarmInfo
+    {
+        // how long to wait after `atom->time` before trying `atom` again
+        virtual int reconnectIntervalSecs(peer_atom const* atom, time_t now) const = 0;
+
+        // true if we'd want to connect to `atom` now
+        virtual bool isCandidate(peer_atom* atom, time_t now) const = 0;
+
+        // smaller is better. `salt` goes in the low 8 bits to break ties.
+        virtual uint64_t score(peer_atom const* atom, uint8_t salt) const = 0;
+
+        virtual ~SwarmInfo() = default;
+    };
+
+    CandidateQueue();
+    ~CandidateQueue();
+
+    // queue `atom` unless it's already queued
+    void queue(peer_atom* atom);
+
+    // forget what's queued and queue every atom in `pool`
+    void rebuild(AtomPool const& pool);
+
+    // return the best candidate, which stays at the front of the queue
+    // until it's popped, or nullptr if there's none
+    [[nodiscard]] peer_atom* next(SwarmInfo const& swarm_info, time_t now, uint64_t* setme_score);
+
+    // take the candidate returned by next() off the queue.
+    // it's queued again when we're done with it.
+    void pop(peer_atom const* atom);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> const impl_;
+};
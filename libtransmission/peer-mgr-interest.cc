@@ -0,0 +1,163 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <memory>
+#include <unordered_map>
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "peer-mgr-interest.h"
+#include "tr-assert.h"
+
+class PeerInterest::Impl
+{
+public:
+    size_t count(ClientInfo const& client_info, tr_peer const* peer)
+    {
+        auto const n_pieces = client_info.countAllPieces();
+
+        if (needs_rebuild_ || std::size(wanted_) != n_pieces)
+        {
+            rebuild(client_info, n_pieces);
+        }
+
+        if (auto const it = counts_.find(peer); it != std::end(counts_))
+        {
+            return it->second;
+        }
+
+        auto const n = recount(peer->have);
+        n_interesting_ += n > 0 ? 1 : 0;
+        return counts_[peer] = n;
+    }
+
+    [[nodiscard]] bool isNobodyInteresting(size_t n_peers) const
+    {
+        return !needs_rebuild_ && std::size(counts_) == n_peers && n_interesting_ == 0;
+    }
+
+    void peerGotPiece(tr_peer const* peer, tr_piece_index_t piece)
+    {
+        if (auto const it = counts_.find(peer); it != std::end(counts_) && isWanted(piece))
+        {
+            n_interesting_ += it->second++ == 0 ? 1 : 0;
+        }
+    }
+
+    void forget(tr_peer const* peer)
+    {
+        if (auto const it = counts_.find(peer); it != std::end(counts_))
+        {
+            n_interesting_ -= it->second > 0 ? 1 : 0;
+            counts_.erase(it);
+        }
+    }
+
+    void clientGotPiece(tr_piece_index_t piece)
+    {
+        if (!isWanted(piece))
+        {
+            return;
+        }
+
+        wanted_.unset(piece);
+
+        for (auto& [peer, count] : counts_)
+        {
+            if (peer->have.test(piece))
+            {
+                TR_ASSERT(count > 0);
+                n_interesting_ -= --count == 0 ? 1 : 0;
+            }
+        }
+    }
+
+    void reset()
+    {
+        needs_rebuild_ = true;
+        counts_.clear();
+        n_interesting_ = 0;
+    }
+
+private:
+    [[nodiscard]] bool isWanted(tr_piece_index_t piece) const
+    {
+        return !needs_rebuild_ && piece < std::size(wanted_) && wanted_.test(piece);
+    }
+
+    void rebuild(ClientInfo const& client_info, tr_piece_index_t n_pieces)
+    {
+        auto flags = std::make_unique<bool[]>(n_pieces);
+        for (tr_piece_index_t piece = 0; piece < n_pieces; ++piece)
+        {
+            flags[piece] = client_info.clientWantsPiece(piece);
+        }
+
+        wanted_ = tr_bitfield{ n_pieces };
+        wanted_.setFromBools(flags.get(), n_pieces);
+
+        counts_.clear();
+        n_interesting_ = 0;
+        needs_rebuild_ = false;
+    }
+
+    [[nodiscard]] size_t recount(tr_bitfield const& have) const
+    {
+        return wanted_.countIntersection(have);
+    }
+
+    // the pieces we want and don't have
+    tr_bitfield wanted_{ 0 };
+
+    // how many of those pieces each peer has
+    std::unordered_map<tr_peer const*, size_t> counts_;
+
+    // how many of those counts are nonzero
+    size_t n_interesting_ = 0;
+
+    bool needs_rebuild_ = true;
+};
+
+PeerInterest::PeerInterest()
+    : impl_{ std::make_unique<Impl>() }
+{
+}
+
+PeerInterest::~PeerInterest() = default;
+
+size_t PeerInterest::count(ClientInfo const& client_info, tr_peer const* peer)
+{
+    return impl_->count(client_info, peer);
+}
+
+bool PeerInterest::isNobodyInteresting(size_t n_peers) const
+{
+    return impl_->isNobodyInteresting(n_peers);
+}
+
+void PeerInterest::peerGotPiece(tr_peer const* peer, tr_piece_index_t piece)
+{
+    impl_->peerGotPiece(peer, piece);
+}
+
+void PeerInterest::forget(tr_peer const* peer)
+{
+    impl_->forget(peer);
+}
+
+void PeerInterest::clientGotPiece(tr_piece_index_t piece)
+{
+    impl_->clientGotPiece(piece);
+}
+
+void PeerInterest::reset()
+{
+    impl_->reset();
+}
@@ -0,0 +1,66 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <memory>
+
+#include "transmission.h" // tr_piece_index_t
+#include "peer-common.h" // tr_peer*
+
+/**
+ * Keeps count of how many of the pieces we want each peer has, so
+ * that deciding which peers we're interested in doesn't mean checking
+ * every peer's bitfield against every piece. Counts are kept up-to-date
+ * as peers announce pieces and as we complete them, and are recounted
+ * lazily when a peer's bitfield is replaced or after reset().
+ */
+class PeerInterest
+{
+public:
+    struct ClientInfo
+    {
+        // true if we want `piece` and don't have it yet
+        virtual bool clientWantsPiece(tr_piece_index_t piece) const = 0;
+        virtual tr_piece_index_t countAllPieces() const = 0;
+        virtual ~ClientInfo() = default;
+    };
+
+    PeerInterest();
+    ~PeerInterest();
+
+    // return how many of the pieces we want are held by `peer`
+    [[nodiscard]] size_t count(ClientInfo const& client_info, tr_peer const* peer);
+
+    // true if all `n_peers` of the swarm's peers have been counted since
+    // the last reset() and none of them has any of the pieces we want
+    [[nodiscard]] bool isNobodyInteresting(size_t n_peers) const;
+
+    // note that `peer` announced `piece`. Call after updating peer->have.
+    void peerGotPiece(tr_peer const* peer, tr_piece_index_t piece);
+
+    // forget what we know about `peer`, e.g. before its bitfield is
+    // replaced or when it's disconnected. It's recounted on next use.
+    void forget(tr_peer const* peer);
+
+    // note that we completed `piece`, so it's no longer wanted
+    void clientGotPiece(tr_piece_index_t piece);
+
+    // note that any or all of the pieces we want may have changed,
+    // e.g. after a verify or when file priorities change
+    void reset();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> const impl_;
+};
@@ -9,14 +9,16 @@
 #include <algorithm>
 #include <cstddef>
 #include <iterator>
+#include <memory>
 #include <numeric>
+#include <set>
 #include <utility>
 #include <vector>
 
 #define LIBTRANSMISSION_PEER_MODULE
 
 #include "transmission.h"
-#include "crypto-utils.h" // tr_rand_buffer()
+#include "crypto-utils.h" // tr_rand_buffer(), tr_rand_int_weak()
 #include "peer-mgr-wishlist.h"
 
 namespace
@@ -27,12 +29,14 @@ struct Candidate
     tr_piece_index_t piece;
     size_t n_blocks_missing;
     tr_priority_t priority;
+    size_t replication;
     uint8_t salt;
 
-    Candidate(tr_piece_index_t piece_in, size_t missing_in, tr_priority_t priority_in, uint8_t salt_in)
+    Candidate(tr_piece_index_t piece_in, size_t missing_in, tr_priority_t priority_in, size_t replication_in, uint8_t salt_in)
         : piece{ piece_in }
         , n_blocks_missing{ missing_in }
         , priority{ priority_in }
+        , replication{ replication_in }
         , salt{ salt_in }
     {
     }
@@ -51,56 +55,31 @@ struct Candidate
             return priority > that.priority ? -1 : 1;
         }
 
-        if (salt != that.salt)
+        // prefer rarer pieces
+        if (replication != that.replication)
         {
-            return salt < that.salt ? -1 : 1;
+            return replication < that.replication ? -1 : 1;
         }
 
-        return 0;
-    }
-
-    bool operator<(Candidate const& that) const // less than
-    {
-        return compare(that) < 0;
-    }
-};
-
-std::vector<Candidate> getCandidates(Wishlist::PeerInfo const& peer_info)
-{
-    // count up the pieces that we still want
-    auto wanted_pieces = std::vector<std::pair<tr_piece_index_t, size_t>>{};
-    auto const n_pieces = peer_info.countAllPieces();
-    wanted_pieces.reserve(n_pieces);
-    for (tr_piece_index_t i = 0; i < n_pieces; ++i)
-    {
-        if (!peer_info.clientCanRequestPiece(i))
+        if (salt != that.salt)
         {
-            continue;
+            return salt < that.salt ? -1 : 1;
         }
 
-        size_t const n_missing = peer_info.countMissingBlocks(i);
-        if (n_missing == 0)
+        // make the ordering strict so that every piece has its own slot
+        if (piece != that.piece)
         {
-            continue;
+            return piece < that.piece ? -1 : 1;
         }
 
-        wanted_pieces.emplace_back(i, n_missing);
+        return 0;
     }
 
-    // transform them into candidates
-    auto const n = std::size(wanted_pieces);
-    auto saltbuf = std::vector<char>(n);
-    tr_rand_buffer(std::data(saltbuf), n);
-    auto candidates = std::vector<Candidate>{};
-    candidates.reserve(n);
-    for (size_t i = 0; i < n; ++i)
+    bool operator<(Candidate const& that) const // less than
     {
-        auto const [piece, n_missing] = wanted_pieces[i];
-        candidates.emplace_back(piece, n_missing, peer_info.priority(piece), saltbuf[i]);
+        return compare(that) < 0;
     }
-
-    return candidates;
-}
+};
 
 std::vector<tr_block_span_t> makeSpans(tr_block_index_t const* sorted_blocks, size_t n_blocks)
 {
@@ -130,69 +109,191 @@ std::vector<tr_block_span_t> makeSpans(tr_block_index_t const* sorted_blocks, si
 
 } // namespace
 
-std::vector<tr_block_span_t> Wishlist::next(Wishlist::PeerInfo const& peer_info, size_t n_wanted_blocks) const
+class Wishlist::Impl
 {
-    size_t n_blocks = 0;
-    auto spans = std::vector<tr_block_span_t>{};
+public:
+    std::vector<tr_block_span_t> next(PeerInfo const& peer_info, size_t n_wanted_blocks)
+    {
+        size_t n_blocks = 0;
+        auto spans = std::vector<tr_block_span_t>{};
+
+        // sanity clause
+        TR_ASSERT(n_wanted_blocks > 0);
+
+        refresh(peer_info);
+
+        for (auto const& candidate : candidates_)
+        {
+            // do we have enough?
+            if (n_blocks >= n_wanted_blocks)
+            {
+                break;
+            }
+
+            // does this peer have it?
+            if (!peer_info.clientCanRequestPiece(candidate.piece))
+            {
+                continue;
+            }
+
+            // walk the blocks in this piece
+            auto const [begin, end] = peer_info.blockSpan(candidate.piece);
+            auto blocks = std::vector<tr_block_index_t>{};
+            blocks.reserve(end - begin);
+            for (tr_block_index_t block = begin; block < end && n_blocks + std::size(blocks) < n_wanted_blocks; ++block)
+            {
+                // don't request blocks we've already got
+                if (!peer_info.clientCanRequestBlock(block))
+                {
+                    continue;
+                }
+
+                // don't request from too many peers
+                size_t const n_peers = peer_info.countActiveRequests(block);
+                if (size_t const max_peers = peer_info.isEndgame() ? 2 : 1; n_peers >= max_peers)
+                {
+                    continue;
+                }
+
+                blocks.push_back(block);
+            }
+
+            if (std::empty(blocks))
+            {
+                continue;
+            }
 
-    // sanity clause
-    TR_ASSERT(n_wanted_blocks > 0);
+            // copy the spans into `spans`
+            auto const tmp = makeSpans(std::data(blocks), std::size(blocks));
+            std::copy(std::begin(tmp), std::end(tmp), std::back_inserter(spans));
+            n_blocks += std::accumulate(
+                std::begin(tmp),
+                std::end(tmp),
+                size_t{},
+                [](size_t sum, auto span) { return sum + span.end - span.begin; });
+        }
 
-    // We usually won't need all the candidates until endgame, so don't
-    // waste cycles sorting all of them here. partial sort is enough.
-    auto candidates = getCandidates(peer_info);
-    auto constexpr MaxSortedPieces = size_t{ 30 };
-    auto const middle = std::min(std::size(candidates), MaxSortedPieces);
-    std::partial_sort(std::begin(candidates), std::begin(candidates) + middle, std::end(candidates));
+        return spans;
+    }
 
-    for (auto const& candidate : candidates)
+    void pieceChanged(tr_piece_index_t piece)
     {
-        // do we have enough?
-        if (n_blocks >= n_wanted_blocks)
+        if (needs_rebuild_)
+        {
+            return;
+        }
+
+        // if we're not being asked for requests, e.g. when seeding,
+        // don't let the backlog grow past the cost of a rebuild
+        if (std::size(dirty_) >= std::size(by_piece_))
         {
-            break;
+            reset();
+            return;
         }
 
-        // walk the blocks in this piece
-        auto const [begin, end] = peer_info.blockSpan(candidate.piece);
-        auto blocks = std::vector<tr_block_index_t>{};
-        blocks.reserve(end - begin);
-        for (tr_block_index_t block = begin; block < end && n_blocks + std::size(blocks) < n_wanted_blocks; ++block)
+        dirty_.push_back(piece);
+    }
+
+    void reset()
+    {
+        needs_rebuild_ = true;
+        dirty_.clear();
+    }
+
+private:
+    using Candidates = std::set<Candidate>;
+
+    // bring the candidate list up-to-date with any changes since the last call
+    void refresh(PeerInfo const& peer_info)
+    {
+        auto const n_pieces = peer_info.countAllPieces();
+
+        if (needs_rebuild_ || std::size(by_piece_) != n_pieces)
         {
-            // don't request blocks we've already got
-            if (!peer_info.clientCanRequestBlock(block))
+            candidates_.clear();
+            by_piece_.assign(n_pieces, std::end(candidates_));
+            dirty_.clear();
+
+            auto salt = std::vector<uint8_t>(n_pieces);
+            tr_rand_buffer(std::data(salt), std::size(salt));
+            for (tr_piece_index_t piece = 0; piece < n_pieces; ++piece)
             {
-                continue;
+                update(peer_info, piece, salt[piece]);
             }
 
-            // don't request from too many peers
-            size_t const n_peers = peer_info.countActiveRequests(block);
-            if (size_t const max_peers = peer_info.isEndgame() ? 2 : 1; n_peers >= max_peers)
+            needs_rebuild_ = false;
+            return;
+        }
+
+        std::sort(std::begin(dirty_), std::end(dirty_));
+        dirty_.erase(std::unique(std::begin(dirty_), std::end(dirty_)), std::end(dirty_));
+        for (auto const piece : dirty_)
+        {
+            if (piece < n_pieces)
             {
-                continue;
+                auto const it = by_piece_[piece];
+                update(peer_info, piece, it != std::end(candidates_) ? it->salt : uint8_t(tr_rand_int_weak(256)));
             }
+        }
+        dirty_.clear();
+    }
 
-            blocks.push_back(block);
+    void update(PeerInfo const& peer_info, tr_piece_index_t piece, uint8_t salt)
+    {
+        auto& it = by_piece_[piece];
+
+        if (it != std::end(candidates_))
+        {
+            candidates_.erase(it);
+            it = std::end(candidates_);
         }
 
-        if (std::empty(blocks))
+        if (!peer_info.clientWantsPiece(piece))
         {
-            continue;
+            return;
         }
 
-        // copy the spans into `spans`
-        auto const tmp = makeSpans(std::data(blocks), std::size(blocks));
-        std::copy(std::begin(tmp), std::end(tmp), std::back_inserter(spans));
-        n_blocks += std::accumulate(
-            std::begin(tmp),
-            std::end(tmp),
-            size_t{},
-            [](size_t sum, auto span) { return sum + span.end - span.begin; });
-        if (n_blocks >= n_wanted_blocks)
+        size_t const n_missing = peer_info.countMissingBlocks(piece);
+        if (n_missing == 0)
         {
-            break;
+            return;
         }
+
+        auto const priority = peer_info.priority(piece);
+        auto const replication = peer_info.countPeersWithPiece(piece);
+        it = candidates_.emplace(piece, n_missing, priority, replication, salt).first;
     }
 
-    return spans;
+    // the pieces we want, sorted from most-wanted to least-wanted
+    Candidates candidates_;
+
+    // each piece's position in `candidates_`, or end() if it's not there
+    std::vector<Candidates::iterator> by_piece_;
+
+    // pieces that changed since the last refresh()
+    std::vector<tr_piece_index_t> dirty_;
+
+    bool needs_rebuild_ = true;
+};
+
+Wishlist::Wishlist()
+    : impl_{ std::make_unique<Impl>() }
+{
+}
+
+Wishlist::~Wishlist() = default;
+
+std::vector<tr_block_span_t> Wishlist::next(Wishlist::PeerInfo const& peer_info, size_t n_wanted_blocks)
+{
+    return impl_->next(peer_info, n_wanted_blocks);
+}
+
+void Wishlist::pieceChanged(tr_piece_index_t piece)
+{
+    impl_->pieceChanged(piece);
+}
+
+void Wishlist::reset()
+{
+    impl_->reset();
 }
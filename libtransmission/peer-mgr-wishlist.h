@@ -12,28 +12,58 @@
 #error only the libtransmission peer module should #include this header.
 #endif
 
+#include <memory>
+#include <vector>
+
 #include "transmission.h"
 #include "torrent.h"
 
 /**
  * Figures out what blocks we want to request next.
+ *
+ * The wishlist keeps a long-lived, sorted list of the pieces that we
+ * still want so that it doesn't need to rebuild and sort every piece
+ * in the torrent each time a peer asks for more requests. The owner
+ * must call pieceChanged() or reset() when a piece's missing-block
+ * count, priority, or replication may have changed.
  */
 class Wishlist
 {
 public:
     struct PeerInfo
     {
+        // these depend on the peer
         virtual bool clientCanRequestBlock(tr_block_index_t block) const = 0;
         virtual bool clientCanRequestPiece(tr_piece_index_t piece) const = 0;
+
+        // these must not depend on the peer: their results are cached
+        // by the wishlist until pieceChanged() or reset() is called
+        virtual bool clientWantsPiece(tr_piece_index_t piece) const = 0;
+        virtual size_t countMissingBlocks(tr_piece_index_t piece) const = 0;
+        virtual tr_priority_t priority(tr_piece_index_t) const = 0;
+        virtual size_t countPeersWithPiece(tr_piece_index_t) const = 0;
+
         virtual bool isEndgame() const = 0;
         virtual size_t countActiveRequests(tr_block_index_t block) const = 0;
-        virtual size_t countMissingBlocks(tr_piece_index_t piece) const = 0;
         virtual tr_block_span_t blockSpan(tr_piece_index_t) const = 0;
         virtual tr_piece_index_t countAllPieces() const = 0;
-        virtual tr_priority_t priority(tr_piece_index_t) const = 0;
         virtual ~PeerInfo() = default;
     };
 
+    Wishlist();
+    ~Wishlist();
+
     // get a list of the next blocks that we should request from a peer
-    std::vector<tr_block_span_t> next(PeerInfo const& peer_info, size_t n_wanted_blocks) const;
+    std::vector<tr_block_span_t> next(PeerInfo const& peer_info, size_t n_wanted_blocks);
+
+    // note that a piece's missing blocks, priority, or replication changed
+    void pieceChanged(tr_piece_index_t piece);
+
+    // note that any or all pieces may have changed, e.g. after a verify
+    // or when file priorities change. The list is rebuilt on next use.
+    void reset();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> const impl_;
 };
@@ -13,6 +13,7 @@
 #include <cstring> /* memcpy, memcmp, strstr */
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -37,6 +38,9 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-mgr-active-requests.h"
+#include "peer-mgr-atom-pool.h"
+#include "peer-mgr-candidates.h"
+#include "peer-mgr-interest.h"
 #include "peer-mgr-wishlist.h"
 #include "peer-msgs.h"
 #include "ptrarray.h"
@@ -58,8 +62,15 @@ static auto constexpr RechokePeriodMsec = int{ 10 * 1000 };
 // for this many calls to rechokeUploads().
 static auto constexpr OptimisticUnchokeMultiplier = int{ 4 };
 
-// how frequently to reallocate bandwidth
-static auto constexpr BandwidthPeriodMsec = int{ 500 };
+// how frequently to reallocate bandwidth. When we're busy, the pulse
+// tightens so that each period's allocation -- and so each burst of
+// reads and writes -- stays around BandwidthBytesPerPulse.
+static auto constexpr BandwidthMinPeriodMsec = int{ 50 };
+static auto constexpr BandwidthMaxPeriodMsec = int{ 500 };
+static auto constexpr BandwidthBytesPerPulse = uint64_t{ 256 * 1024 };
+
+// how frequently to do torrent upkeep in the bandwidth pulse
+static auto constexpr BandwidthUpkeepPeriodMsec = int{ 500 };
 
 // how frequently to age out old piece request lists
 static auto constexpr RefillUpkeepPeriodMsec = int{ 10 * 1000 };
@@ -91,48 +102,12 @@ static auto constexpr MyflagUnreachable = int{ 2 };
 // the minimum we'll wait before attempting to reconnect to a peer
 static auto constexpr MinimumReconnectIntervalSecs = int{ 5 };
 
-// how long we'll let requests we've made linger before we cancel them
-static auto constexpr RequestTtlSecs = int{ 90 };
-
 static auto constexpr CancelHistorySec = int{ 60 };
 
 /**
 ***
 **/
 
-/**
- * Peer information that should be kept even before we've connected and
- * after we've disconnected. These are kept in a pool of peer_atoms to decide
- * which ones would make good candidates for connecting to, and to watch out
- * for banned peers.
- *
- * @see tr_peer
- * @see tr_peerMsgs
- */
-struct peer_atom
-{
-    uint8_t fromFirst; /* where the peer was first found */
-    uint8_t fromBest; /* the "best" value of where the peer has been found */
-    uint8_t flags; /* these match the added_f flags */
-    uint8_t flags2; /* flags that aren't defined in added_f */
-    int8_t blocklisted; /* -1 for unknown, true for blocklisted, false for not blocklisted */
-
-    tr_port port;
-    bool utp_failed; /* We recently failed to connect over uTP */
-    uint16_t numFails;
-    time_t time; /* when the peer's connection status last changed */
-    time_t piece_data_time;
-
-    time_t lastConnectionAttemptAt;
-    time_t lastConnectionAt;
-
-    /* similar to a TTL field, but less rigid --
-     * if the swarm is small, the atom will be kept past this date. */
-    time_t shelf_date;
-    tr_peer* peer; /* will be nullptr if not connected */
-    tr_address addr;
-};
-
 #ifndef TR_ENABLE_ASSERTS
 
 #define tr_isAtom(a) (true)
@@ -167,13 +142,15 @@ public:
     tr_swarm_stats stats = {};
 
     tr_ptrArray outgoingHandshakes = {}; /* tr_handshake */
-    tr_ptrArray pool = {}; /* struct peer_atom */
+    AtomPool pool;
     tr_ptrArray peers = {}; /* tr_peerMsgs */
     tr_ptrArray webseeds = {}; /* tr_webseed */
 
     tr_peerMgr* const manager;
     tr_torrent* const tor;
 
+    CandidateQueue candidates;
+
     tr_peerMsgs* optimistic = nullptr; /* the optimistic peer, or nullptr if none */
     int optimisticUnchokeTimeScaler = 0;
 
@@ -184,13 +161,72 @@ public:
     bool endgame = false;
 
     ActiveRequests active_requests;
+    PeerInterest interest;
     Wishlist wishlist;
 
+    // how many connected peers have each piece, not counting seeds.
+    // kept up-to-date as peers announce pieces or disconnect.
+    std::vector<uint16_t> piece_replication;
+
+    // how many connected peers have every piece. These are kept apart
+    // from piece_replication so that seeds coming and going doesn't
+    // change the pieces' relative rarity or churn the wishlist.
+    size_t have_all_count = 0;
+
     int interestedCount = 0;
     int maxPeers = 0;
     time_t lastCancel = 0;
 };
 
+enum tr_rechoke_state
+{
+    RECHOKE_STATE_GOOD,
+    RECHOKE_STATE_UNTESTED,
+    RECHOKE_STATE_BAD
+};
+
+struct tr_rechoke_info
+{
+    tr_peerMsgs* peer;
+    int salt;
+    int rechoke_state;
+
+    bool operator<(tr_rechoke_info const& that) const
+    {
+        if (rechoke_state != that.rechoke_state)
+        {
+            return rechoke_state < that.rechoke_state;
+        }
+
+        return salt < that.salt;
+    }
+};
+
+struct ChokeData
+{
+    bool isInterested;
+    bool wasChoked;
+    bool isChoked;
+    int rate;
+    int salt;
+    tr_peerMsgs* msgs;
+
+    bool operator<(ChokeData const& that) const
+    {
+        if (rate != that.rate) /* prefer higher overall speeds */
+        {
+            return rate > that.rate;
+        }
+
+        if (wasChoked != that.wasChoked) /* prefer unchoked */
+        {
+            return !wasChoked;
+        }
+
+        return salt < that.salt; /* random order */
+    }
+};
+
 struct tr_peerMgr
 {
     auto unique_lock() const
@@ -204,6 +240,12 @@ struct tr_peerMgr
     struct event* rechokeTimer;
     struct event* refillUpkeepTimer;
     struct event* atomTimer;
+    uint64_t bandwidthUpkeepAt; /* msec */
+
+    // scratch space for rechokeDownloads() and rechokeUploads(),
+    // kept between calls so that rechoking doesn't allocate
+    std::vector<tr_rechoke_info> rechoke;
+    std::vector<ChokeData> choke;
 };
 
 #define tordbg(t, ...) tr_logAddDeepNamed(tr_torrentName((t)->tor), __VA_ARGS__)
@@ -235,6 +277,7 @@ tr_peer::~tr_peer()
     if (swarm != nullptr)
     {
         swarm->active_requests.remove(this);
+        swarm->interest.forget(this);
     }
 
     if (atom != nullptr)
@@ -271,23 +314,6 @@ static inline tr_handshake* getExistingHandshake(tr_ptrArray* handshakes, tr_add
     return static_cast<tr_handshake*>(tr_ptrArrayFindSorted(handshakes, addr, handshakeCompareToAddr));
 }
 
-static int comparePeerAtomToAddress(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct peer_atom const*>(va);
-    auto const* const b = static_cast<tr_address const*>(vb);
-
-    return tr_address_compare(&a->addr, b);
-}
-
-static int compareAtomsByAddress(void const* va, void const* vb)
-{
-    auto const* const b = static_cast<struct peer_atom const*>(vb);
-
-    TR_ASSERT(tr_isAtom(b));
-
-    return comparePeerAtomToAddress(va, &b->addr);
-}
-
 /**
 ***
 **/
@@ -311,10 +337,9 @@ static int peerCompare(void const* va, void const* vb)
     return tr_address_compare(tr_peerAddress(a), tr_peerAddress(b));
 }
 
-static struct peer_atom* getExistingAtom(tr_swarm const* cswarm, tr_address const* addr)
+static struct peer_atom* getExistingAtom(tr_swarm const* swarm, tr_address const* addr)
 {
-    auto* swarm = const_cast<tr_swarm*>(cswarm);
-    return static_cast<struct peer_atom*>(tr_ptrArrayFindSorted(&swarm->pool, addr, comparePeerAtomToAddress));
+    return swarm->pool.find(addr);
 }
 
 static bool peerIsInUse(tr_swarm const* cs, struct peer_atom const* atom)
@@ -326,6 +351,10 @@ static bool peerIsInUse(tr_swarm const* cs, struct peer_atom const* atom)
         getExistingHandshake(&s->manager->incomingHandshakes, &atom->addr) != nullptr;
 }
 
+/**
+***
+**/
+
 static void swarmFree(void* vs)
 {
     auto* s = static_cast<tr_swarm*>(vs);
@@ -337,7 +366,7 @@ static void swarmFree(void* vs)
     TR_ASSERT(tr_ptrArrayEmpty(&s->peers));
 
     tr_ptrArrayDestruct(&s->webseeds, [](void* peer) { delete static_cast<tr_peer*>(peer); });
-    tr_ptrArrayDestruct(&s->pool, (PtrArrayForeachFunc)tr_free);
+    s->pool.clear();
     tr_ptrArrayDestruct(&s->outgoingHandshakes, nullptr);
     tr_ptrArrayDestruct(&s->peers, nullptr);
     s->stats = {};
@@ -364,11 +393,14 @@ static void rebuildWebseedArray(tr_swarm* s, tr_torrent* tor)
     }
 }
 
+static void rebuildPieceReplication(tr_swarm* s);
+
 static tr_swarm* swarmNew(tr_peerMgr* manager, tr_torrent* tor)
 {
     auto* swarm = new tr_swarm{ manager, tor };
 
     rebuildWebseedArray(swarm, tor);
+    rebuildPieceReplication(swarm);
 
     return swarm;
 }
@@ -377,7 +409,7 @@ static void ensureMgrTimersExist(struct tr_peerMgr* m);
 
 tr_peerMgr* tr_peerMgrNew(tr_session* session)
 {
-    tr_peerMgr* m = tr_new0(tr_peerMgr, 1);
+    auto* const m = new tr_peerMgr{};
     m->session = session;
     m->incomingHandshakes = {};
     ensureMgrTimersExist(m);
@@ -416,7 +448,7 @@ void tr_peerMgrFree(tr_peerMgr* manager)
 
     tr_ptrArrayDestruct(&manager->incomingHandshakes, nullptr);
 
-    tr_free(manager);
+    delete manager;
 }
 
 /***
@@ -431,11 +463,13 @@ void tr_peerMgrOnBlocklistChanged(tr_peerMgr* mgr)
     {
         tr_swarm* s = tor->swarm;
 
-        for (int i = 0, n = tr_ptrArraySize(&s->pool); i < n; ++i)
+        for (auto* const atom : s->pool)
         {
-            auto* const atom = static_cast<struct peer_atom*>(tr_ptrArrayNth(&s->pool, i));
             atom->blocklisted = -1;
         }
+
+        // atoms that were blocklisted may be candidates again
+        s->candidates.rebuild(s->pool);
     }
 }
 
@@ -499,6 +533,90 @@ void tr_peerMgrSetUtpFailed(tr_torrent* tor, tr_address const* addr, bool failed
     }
 }
 
+/**
+***  PIECE REPLICATION
+***
+*** tr_swarm::piece_replication counts how many connected peers have each
+*** piece. It is updated incrementally from the peers' HAVE, HAVE_ALL,
+*** HAVE_NONE, and BITFIELD messages and when peers are removed, so that
+*** rarest-first piece selection and the availability stats don't need
+*** to walk every peer's bitfield. Any piece whose count changes relative
+*** to the others is passed along to the wishlist.
+**/
+
+static void updatePieceReplication(tr_swarm* s, tr_bitfield const& have, int delta)
+{
+    auto& replication = s->piece_replication;
+
+    if (have.hasNone())
+    {
+        return;
+    }
+
+    if (have.hasAll())
+    {
+        TR_ASSERT(delta > 0 || s->have_all_count > 0);
+        s->have_all_count += delta;
+        return;
+    }
+
+    for (size_t i = 0, n = std::size(replication); i < n; ++i)
+    {
+        if (have.test(i))
+        {
+            TR_ASSERT(delta > 0 || replication[i] > 0);
+            replication[i] += delta;
+            s->wishlist.pieceChanged(i);
+        }
+    }
+}
+
+static void onPeerGotPiece(tr_swarm* s, tr_peer const* peer, tr_piece_index_t piece)
+{
+    auto& replication = s->piece_replication;
+
+    if (piece >= std::size(replication))
+    {
+        return;
+    }
+
+    ++replication[piece];
+    s->wishlist.pieceChanged(piece);
+
+    // if that was their last missing piece, move them to have_all_count
+    if (peer->have.hasAll())
+    {
+        for (size_t i = 0, n = std::size(replication); i < n; ++i)
+        {
+            TR_ASSERT(replication[i] > 0);
+            --replication[i];
+            s->wishlist.pieceChanged(i);
+        }
+
+        ++s->have_all_count;
+    }
+}
+
+static void rebuildPieceReplication(tr_swarm* s)
+{
+    s->piece_replication.assign(s->tor->info.pieceCount, 0);
+    s->have_all_count = 0;
+
+    for (int i = 0, n = tr_ptrArraySize(&s->peers); i < n; ++i)
+    {
+        updatePieceReplication(s, static_cast<tr_peer const*>(tr_ptrArrayNth(&s->peers, i))->have, 1);
+    }
+
+    s->interest.reset();
+    s->wishlist.reset();
+}
+
+static size_t countPeersWithPiece(tr_swarm const* s, tr_piece_index_t piece)
+{
+    auto const n = piece < std::size(s->piece_replication) ? s->piece_replication[piece] : 0;
+    return n + s->have_all_count;
+}
+
 /**
 ***  REQUESTS
 ***
@@ -541,7 +659,7 @@ static int countActiveWebseeds(tr_swarm* s)
 // TODO: if we keep this, add equivalent API to ActiveRequest
 void tr_peerMgrClientSentRequests(tr_torrent* torrent, tr_peer* peer, tr_block_span_t span)
 {
-    auto const now = tr_time();
+    auto const now = tr_time_msec();
 
     for (tr_block_index_t block = span.begin; block < span.end; ++block)
     {
@@ -580,6 +698,11 @@ std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(tr_torrent* torrent, tr_p
             return torrent_->pieceIsWanted(piece) && peer_->have.test(piece);
         }
 
+        bool clientWantsPiece(tr_piece_index_t piece) const override
+        {
+            return torrent_->pieceIsWanted(piece) && !torrent_->isPieceBeingChecked(piece);
+        }
+
         bool isEndgame() const override
         {
             return swarm_->endgame;
@@ -610,6 +733,11 @@ std::vector<tr_block_span_t> tr_peerMgrGetNextRequests(tr_torrent* torrent, tr_p
             return torrent_->piecePriority(piece);
         }
 
+        size_t countPeersWithPiece(tr_piece_index_t piece) const override
+        {
+            return ::countPeersWithPiece(swarm_, piece);
+        }
+
     private:
         tr_torrent const* const torrent_;
         tr_swarm const* const swarm_;
@@ -657,13 +785,18 @@ static void cancelAllRequestsForBlock(tr_swarm* swarm, tr_block_index_t block, t
 
 static void tr_swarmCancelOldRequests(tr_swarm* swarm)
 {
-    auto const now = tr_time();
-    auto const oldest = now - RequestTtlSecs;
+    auto& requests = swarm->active_requests;
+    auto const now = tr_time_msec();
+    auto const oldest = now - RequestPipeline::MinTimeoutMsec;
 
-    for (auto const& [block, peer] : swarm->active_requests.sentBefore(oldest))
+    // each peer's requests time out after however long that peer usually takes to answer
+    for (auto const& [block, peer] : requests.sentBefore(oldest))
     {
-        maybeSendCancelRequest(peer, block, nullptr);
-        swarm->active_requests.remove(block, peer);
+        if (auto const sent_at = requests.sentAt(block, peer); sent_at && *sent_at + peer->pipeline.requestTimeoutMsec() <= now)
+        {
+            maybeSendCancelRequest(peer, block, nullptr);
+            requests.remove(block, peer);
+        }
     }
 }
 
@@ -768,6 +901,8 @@ void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t p)
 
     /* bookkeeping */
     s->needsCompletenessCheck = true;
+    s->interest.clientGotPiece(p);
+    s->wishlist.pieceChanged(p);
 }
 
 static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
@@ -817,11 +952,32 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
         }
 
     case TR_PEER_CLIENT_GOT_HAVE:
+        onPeerGotPiece(s, peer, e->pieceIndex);
+        s->interest.peerGotPiece(peer, e->pieceIndex);
+        break;
+
+    /* these replace the peer's `have' bitfield wholesale.
+       they're published before peer->have is changed,
+       so we can still subtract the old one here */
     case TR_PEER_CLIENT_GOT_HAVE_ALL:
+        {
+            auto have_all = tr_bitfield{ std::size(s->piece_replication) };
+            have_all.setHasAll();
+            updatePieceReplication(s, peer->have, -1);
+            updatePieceReplication(s, have_all, 1);
+            s->interest.forget(peer);
+            break;
+        }
+
     case TR_PEER_CLIENT_GOT_HAVE_NONE:
+        updatePieceReplication(s, peer->have, -1);
+        s->interest.forget(peer);
+        break;
+
     case TR_PEER_CLIENT_GOT_BITFIELD:
-        /* TODO: if we don't need these, should these events be removed? */
-        /* noop */
+        updatePieceReplication(s, peer->have, -1);
+        updatePieceReplication(s, *e->bitfield, 1);
+        s->interest.forget(peer);
         break;
 
     case TR_PEER_CLIENT_GOT_REJ:
@@ -853,9 +1009,19 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
             tr_torrent* tor = s->tor;
             tr_piece_index_t const p = e->pieceIndex;
             tr_block_index_t const block = tor->blockOf(p, e->offset);
+
+            if (auto const sent_at = s->active_requests.sentAt(block, peer); sent_at)
+            {
+                auto const now = tr_time_msec();
+                auto const queued_bytes = uint64_t{ s->active_requests.count(peer) - 1 } * tor->block_size;
+                auto const rate_Bps = tr_peerGetPieceSpeed_Bps(peer, now, TR_PEER_TO_CLIENT);
+                peer->pipeline.gotBlock(now, now - std::min(now, *sent_at), queued_bytes, rate_Bps);
+            }
+
             cancelAllRequestsForBlock(s, block, peer);
             peer->blocksSentToClient.add(tr_time(), 1);
             tr_torrentGotBlock(tor, block);
+            s->wishlist.pieceChanged(p);
             break;
         }
 
@@ -928,15 +1094,13 @@ static struct peer_atom* ensureAtomExists(
     if (a == nullptr)
     {
         int const jitter = tr_rand_int_weak(60 * 10);
-        a = tr_new0(struct peer_atom, 1);
-        a->addr = *addr;
+        a = s->pool.emplace(addr);
         a->port = port;
         a->flags = flags;
         a->fromFirst = from;
         a->fromBest = from;
         a->shelf_date = tr_time() + getDefaultShelfLife(from) + jitter;
         a->blocklisted = -1;
-        tr_ptrArrayInsertSorted(&s->pool, a, compareAtomsByAddress);
 
         tordbg(s, "got a new atom: %s", tr_atomAddrStr(a));
     }
@@ -950,6 +1114,11 @@ static struct peer_atom* ensureAtomExists(
         a->flags |= flags;
     }
 
+    if (a->peer == nullptr)
+    {
+        s->candidates.queue(a);
+    }
+
     s->poolIsAllSeedsDirty = true;
 
     return a;
@@ -965,19 +1134,13 @@ static int getPeerCount(tr_swarm const* s)
     return tr_ptrArraySize(&s->peers);
 }
 
-static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_atom* atom, tr_quark client)
+static void addPeer(tr_swarm* swarm, tr_peerMsgs* peer)
 {
-    TR_ASSERT(atom != nullptr);
-    TR_ASSERT(tr_isTorrent(tor));
-    TR_ASSERT(tor->swarm != nullptr);
-
-    tr_swarm* swarm = tor->swarm;
-
-    auto* peer = tr_peerMsgsNew(tor, atom, io, peerCallbackFunc, swarm);
-    peer->client = client;
+    auto* const atom = peer->atom;
     atom->peer = peer;
 
     tr_ptrArrayInsertSorted(&swarm->peers, peer, peerCompare);
+    updatePieceReplication(swarm, peer->have, 1);
     ++swarm->stats.peerCount;
     ++swarm->stats.peerFromCount[atom->fromFirst];
 
@@ -990,6 +1153,38 @@ static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_ato
     peer->update_active(TR_DOWN);
 }
 
+static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_atom* atom, tr_quark client)
+{
+    TR_ASSERT(atom != nullptr);
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tor->swarm != nullptr);
+
+    auto* peer = tr_peerMsgsNew(tor, atom, io, peerCallbackFunc, tor->swarm);
+    peer->client = client;
+    addPeer(tor->swarm, peer);
+}
+
+tr_peerMsgs* tr_peerMgrAddPeer(
+    tr_torrent* tor,
+    tr_address const* addr,
+    tr_port port,
+    tr_peerMsgs* (*make_peer)(tr_torrent* tor, peer_atom* atom, void* user_data),
+    void* user_data)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tor->swarm != nullptr);
+
+    auto* const s = tor->swarm;
+    auto const lock = s->manager->unique_lock();
+
+    auto* const atom = ensureAtomExists(s, addr, port, 0, TR_PEER_FROM_INCOMING);
+    atom->time = tr_time();
+
+    auto* const peer = make_peer(tor, atom, user_data);
+    addPeer(s, peer);
+    return peer;
+}
+
 /* FIXME: this is kind of a mess. */
 static bool on_handshake_done(tr_handshake_result const& result)
 {
@@ -1029,6 +1224,8 @@ static bool on_handshake_done(tr_handshake_result const& result)
                     tordbg(s, "marking peer %s as unreachable... numFails is %d", tr_atomAddrStr(atom), (int)atom->numFails);
                     atom->flags2 |= MyflagUnreachable;
                 }
+
+                s->candidates.queue(atom);
             }
         }
     }
@@ -1148,11 +1345,9 @@ void tr_peerMgrSetSwarmIsAllSeeds(tr_torrent* tor)
     auto const lock = tor->unique_lock();
 
     tr_swarm* const swarm = tor->swarm;
-    auto atomCount = int{};
-    struct peer_atom** atoms = (struct peer_atom**)tr_ptrArrayPeek(&swarm->pool, &atomCount);
-    for (int i = 0; i < atomCount; ++i)
+    for (auto* const atom : swarm->pool)
     {
-        atomSetSeed(swarm, atoms[i]);
+        atomSetSeed(swarm, atom);
     }
 
     swarm->poolIsAllSeeds = true;
@@ -1263,6 +1458,7 @@ void tr_peerMgrGotBadPiece(tr_torrent* tor, tr_piece_index_t pieceIndex)
     }
 
     tr_announcerAddBytes(tor, TR_ANN_CORRUPT, byteCount);
+    s->wishlist.pieceChanged(pieceIndex);
 }
 
 int tr_pexCompare(void const* va, void const* vb)
@@ -1371,15 +1567,13 @@ int tr_peerMgrGetPeers(tr_torrent const* tor, tr_pex** setme_pex, uint8_t af, ui
     }
     else /* TR_PEERS_INTERESTING */
     {
-        struct peer_atom** atomBase = (struct peer_atom**)tr_ptrArrayBase(&s->pool);
-        int const n = tr_ptrArraySize(&s->pool);
-        atoms = tr_new(struct peer_atom*, n);
+        atoms = tr_new(struct peer_atom*, std::size(s->pool));
 
-        for (int i = 0; i < n; ++i)
+        for (auto* const atom : s->pool)
         {
-            if (isAtomInteresting(tor, atomBase[i]))
+            if (isAtomInteresting(tor, atom))
             {
-                atoms[atomCount++] = atomBase[i];
+                atoms[atomCount++] = atom;
             }
         }
     }
@@ -1442,7 +1636,7 @@ static void ensureMgrTimersExist(struct tr_peerMgr* m)
 
     if (m->bandwidthTimer == nullptr)
     {
-        m->bandwidthTimer = createTimer(m->session, BandwidthPeriodMsec, bandwidthPulse, m);
+        m->bandwidthTimer = createTimer(m->session, BandwidthMaxPeriodMsec, bandwidthPulse, m);
     }
 
     if (m->rechokeTimer == nullptr)
@@ -1467,6 +1661,11 @@ void tr_peerMgrStartTorrent(tr_torrent* tor)
 
     s->isRunning = true;
     s->maxPeers = tor->maxConnectedPeers;
+    s->candidates.rebuild(s->pool);
+
+    // our pieces may have changed, e.g. if we were just verified
+    s->interest.reset();
+    s->wishlist.reset();
 
     // rechoke soon
     tr_timerAddMsec(s->manager->rechokeTimer, 100);
@@ -1553,6 +1752,9 @@ void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor)
     /* the webseed list may have changed... */
     rebuildWebseedArray(tor->swarm, tor);
 
+    /* we know the piece count now, so we can start counting */
+    rebuildPieceReplication(tor->swarm);
+
     /* some peer_msgs' progress fields may not be accurate if we
        didn't have the metadata before now... so refresh them all... */
     int const peerCount = tr_ptrArraySize(&tor->swarm->peers);
@@ -1572,6 +1774,15 @@ void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor)
     }
 }
 
+void tr_peerMgrOnWantedPiecesChanged(tr_torrent* tor)
+{
+    if (tor->swarm != nullptr)
+    {
+        tor->swarm->interest.reset();
+        tor->swarm->wishlist.reset();
+    }
+}
+
 void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned int tabCount)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -1582,8 +1793,6 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
 
     if (tr_torrentHasMetadata(tor))
     {
-        int const peerCount = tr_ptrArraySize(&tor->swarm->peers);
-        tr_peer const** peers = (tr_peer const**)tr_ptrArrayBase(&tor->swarm->peers);
         float const interval = tor->info.pieceCount / (float)tabCount;
         bool const isSeed = tr_torrentGetCompleteness(tor) == TR_SEED;
 
@@ -1595,15 +1804,9 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
             {
                 tab[i] = -1;
             }
-            else if (peerCount != 0)
+            else
             {
-                for (int j = 0; j < peerCount; ++j)
-                {
-                    if (peers[j]->have.test(piece))
-                    {
-                        ++tab[i];
-                    }
-                }
+                tab[i] = static_cast<int8_t>(std::min(countPeersWithPiece(tor->swarm, piece), size_t{ INT8_MAX }));
             }
         }
     }
@@ -1678,23 +1881,10 @@ uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor)
 
     auto desired_available = uint64_t{};
     auto const n_pieces = tor->info.pieceCount;
-    auto have = std::vector<bool>(n_pieces);
-
-    for (size_t i = 0; i < n_peers; ++i)
-    {
-        auto* peer = peers[i];
-        for (size_t j = 0; j < n_pieces; ++j)
-        {
-            if (peer->have.test(j))
-            {
-                have[j] = true;
-            }
-        }
-    }
 
     for (size_t i = 0; i < n_pieces; ++i)
     {
-        if (tor->pieceIsWanted(i) && have.at(i))
+        if (tor->pieceIsWanted(i) && countPeersWithPiece(s, i) > 0)
         {
             desired_available += tor->countMissingBytesInPiece(i);
         }
@@ -1848,62 +2038,43 @@ void tr_peerMgrClearInterest(tr_torrent* tor)
     }
 }
 
-/* does this peer have any pieces that we want? */
-static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_interesting, tr_peer const* const peer)
+class ClientInterestInfo final : public PeerInterest::ClientInfo
 {
-    /* these cases should have already been handled by the calling code... */
-    TR_ASSERT(!tr_torrentIsSeed(tor));
-    TR_ASSERT(tr_torrentIsPieceTransferAllowed(tor, TR_PEER_TO_CLIENT));
-
-    if (tr_peerIsSeed(peer))
+public:
+    explicit ClientInterestInfo(tr_torrent const* tor)
+        : tor_{ tor }
     {
-        return true;
     }
 
-    for (tr_piece_index_t i = 0; i < tor->info.pieceCount; ++i)
+    bool clientWantsPiece(tr_piece_index_t piece) const override
     {
-        if (piece_is_interesting[i] && peer->have.test(i))
-        {
-            return true;
-        }
+        return tor_->pieceIsWanted(piece) && !tor_->hasPiece(piece);
     }
 
-    return false;
-}
-
-enum tr_rechoke_state
-{
-    RECHOKE_STATE_GOOD,
-    RECHOKE_STATE_UNTESTED,
-    RECHOKE_STATE_BAD
-};
+    tr_piece_index_t countAllPieces() const override
+    {
+        return tor_->info.pieceCount;
+    }
 
-struct tr_rechoke_info
-{
-    tr_peerMsgs* peer;
-    int salt;
-    int rechoke_state;
+private:
+    tr_torrent const* const tor_;
 };
 
-static constexpr int compare_rechoke_info(void const* va, void const* vb)
+/* does this peer have any pieces that we want? */
+static bool isPeerInteresting(tr_swarm* s, ClientInterestInfo const& client_info, tr_peer const* const peer)
 {
-    auto const* const a = static_cast<struct tr_rechoke_info const*>(va);
-    auto const* const b = static_cast<struct tr_rechoke_info const*>(vb);
-
-    if (a->rechoke_state != b->rechoke_state)
-    {
-        return a->rechoke_state - b->rechoke_state;
-    }
+    /* these cases should have already been handled by the calling code... */
+    TR_ASSERT(!tr_torrentIsSeed(s->tor));
+    TR_ASSERT(tr_torrentIsPieceTransferAllowed(s->tor, TR_PEER_TO_CLIENT));
 
-    return a->salt - b->salt;
+    return tr_peerIsSeed(peer) || s->interest.count(client_info, peer) > 0;
 }
 
 /* determines who we send "interested" messages to */
 static void rechokeDownloads(tr_swarm* s)
 {
     int maxPeers = 0;
-    int rechoke_count = 0;
-    struct tr_rechoke_info* rechoke = nullptr;
+    auto& rechoke = s->manager->rechoke;
     auto constexpr MinInterestingPeers = 5;
     int const peerCount = tr_ptrArraySize(&s->peers);
     time_t const now = tr_time();
@@ -1919,6 +2090,13 @@ static void rechokeDownloads(tr_swarm* s)
         return;
     }
 
+    /* we're not interested in anyone and we already know that
+     * none of our peers has anything we want */
+    if (s->interestedCount == 0 && s->interest.isNobodyInteresting(peerCount))
+    {
+        return;
+    }
+
     /* decide HOW MANY peers to be interested in */
     {
         int blocks = 0;
@@ -1990,25 +2168,18 @@ static void rechokeDownloads(tr_swarm* s)
 
     s->maxPeers = maxPeers;
 
+    rechoke.clear();
+
     if (peerCount > 0)
     {
-        tr_torrent const* const tor = s->tor;
-        int const n = tor->info.pieceCount;
-
-        /* build a bitfield of interesting pieces... */
-        bool* const piece_is_interesting = tr_new(bool, n);
-
-        for (int i = 0; i < n; ++i)
-        {
-            piece_is_interesting[i] = tor->pieceIsWanted(i) && !tor->hasPiece(i);
-        }
+        auto const client_info = ClientInterestInfo{ s->tor };
 
         /* decide WHICH peers to be interested in (based on their cancel-to-block ratio) */
         for (int i = 0; i < peerCount; ++i)
         {
             auto* const peer = static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, i));
 
-            if (!isPeerInteresting(s->tor, piece_is_interesting, peer))
+            if (!isPeerInteresting(s, client_info, peer))
             {
                 peer->set_interested(false);
             }
@@ -2039,76 +2210,29 @@ static void rechokeDownloads(tr_swarm* s)
                     rechoke_state = RECHOKE_STATE_BAD;
                 }
 
-                if (rechoke == nullptr)
-                {
-                    rechoke = tr_new(struct tr_rechoke_info, peerCount);
-                }
-
-                rechoke[rechoke_count].peer = peer;
-                rechoke[rechoke_count].rechoke_state = rechoke_state;
-                rechoke[rechoke_count].salt = tr_rand_int_weak(INT_MAX);
-                rechoke_count++;
+                rechoke.push_back({ peer, tr_rand_int_weak(INT_MAX), rechoke_state });
             }
         }
-
-        tr_free(piece_is_interesting);
-    }
-
-    if ((rechoke != nullptr) && (rechoke_count > 0))
-    {
-        qsort(rechoke, rechoke_count, sizeof(struct tr_rechoke_info), compare_rechoke_info);
     }
 
     /* now that we know which & how many peers to be interested in... update the peer interest */
 
-    s->interestedCount = std::min(maxPeers, rechoke_count);
+    s->interestedCount = std::min(maxPeers, int(std::size(rechoke)));
+
+    // we only need to know who makes the cut, not the order they're in
+    auto const cut = std::begin(rechoke) + s->interestedCount;
+    std::nth_element(std::begin(rechoke), cut, std::end(rechoke));
 
-    for (int i = 0; i < rechoke_count; ++i)
+    for (auto it = std::begin(rechoke); it != std::end(rechoke); ++it)
     {
-        rechoke[i].peer->set_interested(i < s->interestedCount);
+        it->peer->set_interested(it < cut);
     }
-
-    /* cleanup */
-    tr_free(rechoke);
 }
 
 /**
 ***
 **/
 
-struct ChokeData
-{
-    bool isInterested;
-    bool wasChoked;
-    bool isChoked;
-    int rate;
-    int salt;
-    tr_peerMsgs* msgs;
-};
-
-static int compareChoke(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct ChokeData const*>(va);
-    auto const* const b = static_cast<struct ChokeData const*>(vb);
-
-    if (a->rate != b->rate) /* prefer higher overall speeds */
-    {
-        return a->rate > b->rate ? -1 : 1;
-    }
-
-    if (a->wasChoked != b->wasChoked) /* prefer unchoked */
-    {
-        return a->wasChoked ? 1 : -1;
-    }
-
-    if (a->salt != b->salt) /* random order */
-    {
-        return a->salt - b->salt;
-    }
-
-    return 0;
-}
-
 /* is this a new connection? */
 static bool isNew(tr_peerMsgs const* msgs)
 {
@@ -2159,7 +2283,7 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
 
     int const peerCount = tr_ptrArraySize(&s->peers);
     tr_peerMsgs** peers = (tr_peerMsgs**)tr_ptrArrayBase(&s->peers);
-    struct ChokeData* choke = tr_new0(struct ChokeData, peerCount);
+    auto& choke = s->manager->choke;
     tr_session const* session = s->manager->session;
     bool const chokeAll = !tr_torrentIsPieceTransferAllowed(s->tor, TR_CLIENT_TO_PEER);
     bool const isMaxedOut = isBandwidthMaxedOut(s->tor->bandwidth, now, TR_UP);
@@ -2175,7 +2299,7 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
         s->optimistic = nullptr;
     }
 
-    int size = 0;
+    choke.clear();
 
     /* sort the peers by preference and rate */
     for (int i = 0; i < peerCount; ++i)
@@ -2195,17 +2319,19 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
         }
         else if (peer != s->optimistic)
         {
-            struct ChokeData* n = &choke[size++];
-            n->msgs = peer;
-            n->isInterested = peer->is_peer_interested();
-            n->wasChoked = peer->is_peer_choked();
-            n->rate = getRate(s->tor, atom, now);
-            n->salt = tr_rand_int_weak(INT_MAX);
-            n->isChoked = true;
+            auto& n = choke.emplace_back();
+            n.msgs = peer;
+            n.isInterested = peer->is_peer_interested();
+            n.wasChoked = peer->is_peer_choked();
+            n.rate = getRate(s->tor, atom, now);
+            n.salt = tr_rand_int_weak(INT_MAX);
+            n.isChoked = true;
         }
     }
 
-    qsort(choke, size, sizeof(struct ChokeData), compareChoke);
+    std::sort(std::begin(choke), std::end(choke));
+
+    int const size = int(std::size(choke));
 
     /**
      * Reciprocation and number of uploads capping is managed by unchoking
@@ -2240,44 +2366,41 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     /* optimistic unchoke */
     if (s->optimistic == nullptr && !isMaxedOut && checkedChokeCount < size)
     {
-        auto randPool = std::vector<ChokeData*>{};
+        // pick an interested peer at random, giving new ones three times the odds
+        auto const weight = [](ChokeData const& c)
+        {
+            return !c.isInterested ? 0 : isNew(c.msgs) ? 3 : 1;
+        };
 
+        auto n = int{};
         for (int i = checkedChokeCount; i < size; ++i)
         {
-            if (choke[i].isInterested)
-            {
-                tr_peerMsgs const* msgs = choke[i].msgs;
-                int const x = isNew(msgs) ? 3 : 1;
-
-                for (int y = 0; y < x; ++y)
-                {
-                    randPool.push_back(&choke[i]);
-                }
-            }
+            n += weight(choke[i]);
         }
 
-        auto const n = std::size(randPool);
         if (n != 0)
         {
-            auto* c = randPool[tr_rand_int_weak(n)];
-            c->isChoked = false;
-            s->optimistic = c->msgs;
+            auto pick = tr_rand_int_weak(n);
+            auto i = checkedChokeCount;
+            while (pick >= weight(choke[i]))
+            {
+                pick -= weight(choke[i++]);
+            }
+
+            choke[i].isChoked = false;
+            s->optimistic = choke[i].msgs;
             s->optimisticUnchokeTimeScaler = OptimisticUnchokeMultiplier;
         }
     }
 
-    for (int i = 0; i < size; ++i)
+    for (auto const& c : choke)
     {
-        choke[i].msgs->set_choke(choke[i].isChoked);
+        c.msgs->set_choke(c.isChoked);
     }
-
-    /* cleanup */
-    tr_free(choke);
 }
 
-static void rechokePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+void tr_peerMgrRechoke(tr_peerMgr* mgr)
 {
-    auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     auto const lock = mgr->unique_lock();
     uint64_t const now = tr_time_msec();
 
@@ -2294,7 +2417,12 @@ static void rechokePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
             }
         }
     }
+}
 
+static void rechokePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+{
+    auto* mgr = static_cast<tr_peerMgr*>(vmgr);
+    tr_peerMgrRechoke(mgr);
     tr_timerAddMsec(mgr->rechokeTimer, RechokePeriodMsec);
 }
 
@@ -2414,8 +2542,10 @@ static void removePeer(tr_peer* peer)
     TR_ASSERT(atom != nullptr);
 
     atom->time = tr_time();
+    s->candidates.queue(atom);
 
     tr_ptrArrayRemoveSortedPointer(&s->peers, peer, peerCompare);
+    updatePieceReplication(s, peer->have, -1);
     --s->stats.peerCount;
     --s->stats.peerFromCount[atom->fromFirst];
 
@@ -2640,17 +2770,45 @@ static void queuePulse(tr_session* session, tr_direction dir)
     }
 }
 
+static int bandwidthPeriodMsec(tr_session const* session, uint64_t now)
+{
+    auto const* const bandwidth = session->bandwidth;
+    uint64_t const speed = std::max(
+        bandwidth->getRawSpeedBytesPerSecond(now, TR_UP),
+        bandwidth->getRawSpeedBytesPerSecond(now, TR_DOWN));
+
+    if (speed == 0)
+    {
+        return BandwidthMaxPeriodMsec;
+    }
+
+    uint64_t const msec = BandwidthBytesPerPulse * 1000U / speed;
+    return int(std::clamp(msec, uint64_t{ BandwidthMinPeriodMsec }, uint64_t{ BandwidthMaxPeriodMsec }));
+}
+
 static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     auto const lock = mgr->unique_lock();
     tr_session* session = mgr->session;
+    uint64_t const now = tr_time_msec();
+    int const period_msec = bandwidthPeriodMsec(session, now);
 
     pumpAllPeers(mgr);
 
     /* allocate bandwidth to the peers */
-    session->bandwidth->allocate(TR_UP, BandwidthPeriodMsec);
-    session->bandwidth->allocate(TR_DOWN, BandwidthPeriodMsec);
+    session->bandwidth->allocate(TR_UP, period_msec);
+    session->bandwidth->allocate(TR_DOWN, period_msec);
+
+    tr_timerAddMsec(mgr->bandwidthTimer, period_msec);
+
+    /* the rest doesn't need to keep up with a busy pulse */
+    if (now < mgr->bandwidthUpkeepAt)
+    {
+        return;
+    }
+
+    mgr->bandwidthUpkeepAt = now + BandwidthUpkeepPeriodMsec;
 
     /* torrent upkeep */
     for (auto* tor : session->torrents)
@@ -2681,64 +2839,31 @@ static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
     queuePulse(session, TR_DOWN);
 
     reconnectPulse(0, 0, mgr);
-
-    tr_timerAddMsec(mgr->bandwidthTimer, BandwidthPeriodMsec);
 }
 
 /***
 ****
 ***/
 
-static int compareAtomPtrsByAddress(void const* va, void const* vb)
-{
-    struct peer_atom const* a = *(struct peer_atom const* const*)va;
-    struct peer_atom const* b = *(struct peer_atom const* const*)vb;
-
-    TR_ASSERT(tr_isAtom(a));
-    TR_ASSERT(tr_isAtom(b));
-
-    return tr_address_compare(&a->addr, &b->addr);
-}
-
 /* best come first, worst go last */
-static int compareAtomPtrsByShelfDate(void const* va, void const* vb)
+static bool isAtomBetterToKeep(peer_atom const* a, peer_atom const* b, time_t now)
 {
-    struct peer_atom const* a = *(struct peer_atom const* const*)va;
-    struct peer_atom const* b = *(struct peer_atom const* const*)vb;
-
     TR_ASSERT(tr_isAtom(a));
     TR_ASSERT(tr_isAtom(b));
 
     int const data_time_cutoff_secs = 60 * 60;
-    time_t const tr_now = tr_time();
 
     /* primary key: the last piece data time *if* it was within the last hour */
-    time_t atime = a->piece_data_time;
-
-    if (atime + data_time_cutoff_secs < tr_now)
-    {
-        atime = 0;
-    }
-
-    time_t btime = b->piece_data_time;
-
-    if (btime + data_time_cutoff_secs < tr_now)
-    {
-        btime = 0;
-    }
+    time_t const atime = a->piece_data_time + data_time_cutoff_secs < now ? 0 : a->piece_data_time;
+    time_t const btime = b->piece_data_time + data_time_cutoff_secs < now ? 0 : b->piece_data_time;
 
     if (atime != btime)
     {
-        return atime > btime ? -1 : 1;
+        return atime > btime;
     }
 
     /* secondary key: shelf date. */
-    if (a->shelf_date != b->shelf_date)
-    {
-        return a->shelf_date > b->shelf_date ? -1 : 1;
-    }
-
-    return 0;
+    return a->shelf_date > b->shelf_date;
 }
 
 static int getMaxAtomCount(tr_torrent const* tor)
@@ -2754,67 +2879,23 @@ static void atomPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
     for (auto* tor : mgr->session->torrents)
     {
         tr_swarm* s = tor->swarm;
-        int const maxAtomCount = getMaxAtomCount(tor);
-        auto atomCount = int{};
-        peer_atom** const atoms = (peer_atom**)tr_ptrArrayPeek(&s->pool, &atomCount);
+        auto const maxAtomCount = size_t(getMaxAtomCount(tor));
+        auto const atomCount = std::size(s->pool);
 
         if (atomCount > maxAtomCount) /* we've got too many atoms... time to prune */
         {
-            int keepCount = 0;
-            int testCount = 0;
-            struct peer_atom** keep = tr_new(struct peer_atom*, atomCount);
-            struct peer_atom** test = tr_new(struct peer_atom*, atomCount);
-
-            /* keep the ones that are in use */
-            for (int i = 0; i < atomCount; ++i)
-            {
-                struct peer_atom* atom = atoms[i];
-
-                if (peerIsInUse(s, atom))
-                {
-                    keep[keepCount++] = atom;
-                }
-                else
-                {
-                    test[testCount++] = atom;
-                }
-            }
-
-            /* if there's room, keep the best of what's left */
-            int i = 0;
-
-            if (keepCount < maxAtomCount)
-            {
-                qsort(test, testCount, sizeof(struct peer_atom*), compareAtomPtrsByShelfDate);
-
-                while (i < testCount && keepCount < maxAtomCount)
-                {
-                    keep[keepCount++] = test[i++];
-                }
-            }
-
-            /* free the culled atoms */
-            while (i < testCount)
-            {
-                tr_free(test[i++]);
-            }
+            auto const now = tr_time();
+            s->pool.prune(
+                maxAtomCount,
+                [s](peer_atom const* atom) { return peerIsInUse(s, atom); },
+                [now](peer_atom const* a, peer_atom const* b) { return isAtomBetterToKeep(a, b, now); });
 
-            /* rebuild Torrent.pool with what's left */
-            tr_ptrArrayDestruct(&s->pool, nullptr);
-            s->pool = {};
-            qsort(keep, keepCount, sizeof(struct peer_atom*), compareAtomPtrsByAddress);
-
-            for (i = 0; i < keepCount; ++i)
-            {
-                tr_ptrArrayAppend(&s->pool, keep[i]);
-            }
-
-            tordbg(s, "max atom count is %d... pruned from %d to %d\n", maxAtomCount, atomCount, keepCount);
-
-            /* cleanup */
-            tr_free(test);
-            tr_free(keep);
+            tordbg(s, "max atom count is %zu... pruned from %zu to %zu\n", maxAtomCount, atomCount, std::size(s->pool));
         }
+
+        // the pruned atoms are gone, and torrent-wide changes may have
+        // made some atoms into candidates that weren't before
+        s->candidates.rebuild(s->pool);
     }
 
     tr_timerAddMsec(mgr->atomTimer, AtomPeriodMsec);
@@ -2942,18 +3023,7 @@ static uint64_t getPeerCandidateScore(tr_torrent const* tor, struct peer_atom co
 
 static bool calculateAllSeeds(tr_swarm* swarm)
 {
-    int nAtoms = 0;
-    struct peer_atom** atoms = (struct peer_atom**)tr_ptrArrayPeek(&swarm->pool, &nAtoms);
-
-    for (int i = 0; i < nAtoms; ++i)
-    {
-        if (!atomIsSeed(atoms[i]))
-        {
-            return false;
-        }
-    }
-
-    return true;
+    return std::all_of(std::begin(swarm->pool), std::end(swarm->pool), atomIsSeed);
 }
 
 static bool swarmIsAllSeeds(tr_swarm* swarm)
@@ -2967,20 +3037,53 @@ static bool swarmIsAllSeeds(tr_swarm* swarm)
     return swarm->poolIsAllSeeds;
 }
 
-/** @return an array of all the atoms we might want to connect to */
-static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t max)
+/** @return the swarm's best candidate, or nullptr if there's none */
+static peer_atom* nextCandidate(tr_torrent* tor, time_t now, uint64_t* setme_score)
+{
+    class SwarmInfoImpl : public CandidateQueue::SwarmInfo
+    {
+    public:
+        explicit SwarmInfoImpl(tr_torrent* torrent_in)
+            : torrent_{ torrent_in }
+        {
+        }
+
+        ~SwarmInfoImpl() override = default;
+
+        int reconnectIntervalSecs(peer_atom const* atom, time_t now) const override
+        {
+            return getReconnectIntervalSecs(atom, now);
+        }
+
+        bool isCandidate(peer_atom* atom, time_t now) const override
+        {
+            return isPeerCandidate(torrent_, atom, now);
+        }
+
+        uint64_t score(peer_atom const* atom, uint8_t salt) const override
+        {
+            return getPeerCandidateScore(torrent_, atom, salt);
+        }
+
+    private:
+        tr_torrent* const torrent_;
+    };
+
+    return tor->swarm->candidates.next(SwarmInfoImpl(tor), now, setme_score);
+}
+
+/** @return the torrents that we might want to make new connections for, with their best candidates */
+static std::vector<peer_candidate> getPeerCandidates(tr_session* session)
 {
     time_t const now = tr_time();
     uint64_t const now_msec = tr_time_msec();
     /* leave 5% of connection slots for incoming connections -- ticket #2609 */
     int const maxCandidates = tr_sessionGetPeerLimit(session) * 0.95;
 
-    /* count how many peers and atoms we've got */
-    int atomCount = 0;
+    /* count how many peers we've got */
     int peerCount = 0;
     for (auto const* tor : session->torrents)
     {
-        atomCount += tr_ptrArraySize(&tor->swarm->pool);
         peerCount += tr_ptrArraySize(&tor->swarm->peers);
     }
 
@@ -2991,7 +3094,6 @@ static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t
     }
 
     auto candidates = std::vector<peer_candidate>{};
-    candidates.reserve(atomCount);
 
     /* populate the candidate array */
     for (auto* tor : session->torrents)
@@ -3021,32 +3123,13 @@ static std::vector<peer_candidate> getPeerCandidates(tr_session* session, size_t
             continue;
         }
 
-        auto nAtoms = int{};
-        peer_atom** atoms = (peer_atom**)tr_ptrArrayPeek(&tor->swarm->pool, &nAtoms);
-
-        for (int i = 0; i < nAtoms; ++i)
+        auto score = uint64_t{};
+        if (auto* const atom = nextCandidate(tor, now, &score); atom != nullptr)
         {
-            struct peer_atom* atom = atoms[i];
-
-            if (isPeerCandidate(tor, atom, now))
-            {
-                uint8_t const salt = tr_rand_int_weak(1024);
-                candidates.push_back({ getPeerCandidateScore(tor, atom, salt), tor, atom });
-            }
+            candidates.push_back({ score, tor, atom });
         }
     }
 
-    // only keep the best `max` candidates
-    if (std::size(candidates) > max)
-    {
-        std::partial_sort(
-            std::begin(candidates),
-            std::begin(candidates) + max,
-            std::end(candidates),
-            [](auto const& a, auto const& b) { return a.score < b.score; });
-        candidates.resize(max);
-    }
-
     return candidates;
 }
 
@@ -3079,6 +3162,7 @@ static void initiateConnection(tr_peerMgr* mgr, tr_swarm* s, struct peer_atom* a
         tordbg(s, "peerIo not created; marking peer %s as unreachable", tr_atomAddrStr(atom));
         atom->flags2 |= MyflagUnreachable;
         atom->numFails++;
+        s->candidates.queue(atom);
     }
     else
     {
@@ -3110,8 +3194,33 @@ static void initiateCandidateConnection(tr_peerMgr* mgr, peer_candidate& c)
 
 static void makeNewPeerConnections(struct tr_peerMgr* mgr, size_t max)
 {
-    for (auto& candidate : getPeerCandidates(mgr->session, max))
+    // a min-heap of each torrent's best candidate
+    auto candidates = getPeerCandidates(mgr->session);
+    auto const compare = [](auto const& a, auto const& b)
     {
+        return a.score > b.score;
+    };
+    std::make_heap(std::begin(candidates), std::end(candidates), compare);
+
+    for (size_t i = 0; i < max && !std::empty(candidates); ++i)
+    {
+        std::pop_heap(std::begin(candidates), std::end(candidates), compare);
+        auto& candidate = candidates.back();
+
+        // take it off the swarm's queue; it'll be queued again when we're done with it
+        candidate.tor->swarm->candidates.pop(candidate.atom);
+
         initiateCandidateConnection(mgr, candidate);
+
+        // that torrent's next-best candidate gets its turn
+        if (auto* const atom = nextCandidate(candidate.tor, tr_time(), &candidate.score); atom != nullptr)
+        {
+            candidate.atom = atom;
+            std::push_heap(std::begin(candidates), std::end(candidates), compare);
+        }
+        else
+        {
+            candidates.pop_back();
+        }
     }
 }
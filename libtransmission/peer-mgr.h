@@ -134,6 +134,9 @@ uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor);
 
 void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor);
 
+/* call when file priorities or which files are wanted change */
+void tr_peerMgrOnWantedPiecesChanged(tr_torrent* tor);
+
 void tr_peerMgrOnBlocklistChanged(tr_peerMgr* manager);
 
 struct tr_peer_stat* tr_peerMgrPeerStats(tr_torrent const* tor, int* setmeCount);
@@ -148,4 +151,15 @@ void tr_peerMgrGotBadPiece(tr_torrent* tor, tr_piece_index_t pieceIndex);
 
 void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t pieceIndex);
 
+/** @brief Private function that's exposed here only for unit tests */
+void tr_peerMgrRechoke(tr_peerMgr* manager);
+
+/** @brief Private function that's exposed here only for unit tests */
+tr_peerMsgs* tr_peerMgrAddPeer(
+    tr_torrent* tor,
+    tr_address const* addr,
+    tr_port port,
+    tr_peerMsgs* (*make_peer)(tr_torrent* tor, peer_atom* atom, void* user_data),
+    void* user_data);
+
 /* @} */
@@ -7,6 +7,7 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstdarg>
 #include <cstdlib>
@@ -14,6 +15,7 @@
 #include <iostream>
 #include <memory> // std::unique_ptr
 #include <optional>
+#include <utility> // std::move
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
@@ -24,6 +26,7 @@
 #include "cache.h"
 #include "completion.h"
 #include "file.h"
+#include "inout.h"
 #include "log.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
@@ -120,6 +123,9 @@ static auto constexpr LowPriorityIntervalSecs = int{ 10 };
 // how many blocks to keep prefetched per peer
 static auto constexpr PrefetchSize = int{ 18 };
 
+// most blocks to read from disk at once when a peer asks for a run of them
+static auto constexpr MaxBlocksPerRead = size_t{ 16 };
+
 // when we're making requests from another peer,
 // batch them together to send enough requests to
 // meet our bandwidth goals for the next N seconds
@@ -176,7 +182,8 @@ struct tr_incoming
     uint8_t id = 0;
     uint32_t length = 0; /* includes the +1 for id length */
     struct peer_request blockReq = {}; /* metadata for incoming blocks */
-    struct evbuffer* block = nullptr; /* piece data for incoming blocks */
+    uint8_t* block = nullptr; /* piece data for incoming blocks, in a buffer from the cache */
+    uint32_t block_received = 0; /* how much of `block` has arrived */
 };
 
 class tr_peerMsgsImpl;
@@ -273,9 +280,9 @@ public:
         set_active(TR_UP, false);
         set_active(TR_DOWN, false);
 
-        if (this->incoming.block != nullptr)
+        if (this->incoming.block != nullptr && session->cache != nullptr)
         {
-            evbuffer_free(this->incoming.block);
+            tr_cacheReleaseBlockBuffer(session->cache, this->incoming.block);
         }
 
         if (this->io != nullptr)
@@ -1565,7 +1572,7 @@ static bool messageLengthIsCorrect(tr_peerMsgsImpl const* msg, uint8_t id, uint3
     }
 }
 
-static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* block, struct peer_request const* req);
+static int clientGotBlock(tr_peerMsgsImpl* msgs, uint8_t* block, struct peer_request const* req);
 
 static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size_t inlen, size_t* setme_piece_bytes_read)
 {
@@ -1586,21 +1593,30 @@ static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size
         tr_peerIoReadUint32(msgs->io, inbuf, &req->offset);
         req->length = msgs->incoming.length - 9;
         dbgmsg(msgs, "got incoming block header %u:%u->%u", req->index, req->offset, req->length);
+
+        /* no block is that big, and it wouldn't fit in a cache buffer */
+        if (req->length > MAX_BLOCK_SIZE)
+        {
+            dbgmsg(msgs, "wrong block size -- got %u", req->length);
+            return READ_ERR;
+        }
+
         return READ_NOW;
     }
 
+    /* the block is decrypted straight into a cache buffer, which the cache
+     * takes over once the block is complete, so it's only copied once */
     if (msgs->incoming.block == nullptr)
     {
-        msgs->incoming.block = evbuffer_new();
+        msgs->incoming.block = tr_cacheAcquireBlockBuffer(msgs->session->cache);
     }
 
-    struct evbuffer* const block_buffer = msgs->incoming.block;
-
     /* read in another chunk of data */
-    size_t const nLeft = req->length - evbuffer_get_length(block_buffer);
+    size_t const nLeft = req->length - msgs->incoming.block_received;
     size_t const n = std::min(nLeft, inlen);
 
-    tr_peerIoReadBytesToBuf(msgs->io, inbuf, block_buffer, n);
+    tr_peerIoReadBytes(msgs->io, inbuf, msgs->incoming.block + msgs->incoming.block_received, n);
+    msgs->incoming.block_received += n;
 
     msgs->publishClientGotPieceData(n);
     *setme_piece_bytes_read += n;
@@ -1611,18 +1627,19 @@ static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size
         req->index,
         req->offset,
         req->length,
-        (int)(req->length - evbuffer_get_length(block_buffer)));
+        (int)(req->length - msgs->incoming.block_received));
 
-    if (evbuffer_get_length(block_buffer) < req->length)
+    if (msgs->incoming.block_received < req->length)
     {
         return READ_LATER;
     }
 
     /* pass the block along... */
-    int const err = clientGotBlock(msgs, block_buffer, req);
-    evbuffer_drain(block_buffer, evbuffer_get_length(block_buffer));
+    int const err = clientGotBlock(msgs, msgs->incoming.block, req);
 
     /* cleanup */
+    msgs->incoming.block = nullptr;
+    msgs->incoming.block_received = 0;
     req->length = 0;
     msgs->state = AwaitingBtLength;
     return err != 0 ? READ_ERR : READ_NOW;
@@ -1715,8 +1732,11 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
             uint8_t* tmp = tr_new(uint8_t, msglen);
             dbgmsg(msgs, "got a bitfield");
             tr_peerIoReadBytes(msgs->io, inbuf, tmp, msglen);
-            msgs->have.setRaw(tmp, msglen);
-            msgs->publishClientGotBitfield(&msgs->have);
+            auto bitfield = tr_bitfield{ msgs->have.size() };
+            bitfield.setRaw(tmp, msglen);
+            // publish before replacing `have' so listeners can see the old one
+            msgs->publishClientGotBitfield(&bitfield);
+            msgs->have = std::move(bitfield);
             updatePeerProgress(msgs);
             tr_free(tmp);
             break;
@@ -1814,8 +1834,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasAll();
             msgs->publishClientGotHaveAll();
+            msgs->have.setHasAll();
             updatePeerProgress(msgs);
         }
         else
@@ -1831,8 +1851,8 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
 
         if (fext)
         {
-            msgs->have.setHasNone();
             msgs->publishClientGotHaveNone();
+            msgs->have.setHasNone();
             updatePeerProgress(msgs);
         }
         else
@@ -1882,8 +1902,7 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
     return READ_NOW;
 }
 
-/* returns 0 on success, or an errno on failure */
-static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct peer_request const* req)
+static int clientGotBlockImpl(tr_peerMsgsImpl* msgs, uint8_t* data, struct peer_request const* req, bool* setme_kept)
 {
     TR_ASSERT(msgs != nullptr);
     TR_ASSERT(req != nullptr);
@@ -1917,11 +1936,18 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
         return 0;
     }
 
+    if (msgs->torrent->isPieceBeingChecked(req->index))
+    {
+        dbgmsg(msgs, "we did ask for this message, but the piece is already being checked...");
+        return 0;
+    }
+
     /**
     ***  Save the block
     **/
 
-    int const err = tr_cacheWriteBlock(msgs->session->cache, tor, req->index, req->offset, req->length, data);
+    int const err = tr_cacheWriteBlockBuffer(msgs->session->cache, tor, req->index, req->offset, req->length, data);
+    *setme_kept = true;
     if (err != 0)
     {
         return err;
@@ -1932,6 +1958,21 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
     return 0;
 }
 
+/* returns 0 on success, or an errno on failure.
+ * either way, `data` goes back to the cache. */
+static int clientGotBlock(tr_peerMsgsImpl* msgs, uint8_t* data, struct peer_request const* req)
+{
+    bool kept = false;
+    int const err = clientGotBlockImpl(msgs, data, req, &kept);
+
+    if (!kept)
+    {
+        tr_cacheReleaseBlockBuffer(msgs->session->cache, data);
+    }
+
+    return err;
+}
+
 static void didWrite(tr_peerIo* io, size_t bytesWritten, bool wasPieceData, void* vmsgs)
 {
     auto* msgs = static_cast<tr_peerMsgsImpl*>(vmsgs);
@@ -2029,11 +2070,23 @@ static void updateDesiredRequestCount(tr_peerMsgsImpl* msgs)
 
         /* use this desired rate to figure out how
          * many requests we should send to this peer */
-        size_t constexpr Floor = 32;
-        size_t constexpr Seconds = RequestBufSecs;
-        size_t const estimated_blocks_in_period = (rate_Bps * Seconds) / torrent->block_size;
         size_t const ceil = msgs->reqq ? *msgs->reqq : 250;
-        msgs->desired_request_count = std::clamp(estimated_blocks_in_period, Floor, ceil);
+
+        if (msgs->pipeline.hasSamples() && rate_Bps > 0)
+        {
+            /* enough to cover the round trip to the peer */
+            size_t constexpr Floor = 4;
+            size_t const bdp_blocks = msgs->pipeline.requestCount(rate_Bps, torrent->block_size);
+            msgs->desired_request_count = std::clamp(bdp_blocks, std::min(Floor, ceil), ceil);
+        }
+        else
+        {
+            /* we don't know the peer well enough yet */
+            size_t constexpr Floor = 32;
+            size_t constexpr Seconds = RequestBufSecs;
+            size_t const estimated_blocks_in_period = (rate_Bps * Seconds) / torrent->block_size;
+            msgs->desired_request_count = std::clamp(estimated_blocks_in_period, std::min(Floor, ceil), ceil);
+        }
     }
 }
 
@@ -2100,6 +2153,95 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
     }
 }
 
+static uint8_t* writeUint32(uint8_t* walk, uint32_t value)
+{
+    uint32_t const nvalue = htonl(value);
+    memcpy(walk, &nvalue, sizeof(nvalue));
+    return walk + sizeof(nvalue);
+}
+
+/* build the piece messages in place, and read the blocks
+ * straight into their payloads */
+static int addBlockCopies(
+    tr_peerMsgsImpl* msgs,
+    struct evbuffer* out,
+    struct peer_request const* reqs,
+    size_t n_reqs,
+    size_t payload_len)
+{
+    auto constexpr HeaderLen = size_t{ 4 + 1 + 4 + 4 };
+    size_t const msglen = n_reqs * HeaderLen + payload_len;
+    struct evbuffer_iovec iovec[1];
+
+    evbuffer_reserve_space(out, msglen, iovec, 1);
+
+    auto blocks = std::array<tr_sys_iovec_t, MaxBlocksPerRead>{};
+    auto* walk = static_cast<uint8_t*>(iovec[0].iov_base);
+    for (size_t i = 0; i < n_reqs; ++i)
+    {
+        walk = writeUint32(walk, sizeof(uint8_t) + 2 * sizeof(uint32_t) + reqs[i].length);
+        *walk++ = BtPiece;
+        walk = writeUint32(walk, reqs[i].index);
+        walk = writeUint32(walk, reqs[i].offset);
+        blocks[i].iov_base = walk;
+        blocks[i].iov_len = reqs[i].length;
+        walk += reqs[i].length;
+    }
+
+    int const err = tr_cacheReadBlocks(
+        msgs->session->cache,
+        msgs->torrent,
+        reqs[0].index,
+        reqs[0].offset,
+        std::data(blocks),
+        n_reqs);
+    iovec[0].iov_len = msglen;
+    evbuffer_commit_space(out, iovec, 1);
+    return err;
+}
+
+/* for plaintext TCP peers, queue the blocks as file-backed segments
+ * so that they go out with sendfile() instead of being read into memory.
+ * returns false if this isn't possible, leaving `out` empty. */
+static bool addBlockSegments(
+    tr_peerMsgsImpl* msgs,
+    struct evbuffer* out,
+    struct peer_request const* reqs,
+    size_t n_reqs,
+    size_t payload_len)
+{
+    auto const& first = reqs[0];
+
+    /* blocks still in the write cache aren't on disk yet */
+    if (!tr_peerIoSupportsZeroCopy(msgs->io) ||
+        tr_cacheHasBlocks(msgs->session->cache, msgs->torrent, first.index, first.offset, payload_len))
+    {
+        return false;
+    }
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    /* like the peer's outbuf, which this is moved to. otherwise
+     * libevent would read the segments into memory as they're added */
+    evbuffer_set_flags(out, EVBUFFER_FLAG_DRAINS_TO_FD);
+#endif
+
+    for (size_t i = 0; i < n_reqs; ++i)
+    {
+        evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + reqs[i].length);
+        evbuffer_add_uint8(out, BtPiece);
+        evbuffer_add_uint32(out, reqs[i].index);
+        evbuffer_add_uint32(out, reqs[i].offset);
+
+        if (tr_ioAddSegments(msgs->torrent, reqs[i].index, reqs[i].offset, reqs[i].length, out) != 0)
+        {
+            evbuffer_drain(out, evbuffer_get_length(out));
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 {
     size_t bytesWritten = 0;
@@ -2202,27 +2344,40 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 
         if (requestIsValid(msgs, &req) && msgs->torrent->hasPiece(req.index))
         {
-            uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
-            struct evbuffer_iovec iovec[1];
+            /* peers tend to ask for consecutive blocks, so send along any
+             * that follow on from this one to save on disk reads */
+            auto reqs = std::array<peer_request, MaxBlocksPerRead>{};
+            size_t n_reqs = 0;
+            reqs[n_reqs++] = req;
+
+            size_t const space = tr_peerIoGetWriteBufferSpace(msgs->io, now);
+            size_t payload_len = req.length;
+            while (n_reqs < MaxBlocksPerRead && msgs->pendingReqsToClient > 0)
+            {
+                auto const& prev = reqs[n_reqs - 1];
+                auto const& next = msgs->peerAskedFor[0];
+
+                if (next.index != prev.index || next.offset != prev.offset + prev.length ||
+                    payload_len + next.length > space || !requestIsValid(msgs, &next))
+                {
+                    break;
+                }
 
+                popNextRequest(msgs, &reqs[n_reqs]);
+                --msgs->prefetchCount;
+                payload_len += reqs[n_reqs].length;
+                ++n_reqs;
+            }
+
+            auto constexpr HeaderLen = size_t{ 4 + 1 + 4 + 4 };
+            size_t const msglen = n_reqs * HeaderLen + payload_len;
             auto* const out = evbuffer_new();
-            evbuffer_expand(out, msglen);
-
-            evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
-            evbuffer_add_uint8(out, BtPiece);
-            evbuffer_add_uint32(out, req.index);
-            evbuffer_add_uint32(out, req.offset);
-
-            evbuffer_reserve_space(out, req.length, iovec, 1);
-            bool err = tr_cacheReadBlock(
-                           msgs->session->cache,
-                           msgs->torrent,
-                           req.index,
-                           req.offset,
-                           req.length,
-                           static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
-            iovec[0].iov_len = req.length;
-            evbuffer_commit_space(out, iovec, 1);
+
+            bool err = false;
+            if (!addBlockSegments(msgs, out, std::data(reqs), n_reqs, payload_len))
+            {
+                err = addBlockCopies(msgs, out, std::data(reqs), n_reqs, payload_len) != 0;
+            }
 
             /* check the piece if it needs checking... */
             if (!err)
@@ -2241,18 +2396,21 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
             {
                 if (fext)
                 {
-                    protocolSendReject(msgs, &req);
+                    for (size_t i = 0; i < n_reqs; ++i)
+                    {
+                        protocolSendReject(msgs, &reqs[i]);
+                    }
                 }
             }
             else
             {
                 size_t const n = evbuffer_get_length(out);
-                dbgmsg(msgs, "sending block %u:%u->%u", req.index, req.offset, req.length);
+                dbgmsg(msgs, "sending %zu blocks %u:%u->%zu", n_reqs, req.index, req.offset, payload_len);
                 TR_ASSERT(n == msglen);
                 tr_peerIoWriteBuf(msgs->io, out, true);
                 bytesWritten += n;
                 msgs->clientSentAnythingAt = now;
-                msgs->blocksSentToPeer.add(tr_time(), 1);
+                msgs->blocksSentToPeer.add(tr_time(), n_reqs);
             }
 
             evbuffer_free(out);
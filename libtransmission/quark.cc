@@ -23,7 +23,7 @@ using namespace std::literals;
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
+auto constexpr my_static = std::array<std::string_view, 409>{ ""sv,
                                                               "activeTorrentCount"sv,
                                                               "activity-date"sv,
                                                               "activityDate"sv,
@@ -60,6 +60,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "blocks"sv,
                                                               "bytesCompleted"sv,
                                                               "cache-size-mb"sv,
+                                                              "cache-stats"sv,
                                                               "clientIsChoked"sv,
                                                               "clientIsInterested"sv,
                                                               "clientName"sv,
@@ -218,13 +219,19 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "nodes"sv,
                                                               "nodes6"sv,
                                                               "open-dialog-dir"sv,
+                                                              "openFileEvictions"sv,
+                                                              "openFileHits"sv,
+                                                              "openFileMisses"sv,
                                                               "p"sv,
+                                                              "packetsReceived"sv,
+                                                              "packetsSent"sv,
                                                               "path"sv,
                                                               "path.utf-8"sv,
                                                               "paused"sv,
                                                               "pausedTorrentCount"sv,
                                                               "peer-congestion-algorithm"sv,
                                                               "peer-id-ttl-hours"sv,
+                                                              "peer-io-threads"sv,
                                                               "peer-limit"sv,
                                                               "peer-limit-global"sv,
                                                               "peer-limit-per-torrent"sv,
@@ -279,6 +286,11 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ratio-limit"sv,
                                                               "ratio-limit-enabled"sv,
                                                               "ratio-mode"sv,
+                                                              "read-cache-size-mb"sv,
+                                                              "readCacheBytes"sv,
+                                                              "readCacheHits"sv,
+                                                              "readCacheMisses"sv,
+                                                              "receiveCalls"sv,
                                                               "recent-download-dir-1"sv,
                                                               "recent-download-dir-2"sv,
                                                               "recent-download-dir-3"sv,
@@ -328,6 +340,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "seedRatioMode"sv,
                                                               "seederCount"sv,
                                                               "seeding-time-seconds"sv,
+                                                              "sendCalls"sv,
                                                               "session-count"sv,
                                                               "session-id"sv,
                                                               "sessionCount"sv,
@@ -385,6 +398,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "trackers"sv,
                                                               "trash-can-enabled"sv,
                                                               "trash-original-torrent-files"sv,
+                                                              "udp-stats"sv,
                                                               "umask"sv,
                                                               "units"sv,
                                                               "upload-slots-per-torrent"sv,
@@ -408,6 +422,9 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ut_recommend"sv,
                                                               "utp-enabled"sv,
                                                               "v"sv,
+                                                              "verify-queue-size"sv,
+                                                              "verify-speed-limit"sv,
+                                                              "verify-threads"sv,
                                                               "version"sv,
                                                               "wanted"sv,
                                                               "warning message"sv,
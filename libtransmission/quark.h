@@ -63,6 +63,7 @@ enum
     TR_KEY_blocks,
     TR_KEY_bytesCompleted,
     TR_KEY_cache_size_mb,
+    TR_KEY_cache_stats,
     TR_KEY_clientIsChoked,
     TR_KEY_clientIsInterested,
     TR_KEY_clientName,
@@ -221,13 +222,19 @@ enum
     TR_KEY_nodes,
     TR_KEY_nodes6,
     TR_KEY_open_dialog_dir,
+    TR_KEY_openFileEvictions,
+    TR_KEY_openFileHits,
+    TR_KEY_openFileMisses,
     TR_KEY_p,
+    TR_KEY_packetsReceived,
+    TR_KEY_packetsSent,
     TR_KEY_path,
     TR_KEY_path_utf_8,
     TR_KEY_paused,
     TR_KEY_pausedTorrentCount,
     TR_KEY_peer_congestion_algorithm,
     TR_KEY_peer_id_ttl_hours,
+    TR_KEY_peer_io_threads,
     TR_KEY_peer_limit,
     TR_KEY_peer_limit_global,
     TR_KEY_peer_limit_per_torrent,
@@ -282,6 +289,11 @@ enum
     TR_KEY_ratio_limit,
     TR_KEY_ratio_limit_enabled,
     TR_KEY_ratio_mode,
+    TR_KEY_read_cache_size_mb,
+    TR_KEY_readCacheBytes,
+    TR_KEY_readCacheHits,
+    TR_KEY_readCacheMisses,
+    TR_KEY_receiveCalls,
     TR_KEY_recent_download_dir_1,
     TR_KEY_recent_download_dir_2,
     TR_KEY_recent_download_dir_3,
@@ -331,6 +343,7 @@ enum
     TR_KEY_seedRatioMode,
     TR_KEY_seederCount,
     TR_KEY_seeding_time_seconds,
+    TR_KEY_sendCalls,
     TR_KEY_session_count,
     TR_KEY_session_id,
     TR_KEY_sessionCount,
@@ -388,6 +401,7 @@ enum
     TR_KEY_trackers,
     TR_KEY_trash_can_enabled,
     TR_KEY_trash_original_torrent_files,
+    TR_KEY_udp_stats,
     TR_KEY_umask,
     TR_KEY_units,
     TR_KEY_upload_slots_per_torrent,
@@ -411,6 +425,9 @@ enum
     TR_KEY_ut_recommend,
     TR_KEY_utp_enabled,
     TR_KEY_v,
+    TR_KEY_verify_queue_size,
+    TR_KEY_verify_speed_limit,
+    TR_KEY_verify_threads,
     TR_KEY_version,
     TR_KEY_wanted,
     TR_KEY_warning_message,
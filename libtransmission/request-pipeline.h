@@ -0,0 +1,124 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <algorithm>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
+/**
+ * Sizes the pipeline of block requests to a peer from how quickly it answers.
+ *
+ * Each block that arrives is a sample of how long the peer takes to answer
+ * a request. The samples set the request timeout the way TCP sets its
+ * retransmission timeout (RFC 6298), so a peer that stalls loses its
+ * requests after a few of its usual response times instead of a fixed TTL.
+ *
+ * A sample also includes the time the request waited behind the ones sent
+ * before it. Taking that out leaves an estimate of the round-trip time,
+ * which with the peer's speed gives the bandwidth-delay product that the
+ * pipeline needs to cover to keep the link busy.
+ */
+class RequestPipeline
+{
+public:
+    /**
+     * @brief a block arrived
+     * @param now the current time in msec, such as from tr_time_msec()
+     * @param elapsed_msec how long ago we requested the block
+     * @param queued_bytes how many requested bytes are still on their way from the peer
+     * @param rate_Bps how fast the peer is sending us piece data
+     */
+    void gotBlock(uint64_t now, uint64_t elapsed_msec, uint64_t queued_bytes, uint64_t rate_Bps)
+    {
+        bool const is_first = !has_samples_;
+        has_samples_ = true;
+
+        // response time, for the timeout
+        if (is_first)
+        {
+            srtt_msec_ = elapsed_msec;
+            rttvar_msec_ = elapsed_msec / 2;
+        }
+        else
+        {
+            auto const delta = srtt_msec_ > elapsed_msec ? srtt_msec_ - elapsed_msec : elapsed_msec - srtt_msec_;
+            rttvar_msec_ = (3 * rttvar_msec_ + delta) / 4;
+            srtt_msec_ = (7 * srtt_msec_ + elapsed_msec) / 8;
+        }
+
+        // round-trip time, for the pipeline depth.
+        // in a full pipeline, about as much was queued ahead of this
+        // block when it was requested as is queued behind it now.
+        auto const queued_msec = rate_Bps != 0 ? queued_bytes * 1000U / rate_Bps : 0;
+        auto const rtt_msec = std::max(elapsed_msec - std::min(elapsed_msec, queued_msec), uint64_t{ 1 });
+
+        // keep the lowest recent estimate: it has the least queueing in it
+        if (is_first || rtt_msec <= min_rtt_msec_ || now >= min_rtt_time_ + RttWindowMsec)
+        {
+            min_rtt_msec_ = rtt_msec;
+            min_rtt_time_ = now;
+        }
+    }
+
+    [[nodiscard]] constexpr bool hasSamples() const
+    {
+        return has_samples_;
+    }
+
+    /** @brief the estimated round-trip time to the peer */
+    [[nodiscard]] constexpr uint64_t rttMsec() const
+    {
+        return min_rtt_msec_;
+    }
+
+    /** @brief how long to wait for a requested block before giving up on it */
+    [[nodiscard]] constexpr uint64_t requestTimeoutMsec() const
+    {
+        if (!has_samples_)
+        {
+            return MaxTimeoutMsec;
+        }
+
+        return std::clamp(srtt_msec_ + 4 * rttvar_msec_, MinTimeoutMsec, MaxTimeoutMsec);
+    }
+
+    /**
+     * @brief how many blocks to keep requested so that we don't run dry
+     *        while our requests are on their way to the peer
+     * @param rate_Bps the speed we expect from the peer
+     * @param block_size the torrent's block size
+     */
+    [[nodiscard]] constexpr size_t requestCount(uint64_t rate_Bps, uint64_t block_size) const
+    {
+        auto const horizon_msec = std::max(2 * min_rtt_msec_, MinHorizonMsec);
+        auto const bytes = rate_Bps * horizon_msec / 1000U;
+        return size_t((bytes + block_size - 1) / block_size);
+    }
+
+    // keep at least this much time's worth of data requested
+    static auto constexpr MinHorizonMsec = uint64_t{ 1000 };
+
+    // how long a round-trip time estimate is trusted before it's replaced
+    static auto constexpr RttWindowMsec = uint64_t{ 10000 };
+
+    static auto constexpr MinTimeoutMsec = uint64_t{ 5000 };
+    static auto constexpr MaxTimeoutMsec = uint64_t{ 90000 };
+
+private:
+    uint64_t srtt_msec_ = 0;
+    uint64_t rttvar_msec_ = 0;
+    uint64_t min_rtt_msec_ = 0;
+    uint64_t min_rtt_time_ = 0;
+    bool has_samples_ = false;
+};
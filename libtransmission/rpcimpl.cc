@@ -23,10 +23,11 @@
 #include <zlib.h>
 
 #include "transmission.h"
+#include "cache.h" /* tr_cacheGetStats() */
 #include "completion.h"
 #include "crypto-utils.h"
 #include "error.h"
-#include "fdlimit.h"
+#include "fdlimit.h" /* tr_fdGetStats() */
 #include "file.h"
 #include "log.h"
 #include "platform-quota.h" /* tr_device_info_get_disk_space() */
@@ -37,6 +38,7 @@
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-macros.h"
+#include "tr-udp.h" /* tr_udpGetStats() */
 #include "utils.h"
 #include "variant.h"
 #include "version.h"
@@ -2147,6 +2149,23 @@ static char const* sessionStats(
     tr_variantDictAddInt(d, TR_KEY_sessionCount, currentStats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+    auto const cacheStats = tr_cacheGetStats(session->cache);
+    auto const fdStats = tr_fdGetStats(session);
+    d = tr_variantDictAddDict(args_out, TR_KEY_cache_stats, 6);
+    tr_variantDictAddInt(d, TR_KEY_openFileEvictions, fdStats.evictions);
+    tr_variantDictAddInt(d, TR_KEY_openFileHits, fdStats.hits);
+    tr_variantDictAddInt(d, TR_KEY_openFileMisses, fdStats.misses);
+    tr_variantDictAddInt(d, TR_KEY_readCacheBytes, cacheStats.read_bytes);
+    tr_variantDictAddInt(d, TR_KEY_readCacheHits, cacheStats.read_hits);
+    tr_variantDictAddInt(d, TR_KEY_readCacheMisses, cacheStats.read_misses);
+
+    auto const udpStats = tr_udpGetStats(session);
+    d = tr_variantDictAddDict(args_out, TR_KEY_udp_stats, 4);
+    tr_variantDictAddInt(d, TR_KEY_packetsReceived, udpStats.recv_packets);
+    tr_variantDictAddInt(d, TR_KEY_packetsSent, udpStats.send_packets);
+    tr_variantDictAddInt(d, TR_KEY_receiveCalls, udpStats.recv_calls);
+    tr_variantDictAddInt(d, TR_KEY_sendCalls, udpStats.send_calls);
+
     return nullptr;
 }
 
@@ -6,7 +6,7 @@
  *
  */
 
-#include <algorithm> // std::partial_sort(), std::min(), std::max()
+#include <algorithm> // std::partial_sort(), std::min(), std::max(), std::clamp()
 #include <cerrno> /* ENOENT */
 #include <climits> /* INT_MAX */
 #include <csignal>
@@ -36,6 +36,7 @@
 #include "bandwidth.h"
 #include "blocklist.h"
 #include "cache.h"
+#include "crypto.h" /* tr_cryptoKeyPoolInit() */
 #include "crypto-utils.h"
 #include "error-types.h"
 #include "error.h"
@@ -71,9 +72,11 @@ std::recursive_mutex tr_session::session_mutex_;
 
 #ifdef TR_LIGHTWEIGHT
 static auto constexpr DefaultCacheSizeMB = int{ 2 };
+static auto constexpr DefaultReadCacheSizeMB = int{ 0 };
 static auto constexpr DefaultPrefetchEnabled = bool{ false };
 #else
 static auto constexpr DefaultCacheSizeMB = int{ 4 };
+static auto constexpr DefaultReadCacheSizeMB = int{ 16 };
 static auto constexpr DefaultPrefetchEnabled = bool{ true };
 #endif
 static auto constexpr SaveIntervalSecs = int{ 360 };
@@ -324,7 +327,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 69);
+    tr_variantDictReserve(d, 73);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, false);
     tr_variantDictAddStrView(d, TR_KEY_blocklist_url, "http://www.example.com/blocklist"sv);
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, DefaultCacheSizeMB);
@@ -353,7 +356,9 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_preallocation, TR_PREALLOCATE_SPARSE);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, DefaultPrefetchEnabled);
+    tr_variantDictAddInt(d, TR_KEY_read_cache_size_mb, DefaultReadCacheSizeMB);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, 6);
+    tr_variantDictAddInt(d, TR_KEY_peer_io_threads, 0);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, 30);
     tr_variantDictAddReal(d, TR_KEY_ratio_limit, 2.0);
@@ -388,6 +393,9 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_umask, 022);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, 14);
+    tr_variantDictAddInt(d, TR_KEY_verify_queue_size, 2);
+    tr_variantDictAddInt(d, TR_KEY_verify_speed_limit, 0);
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, 2);
     tr_variantDictAddStrView(d, TR_KEY_bind_address_ipv4, TR_DEFAULT_BIND_ADDRESS_IPV4);
     tr_variantDictAddStrView(d, TR_KEY_bind_address_ipv6, TR_DEFAULT_BIND_ADDRESS_IPV6);
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, true);
@@ -400,7 +408,7 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 68);
+    tr_variantDictReserve(d, 72);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, s->useBlocklist());
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, s->blocklistUrl());
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, tr_sessionGetCacheLimit_MB(s));
@@ -430,7 +438,9 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, tr_sessionIsPortForwardingEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_preallocation, s->preallocationMode);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, s->isPrefetchEnabled);
+    tr_variantDictAddInt(d, TR_KEY_read_cache_size_mb, toMemMB(tr_cacheGetReadLimit(s->cache)));
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, s->peer_id_ttl_hours);
+    tr_variantDictAddInt(d, TR_KEY_peer_io_threads, s->peerIoThreads);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, tr_sessionGetQueueStalledEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, tr_sessionGetQueueStalledMinutes(s));
     tr_variantDictAddReal(d, TR_KEY_ratio_limit, s->desiredRatio);
@@ -463,6 +473,9 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, tr_sessionIsSpeedLimited(s, TR_UP));
     tr_variantDictAddInt(d, TR_KEY_umask, s->umask);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, s->uploadSlotsPerTorrent);
+    tr_variantDictAddInt(d, TR_KEY_verify_queue_size, s->verifyQueueSize);
+    tr_variantDictAddInt(d, TR_KEY_verify_speed_limit, toSpeedKBps(s->verifySpeedLimit_Bps));
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, s->verifyThreads);
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv4, tr_address_to_string(&s->bind_ipv4->addr));
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv6, tr_address_to_string(&s->bind_ipv6->addr));
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, !tr_sessionGetPaused(s));
@@ -614,6 +627,13 @@ tr_session* tr_sessionInit(char const* configDir, bool messageQueuingEnabled, tr
         tr_logSetLevel(tr_log_level(i));
     }
 
+    /* the peer loops are started along with the libtransmission thread,
+     * so changes to this only take effect when the session is restarted */
+    if (tr_variantDictFindInt(clientSettings, TR_KEY_peer_io_threads, &i))
+    {
+        session->peerIoThreads = std::clamp(int(i), 0, 64);
+    }
+
     /* start the libtransmission thread */
     tr_net_init(); /* must go before tr_eventInit */
     tr_eventInit(session);
@@ -727,6 +747,9 @@ static void tr_sessionInitImpl(void* vdata)
 
     session->peerMgr = tr_peerMgrNew(session);
 
+    /* have some keys ready for the first encrypted handshakes */
+    tr_cryptoKeyPoolInit();
+
     session->shared = tr_sharedInit(session);
 
     /**
@@ -807,6 +830,11 @@ static void sessionSetImpl(void* vdata)
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_read_cache_size_mb, &i))
+    {
+        tr_cacheSetReadLimit(session->cache, toMemBytes(std::max(int(i), 0)));
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_peer_limit_per_torrent, &i))
     {
         tr_sessionSetPeerLimitPerTorrent(session, i);
@@ -999,6 +1027,21 @@ static void sessionSetImpl(void* vdata)
         session->uploadSlotsPerTorrent = i;
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_queue_size, &i))
+    {
+        session->verifyQueueSize = std::max(int(i), 1);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_speed_limit, &i))
+    {
+        session->verifySpeedLimit_Bps = toSpeedBytes(std::max(int(i), 0));
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_threads, &i))
+    {
+        session->verifyThreads = std::max(int(i), 1);
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_speed_limit_up, &i))
     {
         tr_sessionSetSpeedLimit_KBps(session, TR_UP, i);
@@ -1910,6 +1953,7 @@ static void sessionCloseImplFinish(tr_session* session)
 
     tr_statsClose(session);
     tr_peerMgrFree(session->peerMgr);
+    tr_cryptoKeyPoolClose();
 
     closeBlocklists(session);
 
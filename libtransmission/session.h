@@ -15,6 +15,8 @@
 #define TR_NAME "Transmission"
 
 #include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstring> // memcmp()
 #include <list>
 #include <mutex>
@@ -55,6 +57,7 @@ struct tr_bindsockets;
 struct tr_blocklistFile;
 struct tr_cache;
 struct tr_fdInfo;
+struct tr_udp_io;
 
 struct tr_turtle_info
 {
@@ -97,6 +100,16 @@ struct tr_turtle_info
     tr_auto_switch_state_t autoTurtleState;
 };
 
+/* the read budget that all of a session's verifying torrents share,
+ * one second at a time. see verifyThrottle() */
+struct tr_verify_throttle
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::chrono::steady_clock::time_point window_began_at;
+    uint64_t window_bytes = 0;
+};
+
 struct CompareHash
 {
     bool operator()(uint8_t const* const a, uint8_t const* const b) const
@@ -314,6 +327,18 @@ public:
 
     int uploadSlotsPerTorrent;
 
+    /* how many torrents may be verified at once,
+     * how many threads hash each one's pieces,
+     * and how fast all of them together may read (0 == unlimited) */
+    int verifyQueueSize;
+    int verifyThreads;
+    unsigned int verifySpeedLimit_Bps;
+    tr_verify_throttle verify_throttle;
+
+    /* how many extra event loops poll the peers' TCP sockets,
+     * or 0 to poll them all from the event thread */
+    int peerIoThreads;
+
     /* The UDP sockets used for the DHT and uTP. */
     tr_port udp_port;
     tr_socket_t udp_socket;
@@ -321,6 +346,7 @@ public:
     unsigned char* udp6_bound;
     struct event* udp_event;
     struct event* udp6_event;
+    struct tr_udp_io* udp_io;
 
     struct event* utp_timer;
 
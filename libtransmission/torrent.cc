@@ -1561,6 +1561,9 @@ static void verifyTorrent(void* vdata)
         /* if the torrent's already being verified, stop it */
         tr_verifyRemove(tor);
 
+        /* the full verify supersedes any checks of newly-downloaded pieces */
+        tor->pieces_being_checked.clear();
+
         bool const startAfter = (tor->isRunning || tor->startAfterVerify) && !tor->isStopping;
 
         if (tor->isRunning)
@@ -1966,6 +1969,21 @@ void tr_torrentSetMetadataCallback(tr_torrent* tor, tr_torrent_metadata_func fun
 ***  File DND
 **/
 
+void tr_torrent::setFilesWanted(tr_file_index_t const* files, size_t n_files, bool wanted, bool is_bootstrapping)
+{
+    auto const lock = unique_lock();
+
+    files_wanted_.set(files, n_files, wanted);
+    completion.invalidateSizeWhenDone();
+
+    if (!is_bootstrapping)
+    {
+        setDirty();
+        recheckCompleteness();
+        tr_peerMgrOnWantedPiecesChanged(this);
+    }
+}
+
 void tr_torrentSetFileDLs(tr_torrent* tor, tr_file_index_t const* files, tr_file_index_t n_files, bool wanted)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -2787,34 +2805,86 @@ static void tr_torrentPieceCompleted(tr_torrent* tor, tr_piece_index_t pieceInde
     }
 }
 
+static void applyPieceCheck(tr_torrent* tor, tr_piece_index_t p, std::optional<bool> pass)
+{
+    if (!pass)
+    {
+        // it couldn't be read back from disk, so download it again
+        tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, couldn't be read to test its checksum"), p);
+        tor->setHasPiece(p, false);
+        tr_torrentSetDirty(tor);
+    }
+    else if (*pass)
+    {
+        tor->setHasPiece(p, true);
+        tr_torrentSetDirty(tor);
+        tr_torrentPieceCompleted(tor, p);
+    }
+    else
+    {
+        uint32_t const n = tor->pieceSize(p);
+        tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, failed its checksum test"), p);
+        tor->corruptCur += n;
+        tor->downloadedCur -= std::min(tor->downloadedCur, uint64_t{ n });
+        tor->setHasPiece(p, false);
+        tr_torrentSetDirty(tor);
+        tr_peerMgrGotBadPiece(tor, p);
+    }
+}
+
+static void onPieceRechecked(tr_torrent* tor, tr_piece_index_t p, std::optional<bool> pass)
+{
+    auto const lock = tor->unique_lock();
+
+    // if the torrent was re-verified in the meantime, this result is stale
+    if (tor->pieces_being_checked.erase(p) != 0)
+    {
+        applyPieceCheck(tor, p, pass);
+    }
+}
+
+static void onPieceChecked(tr_torrent* tor, tr_piece_index_t p, std::optional<bool> pass)
+{
+    auto const lock = tor->unique_lock();
+
+    if (tor->pieces_being_checked.count(p) == 0)
+    {
+        return;
+    }
+
+    // if the worker couldn't read the piece, e.g. because its files were
+    // just moved, gather it again and give it one more try
+    if (!pass)
+    {
+        tr_verifyPieceAdd(tor, p, onPieceRechecked);
+        return;
+    }
+
+    tor->pieces_being_checked.erase(p);
+    applyPieceCheck(tor, p, pass);
+}
+
 void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
 {
     TR_ASSERT(tr_isTorrent(tor));
     TR_ASSERT(tr_amInEventThread(tor->session));
 
-    bool const block_is_new = !tor->hasBlock(block);
+    tr_piece_index_t const p = tor->pieceForBlock(block);
+    bool const block_is_new = !tor->hasBlock(block) && !tor->isPieceBeingChecked(p);
 
     if (block_is_new)
     {
-        tor->completion.addBlock(block);
-        tr_torrentSetDirty(tor);
-
-        tr_piece_index_t const p = tor->pieceForBlock(block);
-
-        if (tor->hasPiece(p))
+        if (tor->countMissingBlocksInPiece(p) == 1)
         {
-            if (tor->checkPiece(p))
-            {
-                tr_torrentPieceCompleted(tor, p);
-            }
-            else
-            {
-                uint32_t const n = tor->pieceSize(p);
-                tr_logAddTorErr(tor, _("Piece %" PRIu32 ", which was just downloaded, failed its checksum test"), p);
-                tor->corruptCur += n;
-                tor->downloadedCur -= std::min(tor->downloadedCur, uint64_t{ n });
-                tr_peerMgrGotBadPiece(tor, p);
-            }
+            // this block completes the piece. hold it back until the
+            // piece's checksum has been tested off the libevent thread
+            tor->pieces_being_checked.insert(p);
+            tr_verifyPieceAdd(tor, p, onPieceChecked);
+        }
+        else
+        {
+            tor->completion.addBlock(block);
+            tr_torrentSetDirty(tor);
         }
     }
     else
@@ -3334,6 +3404,20 @@ void tr_torrent::swapMetainfo(tr_metainfo_parsed& parsed)
     std::swap(this->infoDictLength, parsed.info_dict_length);
 }
 
+void tr_torrent::setFilePriorities(tr_file_index_t const* files, tr_file_index_t fileCount, tr_priority_t priority)
+{
+    file_priorities_.set(files, fileCount, priority);
+    setDirty();
+    tr_peerMgrOnWantedPiecesChanged(this);
+}
+
+void tr_torrent::setFilePriority(tr_file_index_t file, tr_priority_t priority)
+{
+    file_priorities_.set(file, priority);
+    setDirty();
+    tr_peerMgrOnWantedPiecesChanged(this);
+}
+
 void tr_torrentSetFilePriorities(
     tr_torrent* tor,
     tr_file_index_t const* files,
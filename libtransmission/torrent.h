@@ -13,6 +13,7 @@
 #endif
 
 #include <optional>
+#include <set>
 #include <string>
 #include <string_view>
 #include <unordered_set>
@@ -277,17 +278,9 @@ public:
         return file_priorities_.piecePriority(piece);
     }
 
-    void setFilePriorities(tr_file_index_t const* files, tr_file_index_t fileCount, tr_priority_t priority)
-    {
-        file_priorities_.set(files, fileCount, priority);
-        setDirty();
-    }
+    void setFilePriorities(tr_file_index_t const* files, tr_file_index_t fileCount, tr_priority_t priority);
 
-    void setFilePriority(tr_file_index_t file, tr_priority_t priority)
-    {
-        file_priorities_.set(file, priority);
-        setDirty();
-    }
+    void setFilePriority(tr_file_index_t file, tr_priority_t priority);
 
     /// FILES
 
@@ -374,6 +367,13 @@ public:
         return checked;
     }
 
+    // a piece whose last block has arrived is kept out of `completion`
+    // until a worker thread has tested its checksum. see tr_torrentGotBlock()
+    [[nodiscard]] bool isPieceBeingChecked(tr_piece_index_t piece) const
+    {
+        return pieces_being_checked.count(piece) != 0;
+    }
+
     void initCheckedPieces(tr_bitfield const& checked, time_t const* mtimes /*fileCount*/)
     {
         TR_ASSERT(std::size(checked) == info.pieceCount);
@@ -402,6 +402,8 @@ public:
 
     tr_bitfield checked_pieces_ = tr_bitfield{ 0 };
 
+    std::set<tr_piece_index_t> pieces_being_checked;
+
     // TODO(ckerr): make private once some of torrent.cc's `tr_torrentFoo()` methods are member functions
     tr_completion completion;
 
@@ -554,19 +556,7 @@ public:
     tr_files_wanted files_wanted_{ &fpm_ };
 
 private:
-    void setFilesWanted(tr_file_index_t const* files, size_t n_files, bool wanted, bool is_bootstrapping)
-    {
-        auto const lock = unique_lock();
-
-        files_wanted_.set(files, n_files, wanted);
-        completion.invalidateSizeWhenDone();
-
-        if (!is_bootstrapping)
-        {
-            setDirty();
-            recheckCompleteness();
-        }
-    }
+    void setFilesWanted(tr_file_index_t const* files, size_t n_files, bool wanted, bool is_bootstrapping);
 
     mutable std::vector<tr_sha1_digest_t> piece_checksums_;
 };
@@ -21,6 +21,7 @@ THE SOFTWARE.
 
 */
 
+#include <array>
 #include <cstring> /* memcmp(), memcpy(), memset() */
 #include <cstdlib> /* malloc(), free() */
 
@@ -257,18 +258,216 @@ FAIL:
     }
 }
 
-static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+/* most datagrams to read in one system call */
+static auto constexpr RecvBatchSize = size_t{ 32 };
+
+/* most batches to read per wakeup, so a flood of packets can't starve
+   the rest of the event loop */
+static auto constexpr MaxRecvBatches = int{ 8 };
+
+static auto constexpr RecvBufferSize = size_t{ 4096 };
+
+/* most datagrams to queue up before sending them in one system call */
+static auto constexpr SendBatchSize = size_t{ 64 };
+
+/* uTP packets fit in an ethernet frame; anything bigger is sent unqueued */
+static auto constexpr SendBufferSize = size_t{ 2048 };
+
+struct tr_udp_io
 {
-    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
-    TR_ASSERT(type == EV_READ);
+    std::array<std::array<unsigned char, RecvBufferSize>, RecvBatchSize> bufs;
+    std::array<struct sockaddr_storage, RecvBatchSize> froms;
+    std::array<socklen_t, RecvBatchSize> fromlens;
+    std::array<int, RecvBatchSize> lens;
+
+#ifdef HAVE_RECVMMSG
+    std::array<struct iovec, RecvBatchSize> iovs;
+    std::array<struct mmsghdr, RecvBatchSize> msgs;
+#endif
 
-    unsigned char buf[4096];
-    struct sockaddr_storage from;
-    auto* session = static_cast<tr_session*>(vsession);
+    /* outgoing datagrams, sent together once the event loop
+       has run the rest of this iteration's callbacks */
+    std::array<std::array<unsigned char, SendBufferSize>, SendBatchSize> send_bufs;
+    std::array<struct sockaddr_storage, SendBatchSize> send_tos;
+    std::array<socklen_t, SendBatchSize> send_tolens;
+    std::array<size_t, SendBatchSize> send_lens;
+    std::array<tr_socket_t, SendBatchSize> send_sockets;
+    size_t send_count;
+    struct event* send_event;
+
+#ifdef HAVE_SENDMMSG
+    std::array<struct iovec, SendBatchSize> send_iovs;
+    std::array<struct mmsghdr, SendBatchSize> send_msgs;
+#endif
+
+    tr_udp_stats stats;
+};
+
+/* send the queued datagrams [begin, end), which all use the same socket */
+static void send_run(tr_udp_io* io, size_t begin, size_t end)
+{
+    tr_socket_t const s = io->send_sockets[begin];
+
+#ifdef HAVE_SENDMMSG
+
+    while (begin < end)
+    {
+        int const rc = sendmmsg(s, &io->send_msgs[begin], end - begin, 0);
+        ++io->stats.send_calls;
+
+        /* if the first one failed, drop it like a failed sendto() */
+        if (rc <= 0)
+        {
+            ++begin;
+            continue;
+        }
+
+        io->stats.send_packets += rc;
+        begin += rc;
+    }
+
+#else
+
+    for (; begin < end; ++begin)
+    {
+        auto const rc = sendto(
+            s,
+            reinterpret_cast<char const*>(std::data(io->send_bufs[begin])),
+            io->send_lens[begin],
+            0,
+            (struct sockaddr const*)&io->send_tos[begin],
+            io->send_tolens[begin]);
+        ++io->stats.send_calls;
+
+        if (rc != -1)
+        {
+            ++io->stats.send_packets;
+        }
+    }
+
+#endif
+}
+
+static void send_queued(tr_udp_io* io)
+{
+    for (size_t begin = 0, end = 0; begin < io->send_count; begin = end)
+    {
+        end = begin + 1;
+        while (end < io->send_count && io->send_sockets[end] == io->send_sockets[begin])
+        {
+            ++end;
+        }
+
+        send_run(io, begin, end);
+    }
+
+    io->send_count = 0;
+}
+
+static void send_event_callback(evutil_socket_t /*s*/, short /*type*/, void* vio)
+{
+    send_queued(static_cast<tr_udp_io*>(vio));
+}
+
+static tr_udp_io* udp_io_new(tr_session* session)
+{
+    auto* const io = new tr_udp_io{};
+    io->send_event = event_new(session->event_base, -1, 0, send_event_callback, io);
+
+#ifdef HAVE_SENDMMSG
+
+    for (size_t i = 0; i < SendBatchSize; ++i)
+    {
+        io->send_iovs[i].iov_base = std::data(io->send_bufs[i]);
+        io->send_msgs[i].msg_hdr.msg_iov = &io->send_iovs[i];
+        io->send_msgs[i].msg_hdr.msg_iovlen = 1;
+        io->send_msgs[i].msg_hdr.msg_name = &io->send_tos[i];
+    }
+
+#endif
+
+#ifdef HAVE_RECVMMSG
+
+    for (size_t i = 0; i < RecvBatchSize; ++i)
+    {
+        /* leave room for the DHT code's trailing '\0' */
+        io->iovs[i].iov_base = std::data(io->bufs[i]);
+        io->iovs[i].iov_len = RecvBufferSize - 1;
+        io->msgs[i].msg_hdr.msg_iov = &io->iovs[i];
+        io->msgs[i].msg_hdr.msg_iovlen = 1;
+        io->msgs[i].msg_hdr.msg_name = &io->froms[i];
+    }
+
+#endif
+
+    return io;
+}
+
+/* read up to RecvBatchSize datagrams without blocking.
+   returns how many were read. */
+static size_t recv_batch(evutil_socket_t s, tr_udp_io* io)
+{
+    size_t n = 0;
+
+#ifdef HAVE_RECVMMSG
+
+    for (auto& msg : io->msgs)
+    {
+        msg.msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    int const rc = recvmmsg(s, std::data(io->msgs), RecvBatchSize, MSG_DONTWAIT, nullptr);
+
+    for (int i = 0; i < rc; ++i)
+    {
+        io->lens[n] = io->msgs[i].msg_len;
+        io->fromlens[n] = io->msgs[i].msg_hdr.msg_namelen;
+        ++n;
+    }
+
+#else
+
+#ifdef MSG_DONTWAIT
+    size_t const max = RecvBatchSize;
+    int const flags = MSG_DONTWAIT;
+#else
+    /* without a non-blocking read, only the first one is sure not to block */
+    size_t const max = 1;
+    int const flags = 0;
+#endif
+
+    while (n < max)
+    {
+        io->fromlens[n] = sizeof(struct sockaddr_storage);
+        int const rc = recvfrom(
+            s,
+            reinterpret_cast<char*>(std::data(io->bufs[n])),
+            RecvBufferSize - 1,
+            flags,
+            (struct sockaddr*)&io->froms[n],
+            &io->fromlens[n]);
+
+        if (rc < 0)
+        {
+            break;
+        }
+
+        io->lens[n++] = rc;
+    }
+
+#endif
+
+    if (n > 0)
+    {
+        ++io->stats.recv_calls;
+        io->stats.recv_packets += n;
+    }
 
-    socklen_t fromlen = sizeof(from);
-    int rc = recvfrom(s, reinterpret_cast<char*>(buf), 4096 - 1, 0, (struct sockaddr*)&from, &fromlen);
+    return n;
+}
 
+static void dispatch_packet(tr_session* session, unsigned char* buf, int rc, struct sockaddr* from, socklen_t fromlen)
+{
     /* Since most packets we receive here are ÂµTP, make quick inline
        checks for the other protocols.  The logic is as follows:
        - all DHT packets start with 'd'
@@ -283,7 +482,7 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
             if (tr_sessionAllowsDHT(session))
             {
                 buf[rc] = '\0'; /* required by the DHT code */
-                tr_dhtCallback(buf, rc, (struct sockaddr*)&from, fromlen, vsession);
+                tr_dhtCallback(buf, rc, from, fromlen, session);
             }
         }
         else if (rc >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
@@ -299,7 +498,7 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
         {
             if (tr_sessionIsUTPEnabled(session))
             {
-                rc = tr_utpPacket(buf, rc, (struct sockaddr*)&from, fromlen, session);
+                rc = tr_utpPacket(buf, rc, from, fromlen, session);
 
                 if (rc == 0)
                 {
@@ -310,6 +509,91 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
     }
 }
 
+static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+{
+    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
+    TR_ASSERT(type == EV_READ);
+
+    auto* session = static_cast<tr_session*>(vsession);
+    auto* const io = session->udp_io;
+
+    for (int batch = 0; batch < MaxRecvBatches; ++batch)
+    {
+        size_t const n = recv_batch(s, io);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            dispatch_packet(session, std::data(io->bufs[i]), io->lens[i], (struct sockaddr*)&io->froms[i], io->fromlens[i]);
+        }
+
+        /* if the batch wasn't full, the socket's been drained */
+        if (n < RecvBatchSize)
+        {
+            break;
+        }
+    }
+}
+
+void tr_udpSendTo(tr_session* session, unsigned char const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen)
+{
+    tr_socket_t s = TR_BAD_SOCKET;
+
+    if (to->sa_family == AF_INET)
+    {
+        s = session->udp_socket;
+    }
+    else if (to->sa_family == AF_INET6)
+    {
+        s = session->udp6_socket;
+    }
+
+    if (s == TR_BAD_SOCKET)
+    {
+        return;
+    }
+
+    auto* const io = session->udp_io;
+
+    if (io == nullptr || io->send_event == nullptr || buflen > SendBufferSize || tolen > sizeof(struct sockaddr_storage))
+    {
+        /* send it now, but after anything that's already queued */
+        if (io != nullptr)
+        {
+            send_queued(io);
+        }
+
+        (void)sendto(s, reinterpret_cast<char const*>(buf), buflen, 0, to, tolen);
+        return;
+    }
+
+    if (io->send_count == SendBatchSize)
+    {
+        send_queued(io);
+    }
+
+    size_t const i = io->send_count++;
+    memcpy(std::data(io->send_bufs[i]), buf, buflen);
+    io->send_lens[i] = buflen;
+    memcpy(&io->send_tos[i], to, tolen);
+    io->send_tolens[i] = tolen;
+    io->send_sockets[i] = s;
+
+#ifdef HAVE_SENDMMSG
+    io->send_iovs[i].iov_len = buflen;
+    io->send_msgs[i].msg_hdr.msg_namelen = tolen;
+#endif
+
+    if (i == 0)
+    {
+        event_active(io->send_event, EV_TIMEOUT, 0);
+    }
+}
+
+tr_udp_stats tr_udpGetStats(tr_session const* session)
+{
+    return session->udp_io != nullptr ? session->udp_io->stats : tr_udp_stats{};
+}
+
 void tr_udpInit(tr_session* ss)
 {
     TR_ASSERT(ss->udp_socket == TR_BAD_SOCKET);
@@ -322,6 +606,11 @@ void tr_udpInit(tr_session* ss)
         return;
     }
 
+    if (ss->udp_io == nullptr)
+    {
+        ss->udp_io = udp_io_new(ss);
+    }
+
     ss->udp_socket = socket(PF_INET, SOCK_DGRAM, 0);
 
     if (ss->udp_socket == TR_BAD_SOCKET)
@@ -399,6 +688,11 @@ void tr_udpInit(tr_session* ss)
 
 void tr_udpUninit(tr_session* ss)
 {
+    if (ss->udp_io != nullptr)
+    {
+        send_queued(ss->udp_io);
+    }
+
     tr_dhtUninit(ss);
 
     if (ss->udp_socket != TR_BAD_SOCKET)
@@ -430,4 +724,15 @@ void tr_udpUninit(tr_session* ss)
         free(ss->udp6_bound);
         ss->udp6_bound = nullptr;
     }
+
+    if (ss->udp_io != nullptr)
+    {
+        if (ss->udp_io->send_event != nullptr)
+        {
+            event_free(ss->udp_io->send_event);
+        }
+
+        delete ss->udp_io;
+        ss->udp_io = nullptr;
+    }
 }
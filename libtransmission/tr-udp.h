@@ -32,4 +32,18 @@ void tr_udpUninit(tr_session*);
 void tr_udpSetSocketBuffers(tr_session*);
 void tr_udpSetSocketTOS(tr_session*);
 
+/* Queues a datagram to be sent along with any others that are sent
+   in the same event loop iteration, i.e. in as few system calls as possible */
+void tr_udpSendTo(tr_session*, unsigned char const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen);
+
+struct tr_udp_stats
+{
+    uint64_t recv_calls; /* system calls that read at least one datagram */
+    uint64_t recv_packets;
+    uint64_t send_calls;
+    uint64_t send_packets;
+};
+
+tr_udp_stats tr_udpGetStats(tr_session const*);
+
 bool tau_handle_message(tr_session* session, uint8_t const* msg, size_t msglen);
@@ -34,6 +34,7 @@ THE SOFTWARE.
 #include "peer-mgr.h"
 #include "peer-socket.h"
 #include "tr-assert.h"
+#include "tr-udp.h" /* tr_udpSendTo() */
 #include "tr-utp.h"
 #include "utils.h"
 
@@ -130,16 +131,7 @@ static void incoming(void* vsession, struct UTPSocket* s)
 
 void tr_utpSendTo(void* closure, unsigned char const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen)
 {
-    auto const* const ss = static_cast<tr_session const*>(closure);
-
-    if (to->sa_family == AF_INET && ss->udp_socket != TR_BAD_SOCKET)
-    {
-        (void)sendto(ss->udp_socket, reinterpret_cast<char const*>(buf), buflen, 0, to, tolen);
-    }
-    else if (to->sa_family == AF_INET6 && ss->udp6_socket != TR_BAD_SOCKET)
-    {
-        (void)sendto(ss->udp6_socket, reinterpret_cast<char const*>(buf), buflen, 0, to, tolen);
-    }
+    tr_udpSendTo(static_cast<tr_session*>(closure), buf, buflen, to, tolen);
 }
 
 static void reset_timer(tr_session* ss)
@@ -6,9 +6,18 @@
  *
  */
 
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <csignal>
 
@@ -18,8 +27,13 @@
 #include <unistd.h> /* read(), write(), pipe() */
 #endif
 
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
 #include <event2/dns.h>
 #include <event2/event.h>
+#include <event2/thread.h>
 
 #include "transmission.h"
 #include "log.h"
@@ -149,9 +163,37 @@ using tr_pipe_end_t = int;
 ****
 ***/
 
+struct tr_run_data
+{
+    void (*func)(void*);
+    void* user_data;
+    tr_run_data* next;
+};
+
+/* an extra event loop that polls some of the peers' sockets */
+struct tr_peer_loop
+{
+    tr_session* session = nullptr;
+    struct event_base* base = nullptr;
+    struct event* wakeup = nullptr;
+    std::thread thread;
+
+    /* work for the event thread, queued during the current pass.
+     * `batch` is the newest entry and `batch_oldest` is where it ends */
+    tr_run_data* batch = nullptr;
+    tr_run_data* batch_oldest = nullptr;
+
+    std::atomic<bool> die = false;
+};
+
 struct tr_event_handle
 {
-    std::recursive_mutex fds_mutex;
+    /* functions waiting to be run in the event thread, newest first.
+     * Any thread can push onto it; only the event thread takes from it */
+    std::atomic<tr_run_data*> queue = nullptr;
+
+    /* wakes the event thread when `queue` stops being empty.
+     * With eventfd() both ends are the same descriptor */
     tr_pipe_end_t fds[2] = {};
 
     struct event* pipeEvent = nullptr;
@@ -159,65 +201,107 @@ struct tr_event_handle
     tr_session* session = nullptr;
     tr_thread* thread = nullptr;
 
-    bool die = false;
-};
+    std::vector<std::unique_ptr<tr_peer_loop>> peer_loops;
+    size_t next_peer_loop = 0;
 
-struct tr_run_data
-{
-    void (*func)(void*);
-    void* user_data;
+    std::atomic<bool> die = false;
 };
 
+static thread_local tr_peer_loop* current_peer_loop = nullptr;
+
 #define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
 
-static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
+static bool wakeupNew(tr_pipe_end_t fds[2])
 {
-    auto* eh = static_cast<tr_event_handle*>(veh);
+#ifdef HAVE_EVENTFD
+    fds[0] = fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return fds[0] != -1;
+#else
+    if (pipe(fds) == -1)
+    {
+        return false;
+    }
+
+    evutil_make_socket_nonblocking(fds[0]);
+    evutil_make_socket_nonblocking(fds[1]);
+    return true;
+#endif
+}
 
-    dbgmsg("readFromPipe: eventType is %hd", eventType);
+static void wakeupClose(tr_pipe_end_t fds[2])
+{
+    tr_netCloseSocket(fds[0]);
+#ifndef HAVE_EVENTFD
+    tr_netCloseSocket(fds[1]);
+#endif
+}
 
-    /* read the command type */
-    char ch = '\0';
+static void wakeEventThread(tr_event_handle* eh)
+{
+    /* an eventfd wants exactly eight bytes; a pipe doesn't mind */
+    uint64_t const one = 1;
 
-    int ret = 0;
-    do
+    if (pipewrite(eh->fds[1], &one, sizeof(one)) == -1 && errno != EAGAIN)
     {
-        ret = piperead(fd, &ch, 1);
-    } while (!eh->die && ret == -1 && errno == EAGAIN);
+        tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+    }
+}
 
-    dbgmsg("command is [%c], ret is %d, errno is %d", ch, ret, (int)errno);
+/* push the list newest...oldest onto the event thread's queue */
+static void pushToEventThread(tr_event_handle* eh, tr_run_data* newest, tr_run_data* oldest)
+{
+    auto* head = eh->queue.load(std::memory_order_relaxed);
 
-    switch (ch)
+    do
     {
-    case 'r': /* run in libevent thread */
-        {
-            struct tr_run_data data;
-            size_t const nwant = sizeof(data);
-            ev_ssize_t const ngot = piperead(fd, &data, nwant);
+        oldest->next = head;
+    } while (!eh->queue.compare_exchange_weak(head, newest, std::memory_order_release, std::memory_order_relaxed));
 
-            if (!eh->die && ngot == (ev_ssize_t)nwant)
-            {
-                dbgmsg("invoking function in libevent thread");
-                (*data.func)(data.user_data);
-            }
+    /* if the queue wasn't empty, its first entry already woke the event thread */
+    if (head == nullptr)
+    {
+        wakeEventThread(eh);
+    }
+}
 
-            break;
-        }
+static void readFromQueue(evutil_socket_t fd, short eventType, void* veh)
+{
+    auto* eh = static_cast<tr_event_handle*>(veh);
 
-    case '\0': /* eof */
-        {
-            dbgmsg("pipe eof reached... removing event listener");
-            event_free(eh->pipeEvent);
-            tr_netCloseSocket(eh->fds[0]);
-            event_base_loopexit(eh->base, nullptr);
-            break;
-        }
+    dbgmsg("readFromQueue: eventType is %hd", eventType);
+
+    /* consume the wakeup before taking the queue. Anything pushed
+     * after this either makes it into this batch or wakes us again */
+    uint64_t buf[8];
+    auto const n_read = piperead(fd, buf, sizeof(buf));
+    dbgmsg("consumed wakeup, ret is %d, errno is %d", (int)n_read, (int)errno);
+
+    /* take everything at once and put it back in the order it was posted */
+    tr_run_data* data = nullptr;
+    for (auto* it = eh->queue.exchange(nullptr, std::memory_order_acquire); it != nullptr;)
+    {
+        auto* const next = it->next;
+        it->next = data;
+        data = it;
+        it = next;
+    }
 
-    default:
+    while (data != nullptr)
+    {
+        if (!eh->die)
         {
-            TR_ASSERT_MSG(false, "unhandled command type %d", (int)ch);
-            break;
+            (*data->func)(data->user_data);
         }
+
+        delete std::exchange(data, data->next);
+    }
+
+    if (eh->die)
+    {
+        dbgmsg("event queue closed... removing event listener");
+        event_free(eh->pipeEvent);
+        wakeupClose(eh->fds);
+        event_base_loopexit(eh->base, nullptr);
     }
 }
 
@@ -251,8 +335,8 @@ static void libeventThreadFunc(void* veh)
     eh->session->evdns_base = evdns_base_new(base, true);
     eh->session->events = eh;
 
-    /* listen to the pipe's read fd */
-    eh->pipeEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, readFromPipe, veh);
+    /* listen for work from other threads */
+    eh->pipeEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, readFromQueue, veh);
     event_add(eh->pipeEvent, nullptr);
     event_set_log_callback(logFunc);
 
@@ -262,25 +346,239 @@ static void libeventThreadFunc(void* veh)
         event_base_dispatch(base);
     }
 
-    /* shut down the thread */
+    /* shut down the thread, dropping anything posted after tr_eventClose() */
+    for (auto* data = eh->queue.exchange(nullptr); data != nullptr;)
+    {
+        delete std::exchange(data, data->next);
+    }
+
     event_base_free(base);
     eh->session->events = nullptr;
     delete eh;
     tr_logAddDebug("Closing libevent thread");
 }
 
+/***
+****  Peer loops
+***/
+
+#ifdef EVTHREAD_LOCK_API_VERSION
+
+/* libevent needs locks before its bases and buffers can be shared
+ * between threads. These use the standard library's, so that we don't
+ * need to link against libevent_pthreads too. */
+
+static void* lockAlloc(unsigned /*locktype*/)
+{
+    return new std::recursive_mutex{};
+}
+
+static void lockFree(void* lock, unsigned /*locktype*/)
+{
+    delete static_cast<std::recursive_mutex*>(lock);
+}
+
+static int lockLock(unsigned mode, void* lock)
+{
+    auto* const mutex = static_cast<std::recursive_mutex*>(lock);
+
+    if ((mode & EVTHREAD_TRY) != 0)
+    {
+        return mutex->try_lock() ? 0 : 1;
+    }
+
+    mutex->lock();
+    return 0;
+}
+
+static int lockUnlock(unsigned /*mode*/, void* lock)
+{
+    static_cast<std::recursive_mutex*>(lock)->unlock();
+    return 0;
+}
+
+static void* condAlloc(unsigned /*condtype*/)
+{
+    return new std::condition_variable_any{};
+}
+
+static void condFree(void* cond)
+{
+    delete static_cast<std::condition_variable_any*>(cond);
+}
+
+static int condSignal(void* vcond, int broadcast)
+{
+    auto* const cond = static_cast<std::condition_variable_any*>(vcond);
+
+    if (broadcast != 0)
+    {
+        cond->notify_all();
+    }
+    else
+    {
+        cond->notify_one();
+    }
+
+    return 0;
+}
+
+static int condWait(void* vcond, void* lock, struct timeval const* tv)
+{
+    auto* const cond = static_cast<std::condition_variable_any*>(vcond);
+    auto& mutex = *static_cast<std::recursive_mutex*>(lock);
+
+    if (tv == nullptr)
+    {
+        cond->wait(mutex);
+        return 0;
+    }
+
+    auto const timeout = std::chrono::seconds{ tv->tv_sec } + std::chrono::microseconds{ tv->tv_usec };
+    return cond->wait_for(mutex, timeout) == std::cv_status::timeout ? 1 : 0;
+}
+
+static unsigned long threadId()
+{
+    return std::hash<std::thread::id>{}(std::this_thread::get_id());
+}
+
+static bool useEventLocks()
+{
+    static std::once_flag once;
+
+    std::call_once(
+        once,
+        []()
+        {
+            static auto const locks = evthread_lock_callbacks{
+                EVTHREAD_LOCK_API_VERSION, EVTHREAD_LOCKTYPE_RECURSIVE, lockAlloc, lockFree, lockLock, lockUnlock,
+            };
+            static auto const conds = evthread_condition_callbacks{
+                EVTHREAD_CONDITION_API_VERSION, condAlloc, condFree, condSignal, condWait,
+            };
+
+            /* these fail harmlessly if the application has set up its own */
+            evthread_set_lock_callbacks(&locks);
+            evthread_set_condition_callbacks(&conds);
+            evthread_set_id_callback(threadId);
+        });
+
+    return true;
+}
+
+#else
+
+static bool useEventLocks()
+{
+    return false;
+}
+
+#endif
+
+static void peerLoopWakeup(evutil_socket_t /*fd*/, short /*events*/, void* /*vloop*/)
+{
+}
+
+static void peerLoopThreadFunc(tr_peer_loop* loop)
+{
+#ifndef _WIN32
+    /* Don't exit when writing on a broken socket */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    current_peer_loop = loop;
+
+    while (!loop->die)
+    {
+        event_base_loop(loop->base, EVLOOP_ONCE);
+
+        /* hand everything from this pass to the event thread at once */
+        if (loop->batch != nullptr)
+        {
+            pushToEventThread(loop->session->events, loop->batch, loop->batch_oldest);
+            loop->batch = nullptr;
+            loop->batch_oldest = nullptr;
+        }
+    }
+
+    current_peer_loop = nullptr;
+}
+
+static void peerLoopsStart(tr_event_handle* eh, int n)
+{
+    if (n > 0 && !useEventLocks())
+    {
+        tr_logAddError("Peer I/O threads need a libevent that was built with thread support");
+        return;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        auto loop = std::make_unique<tr_peer_loop>();
+        loop->session = eh->session;
+        loop->base = event_base_new();
+        loop->wakeup = event_new(loop->base, -1, EV_PERSIST, peerLoopWakeup, loop.get());
+
+        /* keep the loop from running out of events */
+        auto const keepalive = timeval{ 3600, 0 };
+        event_add(loop->wakeup, &keepalive);
+
+        loop->thread = std::thread(peerLoopThreadFunc, loop.get());
+        eh->peer_loops.push_back(std::move(loop));
+    }
+}
+
+static void peerLoopsStop(tr_event_handle* eh)
+{
+    for (auto& loop : eh->peer_loops)
+    {
+        loop->die = true;
+        event_active(loop->wakeup, EV_TIMEOUT, 1);
+    }
+
+    for (auto& loop : eh->peer_loops)
+    {
+        loop->thread.join();
+        event_free(loop->wakeup);
+        event_base_free(loop->base);
+    }
+
+    eh->peer_loops.clear();
+}
+
+struct event_base* tr_eventGetPeerBase(tr_session* session)
+{
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(session->events != nullptr);
+
+    auto* const eh = session->events;
+
+    if (std::empty(eh->peer_loops))
+    {
+        return session->event_base;
+    }
+
+    return eh->peer_loops[eh->next_peer_loop++ % std::size(eh->peer_loops)]->base;
+}
+
+/***
+****
+***/
+
 void tr_eventInit(tr_session* session)
 {
     session->events = nullptr;
 
     auto* const eh = new tr_event_handle{};
 
-    if (pipe(eh->fds) == -1)
+    if (!wakeupNew(eh->fds))
     {
-        tr_logAddError("Unable to write to pipe() in libtransmission: %s", tr_strerror(errno));
+        tr_logAddError("Unable to create libtransmission event queue: %s", tr_strerror(errno));
     }
 
     eh->session = session;
+    peerLoopsStart(eh, session->peerIoThreads);
     eh->thread = tr_threadNew(libeventThreadFunc, eh);
 
     /* wait until the libevent thread is running */
@@ -299,13 +597,19 @@ void tr_eventClose(tr_session* session)
         return;
     }
 
+    /* stop the peer loops first, so that their last results
+     * still reach the event thread */
+    peerLoopsStop(session->events);
+
     session->events->die = true;
     if (tr_logGetDeepEnabled())
     {
-        tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent pipe");
+        tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent queue");
     }
 
-    tr_netCloseSocket(session->events->fds[1]);
+    /* always wake it: the queue may already have a wakeup pending
+     * that the event thread consumed before seeing `die` */
+    wakeEventThread(session->events);
 }
 
 /**
@@ -333,23 +637,18 @@ void tr_runInEventThread(tr_session* session, void (*func)(void*), void* user_da
     {
         (*func)(user_data);
     }
-    else
+    else if (auto* const loop = current_peer_loop; loop != nullptr && loop->session == session)
     {
-        tr_event_handle* e = session->events;
-        auto const lock = std::unique_lock(e->fds_mutex);
-        auto data = tr_run_data{};
+        loop->batch = new tr_run_data{ func, user_data, loop->batch };
 
-        tr_pipe_end_t const fd = e->fds[1];
-        char ch = 'r';
-        ev_ssize_t const res_1 = pipewrite(fd, &ch, 1);
-
-        data.func = func;
-        data.user_data = user_data;
-        ev_ssize_t const res_2 = pipewrite(fd, &data, sizeof(data));
-
-        if (res_1 == -1 || res_2 == -1)
+        if (loop->batch_oldest == nullptr)
         {
-            tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+            loop->batch_oldest = loop->batch;
         }
     }
+    else
+    {
+        auto* const data = new tr_run_data{ func, user_data, nullptr };
+        pushToEventThread(session->events, data, data);
+    }
 }
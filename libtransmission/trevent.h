@@ -14,6 +14,8 @@
 
 #include "tr-macros.h"
 
+struct event_base;
+
 void tr_eventInit(tr_session*);
 
 void tr_eventClose(tr_session*);
@@ -21,3 +23,9 @@ void tr_eventClose(tr_session*);
 bool tr_amInEventThread(tr_session const*);
 
 void tr_runInEventThread(tr_session*, void (*func)(void*), void* user_data);
+
+/* the event base that a new peer socket should be polled by.
+ * this is the session's own unless `peer-io-threads` is set, in which case
+ * sockets are spread across that many extra loops. Calls made to
+ * tr_runInEventThread() from those loops are batched, one batch per pass. */
+struct event_base* tr_eventGetPeerBase(tr_session*);
@@ -7,132 +7,296 @@
  */
 
 #include <algorithm>
-#include <cstdlib> /* free() */
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstring> /* memcmp() */
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "transmission.h"
+#include "cache.h" /* tr_cacheCopyBlock() */
 #include "completion.h"
 #include "crypto-utils.h"
 #include "file.h"
+#include "inout.h" /* tr_ioFindFileLocation() */
 #include "log.h"
 #include "platform.h"
 #include "torrent.h"
 #include "tr-assert.h"
-#include "utils.h" /* tr_malloc(), tr_free() */
+#include "trevent.h" /* tr_runInEventThread() */
+#include "utils.h" /* tr_free(), tr_wait_msec() */
 #include "verify.h"
 
 /***
 ****
 ***/
 
-static auto constexpr MsecToSleepPerSecondDuringVerify = int{ 100 };
+/* caps how much memory a torrent's read-ahead buffers may use */
+static auto constexpr MaxVerifyBufferBytes = size_t{ 32 * 1024 * 1024 };
 
-static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
+/* a piece that's been read from disk and is waiting to be hashed,
+ * or that's been hashed and is waiting for its result to be applied */
+struct verify_piece
+{
+    tr_piece_index_t piece;
+    tr_sha1_digest_t hash;
+    bool had;
+    bool readable;
+    bool pass;
+    std::vector<uint8_t> buf;
+};
+
+/* the reader thread fills `unused` buffers and moves them to `unhashed`;
+ * the hash threads move them to `hashed`; and the reader applies the
+ * results and recycles the buffers. This keeps the disk busy while
+ * the pieces before it are being hashed. */
+struct verify_pipeline
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<verify_piece>> unused;
+    std::deque<std::unique_ptr<verify_piece>> unhashed;
+    std::vector<std::unique_ptr<verify_piece>> hashed;
+    int n_hashers = 0;
+    bool reading_done = false;
+};
+
+static void verifyHashThreadFunc(void* vpipeline)
+{
+    auto* const p = static_cast<verify_pipeline*>(vpipeline);
+    auto lock = std::unique_lock(p->mutex);
+
+    for (;;)
+    {
+        p->cv.wait(lock, [p]() { return !std::empty(p->unhashed) || p->reading_done; });
+
+        if (std::empty(p->unhashed))
+        {
+            break;
+        }
+
+        auto vp = std::move(p->unhashed.front());
+        p->unhashed.pop_front();
+        lock.unlock();
+
+        vp->pass = false;
+        if (vp->readable)
+        {
+            tr_sha1_ctx_t sha = tr_sha1_init();
+            tr_sha1_update(sha, std::data(vp->buf), std::size(vp->buf));
+            auto const hash = tr_sha1_final(sha);
+            vp->pass = hash && *hash == vp->hash;
+        }
+
+        lock.lock();
+        p->hashed.push_back(std::move(vp));
+        p->cv.notify_all();
+    }
+
+    --p->n_hashers;
+    p->cv.notify_all();
+}
+
+/* keeps all the torrents being verified under the session's verify speed limit */
+static void verifyThrottle(tr_session* session, uint64_t n_bytes, std::atomic<bool> const& stop)
+{
+    auto constexpr Window = std::chrono::seconds{ 1 };
+    auto& throttle = session->verify_throttle;
+    auto lock = std::unique_lock(throttle.mutex);
+
+    for (;;)
+    {
+        auto const limit = uint64_t{ session->verifySpeedLimit_Bps };
+        if (limit == 0 || stop)
+        {
+            return;
+        }
+
+        auto const now = std::chrono::steady_clock::now();
+        if (now - throttle.window_began_at >= Window)
+        {
+            throttle.window_began_at = now;
+            throttle.window_bytes = 0;
+        }
+
+        if (throttle.window_bytes < limit)
+        {
+            throttle.window_bytes += n_bytes;
+            return;
+        }
+
+        /* sleep until the next window, unless the verify is stopped first */
+        throttle.cv.wait_until(lock, throttle.window_began_at + Window);
+    }
+}
+
+/* wakes the verifies that are waiting in verifyThrottle() so they can see their stop flags */
+static void verifyThrottleWake(tr_session* session)
+{
+    auto const lock = std::lock_guard(session->verify_throttle.mutex);
+    session->verify_throttle.cv.notify_all();
+}
+
+/* applies the hashed pieces' results to the torrent. the caller must hold p->mutex */
+static void verifyApplyResults(tr_torrent* tor, verify_pipeline* p, tr_piece_index_t* n_done, bool* changed)
+{
+    for (auto& vp : p->hashed)
+    {
+        if (vp->pass || vp->had)
+        {
+            tor->setHasPiece(vp->piece, vp->pass);
+            *changed |= vp->pass != vp->had;
+        }
+
+        ++*n_done;
+        p->unused.push_back(std::move(vp));
+    }
+
+    if (!std::empty(p->hashed))
+    {
+        p->hashed.clear();
+        tor->anyDate = tr_time();
+        tor->verify_progress = *n_done / double(tor->info.pieceCount);
+    }
+}
+
+static bool verifyTorrent(tr_torrent* tor, std::atomic<bool> const& stop)
 {
     tr_sys_file_t fd = TR_BAD_SYS_FILE;
     uint64_t filePos = 0;
     bool changed = false;
-    bool hadPiece = false;
-    time_t lastSleptAt = 0;
-    uint32_t piecePos = 0;
     tr_file_index_t fileIndex = 0;
     tr_file_index_t prevFileIndex = !fileIndex;
-    tr_piece_index_t piece = 0;
+    tr_piece_index_t n_done = 0;
     time_t const begin = tr_time();
-    size_t const buflen = 1024 * 128; // 128 KiB buffer
-    auto* const buffer = static_cast<uint8_t*>(tr_malloc(buflen));
-
-    tr_sha1_ctx_t sha = tr_sha1_init();
 
     tr_logAddTorDbg(tor, "%s", "verifying torrent...");
     tor->verify_progress = 0;
 
-    while (!*stopFlag && piece < tor->info.pieceCount)
+    auto pipeline = verify_pipeline{};
+    int const n_hashers = std::max(tor->session->verifyThreads, 1);
+    auto const n_buffers = std::clamp(
+        MaxVerifyBufferBytes / std::max(size_t{ tor->info.pieceSize }, size_t{ 1 }),
+        size_t{ 2 },
+        size_t(n_hashers) * 2);
+    for (size_t i = 0; i < n_buffers; ++i)
     {
-        auto const file_length = tor->file(fileIndex).length;
+        pipeline.unused.push_back(std::make_unique<verify_piece>());
+    }
 
-        /* if we're starting a new piece... */
-        if (piecePos == 0)
-        {
-            hadPiece = tor->hasPiece(piece);
-        }
+    pipeline.n_hashers = n_hashers;
+    for (int i = 0; i < n_hashers; ++i)
+    {
+        tr_threadNew(verifyHashThreadFunc, &pipeline);
+    }
+
+    for (tr_piece_index_t piece = 0; !stop && piece < tor->info.pieceCount; ++piece)
+    {
+        auto vp = std::unique_ptr<verify_piece>{};
 
-        /* if we're starting a new file... */
-        if (filePos == 0 && fd == TR_BAD_SYS_FILE && fileIndex != prevFileIndex)
+        /* wait for a free buffer */
         {
-            char* filename = tr_torrentFindFile(tor, fileIndex);
-            fd = filename == nullptr ? TR_BAD_SYS_FILE :
-                                       tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
-            tr_free(filename);
-            prevFileIndex = fileIndex;
+            auto lock = std::unique_lock(pipeline.mutex);
+            pipeline.cv.wait(lock, [&pipeline]() { return !std::empty(pipeline.unused) || !std::empty(pipeline.hashed); });
+            verifyApplyResults(tor, &pipeline, &n_done, &changed);
+            vp = std::move(pipeline.unused.back());
+            pipeline.unused.pop_back();
         }
 
-        /* figure out how much we can read this pass */
-        uint64_t leftInPiece = tor->pieceSize(piece) - piecePos;
-        uint64_t leftInFile = file_length - filePos;
-        uint64_t bytesThisPass = std::min(leftInFile, leftInPiece);
-        bytesThisPass = std::min(bytesThisPass, uint64_t{ buflen });
+        vp->piece = piece;
+        vp->hash = tor->pieceHash(piece);
+        vp->had = tor->hasPiece(piece);
+        vp->readable = true;
+        vp->buf.resize(tor->pieceSize(piece));
 
-        /* read a bit */
-        if (fd != TR_BAD_SYS_FILE)
+        /* read the piece, which may span several files */
+        uint32_t piecePos = 0;
+        while (piecePos < std::size(vp->buf))
         {
-            auto numRead = uint64_t{};
-            if (tr_sys_file_read_at(fd, buffer, bytesThisPass, filePos, &numRead, nullptr) && numRead > 0)
+            auto const file_length = tor->file(fileIndex).length;
+
+            /* if we're starting a new file... */
+            if (filePos == 0 && fd == TR_BAD_SYS_FILE && fileIndex != prevFileIndex)
             {
-                bytesThisPass = numRead;
-                tr_sha1_update(sha, buffer, bytesThisPass);
-                tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
+                char* filename = tr_torrentFindFile(tor, fileIndex);
+                fd = filename == nullptr ? TR_BAD_SYS_FILE :
+                                           tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
+                tr_free(filename);
+                prevFileIndex = fileIndex;
             }
-        }
 
-        /* move our offsets */
-        leftInPiece -= bytesThisPass;
-        leftInFile -= bytesThisPass;
-        piecePos += bytesThisPass;
-        filePos += bytesThisPass;
+            /* figure out how much we can read this pass */
+            uint64_t const leftInPiece = std::size(vp->buf) - piecePos;
+            uint64_t const leftInFile = file_length - filePos;
+            uint64_t bytesThisPass = std::min(leftInFile, leftInPiece);
 
-        /* if we're finishing a piece... */
-        if (leftInPiece == 0)
-        {
-            auto hash = tr_sha1_final(sha);
-            auto const hasPiece = hash && *hash == tor->pieceHash(piece);
-
-            if (hasPiece || hadPiece)
+            /* read a bit. a short read just means we loop around for the rest */
+            if (bytesThisPass > 0)
             {
-                tor->setHasPiece(piece, hasPiece);
-                changed |= hasPiece != hadPiece;
+                verifyThrottle(tor->session, bytesThisPass, stop);
+
+                auto numRead = uint64_t{};
+                if (fd != TR_BAD_SYS_FILE &&
+                    tr_sys_file_read_at(fd, std::data(vp->buf) + piecePos, bytesThisPass, filePos, &numRead, nullptr) &&
+                    numRead > 0)
+                {
+                    bytesThisPass = numRead;
+                    tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
+                }
+                else
+                {
+                    vp->readable = false;
+                }
             }
 
-            time_t const now = tr_time();
-            tor->anyDate = now;
+            /* move our offsets */
+            piecePos += bytesThisPass;
+            filePos += bytesThisPass;
 
-            /* sleeping even just a few msec per second goes a long
-             * way towards reducing IO load... */
-            if (lastSleptAt != now)
+            /* if we're finishing a file... */
+            if (filePos == file_length)
             {
-                lastSleptAt = now;
-                tr_wait_msec(MsecToSleepPerSecondDuringVerify);
+                if (fd != TR_BAD_SYS_FILE)
+                {
+                    tr_sys_file_close(fd, nullptr);
+                    fd = TR_BAD_SYS_FILE;
+                }
+
+                fileIndex++;
+                filePos = 0;
             }
-
-            sha = tr_sha1_init();
-            ++piece;
-            tor->verify_progress = piece / double(tor->info.pieceCount);
-            piecePos = 0;
         }
 
-        /* if we're finishing a file... */
-        if (leftInFile == 0)
+        /* hand it off to the hash threads */
+        auto const lock = std::lock_guard(pipeline.mutex);
+        pipeline.unhashed.push_back(std::move(vp));
+        pipeline.cv.notify_all();
+    }
+
+    /* wait for the hash threads to finish */
+    {
+        auto lock = std::unique_lock(pipeline.mutex);
+        pipeline.reading_done = true;
+        pipeline.cv.notify_all();
+
+        for (;;)
         {
-            if (fd != TR_BAD_SYS_FILE)
+            verifyApplyResults(tor, &pipeline, &n_done, &changed);
+
+            if (pipeline.n_hashers == 0)
             {
-                tr_sys_file_close(fd, nullptr);
-                fd = TR_BAD_SYS_FILE;
+                break;
             }
 
-            fileIndex++;
-            filePos = 0;
+            pipeline.cv.wait(lock);
         }
     }
 
@@ -143,8 +307,6 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
     }
 
     tor->verify_progress.reset();
-    tr_sha1_final(sha);
-    free(buffer);
 
     /* stopwatch */
     time_t const end = tr_time();
@@ -185,6 +347,12 @@ struct verify_node
             return current_size < that.current_size ? -1 : 1;
         }
 
+        // tell same-sized torrents apart, or verifyList would only keep one of them
+        if (torrent != that.torrent)
+        {
+            return torrent->uniqueId < that.torrent->uniqueId ? -1 : 1;
+        }
+
         return 0;
     }
 
@@ -194,11 +362,25 @@ struct verify_node
     }
 };
 
-static struct verify_node currentNode;
+/* a torrent that a worker thread is verifying right now.
+ * it is owned by that thread until the verification is done */
+struct verify_active_node
+{
+    explicit verify_active_node(verify_node const& node_in)
+        : node{ node_in }
+    {
+    }
+
+    verify_node const node;
+
+    /* set when the torrent is removed or the session is closed */
+    std::atomic<bool> stop = false;
+};
+
 // TODO: refactor s.t. this doesn't leak
 static auto& verifyList{ *new std::set<verify_node>{} };
-static tr_thread* verifyThread = nullptr;
-static bool stopCurrent = false;
+static std::vector<verify_active_node*> verifyActive;
+static int verifyThreadCount = 0;
 
 static std::mutex verify_mutex_;
 
@@ -206,42 +388,46 @@ static void verifyThreadFunc(void* /*user_data*/)
 {
     for (;;)
     {
-        bool changed = false;
+        auto active = std::unique_ptr<verify_active_node>{};
 
         {
             auto const lock = std::lock_guard(verify_mutex_);
 
-            stopCurrent = false;
             if (std::empty(verifyList))
             {
-                currentNode.torrent = nullptr;
+                --verifyThreadCount;
                 break;
             }
 
             auto const it = std::begin(verifyList);
-            currentNode = *it;
+            active = std::make_unique<verify_active_node>(*it);
             verifyList.erase(it);
+            verifyActive.push_back(active.get());
         }
 
-        tr_torrent* tor = currentNode.torrent;
+        auto const& node = active->node;
+        tr_torrent* tor = node.torrent;
         tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
         tr_torrentSetVerifyState(tor, TR_VERIFY_NOW);
-        changed = verifyTorrent(tor, &stopCurrent);
+        bool const changed = verifyTorrent(tor, active->stop);
         tr_torrentSetVerifyState(tor, TR_VERIFY_NONE);
         TR_ASSERT(tr_isTorrent(tor));
 
-        if (!stopCurrent && changed)
+        bool const aborted = active->stop;
+
+        if (!aborted && changed)
         {
             tr_torrentSetDirty(tor);
         }
 
-        if (currentNode.callback_func != nullptr)
+        if (node.callback_func != nullptr)
         {
-            (*currentNode.callback_func)(tor, stopCurrent, currentNode.callback_data);
+            (*node.callback_func)(tor, aborted, node.callback_data);
         }
-    }
 
-    verifyThread = nullptr;
+        auto const lock = std::lock_guard(verify_mutex_);
+        verifyActive.erase(std::find(std::begin(verifyActive), std::end(verifyActive), active.get()));
+    }
 }
 
 void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* callback_data)
@@ -259,9 +445,10 @@ void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* call
     tr_torrentSetVerifyState(tor, TR_VERIFY_WAIT);
     verifyList.insert(node);
 
-    if (verifyThread == nullptr)
+    if (verifyThreadCount < std::max(tor->session->verifyQueueSize, 1))
     {
-        verifyThread = tr_threadNew(verifyThreadFunc, nullptr);
+        ++verifyThreadCount;
+        tr_threadNew(verifyThreadFunc, nullptr);
     }
 }
 
@@ -271,11 +458,18 @@ void tr_verifyRemove(tr_torrent* tor)
 
     verify_mutex_.lock();
 
-    if (tor == currentNode.torrent)
+    auto const isTor = [tor](auto const* active)
     {
-        stopCurrent = true;
+        return active->node.torrent == tor;
+    };
 
-        while (stopCurrent)
+    if (auto const active = std::find_if(std::begin(verifyActive), std::end(verifyActive), isTor);
+        active != std::end(verifyActive))
+    {
+        (*active)->stop = true;
+        verifyThrottleWake(tor->session);
+
+        while (std::any_of(std::begin(verifyActive), std::end(verifyActive), isTor))
         {
             verify_mutex_.unlock();
             tr_wait_msec(100);
@@ -305,10 +499,261 @@ void tr_verifyRemove(tr_torrent* tor)
     verify_mutex_.unlock();
 }
 
-void tr_verifyClose(tr_session* /*session*/)
+/***
+****  Newly-downloaded pieces
+***/
+
+/* how many threads may be hashing newly-downloaded pieces at once */
+static auto constexpr MaxPieceCheckThreads = size_t{ 2 };
+
+/* a run of bytes in the piece that wasn't in the cache and must be read from disk */
+struct piece_check_span
 {
-    auto const lock = std::lock_guard(verify_mutex_);
+    std::string filename;
+    uint64_t file_offset;
+    size_t piece_offset;
+    size_t length;
+};
+
+struct piece_check
+{
+    tr_session* session;
+    int torrent_id;
+    tr_piece_index_t piece;
+    tr_sha1_digest_t hash;
+    tr_verify_piece_done_func callback_func;
+    std::vector<uint8_t> buf;
+    std::vector<piece_check_span> spans;
+    std::optional<bool> pass;
+};
+
+/* the queue of pieces waiting to be checked, and the threads checking them.
+ * created by the first tr_verifyPieceAdd() and torn down by tr_verifyClose(),
+ * both of which run in the libevent thread */
+struct piece_checker
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::unique_ptr<piece_check>> queue;
+    std::vector<std::thread> threads;
+    bool closing = false;
+};
+
+static std::unique_ptr<piece_checker> pieceChecker;
+
+/* gather the parts of the piece that are still in the cache into check->buf
+ * and note where the rest of it lives on disk, so that the worker threads
+ * never need to touch the torrent */
+static bool pieceCheckPrepare(tr_torrent* tor, piece_check* check)
+{
+    tr_piece_index_t const piece = check->piece;
+    auto const piece_begin = tor->offset(piece, 0);
+    auto const [begin, end] = tor->blockSpanForPiece(piece);
+
+    check->buf.resize(tor->pieceSize(piece));
+
+    /* find the runs of blocks that aren't in the cache */
+    auto uncached = std::vector<std::pair<uint32_t, uint32_t>>{};
+    for (tr_block_index_t block = begin; block < end; ++block)
+    {
+        auto const offset = uint32_t(uint64_t{ block } * tor->block_size - piece_begin);
+        auto const length = tor->blockSize(block);
 
-    stopCurrent = true;
-    verifyList.clear();
+        if (tr_cacheCopyBlock(tor->session->cache, tor, piece, offset, length, std::data(check->buf) + offset))
+        {
+            continue;
+        }
+
+        if (!std::empty(uncached) && uncached.back().second == offset)
+        {
+            uncached.back().second += length;
+        }
+        else
+        {
+            uncached.emplace_back(offset, offset + length);
+        }
+    }
+
+    /* map those runs onto the torrent's files */
+    for (auto [offset, run_end] : uncached)
+    {
+        while (offset < run_end)
+        {
+            auto file_index = tr_file_index_t{};
+            auto file_offset = uint64_t{};
+            tr_ioFindFileLocation(tor, piece, offset, &file_index, &file_offset);
+
+            auto const file_length = tor->file(file_index).length;
+            auto const n = std::min(uint64_t{ run_end - offset }, file_length - file_offset);
+            if (n == 0)
+            {
+                return false;
+            }
+
+            char* const filename = tr_torrentFindFile(tor, file_index);
+            if (filename == nullptr)
+            {
+                return false;
+            }
+
+            check->spans.push_back({ filename, file_offset, offset, size_t(n) });
+            tr_free(filename);
+            offset += n;
+        }
+    }
+
+    return true;
+}
+
+static bool pieceCheckRead(piece_check* check)
+{
+    for (auto const& span : check->spans)
+    {
+        tr_sys_file_t const fd = tr_sys_file_open(span.filename.c_str(), TR_SYS_FILE_READ, 0, nullptr);
+        if (fd == TR_BAD_SYS_FILE)
+        {
+            return false;
+        }
+
+        auto* walk = std::data(check->buf) + span.piece_offset;
+        auto file_offset = span.file_offset;
+        auto left = uint64_t{ span.length };
+        while (left > 0)
+        {
+            auto n_read = uint64_t{};
+            if (!tr_sys_file_read_at(fd, walk, left, file_offset, &n_read, nullptr) || n_read == 0)
+            {
+                break;
+            }
+
+            walk += n_read;
+            file_offset += n_read;
+            left -= n_read;
+        }
+
+        tr_sys_file_close(fd, nullptr);
+
+        if (left > 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void onPieceCheckDone(void* vcheck)
+{
+    auto const check = std::unique_ptr<piece_check>{ static_cast<piece_check*>(vcheck) };
+
+    tr_torrent* const tor = tr_torrentFindFromId(check->session, check->torrent_id);
+    if (tor != nullptr)
+    {
+        (*check->callback_func)(tor, check->piece, check->pass);
+    }
+}
+
+static void pieceCheckThreadFunc(piece_checker* checker)
+{
+    for (;;)
+    {
+        auto check = std::unique_ptr<piece_check>{};
+
+        {
+            auto lock = std::unique_lock(checker->mutex);
+            checker->cv.wait(lock, [checker]() { return !std::empty(checker->queue) || checker->closing; });
+
+            if (checker->closing)
+            {
+                break;
+            }
+
+            check = std::move(checker->queue.front());
+            checker->queue.pop_front();
+        }
+
+        if (pieceCheckRead(check.get()))
+        {
+            tr_sha1_ctx_t sha = tr_sha1_init();
+            tr_sha1_update(sha, std::data(check->buf), std::size(check->buf));
+            auto const hash = tr_sha1_final(sha);
+            check->pass = hash && *hash == check->hash;
+        }
+
+        tr_session* const session = check->session;
+        tr_runInEventThread(session, onPieceCheckDone, check.release());
+    }
+}
+
+void tr_verifyPieceAdd(tr_torrent* tor, tr_piece_index_t piece, tr_verify_piece_done_func callback_func)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tr_amInEventThread(tor->session));
+    TR_ASSERT(piece < tor->info.pieceCount);
+
+    auto check = std::make_unique<piece_check>();
+    check->session = tor->session;
+    check->torrent_id = tor->uniqueId;
+    check->piece = piece;
+    check->hash = tor->pieceHash(piece);
+    check->callback_func = callback_func;
+
+    if (!pieceCheckPrepare(tor, check.get()))
+    {
+        (*callback_func)(tor, piece, {});
+        return;
+    }
+
+    if (!pieceChecker)
+    {
+        pieceChecker = std::make_unique<piece_checker>();
+    }
+
+    auto* const checker = pieceChecker.get();
+    auto const lock = std::lock_guard(checker->mutex);
+    checker->queue.push_back(std::move(check));
+    checker->cv.notify_one();
+
+    if (std::size(checker->threads) < MaxPieceCheckThreads)
+    {
+        checker->threads.emplace_back(pieceCheckThreadFunc, checker);
+    }
+}
+
+/***
+****
+***/
+
+void tr_verifyClose(tr_session* session)
+{
+    {
+        auto const lock = std::lock_guard(verify_mutex_);
+
+        for (auto* const active : verifyActive)
+        {
+            active->stop = true;
+        }
+
+        verifyList.clear();
+    }
+
+    verifyThrottleWake(session);
+
+    /* wait for the piece checkers so none of them posts a result after the session is gone */
+    if (pieceChecker)
+    {
+        {
+            auto const lock = std::lock_guard(pieceChecker->mutex);
+            pieceChecker->closing = true;
+            pieceChecker->queue.clear();
+            pieceChecker->cv.notify_all();
+        }
+
+        for (auto& thread : pieceChecker->threads)
+        {
+            thread.join();
+        }
+
+        pieceChecker.reset();
+    }
 }
@@ -12,6 +12,10 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <optional>
+
+#include "transmission.h"
+
 /**
  * @addtogroup file_io File IO
  * @{
@@ -23,4 +27,18 @@ void tr_verifyRemove(tr_torrent* tor);
 
 void tr_verifyClose(tr_session*);
 
+/**
+ * `pass` is empty if the piece couldn't be read, e.g. if its file was moved
+ * while the piece was being checked.
+ */
+using tr_verify_piece_done_func = void (*)(tr_torrent* tor, tr_piece_index_t piece, std::optional<bool> pass);
+
+/**
+ * Test a newly-downloaded piece's checksum in a worker thread.
+ * The piece's data is gathered in the calling thread, so its blocks
+ * must already be in the cache or on disk. `callback_func` is invoked
+ * from the libevent thread unless the torrent is removed first.
+ */
+void tr_verifyPieceAdd(tr_torrent* tor, tr_piece_index_t piece, tr_verify_piece_done_func callback_func);
+
 /* @} */
@@ -0,0 +1,238 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "transmission.h"
+#include "bandwidth.h"
+
+#include "gtest/gtest.h"
+
+// Simulates Bandwidth::allocate()'s first phase: a set of peers with data
+// queued share a single period's bandwidth budget, and each flush stands
+// in for one read() or write() on a peer's socket.
+class BandwidthTest : public ::testing::Test
+{
+protected:
+    struct Peer
+    {
+        tr_priority_t priority;
+        uint64_t queued;
+        uint64_t sent = 0;
+        size_t flushes = 0;
+    };
+
+    struct Result
+    {
+        std::vector<Peer> peers;
+        size_t flushes;
+    };
+
+    static Result simulate(std::vector<Peer> peers, uint64_t budget, size_t first = 0)
+    {
+        auto const quantum = [&peers](size_t i)
+        {
+            return Bandwidth::TcpQuantum * Bandwidth::priorityWeight(peers[i].priority);
+        };
+
+        auto const flush = [&peers, &budget](size_t i, size_t offered)
+        {
+            auto& peer = peers[i];
+            auto const used = std::min({ uint64_t{ offered }, peer.queued, budget });
+            peer.queued -= used;
+            peer.sent += used;
+            ++peer.flushes;
+            budget -= used;
+            return size_t(used);
+        };
+
+        auto const flushes = Bandwidth::roundRobin(std::size(peers), first, quantum, flush);
+        return { peers, flushes };
+    }
+
+    static uint64_t totalSent(std::vector<Peer> const& peers)
+    {
+        return std::accumulate(
+            std::begin(peers),
+            std::end(peers),
+            uint64_t{},
+            [](uint64_t sum, Peer const& peer) { return sum + peer.sent; });
+    }
+};
+
+TEST_F(BandwidthTest, sharesByPriority)
+{
+    auto constexpr Budget = uint64_t{ 7 * 1024 * 1024 };
+    auto constexpr Plenty = uint64_t{ 100 * 1024 * 1024 };
+
+    auto const result = simulate(
+        {
+            { TR_PRI_LOW, Plenty },
+            { TR_PRI_NORMAL, Plenty },
+            { TR_PRI_HIGH, Plenty },
+        },
+        Budget);
+
+    auto const& peers = result.peers;
+    EXPECT_EQ(Budget, totalSent(peers));
+
+    // everyone's backlogged, so the budget is split 1:2:4,
+    // give or take the partial round at the end
+    auto const unit = Budget / 7;
+    auto constexpr Slop = uint64_t{ 4 * Bandwidth::TcpQuantum };
+    EXPECT_NEAR(1 * unit, peers[0].sent, Slop);
+    EXPECT_NEAR(2 * unit, peers[1].sent, Slop);
+    EXPECT_NEAR(4 * unit, peers[2].sent, Slop);
+
+    // and each peer gets it in the same number of large writes
+    EXPECT_LE(peers[2].flushes, peers[0].flushes + 1);
+    EXPECT_LE(peers[0].flushes, peers[2].flushes + 1);
+}
+
+TEST_F(BandwidthTest, sharesEquallyAtSamePriority)
+{
+    auto constexpr Budget = uint64_t{ 10 * 1024 * 1024 };
+    auto constexpr Plenty = uint64_t{ 100 * 1024 * 1024 };
+
+    auto const result = simulate(std::vector<Peer>(10, Peer{ TR_PRI_NORMAL, Plenty }), Budget);
+
+    auto const& peers = result.peers;
+    EXPECT_EQ(Budget, totalSent(peers));
+
+    for (auto const& peer : peers)
+    {
+        EXPECT_NEAR(Budget / 10, peer.sent, 2 * Bandwidth::TcpQuantum);
+    }
+}
+
+TEST_F(BandwidthTest, unusedBandwidthGoesToBusyPeers)
+{
+    auto constexpr Budget = uint64_t{ 4 * 1024 * 1024 };
+    auto constexpr Plenty = uint64_t{ 100 * 1024 * 1024 };
+    auto constexpr Little = uint64_t{ 50000 };
+
+    auto const result = simulate(
+        {
+            { TR_PRI_HIGH, Little },
+            { TR_PRI_NORMAL, Plenty },
+            { TR_PRI_LOW, 0 },
+            { TR_PRI_NORMAL, Plenty },
+        },
+        Budget);
+
+    auto const& peers = result.peers;
+    EXPECT_EQ(Budget, totalSent(peers));
+
+    // peers that have little or nothing to send are done early...
+    EXPECT_EQ(Little, peers[0].sent);
+    EXPECT_EQ(0U, peers[2].sent);
+    EXPECT_EQ(1U, peers[2].flushes);
+
+    // ...and the busy ones split what's left
+    EXPECT_NEAR((Budget - Little) / 2, peers[1].sent, Bandwidth::TcpQuantum * 2);
+    EXPECT_NEAR((Budget - Little) / 2, peers[3].sent, Bandwidth::TcpQuantum * 2);
+}
+
+TEST_F(BandwidthTest, stopsWhenBudgetIsSpent)
+{
+    auto constexpr Plenty = uint64_t{ 100 * 1024 * 1024 };
+
+    auto const result = simulate(std::vector<Peer>(50, Peer{ TR_PRI_NORMAL, Plenty }), 0);
+
+    // one look at each peer is enough to see there's nothing to send
+    EXPECT_EQ(50U, result.flushes);
+    EXPECT_EQ(0U, totalSent(result.peers));
+}
+
+TEST_F(BandwidthTest, flushCount)
+{
+    // 50 MiB/s shared by 50 peers over a 500 msec period
+    auto constexpr Budget = uint64_t{ 25 * 1024 * 1024 };
+    auto constexpr Plenty = uint64_t{ 100 * 1024 * 1024 };
+    auto constexpr NumPeers = size_t{ 50 };
+
+    auto const result = simulate(std::vector<Peer>(NumPeers, Peer{ TR_PRI_NORMAL, Plenty }), Budget);
+    EXPECT_EQ(Budget, totalSent(result.peers));
+
+    // every flush but the last round's moves a full quantum
+    auto const quantum = Bandwidth::TcpQuantum * Bandwidth::priorityWeight(TR_PRI_NORMAL);
+    EXPECT_LE(result.flushes, Budget / quantum + 2 * NumPeers);
+
+    // handing out 3000-byte increments would've taken this many
+    EXPECT_LT(result.flushes * 10, Budget / 3000);
+}
+
+TEST_F(BandwidthTest, rotatesFirstPeer)
+{
+    auto constexpr Plenty = uint64_t{ 100 * 1024 * 1024 };
+    auto const peers = std::vector<Peer>(4, Peer{ TR_PRI_NORMAL, Plenty });
+    auto const quantum = Bandwidth::TcpQuantum * Bandwidth::priorityWeight(TR_PRI_NORMAL);
+
+    // with only one quantum to hand out, whoever goes first gets it
+    for (size_t first = 0; first < 8; ++first)
+    {
+        auto const result = simulate(peers, quantum, first);
+
+        for (size_t i = 0; i < std::size(peers); ++i)
+        {
+            EXPECT_EQ(i == first % std::size(peers) ? quantum : 0U, result.peers[i].sent);
+        }
+    }
+}
+
+TEST_F(BandwidthTest, speedWindow)
+{
+    auto bandwidth = Bandwidth{};
+    auto constexpr Start = uint64_t{ 1000000 };
+    auto constexpr Window = uint64_t{ Bandwidth::HistoryMSec };
+
+    EXPECT_EQ(0U, bandwidth.getRawSpeedBytesPerSecond(Start, TR_UP));
+
+    // 1000 bytes every 10 msec is 100 KB/s
+    for (uint64_t now = Start; now < Start + Window; now += 10)
+    {
+        bandwidth.notifyBandwidthConsumed(TR_UP, 1000, true, now);
+    }
+
+    auto const now = Start + Window - 1;
+    EXPECT_EQ(100000U, bandwidth.getRawSpeedBytesPerSecond(now, TR_UP));
+    EXPECT_EQ(100000U, bandwidth.getPieceSpeedBytesPerSecond(now, TR_UP));
+    EXPECT_EQ(0U, bandwidth.getRawSpeedBytesPerSecond(now, TR_DOWN));
+
+    // protocol overhead counts in the raw speed but not the piece speed
+    bandwidth.notifyBandwidthConsumed(TR_UP, 2000, false, now);
+    EXPECT_EQ(101000U, bandwidth.getRawSpeedBytesPerSecond(now, TR_UP));
+    EXPECT_EQ(100000U, bandwidth.getPieceSpeedBytesPerSecond(now, TR_UP));
+
+    // once the transfers slide out of the window, the speed drops off
+    EXPECT_GT(bandwidth.getRawSpeedBytesPerSecond(now + Window / 2, TR_UP), 0U);
+    EXPECT_LT(bandwidth.getRawSpeedBytesPerSecond(now + Window / 2, TR_UP), 60000U);
+    EXPECT_EQ(0U, bandwidth.getRawSpeedBytesPerSecond(now + Window + 1, TR_UP));
+
+    // and picks back up from zero
+    bandwidth.notifyBandwidthConsumed(TR_UP, 4000, true, now + Window * 10);
+    EXPECT_EQ(2000U, bandwidth.getRawSpeedBytesPerSecond(now + Window * 10, TR_UP));
+}
+
+TEST_F(BandwidthTest, speedIsSummedUpTheTree)
+{
+    auto parent = Bandwidth{};
+    auto child_a = Bandwidth{ &parent };
+    auto child_b = Bandwidth{ &parent };
+    auto constexpr Now = uint64_t{ 1000000 };
+
+    child_a.notifyBandwidthConsumed(TR_DOWN, 3000, true, Now);
+    child_b.notifyBandwidthConsumed(TR_DOWN, 1000, true, Now);
+
+    EXPECT_EQ(1500U, child_a.getPieceSpeedBytesPerSecond(Now, TR_DOWN));
+    EXPECT_EQ(500U, child_b.getPieceSpeedBytesPerSecond(Now, TR_DOWN));
+    EXPECT_EQ(2000U, parent.getPieceSpeedBytesPerSecond(Now, TR_DOWN));
+}
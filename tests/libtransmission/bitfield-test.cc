@@ -17,6 +17,7 @@
 #include "utils.h" /* tr_free */
 
 #include "gtest/gtest.h"
+#include "test-fixtures.h"
 
 TEST(Bitfield, count)
 {
@@ -323,3 +324,206 @@ TEST(Bitfield, hasAllNone)
         EXPECT_TRUE(!field.hasNone());
     }
 }
+
+TEST(Bitfield, rawRoundTrip)
+{
+    // sizes that do and don't land on byte and word boundaries
+    for (size_t const bit_count : { 1, 7, 8, 63, 64, 65, 127, 128, 129, 1000 })
+    {
+        auto raw = std::vector<uint8_t>((bit_count + 7) / 8);
+        for (auto& byte : raw)
+        {
+            byte = uint8_t(tr_rand_int_weak(256));
+        }
+
+        auto bf = tr_bitfield{ bit_count };
+        bf.setRaw(std::data(raw), std::size(raw));
+
+        // spare bits at the end are dropped
+        if (auto const spare = std::size(raw) * 8 - bit_count; spare != 0)
+        {
+            raw.back() &= 0xFF << spare;
+        }
+
+        EXPECT_EQ(raw, bf.raw());
+
+        auto expected_count = size_t{};
+        for (size_t i = 0; i < bit_count; ++i)
+        {
+            auto const is_set = (raw[i / 8] & (0x80 >> (i % 8))) != 0;
+            EXPECT_EQ(is_set, bf.test(i));
+            expected_count += is_set ? 1 : 0;
+        }
+
+        EXPECT_EQ(expected_count, bf.count());
+    }
+}
+
+TEST(Bitfield, rawWithUnknownSize)
+{
+    // a magnet link's peers can send us bits before we know the bit count.
+    // raw() returns as many bytes as have been used, not whole words
+    auto bf = tr_bitfield{ 0 };
+    EXPECT_TRUE(std::empty(bf.raw()));
+
+    bf.set(0);
+    EXPECT_EQ(std::vector<uint8_t>({ 0x80 }), bf.raw());
+
+    bf.set(9);
+    EXPECT_EQ(std::vector<uint8_t>({ 0x80, 0x40 }), bf.raw());
+
+    // unsetting a bit doesn't shrink it
+    bf.unset(9);
+    EXPECT_EQ(std::vector<uint8_t>({ 0x80, 0x00 }), bf.raw());
+
+    auto const raw = std::vector<uint8_t>({ 0x01, 0x02, 0x03 });
+    bf.setRaw(std::data(raw), std::size(raw));
+    EXPECT_EQ(raw, bf.raw());
+
+    bool const flags[] = { false, true, false, false, false, false, false, false, false, true };
+    bf.setFromBools(flags, std::size(flags));
+    EXPECT_EQ(std::vector<uint8_t>({ 0x40, 0x40 }), bf.raw());
+
+    bf.setHasNone();
+    EXPECT_TRUE(std::empty(bf.raw()));
+}
+
+TEST(Bitfield, intersection)
+{
+    auto constexpr BitCount = size_t{ 1000 };
+
+    auto a = tr_bitfield{ BitCount };
+    auto b = tr_bitfield{ BitCount };
+    for (size_t i = 0; i < BitCount; ++i)
+    {
+        a.set(i, i % 2 == 0);
+        b.set(i, i % 3 == 0);
+    }
+
+    auto const count = [](size_t n, auto pred)
+    {
+        auto ret = size_t{};
+        for (size_t i = 0; i < n; ++i)
+        {
+            ret += pred(i) ? 1 : 0;
+        }
+        return ret;
+    };
+
+    auto const both = count(BitCount, [](size_t i) { return i % 6 == 0; });
+    EXPECT_EQ(both, a.countIntersection(b));
+    EXPECT_EQ(both, b.countIntersection(a));
+
+    auto all = tr_bitfield{ BitCount };
+    all.setHasAll();
+    auto none = tr_bitfield{ BitCount };
+    none.setHasNone();
+    EXPECT_EQ(a.count(), a.countIntersection(all));
+    EXPECT_EQ(a.count(), all.countIntersection(a));
+    EXPECT_EQ(0U, a.countIntersection(none));
+    EXPECT_EQ(0U, none.countIntersection(all));
+
+    auto c = a;
+    c.intersect(b);
+    EXPECT_EQ(both, c.count());
+    for (size_t i = 0; i < BitCount; ++i)
+    {
+        EXPECT_EQ(i % 6 == 0, c.test(i));
+    }
+
+    c = a;
+    c.subtract(b);
+    EXPECT_EQ(count(BitCount, [](size_t i) { return i % 2 == 0 && i % 3 != 0; }), c.count());
+    for (size_t i = 0; i < BitCount; ++i)
+    {
+        EXPECT_EQ(i % 2 == 0 && i % 3 != 0, c.test(i));
+    }
+
+    // the have-all and have-none special cases
+    c = all;
+    c.intersect(b);
+    EXPECT_EQ(b.count(), c.count());
+    EXPECT_EQ(b.raw(), c.raw());
+
+    c = all;
+    c.subtract(b);
+    EXPECT_EQ(BitCount - b.count(), c.count());
+    EXPECT_FALSE(c.test(0));
+    EXPECT_TRUE(c.test(1));
+
+    c = a;
+    c.intersect(none);
+    EXPECT_TRUE(c.hasNone());
+
+    c = a;
+    c.subtract(all);
+    EXPECT_TRUE(c.hasNone());
+
+    c = a;
+    c.intersect(all);
+    EXPECT_EQ(a.raw(), c.raw());
+
+    c = a;
+    c.subtract(a);
+    EXPECT_TRUE(c.hasNone());
+
+    c = a;
+    auto not_a = all;
+    not_a.subtract(a);
+    c.subtract(not_a);
+    EXPECT_EQ(a.raw(), c.raw());
+}
+
+TEST(Bitfield, DISABLED_benchmark)
+{
+    // block completion for a large torrent, e.g. 64 GiB in 16 KiB blocks
+    static auto constexpr BitCount = size_t{ 4 * 1024 * 1024 };
+    static auto constexpr Rounds = size_t{ 100 };
+
+    auto raw = std::vector<uint8_t>(BitCount / 8);
+    for (auto& byte : raw)
+    {
+        byte = uint8_t(tr_rand_int_weak(256));
+    }
+
+    auto a = tr_bitfield{ BitCount };
+    a.setRaw(std::data(raw), std::size(raw));
+    auto b = tr_bitfield{ BitCount };
+    b.setRaw(std::data(raw), std::size(raw) / 2);
+
+    // the results are summed and checked so that the calls can't be optimized away
+    auto const time = [](char const* name, auto func)
+    {
+        auto sum = size_t{};
+        libtransmission::test::benchmark(name, Rounds, [&sum, &func](size_t i) { sum += func(i); });
+        EXPECT_NE(0U, sum);
+    };
+
+    time("count(begin, end)", [&a](size_t i) { return a.count(i, BitCount - i); });
+    time("countIntersection", [&a, &b](size_t /*i*/) { return a.countIntersection(b); });
+    time(
+        "setSpan + unsetSpan",
+        [&a](size_t i)
+        {
+            a.setSpan(i, BitCount / 2 + i);
+            a.unsetSpan(BitCount / 4 + i, BitCount - i);
+            return a.count();
+        });
+    time(
+        "intersect",
+        [&a, &b](size_t /*i*/)
+        {
+            auto c = a;
+            c.intersect(b);
+            return c.count();
+        });
+    time("raw", [&a](size_t /*i*/) { return std::size(a.raw()); });
+    time(
+        "setRaw",
+        [&raw](size_t /*i*/)
+        {
+            auto c = tr_bitfield{ BitCount };
+            c.setRaw(std::data(raw), std::size(raw));
+            return c.count();
+        });
+}
@@ -0,0 +1,319 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "cache.h"
+#include "session.h"
+#include "torrent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class CacheTest : public SessionTest
+{
+protected:
+    void SetUp() override
+    {
+        SessionTest::SetUp();
+        tor_ = zeroTorrentInit();
+        ASSERT_NE(nullptr, tor_);
+    }
+
+    void TearDown() override
+    {
+        runInEventThread([this]() { tr_cacheFlushTorrent(session_->cache, tor_); });
+        tr_torrentRemove(tor_, false, nullptr);
+        SessionTest::TearDown();
+    }
+
+    [[nodiscard]] uint32_t blockOffset(tr_block_index_t block) const
+    {
+        auto const piece = tor_->pieceForBlock(block);
+        return uint32_t(uint64_t{ block } * tor_->block_size - tor_->offset(piece, 0));
+    }
+
+    [[nodiscard]] std::vector<uint8_t> blockContents(tr_block_index_t block) const
+    {
+        return std::vector<uint8_t>(tor_->blockSize(block), uint8_t(block + 1));
+    }
+
+    void writeBlock(tr_block_index_t block)
+    {
+        auto const contents = blockContents(block);
+        auto* const buf = evbuffer_new();
+        evbuffer_add(buf, std::data(contents), std::size(contents));
+        auto const piece = tor_->pieceForBlock(block);
+        EXPECT_EQ(0, tr_cacheWriteBlock(session_->cache, tor_, piece, blockOffset(block), std::size(contents), buf));
+        evbuffer_free(buf);
+    }
+
+    [[nodiscard]] std::vector<uint8_t> readBlock(tr_block_index_t block)
+    {
+        auto contents = std::vector<uint8_t>(tor_->blockSize(block));
+        auto const piece = tor_->pieceForBlock(block);
+        auto const offset = blockOffset(block);
+        EXPECT_EQ(0, tr_cacheReadBlock(session_->cache, tor_, piece, offset, std::size(contents), std::data(contents)));
+        return contents;
+    }
+
+    [[nodiscard]] bool hasBlock(tr_block_index_t block) const
+    {
+        auto const piece = tor_->pieceForBlock(block);
+        return tr_cacheHasBlocks(session_->cache, tor_, piece, blockOffset(block), tor_->blockSize(block));
+    }
+
+    tr_torrent* tor_ = nullptr;
+};
+
+TEST_F(CacheTest, flushFile)
+{
+    // the zero torrent's first file has blocks [0..64) and the other two share block 64
+    auto const [begin, end] = tr_torGetFileBlockSpan(tor_, 0);
+    EXPECT_EQ(0U, begin);
+    EXPECT_EQ(64U, end);
+
+    runInEventThread(
+        [&, end = end]()
+        {
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                writeBlock(block);
+            }
+
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_TRUE(hasBlock(block));
+                EXPECT_EQ(blockContents(block), readBlock(block));
+            }
+
+            // only the first file's blocks are written out
+            EXPECT_EQ(0, tr_cacheFlushFile(session_->cache, tor_, 0));
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_EQ(block >= end, hasBlock(block));
+            }
+
+            // and they read back from disk unchanged
+            for (tr_block_index_t block = 0; block < end; ++block)
+            {
+                EXPECT_EQ(blockContents(block), readBlock(block));
+            }
+        });
+}
+
+TEST_F(CacheTest, flushRunsWrittenOutOfOrder)
+{
+    runInEventThread(
+        [&]()
+        {
+            EXPECT_EQ(0, tr_cacheSetLimit(session_->cache, 8 * 1024 * 1024));
+
+            // every other block of the first file, then a run across the
+            // first file's end that's written back to front
+            auto is_written = std::vector<bool>(tor_->n_blocks);
+            auto const write = [&](tr_block_index_t block)
+            {
+                writeBlock(block);
+                is_written[block] = true;
+            };
+            for (tr_block_index_t block = 0; block < 32; block += 2)
+            {
+                write(block);
+            }
+            for (tr_block_index_t block = tor_->n_blocks; block-- > 58;)
+            {
+                write(block);
+            }
+
+            // filling a gap joins the runs on either side, or extends one
+            write(1);
+            write(31);
+
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_EQ(is_written[block], hasBlock(block));
+            }
+
+            // flushing the first file splits the run at its end
+            EXPECT_EQ(0, tr_cacheFlushFile(session_->cache, tor_, 0));
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_EQ(is_written[block] && block >= 64, hasBlock(block));
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(session_->cache, tor_));
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_FALSE(hasBlock(block));
+
+                if (is_written[block])
+                {
+                    EXPECT_EQ(blockContents(block), readBlock(block));
+                }
+            }
+        });
+}
+
+TEST_F(CacheTest, flushTorrentFreesSlabs)
+{
+    runInEventThread(
+        [&]()
+        {
+            EXPECT_EQ(0, tr_cacheSetLimit(session_->cache, 8 * 1024 * 1024));
+            EXPECT_EQ(0U, tr_cacheGetStats(session_->cache).write_slab_bytes);
+
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                writeBlock(block);
+            }
+
+            EXPECT_LE(uint64_t{ tor_->n_blocks } * tor_->block_size, tr_cacheGetStats(session_->cache).write_slab_bytes);
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(session_->cache, tor_));
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_FALSE(hasBlock(block));
+                EXPECT_EQ(blockContents(block), readBlock(block));
+            }
+
+            EXPECT_EQ(0U, tr_cacheGetStats(session_->cache).write_slab_bytes);
+        });
+}
+
+TEST_F(CacheTest, setLimitFreesSlabs)
+{
+    runInEventThread(
+        [&]()
+        {
+            EXPECT_EQ(0, tr_cacheSetLimit(session_->cache, 8 * 1024 * 1024));
+
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                writeBlock(block);
+            }
+
+            auto const before = tr_cacheGetStats(session_->cache).write_slab_bytes;
+
+            // shrinking the cache writes blocks out and frees the slabs they leave empty
+            EXPECT_EQ(0, tr_cacheSetLimit(session_->cache, 0));
+            EXPECT_LT(tr_cacheGetStats(session_->cache).write_slab_bytes, before);
+
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_EQ(blockContents(block), readBlock(block));
+            }
+        });
+}
+
+TEST_F(CacheTest, writeBlockBuffer)
+{
+    runInEventThread(
+        [&]()
+        {
+            EXPECT_EQ(0, tr_cacheSetLimit(session_->cache, 8 * 1024 * 1024));
+
+            // the cache takes over each buffer as the block's slot
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                auto const contents = blockContents(block);
+                auto* const buf = tr_cacheAcquireBlockBuffer(session_->cache);
+                ASSERT_NE(nullptr, buf);
+                std::copy(std::begin(contents), std::end(contents), buf);
+
+                auto const piece = tor_->pieceForBlock(block);
+                auto const offset = blockOffset(block);
+                EXPECT_EQ(0, tr_cacheWriteBlockBuffer(session_->cache, tor_, piece, offset, std::size(contents), buf));
+            }
+
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_TRUE(hasBlock(block));
+                EXPECT_EQ(blockContents(block), readBlock(block));
+            }
+
+            // a newer copy of a block replaces the older one
+            auto contents = blockContents(0);
+            std::fill(std::begin(contents), std::end(contents), uint8_t{ 0xFF });
+            auto* const buf = tr_cacheAcquireBlockBuffer(session_->cache);
+            std::copy(std::begin(contents), std::end(contents), buf);
+            EXPECT_EQ(0, tr_cacheWriteBlockBuffer(session_->cache, tor_, 0, 0, std::size(contents), buf));
+            EXPECT_EQ(contents, readBlock(0));
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(session_->cache, tor_));
+            EXPECT_EQ(contents, readBlock(0));
+            for (tr_block_index_t block = 1; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_FALSE(hasBlock(block));
+                EXPECT_EQ(blockContents(block), readBlock(block));
+            }
+
+            EXPECT_EQ(0U, tr_cacheGetStats(session_->cache).write_slab_bytes);
+        });
+}
+
+TEST_F(CacheTest, releaseBlockBuffer)
+{
+    runInEventThread(
+        [&]()
+        {
+            EXPECT_EQ(0, tr_cacheSetLimit(session_->cache, 8 * 1024 * 1024));
+
+            // e.g. peers that disconnect partway through their blocks
+            auto bufs = std::vector<uint8_t*>{};
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                bufs.push_back(tr_cacheAcquireBlockBuffer(session_->cache));
+                ASSERT_NE(nullptr, bufs.back());
+            }
+
+            auto const bytes = tr_cacheGetStats(session_->cache).write_slab_bytes;
+            EXPECT_LE(uint64_t{ tor_->n_blocks } * tor_->block_size, bytes);
+
+            for (auto* const buf : bufs)
+            {
+                tr_cacheReleaseBlockBuffer(session_->cache, buf);
+            }
+
+            // nothing was written...
+            for (tr_block_index_t block = 0; block < tor_->n_blocks; ++block)
+            {
+                EXPECT_FALSE(hasBlock(block));
+            }
+
+            // ...the released slots get reused...
+            for (auto& buf : bufs)
+            {
+                buf = tr_cacheAcquireBlockBuffer(session_->cache);
+            }
+
+            EXPECT_EQ(bytes, tr_cacheGetStats(session_->cache).write_slab_bytes);
+
+            for (auto* const buf : bufs)
+            {
+                tr_cacheReleaseBlockBuffer(session_->cache, buf);
+            }
+
+            // ...and their slabs are freed like any other empty slab
+            EXPECT_EQ(0, tr_cacheSetLimit(session_->cache, 0));
+            EXPECT_EQ(0U, tr_cacheGetStats(session_->cache).write_slab_bytes);
+        });
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -22,6 +22,10 @@
 #define tr_x509_store_t tr_x509_store_t_
 #define tr_x509_cert_t tr_x509_cert_t_
 #define tr_crypto tr_crypto_
+#define tr_crypto_key_pool_stats tr_crypto_key_pool_stats_
+#define tr_cryptoKeyPoolInit tr_cryptoKeyPoolInit_
+#define tr_cryptoKeyPoolClose tr_cryptoKeyPoolClose_
+#define tr_cryptoGetKeyPoolStats tr_cryptoGetKeyPoolStats_
 #define tr_cryptoConstruct tr_cryptoConstruct_
 #define tr_cryptoDestruct tr_cryptoDestruct_
 #define tr_cryptoSetTorrentHash tr_cryptoSetTorrentHash_
@@ -45,6 +49,7 @@
 #define tr_dh_secret_derive tr_dh_secret_derive_
 #define tr_dh_secret_free tr_dh_secret_free_
 #define tr_dh_align_key tr_dh_align_key_
+#define tr_arc4_process tr_arc4_process_
 #define tr_ssl_get_x509_store tr_ssl_get_x509_store_
 #define tr_x509_store_add tr_x509_store_add_
 #define tr_x509_cert_new tr_x509_cert_new_
@@ -81,6 +86,10 @@
 #undef tr_x509_store_t
 #undef tr_x509_cert_t
 #undef tr_crypto
+#undef tr_crypto_key_pool_stats
+#undef tr_cryptoKeyPoolInit
+#undef tr_cryptoKeyPoolClose
+#undef tr_cryptoGetKeyPoolStats
 #undef tr_cryptoConstruct
 #undef tr_cryptoDestruct
 #undef tr_cryptoSetTorrentHash
@@ -104,6 +113,7 @@
 #undef tr_dh_secret_derive
 #undef tr_dh_secret_free
 #undef tr_dh_align_key
+#undef tr_arc4_process
 #undef tr_ssl_get_x509_store
 #undef tr_x509_store_add
 #undef tr_x509_cert_new
@@ -133,6 +143,10 @@
 #define tr_x509_store_t_ tr_x509_store_t
 #define tr_x509_cert_t_ tr_x509_cert_t
 #define tr_crypto_ tr_crypto
+#define tr_crypto_key_pool_stats_ tr_crypto_key_pool_stats
+#define tr_cryptoKeyPoolInit_ tr_cryptoKeyPoolInit
+#define tr_cryptoKeyPoolClose_ tr_cryptoKeyPoolClose
+#define tr_cryptoGetKeyPoolStats_ tr_cryptoGetKeyPoolStats
 #define tr_cryptoConstruct_ tr_cryptoConstruct
 #define tr_cryptoDestruct_ tr_cryptoDestruct
 #define tr_cryptoSetTorrentHash_ tr_cryptoSetTorrentHash
@@ -156,6 +170,7 @@
 #define tr_dh_secret_derive_ tr_dh_secret_derive
 #define tr_dh_secret_free_ tr_dh_secret_free
 #define tr_dh_align_key_ tr_dh_align_key
+#define tr_arc4_process_ tr_arc4_process
 #define tr_ssl_get_x509_store_ tr_ssl_get_x509_store
 #define tr_x509_store_add_ tr_x509_store_add
 #define tr_x509_cert_new_ tr_x509_cert_new
@@ -12,6 +12,9 @@
 #include "utils.h"
 
 #include "crypto-test-ref.h"
+#include "test-fixtures.h"
+
+#include <arc4.h>
 
 #include "gtest/gtest.h"
 
@@ -19,6 +22,7 @@
 #include <cstring>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 using namespace std::literals;
 
@@ -102,6 +106,143 @@ TEST(Crypto, encryptDecrypt)
     tr_cryptoDestruct(&a);
 }
 
+TEST(Crypto, keyPool)
+{
+    // the pool fills itself in the background
+    tr_cryptoKeyPoolInit();
+    for (int i = 0; i < 500 && tr_cryptoGetKeyPoolStats().ready == 0; ++i)
+    {
+        tr_wait_msec(10);
+    }
+
+    auto const before = tr_cryptoGetKeyPoolStats();
+    EXPECT_LT(0U, before.ready);
+
+    auto a = tr_crypto{};
+    tr_cryptoConstruct(&a, nullptr, false);
+    auto b = tr_crypto{};
+    tr_cryptoConstruct(&b, nullptr, true);
+
+    auto public_key_length = int{};
+    auto const* const key_a = tr_cryptoGetMyPublicKey(&a, &public_key_length);
+    auto const* const key_b = tr_cryptoGetMyPublicKey(&b, &public_key_length);
+    EXPECT_NE(0, memcmp(key_a, key_b, KEY_LEN));
+
+    // each key is counted once, and at least the first came from the pool
+    auto const after = tr_cryptoGetKeyPoolStats();
+    EXPECT_EQ(before.hits + before.misses + 2, after.hits + after.misses);
+    EXPECT_LE(before.hits + 1, after.hits);
+
+    // pooled keys work just like freshly-made ones
+    EXPECT_TRUE(tr_cryptoComputeSecret(&a, key_b));
+    EXPECT_TRUE(tr_cryptoComputeSecret(&b, key_a));
+    auto hash_a = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    auto hash_b = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    EXPECT_TRUE(tr_cryptoSecretKeySha1(&a, "test", 4, nullptr, 0, std::data(hash_a)));
+    EXPECT_TRUE(tr_cryptoSecretKeySha1(&b, "test", 4, nullptr, 0, std::data(hash_b)));
+    EXPECT_EQ(hash_a, hash_b);
+
+    tr_cryptoDestruct(&b);
+    tr_cryptoDestruct(&a);
+    tr_cryptoKeyPoolClose();
+    EXPECT_EQ(0U, tr_cryptoGetKeyPoolStats().ready);
+}
+
+TEST(Crypto, keyPoolMiss)
+{
+    // with no pool to take from, each key is made on the spot
+    auto const before = tr_cryptoGetKeyPoolStats();
+    EXPECT_EQ(0U, before.ready);
+
+    auto a = tr_crypto{};
+    tr_cryptoConstruct(&a, nullptr, false);
+    auto b = tr_crypto{};
+    tr_cryptoConstruct(&b, nullptr, true);
+
+    auto public_key_length = int{};
+    auto const* const key_a = tr_cryptoGetMyPublicKey(&a, &public_key_length);
+    ASSERT_NE(nullptr, key_a);
+    EXPECT_EQ(KEY_LEN, public_key_length);
+    auto const* const key_b = tr_cryptoGetMyPublicKey(&b, &public_key_length);
+    ASSERT_NE(nullptr, key_b);
+    EXPECT_NE(0, memcmp(key_a, key_b, KEY_LEN));
+
+    auto const after = tr_cryptoGetKeyPoolStats();
+    EXPECT_EQ(before.hits, after.hits);
+    EXPECT_EQ(before.misses + 2, after.misses);
+
+    // and they work just like pooled ones
+    EXPECT_TRUE(tr_cryptoComputeSecret(&a, key_b));
+    EXPECT_TRUE(tr_cryptoComputeSecret(&b, key_a));
+    auto hash_a = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    auto hash_b = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    EXPECT_TRUE(tr_cryptoSecretKeySha1(&a, "test", 4, nullptr, 0, std::data(hash_a)));
+    EXPECT_TRUE(tr_cryptoSecretKeySha1(&b, "test", 4, nullptr, 0, std::data(hash_b)));
+    EXPECT_EQ(hash_a, hash_b);
+
+    tr_cryptoDestruct(&b);
+    tr_cryptoDestruct(&a);
+}
+
+TEST(Crypto, arc4)
+{
+    auto key = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    tr_rand_buffer(std::data(key), std::size(key));
+
+    auto expected_ctx = arc4_context{};
+    arc4_init(&expected_ctx, std::data(key), std::size(key));
+    auto ctx = expected_ctx;
+
+    auto plain = std::vector<uint8_t>(4096);
+    tr_rand_buffer(std::data(plain), std::size(plain));
+
+    // odd lengths and offsets exercise both the 8-byte and the 1-byte paths,
+    // and the state has to carry over correctly from one call to the next
+    for (size_t len = 0; len <= 100; ++len)
+    {
+        auto expected = std::vector<uint8_t>(len);
+        arc4_process(&expected_ctx, std::data(plain) + len, std::data(expected), len);
+
+        auto out = std::vector<uint8_t>(len);
+        tr_arc4_process(&ctx, std::data(plain) + len, std::data(out), len);
+        EXPECT_EQ(expected, out);
+    }
+
+    // in-place
+    auto expected = plain;
+    arc4_process(&expected_ctx, std::data(expected), std::data(expected), std::size(expected));
+    auto out = plain;
+    tr_arc4_process(&ctx, std::data(out), std::data(out), std::size(out));
+    EXPECT_EQ(expected, out);
+}
+
+// not run by default; use --gtest_also_run_disabled_tests to compare with arc4_process()
+TEST(Crypto, DISABLED_arc4Benchmark)
+{
+    auto key = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    tr_rand_buffer(std::data(key), std::size(key));
+
+    auto buf = std::vector<uint8_t>(16 * 1024);
+    tr_rand_buffer(std::data(buf), std::size(buf));
+
+    auto constexpr Rounds = 4096;
+
+    // each call encrypts one 16 KiB block
+    auto const bench = [&](char const* name, auto process)
+    {
+        auto ctx = arc4_context{};
+        arc4_init(&ctx, std::data(key), std::size(key));
+
+        libtransmission::test::benchmark(
+            name,
+            Rounds,
+            [&](size_t /*i*/) { process(&ctx, std::data(buf), std::data(buf), std::size(buf)); });
+    };
+
+    bench("arc4_process (16 KiB)", arc4_process);
+    bench("tr_arc4_process (16 KiB)", tr_arc4_process);
+}
+
 TEST(Crypto, sha1)
 {
     auto hash1 = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
@@ -16,6 +16,7 @@
 #include <array>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #ifndef _WIN32
 #include <sys/types.h>
@@ -1139,6 +1140,120 @@ TEST_F(FileTest, fileReadWriteSeek)
     tr_sys_path_remove(path1.c_str(), nullptr);
 }
 
+TEST_F(FileTest, fileReadWriteVectored)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path1 = tr_strvPath(test_dir, "a"sv);
+    auto const fd = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+    auto in1 = std::string{ "hello" };
+    auto in2 = std::string{};
+    auto in3 = std::string{ ", world" };
+    auto iov = std::array<tr_sys_iovec_t, 3>{};
+    iov[0].iov_base = in1.data();
+    iov[0].iov_len = in1.size();
+    iov[1].iov_base = in2.data();
+    iov[1].iov_len = in2.size();
+    iov[2].iov_base = in3.data();
+    iov[2].iov_len = in3.size();
+
+    uint64_t n;
+    tr_error* err = nullptr;
+    EXPECT_TRUE(tr_sys_file_write_at_v(fd, iov.data(), iov.size(), 2, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(12, n);
+
+    // scatter the data into differently-sized buffers
+    auto out1 = std::array<char, 4>{};
+    auto out2 = std::array<char, 20>{};
+    iov[0].iov_base = out1.data();
+    iov[0].iov_len = out1.size();
+    iov[1].iov_base = out2.data();
+    iov[1].iov_len = out2.size();
+    EXPECT_TRUE(tr_sys_file_read_at_v(fd, iov.data(), 2, 1, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(13, n);
+
+    EXPECT_EQ(0, memcmp("\0hel", out1.data(), 4));
+    EXPECT_EQ(0, memcmp("lo, world", out2.data(), 9));
+
+    tr_sys_file_close(fd, nullptr);
+
+    tr_sys_path_remove(path1.c_str(), nullptr);
+}
+
+TEST_F(FileTest, fileWriteVectoredManyBuffers)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path1 = tr_strvPath(test_dir, "a"sv);
+    auto const fd = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+    // more buffers than a single pwritev() call will take,
+    // of different sizes and with some empty ones mixed in
+    auto bufs = std::vector<std::string>{};
+    auto expected = std::string{};
+    for (size_t i = 0; i < 3000; ++i)
+    {
+        auto& buf = bufs.emplace_back(i % 7, char('a' + i % 26));
+        expected += buf;
+    }
+
+    auto iov = std::vector<tr_sys_iovec_t>(std::size(bufs));
+    for (size_t i = 0; i < std::size(bufs); ++i)
+    {
+        iov[i].iov_base = bufs[i].data();
+        iov[i].iov_len = bufs[i].size();
+    }
+
+    uint64_t n;
+    tr_error* err = nullptr;
+    EXPECT_TRUE(tr_sys_file_write_at_v(fd, iov.data(), iov.size(), 3, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(expected.size(), n);
+
+    auto out = std::string(expected.size(), '\0');
+    EXPECT_TRUE(tr_sys_file_read_at(fd, out.data(), out.size(), 3, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(expected.size(), n);
+    EXPECT_EQ(expected, out);
+
+    // nothing to write is not an error
+    EXPECT_TRUE(tr_sys_file_write_at_v(fd, nullptr, 0, 0, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(0, n);
+
+    tr_sys_file_close(fd, nullptr);
+
+    tr_sys_path_remove(path1.c_str(), nullptr);
+}
+
+TEST_F(FileTest, fileWriteVectoredError)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path1 = tr_strvPath(test_dir, "a"sv);
+    createFileWithContents(path1, "test");
+
+    // writing to a file that was opened read-only fails
+    auto const fd = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ, 0, nullptr);
+
+    auto in1 = std::string{ "hello" };
+    auto iov = std::array<tr_sys_iovec_t, 1>{};
+    iov[0].iov_base = in1.data();
+    iov[0].iov_len = in1.size();
+
+    tr_error* err = nullptr;
+    EXPECT_FALSE(tr_sys_file_write_at_v(fd, iov.data(), iov.size(), 0, nullptr, &err));
+    EXPECT_NE(nullptr, err);
+    tr_error_clear(&err);
+
+    tr_sys_file_close(fd, nullptr);
+
+    tr_sys_path_remove(path1.c_str(), nullptr);
+}
+
 TEST_F(FileTest, fileTruncate)
 {
     auto const test_dir = createTestDir(currentTestName());
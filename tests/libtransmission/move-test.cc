@@ -115,6 +115,13 @@ TEST_P(IncompleteDirTest, incompleteDir)
         tr_free(zero_block);
     }
 
+    // the piece's checksum is tested in a worker thread
+    auto const piece_completed = [tor]()
+    {
+        return tr_torrentStat(tor)->leftUntilDone == 0;
+    };
+    EXPECT_TRUE(waitFor(piece_completed, 2000));
+
     blockingTorrentVerify(tor);
     EXPECT_EQ(0, tr_torrentStat(tor)->leftUntilDone);
 
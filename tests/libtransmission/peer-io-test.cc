@@ -0,0 +1,272 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <event2/buffer.h>
+#include <event2/util.h>
+
+#include "transmission.h"
+#include "net.h"
+#include "peer-io.h"
+#include "peer-socket.h"
+#include "session.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class PeerIoTest : public SessionTest
+{
+protected:
+    // run `func` on the session's event thread and wait for it to finish
+    void runInEventThread(std::function<void()> func)
+    {
+        struct Task
+        {
+            std::function<void()> func;
+            std::atomic<bool> done;
+        };
+
+        auto task = Task{ std::move(func), false };
+        auto const run = [](void* vtask)
+        {
+            auto* const t = static_cast<Task*>(vtask);
+            t->func();
+            t->done = true;
+        };
+
+        tr_runInEventThread(session_, run, &task);
+        EXPECT_TRUE(waitFor([&task]() { return task.done.load(); }, 60000));
+    }
+
+    // returns a peer io on one end of a connected socket pair
+    tr_peerIo* newPeerIo()
+    {
+        auto fds = std::array<evutil_socket_t, 2>{};
+        EXPECT_EQ(0, evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, std::data(fds)));
+        evutil_make_socket_nonblocking(fds[0]);
+        remote_ = fds[1];
+
+        auto addr = tr_address{};
+        EXPECT_TRUE(tr_address_from_string(&addr, "127.0.0.1"));
+
+        tr_peerIo* io = nullptr;
+        runInEventThread(
+            [this, &io, &addr, fds]()
+            {
+                io = tr_peerIoNewIncoming(session_, session_->bandwidth, &addr, 51413, tr_peer_socket_tcp_create(fds[0]));
+                tr_peerIoSetIOFuncs(io, nullptr, onDidWrite, nullptr, this);
+            });
+        return io;
+    }
+
+    void freePeerIo(tr_peerIo* io)
+    {
+        runInEventThread([io]() { tr_peerIoUnref(io); });
+        evutil_closesocket(remote_);
+    }
+
+    static void onDidWrite(tr_peerIo* /*io*/, size_t bytes_written, bool was_piece_data, void* vself)
+    {
+        auto* const self = static_cast<PeerIoTest*>(vself);
+        (was_piece_data ? self->piece_bytes_written_ : self->protocol_bytes_written_) += bytes_written;
+    }
+
+    evutil_socket_t remote_ = {};
+    size_t piece_bytes_written_ = 0;
+    size_t protocol_bytes_written_ = 0;
+};
+
+TEST_F(PeerIoTest, writeAccounting)
+{
+    auto* const io = newPeerIo();
+    ASSERT_NE(nullptr, io);
+
+    auto const write = [io](size_t len, bool is_piece_data)
+    {
+        auto* const buf = evbuffer_new();
+        auto const bytes = std::vector<char>(len, is_piece_data ? 'p' : 'm');
+        evbuffer_add(buf, std::data(bytes), std::size(bytes));
+        tr_peerIoWriteBuf(io, buf, is_piece_data);
+        evbuffer_free(buf);
+    };
+
+    auto flushed = std::array<int, 2>{};
+    runInEventThread(
+        [io, &write, &flushed]()
+        {
+            // a run of protocol messages, a piece, then more protocol messages
+            for (int i = 0; i < 100; ++i)
+            {
+                write(5, false);
+            }
+
+            write(1000, true);
+            write(17, false);
+            write(4, false);
+
+            flushed[0] = tr_peerIoFlushOutgoingProtocolMsgs(io);
+            flushed[1] = tr_peerIoFlush(io, TR_UP, 2000);
+        });
+
+    // only the protocol messages ahead of the piece go out on their own
+    EXPECT_EQ(500, flushed[0]);
+    EXPECT_EQ(1021, flushed[1]);
+    EXPECT_EQ(1000U, piece_bytes_written_);
+    EXPECT_EQ(521U, protocol_bytes_written_);
+
+    freePeerIo(io);
+}
+
+// the same, with the sockets polled by the session's peer loops
+class PeerIoThreadsTest : public PeerIoTest
+{
+protected:
+    void SetUp() override
+    {
+        tr_variantDictAddInt(settings(), TR_KEY_peer_io_threads, 2);
+        PeerIoTest::SetUp();
+    }
+
+    static ReadState onCanRead(tr_peerIo* io, void* vself, size_t* /*setme_piece_byte_count*/)
+    {
+        auto* const self = static_cast<PeerIoThreadsTest*>(vself);
+        auto* const inbuf = tr_peerIoGetReadBuffer(io);
+        auto const n = evbuffer_get_length(inbuf);
+        auto const* const bytes = evbuffer_pullup(inbuf, n);
+        self->bytes_read_.insert(std::end(self->bytes_read_), bytes, bytes + n);
+        evbuffer_drain(inbuf, n);
+        return READ_LATER;
+    }
+
+    std::vector<uint8_t> bytes_read_;
+};
+
+TEST_F(PeerIoThreadsTest, readAndWrite)
+{
+    static auto constexpr Len = size_t{ 256 * 1024 };
+
+    auto* const io = newPeerIo();
+    ASSERT_NE(nullptr, io);
+
+    auto on_peer_loop = false;
+    runInEventThread(
+        [this, io, &on_peer_loop]()
+        {
+            on_peer_loop = io->loop_inbuf != nullptr;
+            tr_peerIoSetIOFuncs(io, onCanRead, onDidWrite, nullptr, this);
+            tr_peerIoSetEnabled(io, TR_DOWN, true);
+        });
+    EXPECT_TRUE(on_peer_loop);
+
+    auto payload = std::vector<uint8_t>(Len);
+    for (size_t i = 0; i < Len; ++i)
+    {
+        payload[i] = uint8_t(i * 7);
+    }
+
+    // the loop writes what the event thread queues...
+    runInEventThread(
+        [io, &payload]()
+        {
+            auto* const buf = evbuffer_new();
+            evbuffer_add(buf, std::data(payload), std::size(payload));
+            tr_peerIoWriteBuf(io, buf, true);
+            evbuffer_free(buf);
+            tr_peerIoSetEnabled(io, TR_UP, true);
+        });
+
+    auto received = std::vector<uint8_t>{};
+    while (std::size(received) < Len)
+    {
+        auto chunk = std::array<uint8_t, 4096>{};
+        auto const n = recv(remote_, reinterpret_cast<char*>(std::data(chunk)), std::size(chunk), 0);
+        ASSERT_LT(0, n);
+        received.insert(std::end(received), std::begin(chunk), std::begin(chunk) + n);
+    }
+
+    EXPECT_EQ(payload, received);
+
+    auto const all_written = [this]()
+    {
+        auto written = size_t{};
+        runInEventThread([this, &written]() { written = piece_bytes_written_; });
+        return written == Len;
+    };
+    EXPECT_TRUE(waitFor(all_written, 5000));
+
+    // ...and reads hand what arrives back to the event thread
+    for (size_t sent = 0; sent < Len;)
+    {
+        auto const n = send(remote_, reinterpret_cast<char const*>(std::data(payload)) + sent, Len - sent, 0);
+        ASSERT_LT(0, n);
+        sent += n;
+    }
+
+    auto const all_read = [this]()
+    {
+        auto n_read = size_t{};
+        runInEventThread([this, &n_read]() { n_read = std::size(bytes_read_); });
+        return n_read == Len;
+    };
+    EXPECT_TRUE(waitFor(all_read, 5000));
+    EXPECT_EQ(payload, bytes_read_);
+
+    freePeerIo(io);
+}
+
+TEST_F(PeerIoTest, DISABLED_writeBufBenchmark)
+{
+    static auto constexpr MessageCount = size_t{ 100000 };
+    static auto constexpr MessageSize = size_t{ 9 }; // e.g. a "have"
+
+    auto* const io = newPeerIo();
+    ASSERT_NE(nullptr, io);
+
+    auto const writes = [this, io](char const* name, bool alternate)
+    {
+        runInEventThread(
+            [io, name, alternate]()
+            {
+                auto const bytes = std::array<char, MessageSize>{};
+                auto* const buf = evbuffer_new();
+
+                // nothing gets flushed, so the output queue only grows
+                benchmark(
+                    name,
+                    MessageCount,
+                    [io, buf, alternate, &bytes](size_t i)
+                    {
+                        evbuffer_add(buf, std::data(bytes), std::size(bytes));
+                        tr_peerIoWriteBuf(io, buf, alternate && (i % 2) != 0);
+                    });
+
+                evbuffer_drain(io->outbuf, evbuffer_get_length(io->outbuf));
+                io->outbuf_datatypes.clear();
+                evbuffer_free(buf);
+            });
+    };
+
+    writes("protocol messages", false);
+    writes("alternating piece and protocol messages", true);
+
+    freePeerIo(io);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -10,12 +10,16 @@
 
 #include <algorithm>
 #include <type_traits>
+#include <vector>
 
 #include "transmission.h"
 
 #include "peer-mgr-active-requests.h"
 
 #include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+using libtransmission::test::benchmark;
 
 class PeerMgrActiveRequestsTest : public ::testing::Test
 {
@@ -189,3 +193,125 @@ TEST_F(PeerMgrActiveRequestsTest, sentBefore)
     EXPECT_EQ(block_a1, items[0].first);
     EXPECT_EQ(peer_a_, items[0].second);
 }
+
+TEST_F(PeerMgrActiveRequestsTest, sentAt)
+{
+    auto requests = ActiveRequests{};
+    auto const block = tr_block_index_t{ 128 };
+    auto const when_a = uint64_t{ 1638000000000 }; // msec
+    auto const when_b = when_a + 250;
+    EXPECT_TRUE(requests.add(block, peer_a_, when_a));
+    EXPECT_TRUE(requests.add(block, peer_b_, when_b));
+
+    EXPECT_EQ(when_a, requests.sentAt(block, peer_a_));
+    EXPECT_EQ(when_b, requests.sentAt(block, peer_b_));
+    EXPECT_FALSE(requests.sentAt(block, peer_c_));
+    EXPECT_FALSE(requests.sentAt(block + 1, peer_a_));
+
+    EXPECT_TRUE(requests.remove(block, peer_a_));
+    EXPECT_FALSE(requests.sentAt(block, peer_a_));
+    EXPECT_EQ(when_b, requests.sentAt(block, peer_b_));
+}
+
+TEST_F(PeerMgrActiveRequestsTest, manyPeersAndBlocks)
+{
+    static auto constexpr NumPeers = size_t{ 64 };
+    static auto constexpr NumBlocks = tr_block_index_t{ 300 };
+
+    auto peers = std::vector<tr_peer*>{};
+    for (size_t i = 0; i < NumPeers; ++i)
+    {
+        peers.push_back(reinterpret_cast<tr_peer*>(0x1000 + i * 0x40));
+    }
+
+    // every peer gets a disjoint range of blocks, sent a second apart,
+    // and the even-numbered peers are also asked for their neighbour's
+    auto requests = ActiveRequests{};
+    for (size_t i = 0; i < NumPeers; ++i)
+    {
+        for (tr_block_index_t block = 0; block < NumBlocks; ++block)
+        {
+            EXPECT_TRUE(requests.add(i * NumBlocks + block, peers[i], block * 1000U));
+
+            if (i % 2 == 0)
+            {
+                EXPECT_TRUE(requests.add((i + 1) * NumBlocks + block, peers[i], block * 1000U));
+            }
+        }
+    }
+
+    EXPECT_EQ(NumPeers * NumBlocks * 3 / 2, requests.size());
+    EXPECT_EQ(2U * NumBlocks, requests.count(peers[0]));
+    EXPECT_EQ(2U, requests.count(tr_block_index_t{ NumBlocks }));
+    EXPECT_EQ(NumPeers * 3 / 2 * 10, std::size(requests.sentBefore(10 * 1000)));
+
+    // drop the even-numbered peers
+    for (size_t i = 0; i < NumPeers; i += 2)
+    {
+        EXPECT_EQ(2U * NumBlocks, std::size(requests.remove(peers[i])));
+        EXPECT_EQ(0U, requests.count(peers[i]));
+    }
+
+    EXPECT_EQ(NumPeers / 2 * NumBlocks, requests.size());
+    EXPECT_EQ(0U, requests.count(tr_block_index_t{ 0 }));
+    EXPECT_EQ(1U, requests.count(tr_block_index_t{ NumBlocks }));
+    EXPECT_TRUE(requests.has(NumBlocks + 7, peers[1]));
+    EXPECT_FALSE(requests.has(NumBlocks + 7, peers[0]));
+    EXPECT_EQ(uint64_t{ 7000 }, requests.sentAt(NumBlocks + 7, peers[1]));
+
+    // everything left is old enough to be found
+    auto const old = requests.sentBefore(NumBlocks * 1000U);
+    EXPECT_EQ(requests.size(), std::size(old));
+    for (auto const& [block, peer] : old)
+    {
+        EXPECT_EQ(std::vector<tr_peer*>{ peer }, requests.remove(block));
+    }
+
+    EXPECT_EQ(0U, requests.size());
+    EXPECT_EQ(0U, std::size(requests.sentBefore(NumBlocks * 1000U)));
+}
+
+TEST_F(PeerMgrActiveRequestsTest, DISABLED_benchmark)
+{
+    // a busy swarm: hundreds of peers, each with a full request pipeline
+    static auto constexpr NumPeers = size_t{ 300 };
+    static auto constexpr RequestsPerPeer = size_t{ 512 };
+    static auto constexpr Rounds = size_t{ 10 };
+
+    auto peers = std::vector<tr_peer*>{};
+    for (size_t i = 0; i < NumPeers; ++i)
+    {
+        peers.push_back(reinterpret_cast<tr_peer*>(0x1000 + i * 0x40));
+    }
+
+    auto requests = ActiveRequests{};
+    auto const n_requests = NumPeers * RequestsPerPeer;
+    for (size_t round = 0; round < Rounds; ++round)
+    {
+        auto const now = uint64_t{ round * 100000 };
+
+        benchmark(
+            "add",
+            n_requests,
+            [&](size_t i) { requests.add(tr_block_index_t(i), peers[i % NumPeers], now + i % 60000); });
+
+        auto found = size_t{};
+        benchmark(
+            "has + sentAt",
+            n_requests,
+            [&](size_t i) { found += requests.sentAt(tr_block_index_t(i), peers[i % NumPeers]) ? 1 : 0; });
+        EXPECT_EQ(n_requests, found);
+
+        // the periodic sweep, when only a few requests have gone stale
+        benchmark(
+            "sentBefore (1% stale)",
+            1,
+            [&](size_t /*i*/) { EXPECT_EQ(n_requests / 100, std::size(requests.sentBefore(now + 600))); });
+
+        // half the peers disconnect, the rest have their blocks arrive
+        benchmark("remove(peer)", NumPeers / 2, [&](size_t i) { requests.remove(peers[i * 2]); });
+        benchmark("remove(block)", n_requests / 2, [&](size_t i) { requests.remove(tr_block_index_t(i * 2 + 1)); });
+
+        EXPECT_EQ(0U, requests.size());
+    }
+}
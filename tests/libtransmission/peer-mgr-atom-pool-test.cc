@@ -0,0 +1,232 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+#include "net.h"
+#include "open-hash-table.h"
+#include "peer-mgr-atom-pool.h"
+
+#include "gtest/gtest.h"
+
+class PeerMgrAtomPoolTest : public ::testing::Test
+{
+protected:
+    static tr_address makeAddress(size_t i)
+    {
+        auto str = std::string(64, '\0');
+        if (i % 4 == 0)
+        {
+            str.resize(std::snprintf(std::data(str), std::size(str), "2001:db8::%zx", i));
+        }
+        else
+        {
+            str.resize(std::snprintf(std::data(str), std::size(str), "10.%zu.%zu.%zu", i >> 16, (i >> 8) & 0xFF, i & 0xFF));
+        }
+
+        auto addr = tr_address{};
+        EXPECT_TRUE(tr_address_from_string(&addr, str));
+        return addr;
+    }
+
+    static std::vector<peer_atom*> fill(AtomPool& pool, size_t n)
+    {
+        auto atoms = std::vector<peer_atom*>{};
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto const addr = makeAddress(i);
+            atoms.push_back(pool.emplace(&addr));
+        }
+
+        return atoms;
+    }
+};
+
+TEST_F(PeerMgrAtomPoolTest, emplaceAndFind)
+{
+    static auto constexpr NumAtoms = size_t{ 1000 };
+
+    auto pool = AtomPool{};
+    auto const atoms = fill(pool, NumAtoms);
+    EXPECT_EQ(NumAtoms, std::size(pool));
+    EXPECT_EQ(NumAtoms, std::size(std::set<peer_atom*>(std::begin(atoms), std::end(atoms))));
+
+    for (size_t i = 0; i < NumAtoms; ++i)
+    {
+        auto const addr = makeAddress(i);
+        EXPECT_EQ(atoms[i], pool.find(&addr));
+        EXPECT_EQ(0, tr_address_compare(&addr, &atoms[i]->addr));
+        EXPECT_EQ(nullptr, atoms[i]->peer);
+    }
+
+    // an address that was never added
+    auto const missing = makeAddress(NumAtoms);
+    EXPECT_EQ(nullptr, pool.find(&missing));
+
+    // the atoms don't move as the pool grows
+    auto const more = makeAddress(NumAtoms + 1);
+    pool.emplace(&more);
+    auto const first = makeAddress(0);
+    EXPECT_EQ(atoms[0], pool.find(&first));
+}
+
+TEST_F(PeerMgrAtomPoolTest, prune)
+{
+    static auto constexpr NumAtoms = size_t{ 500 };
+    static auto constexpr MaxAtoms = size_t{ 200 };
+
+    auto pool = AtomPool{};
+    auto atoms = fill(pool, NumAtoms);
+
+    // every tenth atom is connected; the others are ranked by when they last sent piece data
+    auto* const connected = reinterpret_cast<tr_peer*>(0xCAFE);
+    for (size_t i = 0; i < NumAtoms; ++i)
+    {
+        atoms[i]->piece_data_time = time_t(i);
+        atoms[i]->peer = i % 10 == 0 ? connected : nullptr;
+    }
+
+    auto const in_use = [connected](peer_atom const* atom)
+    {
+        return atom->peer == connected;
+    };
+    auto const better = [](peer_atom const* a, peer_atom const* b)
+    {
+        return a->piece_data_time > b->piece_data_time;
+    };
+
+    // the connected atoms and the most recently useful of the rest are kept
+    auto expected = std::set<size_t>{};
+    auto n_unused = size_t{};
+    for (size_t i = NumAtoms; i-- > 0;)
+    {
+        if (in_use(atoms[i]) || n_unused++ < MaxAtoms - NumAtoms / 10)
+        {
+            expected.insert(i);
+        }
+    }
+
+    pool.prune(MaxAtoms, in_use, better);
+    EXPECT_EQ(MaxAtoms, std::size(pool));
+    EXPECT_EQ(MaxAtoms, size_t(std::distance(std::begin(pool), std::end(pool))));
+
+    for (size_t i = 0; i < NumAtoms; ++i)
+    {
+        auto const addr = makeAddress(i);
+        EXPECT_EQ(expected.count(i) != 0 ? atoms[i] : nullptr, pool.find(&addr)) << i;
+    }
+
+    // the pruned atoms are recycled
+    auto const old_atoms = std::set<peer_atom*>(std::begin(atoms), std::end(atoms));
+    auto const addr = makeAddress(NumAtoms);
+    EXPECT_EQ(1U, old_atoms.count(pool.emplace(&addr)));
+
+    // connected atoms are never pruned, even if that leaves the pool too big
+    pool.prune(NumAtoms / 20, in_use, better);
+    EXPECT_EQ(NumAtoms / 10, std::size(pool));
+    EXPECT_TRUE(std::all_of(std::begin(pool), std::end(pool), in_use));
+}
+
+namespace
+{
+
+struct TestSlot
+{
+    size_t hash = 0;
+    int value = 0;
+    bool used = false;
+};
+
+struct TestSlotTraits
+{
+    static bool isUsed(TestSlot const& slot)
+    {
+        return slot.used;
+    }
+
+    static size_t hash(TestSlot const& slot)
+    {
+        return slot.hash;
+    }
+};
+
+} // namespace
+
+TEST_F(PeerMgrAtomPoolTest, openHashTableEraseWithWraparound)
+{
+    auto table = OpenHashTable<TestSlot, TestSlotTraits>{};
+
+    auto const add = [&table](size_t hash, int value)
+    {
+        table.add(hash) = TestSlot{ hash, value, true };
+    };
+    auto const find = [&table](size_t hash, int value)
+    {
+        auto const* const slot = table.find(hash, [value](TestSlot const& s) { return s.value == value; });
+        return slot != nullptr ? slot->value : -1;
+    };
+
+    // hashes that land in the last two slots, whatever the capacity,
+    // so that their probe runs wrap around to the front of the table
+    auto const last = ~size_t{};
+    auto const second_last = last - 1;
+    add(second_last, 1);
+    add(last, 2);
+    add(second_last, 3);
+    add(last, 4);
+    add(0, 5);
+    add(1, 6);
+    EXPECT_EQ(6U, table.size());
+
+    EXPECT_EQ(1, find(second_last, 1));
+    EXPECT_EQ(2, find(last, 2));
+    EXPECT_EQ(3, find(second_last, 3));
+    EXPECT_EQ(4, find(last, 4));
+    EXPECT_EQ(5, find(0, 5));
+    EXPECT_EQ(6, find(1, 6));
+
+    // erasing the head of the run shifts the wrapped entries back
+    table.erase(table.find(second_last, [](TestSlot const& s) { return s.value == 1; }));
+    EXPECT_EQ(5U, table.size());
+    EXPECT_EQ(-1, find(second_last, 1));
+    EXPECT_EQ(2, find(last, 2));
+    EXPECT_EQ(3, find(second_last, 3));
+    EXPECT_EQ(4, find(last, 4));
+    EXPECT_EQ(5, find(0, 5));
+    EXPECT_EQ(6, find(1, 6));
+
+    // and so does erasing from the middle of it, after the wraparound
+    table.erase(table.find(second_last, [](TestSlot const& s) { return s.value == 3; }));
+    EXPECT_EQ(-1, find(second_last, 3));
+    EXPECT_EQ(2, find(last, 2));
+    EXPECT_EQ(4, find(last, 4));
+    EXPECT_EQ(5, find(0, 5));
+    EXPECT_EQ(6, find(1, 6));
+
+    // the table still grows and keeps everything findable
+    for (int value = 7; value < 200; ++value)
+    {
+        add(size_t(value) * 7919, value);
+    }
+
+    EXPECT_LT(16U, table.capacity());
+    EXPECT_EQ(4, find(last, 4));
+    EXPECT_EQ(6, find(1, 6));
+    for (int value = 7; value < 200; ++value)
+    {
+        EXPECT_EQ(value, find(size_t(value) * 7919, value));
+    }
+}
@@ -0,0 +1,240 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+#include "net.h"
+#include "peer-mgr-atom-pool.h"
+#include "peer-mgr-candidates.h"
+
+#include "gtest/gtest.h"
+
+class PeerMgrCandidatesTest : public ::testing::Test
+{
+protected:
+    static auto constexpr Now = time_t{ 1000 };
+
+    class MockSwarmInfo final : public CandidateQueue::SwarmInfo
+    {
+    public:
+        int reconnectIntervalSecs(peer_atom const* atom, time_t /*now*/) const override
+        {
+            auto const it = intervals.find(atom);
+            return it != std::end(intervals) ? it->second : 0;
+        }
+
+        bool isCandidate(peer_atom* atom, time_t /*now*/) const override
+        {
+            return rejected.count(atom) == 0;
+        }
+
+        uint64_t score(peer_atom const* atom, uint8_t salt) const override
+        {
+            salts[atom].insert(salt);
+            return (base_scores.at(atom) << 8) | salt;
+        }
+
+        std::map<peer_atom const*, uint64_t> base_scores;
+        std::map<peer_atom const*, int> intervals;
+        std::set<peer_atom const*> rejected;
+
+        // the salts that each atom was scored with
+        mutable std::map<peer_atom const*, std::set<uint8_t>> salts;
+    };
+
+    std::vector<peer_atom*> addAtoms(size_t n)
+    {
+        auto atoms = std::vector<peer_atom*>{};
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto str = std::string(32, '\0');
+            str.resize(std::snprintf(std::data(str), std::size(str), "10.0.%zu.%zu", i >> 8, i & 0xFF));
+            auto addr = tr_address{};
+            EXPECT_TRUE(tr_address_from_string(&addr, str));
+
+            auto* const atom = pool_.emplace(&addr);
+            info_.base_scores[atom] = i;
+            atoms.push_back(atom);
+        }
+
+        return atoms;
+    }
+
+    // pop every candidate that's ready now, best first
+    std::vector<peer_atom*> popAll(time_t now = Now)
+    {
+        auto popped = std::vector<peer_atom*>{};
+        auto score = uint64_t{};
+        while (auto* const atom = queue_.next(info_, now, &score))
+        {
+            EXPECT_EQ(info_.score(atom, score & 0xFF), score);
+            queue_.pop(atom);
+            EXPECT_FALSE(atom->is_queued_candidate);
+            popped.push_back(atom);
+        }
+
+        return popped;
+    }
+
+    AtomPool pool_;
+    CandidateQueue queue_;
+    MockSwarmInfo info_;
+};
+
+TEST_F(PeerMgrCandidatesTest, bestScoreComesFirst)
+{
+    static auto constexpr NumAtoms = size_t{ 200 };
+
+    auto atoms = addAtoms(NumAtoms);
+    auto scores = std::vector<uint64_t>(NumAtoms);
+    std::iota(std::begin(scores), std::end(scores), 0);
+    std::shuffle(std::begin(scores), std::end(scores), std::mt19937{ 0 });
+    for (size_t i = 0; i < NumAtoms; ++i)
+    {
+        info_.base_scores[atoms[i]] = scores[i];
+    }
+
+    for (auto* const atom : atoms)
+    {
+        queue_.queue(atom);
+        EXPECT_TRUE(atom->is_queued_candidate);
+    }
+
+    // queueing an atom twice doesn't hand it out twice
+    queue_.queue(atoms.front());
+
+    auto const popped = popAll();
+    ASSERT_EQ(NumAtoms, std::size(popped));
+    EXPECT_TRUE(std::is_sorted(
+        std::begin(popped),
+        std::end(popped),
+        [this](auto const* a, auto const* b) { return info_.base_scores[a] < info_.base_scores[b]; }));
+
+    auto score = uint64_t{};
+    EXPECT_EQ(nullptr, queue_.next(info_, Now, &score));
+}
+
+TEST_F(PeerMgrCandidatesTest, saltBreaksTies)
+{
+    static auto constexpr NumAtoms = size_t{ 50 };
+
+    // every atom scores the same apart from its salt
+    auto const atoms = addAtoms(NumAtoms);
+    for (auto* const atom : atoms)
+    {
+        info_.base_scores[atom] = 7;
+        queue_.queue(atom);
+    }
+
+    auto const popped = popAll();
+    ASSERT_EQ(NumAtoms, std::size(popped));
+
+    // each atom keeps the salt it was given when it became ready, so
+    // rechecking its score at the front of the queue doesn't reorder it
+    auto prev_salt = 0;
+    for (auto const* const atom : popped)
+    {
+        ASSERT_EQ(1U, std::size(info_.salts[atom]));
+        auto const salt = int{ *std::begin(info_.salts[atom]) };
+        EXPECT_LE(prev_salt, salt);
+        prev_salt = salt;
+    }
+}
+
+TEST_F(PeerMgrCandidatesTest, rescoresChangedCandidates)
+{
+    auto const atoms = addAtoms(2);
+    queue_.queue(atoms[0]);
+    queue_.queue(atoms[1]);
+
+    auto score = uint64_t{};
+    EXPECT_EQ(atoms[0], queue_.next(info_, Now, &score));
+
+    // if the best candidate's score gets worse while it's queued,
+    // it's put back in line behind the new best
+    info_.base_scores[atoms[0]] = 2;
+    EXPECT_EQ(atoms[1], queue_.next(info_, Now, &score));
+    EXPECT_EQ(uint64_t{ 1 }, score >> 8);
+
+    EXPECT_EQ(std::vector<peer_atom*>({ atoms[1], atoms[0] }), popAll());
+}
+
+TEST_F(PeerMgrCandidatesTest, waitsForReconnectInterval)
+{
+    auto const atoms = addAtoms(2);
+    atoms[0]->time = Now;
+    info_.intervals[atoms[0]] = 60;
+    queue_.queue(atoms[0]);
+    queue_.queue(atoms[1]);
+
+    EXPECT_EQ(std::vector<peer_atom*>({ atoms[1] }), popAll());
+    EXPECT_TRUE(atoms[0]->is_queued_candidate);
+    EXPECT_TRUE(std::empty(popAll(Now + 59)));
+    EXPECT_EQ(std::vector<peer_atom*>({ atoms[0] }), popAll(Now + 60));
+}
+
+TEST_F(PeerMgrCandidatesTest, rebuildAfterBlocklistChange)
+{
+    auto const atoms = addAtoms(3);
+    for (auto* const atom : atoms)
+    {
+        queue_.queue(atom);
+    }
+
+    // a blocklisted atom is dropped when it reaches the front...
+    info_.rejected.insert(atoms[1]);
+    EXPECT_EQ(std::vector<peer_atom*>({ atoms[0], atoms[2] }), popAll());
+    EXPECT_FALSE(atoms[1]->is_queued_candidate);
+
+    // ...and nothing about the atom itself changes when the blocklist does
+    info_.rejected.clear();
+    EXPECT_TRUE(std::empty(popAll()));
+
+    queue_.rebuild(pool_);
+    EXPECT_EQ(atoms, popAll());
+}
+
+TEST_F(PeerMgrCandidatesTest, rebuildOnTorrentStart)
+{
+    auto const atoms = addAtoms(10);
+
+    // some atoms are still queued, some are connected, some were dropped
+    for (auto* const atom : atoms)
+    {
+        queue_.queue(atom);
+    }
+
+    auto score = uint64_t{};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        queue_.pop(queue_.next(info_, Now, &score));
+    }
+
+    info_.rejected.insert(atoms[3]);
+    EXPECT_EQ(atoms[4], queue_.next(info_, Now, &score));
+    info_.rejected.clear();
+
+    // starting the torrent queues every atom exactly once
+    queue_.rebuild(pool_);
+    for (auto const* const atom : atoms)
+    {
+        EXPECT_TRUE(atom->is_queued_candidate);
+    }
+
+    EXPECT_EQ(atoms, popAll());
+}
@@ -0,0 +1,453 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "net.h"
+#include "peer-common.h"
+#include "peer-mgr.h"
+#include "peer-mgr-interest.h"
+#include "peer-msgs.h"
+#include "session.h"
+#include "torrent.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class PeerMgrInterestTest : public SessionTest
+{
+protected:
+    static auto constexpr NumPieces = tr_piece_index_t{ 100 };
+
+    class FakePeer final : public tr_peer
+    {
+    public:
+        FakePeer(tr_torrent const* tor, tr_piece_index_t n_pieces)
+            : tr_peer{ tor }
+        {
+            have = tr_bitfield{ n_pieces };
+        }
+
+        bool is_transferring_pieces(uint64_t /*now*/, tr_direction /*direction*/, unsigned int* setme_Bps) const override
+        {
+            if (setme_Bps != nullptr)
+            {
+                *setme_Bps = 0;
+            }
+
+            return false;
+        }
+    };
+
+    class MockClientInfo final : public PeerInterest::ClientInfo
+    {
+    public:
+        explicit MockClientInfo(tr_piece_index_t n_pieces)
+            : wanted(n_pieces, true)
+        {
+        }
+
+        bool clientWantsPiece(tr_piece_index_t piece) const override
+        {
+            return wanted[piece];
+        }
+
+        tr_piece_index_t countAllPieces() const override
+        {
+            return tr_piece_index_t(std::size(wanted));
+        }
+
+        std::vector<bool> wanted;
+    };
+
+    void SetUp() override
+    {
+        SessionTest::SetUp();
+        tor_ = zeroTorrentInit();
+        ASSERT_NE(nullptr, tor_);
+    }
+
+    void TearDown() override
+    {
+        tr_torrentRemove(tor_, false, nullptr);
+        SessionTest::TearDown();
+    }
+
+    tr_torrent* tor_ = nullptr;
+};
+
+TEST_F(PeerMgrInterestTest, countsWantedPieces)
+{
+    auto info = MockClientInfo{ NumPieces };
+    auto interest = PeerInterest{};
+    auto seed = FakePeer{ tor_, NumPieces };
+    auto leech = FakePeer{ tor_, NumPieces };
+    auto empty = FakePeer{ tor_, NumPieces };
+
+    seed.have.setHasAll();
+    for (tr_piece_index_t piece = 0; piece < 10; ++piece)
+    {
+        leech.have.set(piece);
+    }
+
+    // we only want the odd pieces
+    for (tr_piece_index_t piece = 0; piece < NumPieces; piece += 2)
+    {
+        info.wanted[piece] = false;
+    }
+
+    EXPECT_EQ(NumPieces / 2, interest.count(info, &seed));
+    EXPECT_EQ(5U, interest.count(info, &leech));
+    EXPECT_EQ(0U, interest.count(info, &empty));
+}
+
+TEST_F(PeerMgrInterestTest, tracksPeerHaves)
+{
+    auto info = MockClientInfo{ NumPieces };
+    auto interest = PeerInterest{};
+    auto peer = FakePeer{ tor_, NumPieces };
+    info.wanted[1] = false;
+
+    EXPECT_EQ(0U, interest.count(info, &peer));
+
+    // a piece we want
+    peer.have.set(0);
+    interest.peerGotPiece(&peer, 0);
+    EXPECT_EQ(1U, interest.count(info, &peer));
+
+    // a piece we don't want
+    peer.have.set(1);
+    interest.peerGotPiece(&peer, 1);
+    EXPECT_EQ(1U, interest.count(info, &peer));
+
+    // a new bitfield is recounted from scratch
+    peer.have.setHasAll();
+    interest.forget(&peer);
+    EXPECT_EQ(NumPieces - 1, interest.count(info, &peer));
+}
+
+TEST_F(PeerMgrInterestTest, tracksClientPieces)
+{
+    auto info = MockClientInfo{ NumPieces };
+    auto interest = PeerInterest{};
+    auto peer_a = FakePeer{ tor_, NumPieces };
+    auto peer_b = FakePeer{ tor_, NumPieces };
+    peer_a.have.set(0);
+    peer_a.have.set(1);
+    peer_b.have.set(1);
+
+    EXPECT_EQ(2U, interest.count(info, &peer_a));
+    EXPECT_EQ(1U, interest.count(info, &peer_b));
+
+    // once we have a piece, neither peer is interesting for it
+    info.wanted[1] = false;
+    interest.clientGotPiece(1);
+    EXPECT_EQ(1U, interest.count(info, &peer_a));
+    EXPECT_EQ(0U, interest.count(info, &peer_b));
+
+    // completing it again, or announcing it, changes nothing
+    interest.clientGotPiece(1);
+    interest.peerGotPiece(&peer_b, 1);
+    EXPECT_EQ(1U, interest.count(info, &peer_a));
+    EXPECT_EQ(0U, interest.count(info, &peer_b));
+}
+
+TEST_F(PeerMgrInterestTest, resetRecounts)
+{
+    auto info = MockClientInfo{ NumPieces };
+    auto interest = PeerInterest{};
+    auto peer = FakePeer{ tor_, NumPieces };
+    peer.have.setHasAll();
+
+    EXPECT_EQ(NumPieces, interest.count(info, &peer));
+
+    // e.g. the user unchecks some files
+    for (tr_piece_index_t piece = 0; piece < NumPieces / 4; ++piece)
+    {
+        info.wanted[piece] = false;
+    }
+
+    interest.reset();
+    EXPECT_EQ(NumPieces - NumPieces / 4, interest.count(info, &peer));
+}
+
+TEST_F(PeerMgrInterestTest, knowsWhenNobodyIsInteresting)
+{
+    auto info = MockClientInfo{ NumPieces };
+    auto interest = PeerInterest{};
+    auto peer_a = FakePeer{ tor_, NumPieces };
+    auto peer_b = FakePeer{ tor_, NumPieces };
+    peer_b.have.set(0);
+
+    // we can't tell until every peer has been counted
+    EXPECT_FALSE(interest.isNobodyInteresting(2));
+    EXPECT_EQ(0U, interest.count(info, &peer_a));
+    EXPECT_FALSE(interest.isNobodyInteresting(2));
+    EXPECT_EQ(1U, interest.count(info, &peer_b));
+    EXPECT_FALSE(interest.isNobodyInteresting(2));
+
+    // once we have the only piece they have, nobody is interesting
+    info.wanted[0] = false;
+    interest.clientGotPiece(0);
+    EXPECT_TRUE(interest.isNobodyInteresting(2));
+
+    // until one of them gets a piece we want
+    peer_a.have.set(1);
+    interest.peerGotPiece(&peer_a, 1);
+    EXPECT_FALSE(interest.isNobodyInteresting(2));
+
+    // or is disconnected and replaced by a new peer
+    interest.forget(&peer_a);
+    EXPECT_TRUE(interest.isNobodyInteresting(1));
+    EXPECT_FALSE(interest.isNobodyInteresting(2));
+
+    // and everything is recounted after a reset
+    interest.reset();
+    EXPECT_FALSE(interest.isNobodyInteresting(1));
+    EXPECT_EQ(0U, interest.count(info, &peer_b));
+    EXPECT_TRUE(interest.isNobodyInteresting(1));
+}
+
+TEST_F(PeerMgrInterestTest, DISABLED_benchmark)
+{
+    // a large session: every rechoke pulse decides, for each torrent,
+    // which of its peers we're interested in
+    static auto constexpr NumTorrents = size_t{ 5000 };
+    static auto constexpr PeersPerTorrent = size_t{ 10 };
+    static auto constexpr PieceSize = uint32_t{ 16384 };
+    static auto constexpr Pieces = tr_piece_index_t{ 2000 };
+    static auto constexpr Pulses = size_t{ 10 };
+
+    // the peers only have pieces from the first of each torrent's two files
+    class FakePeerMsgs final : public tr_peerMsgs
+    {
+    public:
+        FakePeerMsgs(tr_torrent* tor, peer_atom* atom, std::mt19937& rng)
+            : tr_peerMsgs{ tor, atom }
+        {
+            for (tr_piece_index_t piece = 0; piece < Pieces / 2; ++piece)
+            {
+                if (rng() % 8 == 0)
+                {
+                    have.set(piece);
+                }
+            }
+        }
+
+        bool is_transferring_pieces(uint64_t /*now*/, tr_direction /*direction*/, unsigned int* setme_Bps) const override
+        {
+            if (setme_Bps != nullptr)
+            {
+                *setme_Bps = 0;
+            }
+
+            return false;
+        }
+
+        bool is_peer_choked() const override
+        {
+            return peer_is_choked;
+        }
+
+        bool is_peer_interested() const override
+        {
+            return false;
+        }
+
+        bool is_client_choked() const override
+        {
+            return true;
+        }
+
+        bool is_client_interested() const override
+        {
+            return client_is_interested;
+        }
+
+        bool is_utp_connection() const override
+        {
+            return false;
+        }
+
+        bool is_encrypted() const override
+        {
+            return false;
+        }
+
+        bool is_incoming_connection() const override
+        {
+            return true;
+        }
+
+        bool is_active(tr_direction /*direction*/) const override
+        {
+            return false;
+        }
+
+        void update_active(tr_direction /*direction*/) override
+        {
+        }
+
+        time_t get_connection_age() const override
+        {
+            return 0;
+        }
+
+        bool is_reading_block(tr_block_index_t /*block*/) const override
+        {
+            return false;
+        }
+
+        void cancel_block_request(tr_block_index_t /*block*/) override
+        {
+        }
+
+        void set_choke(bool peer_is_choked_in) override
+        {
+            peer_is_choked = peer_is_choked_in;
+        }
+
+        void set_interested(bool client_is_interested_in) override
+        {
+            client_is_interested = client_is_interested_in;
+        }
+
+        void pulse() override
+        {
+        }
+
+        void on_piece_completed(tr_piece_index_t /*piece*/) override
+        {
+        }
+
+        bool peer_is_choked = true;
+        bool client_is_interested = false;
+    };
+
+    auto const makeMetainfo = [](size_t i)
+    {
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 1);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddStr(info, TR_KEY_name, "torrent-" + std::to_string(i));
+        tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+        auto const pieces = std::string(Pieces * SHA_DIGEST_LENGTH, '\0');
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto* const files = tr_variantDictAddList(info, TR_KEY_files, 2);
+        for (auto const* const name : { "a", "b" })
+        {
+            auto* const file = tr_variantListAddDict(files, 2);
+            tr_variantDictAddInt(file, TR_KEY_length, uint64_t{ PieceSize } * Pieces / 2);
+            tr_variantListAddStr(tr_variantDictAddList(file, TR_KEY_path, 1), name);
+        }
+
+        auto len = size_t{};
+        auto* const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+        auto metainfo = std::string{ benc, len };
+        tr_free(benc);
+        tr_variantFree(&top);
+        return metainfo;
+    };
+
+    // new torrents are verified before they start, so save each one's
+    // .torrent file first and start it as if it were being reloaded
+    tr_sessionSetQueueEnabled(session_, TR_DOWN, false);
+    auto torrents = std::vector<tr_torrent*>{};
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        auto const metainfo = makeMetainfo(i);
+        auto* const ctor = tr_ctorNew(session_);
+        tr_ctorSetMetainfo(ctor, std::data(metainfo), std::size(metainfo));
+        tr_ctorSetPaused(ctor, TR_FORCE, false);
+        auto info = tr_info{};
+        ASSERT_EQ(TR_PARSE_OK, tr_torrentParse(ctor, &info));
+        EXPECT_TRUE(tr_ctorSaveContents(ctor, info.torrent, nullptr));
+        tr_metainfoFree(&info);
+        auto err = int{};
+        torrents.push_back(tr_torrentNew(ctor, &err, nullptr));
+        tr_ctorFree(ctor);
+        ASSERT_EQ(0, err);
+    }
+
+    auto const allRunning = [&torrents]()
+    {
+        return std::all_of(std::begin(torrents), std::end(torrents), [](auto const* tor) { return tor->isRunning; });
+    };
+    ASSERT_TRUE(waitFor(allRunning, 60000));
+
+    // don't let the session close peers to get under its peer limit
+    tr_sessionSetPeerLimit(session_, uint16_t{ NumTorrents * PeersPerTorrent });
+
+    auto rng = std::mt19937{ 0 };
+    auto peers = std::vector<FakePeerMsgs*>{};
+    for (auto* const tor : torrents)
+    {
+        for (size_t i = 0; i < PeersPerTorrent; ++i)
+        {
+            auto addr = tr_address{};
+            EXPECT_TRUE(tr_address_from_string(&addr, "10.0.0." + std::to_string(i + 1)));
+            auto* const peer = tr_peerMgrAddPeer(
+                tor,
+                &addr,
+                htons(51413),
+                [](tr_torrent* tor, peer_atom* atom, void* vrng) -> tr_peerMsgs*
+                {
+                    return new FakePeerMsgs{ tor, atom, *static_cast<std::mt19937*>(vrng) };
+                },
+                &rng);
+            peers.push_back(static_cast<FakePeerMsgs*>(peer));
+        }
+    }
+
+    auto const countInterested = [&peers]()
+    {
+        return std::count_if(std::begin(peers), std::end(peers), [](auto const* peer) { return peer->client_is_interested; });
+    };
+
+    auto* const mgr = session_->peerMgr;
+
+    // we want everything, and every swarm has something we want...
+    benchmark("rechoke (first pulse)", 1, [mgr](size_t /*pulse*/) { tr_peerMgrRechoke(mgr); });
+    benchmark("rechoke (interesting peers)", Pulses, [mgr](size_t /*pulse*/) { tr_peerMgrRechoke(mgr); });
+    EXPECT_LT(0, countInterested());
+
+    // ...but once we only want the files that nobody has,
+    // the swarms are skipped after the next pulse recounts them
+    auto const first_file = tr_file_index_t{ 0 };
+    for (auto* const tor : torrents)
+    {
+        tr_torrentSetFileDLs(tor, &first_file, 1, false);
+    }
+
+    benchmark("rechoke (recount)", 1, [mgr](size_t /*pulse*/) { tr_peerMgrRechoke(mgr); });
+    EXPECT_EQ(0, countInterested());
+    benchmark("rechoke (nobody interesting)", Pulses, [mgr](size_t /*pulse*/) { tr_peerMgrRechoke(mgr); });
+    EXPECT_EQ(0, countInterested());
+
+    for (auto* const tor : torrents)
+    {
+        tr_torrentRemove(tor, false, nullptr);
+    }
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -26,6 +26,7 @@ protected:
         mutable std::map<tr_piece_index_t, size_t> missing_block_count_;
         mutable std::map<tr_piece_index_t, tr_block_span_t> block_span_;
         mutable std::map<tr_piece_index_t, tr_priority_t> piece_priority_;
+        mutable std::map<tr_piece_index_t, size_t> piece_replication_;
         mutable std::set<tr_block_index_t> can_request_block_;
         mutable std::set<tr_piece_index_t> can_request_piece_;
         tr_piece_index_t piece_count_ = 0;
@@ -41,6 +42,11 @@ protected:
             return can_request_piece_.count(piece) != 0;
         }
 
+        [[nodiscard]] bool clientWantsPiece(tr_piece_index_t piece) const final
+        {
+            return can_request_piece_.count(piece) != 0;
+        }
+
         [[nodiscard]] bool isEndgame() const final
         {
             return is_endgame_;
@@ -70,6 +76,11 @@ protected:
         {
             return piece_priority_[piece];
         }
+
+        [[nodiscard]] size_t countPeersWithPiece(tr_piece_index_t piece) const final
+        {
+            return piece_replication_[piece];
+        }
     };
 };
 
@@ -351,3 +362,146 @@ TEST_F(PeerMgrWishlistTest, prefersNearlyCompletePieces)
         EXPECT_EQ(0, requested.count(200, 300));
     }
 }
+
+TEST_F(PeerMgrWishlistTest, prefersRarerPieces)
+{
+    auto peer_info = MockPeerInfo{};
+    auto wishlist = Wishlist{};
+
+    // setup: three pieces, all missing
+    peer_info.piece_count_ = 3;
+    peer_info.missing_block_count_[0] = 100;
+    peer_info.missing_block_count_[1] = 100;
+    peer_info.missing_block_count_[2] = 100;
+    peer_info.block_span_[0] = { 0, 100 };
+    peer_info.block_span_[1] = { 100, 200 };
+    peer_info.block_span_[2] = { 200, 300 };
+
+    // and we want everything
+    for (tr_piece_index_t i = 0; i < 3; ++i)
+    {
+        peer_info.can_request_piece_.insert(i);
+    }
+    for (tr_block_index_t i = 0; i < 300; ++i)
+    {
+        peer_info.can_request_block_.insert(i);
+    }
+
+    // but some pieces are rarer than others
+    peer_info.piece_replication_[0] = 20;
+    peer_info.piece_replication_[1] = 1;
+    peer_info.piece_replication_[2] = 5;
+
+    // wishlist should pick the rarest piece's blocks first,
+    // then move on to the next-rarest piece.
+    // NB: when all other things are equal in the wishlist, pieces are
+    // picked at random so this test -could- pass even if there's a bug.
+    // So test several times to shake out any randomness
+    auto const num_runs = 1000;
+    for (int run = 0; run < num_runs; ++run)
+    {
+        auto const ranges = wishlist.next(peer_info, 150);
+        auto requested = tr_bitfield(300);
+        for (auto const& range : ranges)
+        {
+            requested.setSpan(range.begin, range.end);
+        }
+        EXPECT_EQ(150, requested.count());
+        EXPECT_EQ(0, requested.count(0, 100));
+        EXPECT_EQ(100, requested.count(100, 200));
+        EXPECT_EQ(50, requested.count(200, 300));
+    }
+
+    // ...but priority still wins over rarity
+    peer_info.piece_priority_[0] = TR_PRI_HIGH;
+    wishlist.pieceChanged(0);
+    for (int run = 0; run < num_runs; ++run)
+    {
+        auto const ranges = wishlist.next(peer_info, 10);
+        auto requested = tr_bitfield(300);
+        for (auto const& range : ranges)
+        {
+            requested.setSpan(range.begin, range.end);
+        }
+        EXPECT_EQ(10, requested.count());
+        EXPECT_EQ(10, requested.count(0, 100));
+    }
+}
+
+TEST_F(PeerMgrWishlistTest, picksUpPieceChanges)
+{
+    auto peer_info = MockPeerInfo{};
+    auto wishlist = Wishlist{};
+
+    // setup: three pieces, all missing
+    peer_info.piece_count_ = 3;
+    peer_info.missing_block_count_[0] = 100;
+    peer_info.missing_block_count_[1] = 100;
+    peer_info.missing_block_count_[2] = 100;
+    peer_info.block_span_[0] = { 0, 100 };
+    peer_info.block_span_[1] = { 100, 200 };
+    peer_info.block_span_[2] = { 200, 300 };
+
+    // and we want everything
+    for (tr_piece_index_t i = 0; i < 3; ++i)
+    {
+        peer_info.can_request_piece_.insert(i);
+    }
+    for (tr_block_index_t i = 0; i < 300; ++i)
+    {
+        peer_info.can_request_block_.insert(i);
+    }
+
+    // and the first piece is the rarest
+    peer_info.piece_replication_[0] = 1;
+    peer_info.piece_replication_[1] = 5;
+    peer_info.piece_replication_[2] = 5;
+
+    auto const requested = [&wishlist, &peer_info](size_t n_wanted)
+    {
+        auto bitfield = tr_bitfield(300);
+        for (auto const& span : wishlist.next(peer_info, n_wanted))
+        {
+            bitfield.setSpan(span.begin, span.end);
+        }
+        return bitfield;
+    };
+
+    auto blocks = requested(10);
+    EXPECT_EQ(10, blocks.count(0, 100));
+
+    // now we get most of the third piece, so it's closer to completion.
+    // the wishlist keeps its list between calls, so tell it what changed
+    peer_info.missing_block_count_[2] = 10;
+    for (tr_block_index_t i = 200; i < 290; ++i)
+    {
+        peer_info.can_request_block_.erase(i);
+    }
+    wishlist.pieceChanged(2);
+
+    blocks = requested(10);
+    EXPECT_EQ(10, blocks.count(290, 300));
+
+    // and then we get the rest of it
+    peer_info.missing_block_count_[2] = 0;
+    for (tr_block_index_t i = 290; i < 300; ++i)
+    {
+        peer_info.can_request_block_.erase(i);
+    }
+    wishlist.pieceChanged(2);
+
+    blocks = requested(10);
+    EXPECT_EQ(10, blocks.count(0, 100));
+    EXPECT_EQ(0, blocks.count(200, 300));
+
+    // now the first piece becomes unwanted and the second piece
+    // becomes high priority. After a reset(), both should be noticed.
+    peer_info.can_request_piece_.erase(0);
+    peer_info.piece_priority_[1] = TR_PRI_HIGH;
+    wishlist.reset();
+
+    blocks = requested(200);
+    EXPECT_EQ(0, blocks.count(0, 100));
+    EXPECT_EQ(100, blocks.count(100, 200));
+    EXPECT_EQ(100, blocks.count());
+}
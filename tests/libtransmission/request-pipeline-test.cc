@@ -0,0 +1,103 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdint>
+
+#include "transmission.h"
+#include "request-pipeline.h"
+
+#include "gtest/gtest.h"
+
+namespace
+{
+
+auto constexpr BlockSize = uint64_t{ 16384 };
+
+} // namespace
+
+TEST(RequestPipeline, noSamples)
+{
+    auto const pipeline = RequestPipeline{};
+
+    EXPECT_FALSE(pipeline.hasSamples());
+    EXPECT_EQ(RequestPipeline::MaxTimeoutMsec, pipeline.requestTimeoutMsec());
+}
+
+TEST(RequestPipeline, timeoutFollowsResponseTime)
+{
+    auto pipeline = RequestPipeline{};
+    auto now = uint64_t{ 1000000 };
+
+    // a peer that steadily answers in 2 seconds...
+    for (int i = 0; i < 50; ++i)
+    {
+        pipeline.gotBlock(now, 2000, 0, 0);
+        now += 100;
+    }
+
+    EXPECT_TRUE(pipeline.hasSamples());
+    auto const steady = pipeline.requestTimeoutMsec();
+    EXPECT_GE(steady, RequestPipeline::MinTimeoutMsec);
+    EXPECT_LT(steady, 10000U);
+
+    // ...gets more rope when its answers start to vary
+    for (int i = 0; i < 50; ++i)
+    {
+        pipeline.gotBlock(now, i % 2 == 0 ? 1000 : 12000, 0, 0);
+        now += 100;
+    }
+
+    EXPECT_GT(pipeline.requestTimeoutMsec(), steady);
+    EXPECT_LE(pipeline.requestTimeoutMsec(), RequestPipeline::MaxTimeoutMsec);
+
+    // but never more than the old fixed TTL
+    pipeline.gotBlock(now, 1000000, 0, 0);
+    EXPECT_EQ(RequestPipeline::MaxTimeoutMsec, pipeline.requestTimeoutMsec());
+}
+
+TEST(RequestPipeline, rttExcludesQueueing)
+{
+    auto pipeline = RequestPipeline{};
+    auto constexpr Now = uint64_t{ 1000000 };
+
+    // at 1 MB/s, a block with 1 MB queued behind it that arrives after
+    // 1.3 seconds spent about 1 second of that waiting its turn
+    auto constexpr Rate = uint64_t{ 1000000 };
+    pipeline.gotBlock(Now, 1300, Rate, Rate);
+    EXPECT_EQ(300U, pipeline.rttMsec());
+
+    // a lower estimate replaces it right away...
+    pipeline.gotBlock(Now + 100, 1250, Rate, Rate);
+    EXPECT_EQ(250U, pipeline.rttMsec());
+
+    // ...a higher one only once the old one's stale
+    pipeline.gotBlock(Now + 200, 1500, Rate, Rate);
+    EXPECT_EQ(250U, pipeline.rttMsec());
+    pipeline.gotBlock(Now + 100 + RequestPipeline::RttWindowMsec, 1500, Rate, Rate);
+    EXPECT_EQ(500U, pipeline.rttMsec());
+}
+
+TEST(RequestPipeline, requestCountCoversRoundTrip)
+{
+    auto constexpr Now = uint64_t{ 1000000 };
+
+    // a nearby peer gets the minimum horizon's worth of requests
+    auto nearby = RequestPipeline{};
+    nearby.gotBlock(Now, 20, 0, 0);
+    EXPECT_EQ(20U, nearby.rttMsec());
+    EXPECT_EQ(62U, nearby.requestCount(1000000, BlockSize)); // 1 sec at 1 MB/s
+
+    // a faraway peer needs more in flight to keep the link busy
+    auto faraway = RequestPipeline{};
+    faraway.gotBlock(Now, 800, 0, 0);
+    EXPECT_EQ(800U, faraway.rttMsec());
+    EXPECT_EQ(98U, faraway.requestCount(1000000, BlockSize)); // 1.6 sec at 1 MB/s
+
+    // and a slow peer doesn't get to sit on a long queue of blocks
+    EXPECT_EQ(1U, faraway.requestCount(5000, BlockSize));
+}
@@ -9,6 +9,7 @@
 #include "transmission.h"
 #include "session.h"
 #include "session-id.h"
+#include "trevent.h"
 #include "utils.h"
 #include "version.h"
 
@@ -16,10 +17,14 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <numeric>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace std::literals;
 
@@ -292,6 +297,141 @@ TEST_F(SessionTest, sessionId)
     tr_free(const_cast<char*>(session_id_str_1));
 }
 
+TEST_F(SessionTest, runInEventThread)
+{
+    // several threads post at once; everything should run,
+    // and each thread's calls should run in the order they were made
+    static auto constexpr NumThreads = size_t{ 4 };
+    static auto constexpr NumPosts = size_t{ 2000 };
+
+    struct Post
+    {
+        std::vector<size_t>* ran;
+        std::atomic<size_t>* n_ran;
+        size_t seq;
+    };
+
+    auto ran = std::array<std::vector<size_t>, NumThreads>{};
+    auto n_ran = std::atomic<size_t>{};
+    auto posts = std::vector<Post>{};
+    posts.reserve(NumThreads * NumPosts);
+    for (size_t i = 0; i < NumThreads; ++i)
+    {
+        for (size_t seq = 0; seq < NumPosts; ++seq)
+        {
+            posts.push_back({ &ran[i], &n_ran, seq });
+        }
+    }
+
+    auto const run_post = [](void* vpost)
+    {
+        auto* const post = static_cast<Post*>(vpost);
+        post->ran->push_back(post->seq);
+        ++*post->n_ran;
+    };
+
+    auto threads = std::vector<std::thread>{};
+    for (size_t i = 0; i < NumThreads; ++i)
+    {
+        threads.emplace_back(
+            [this, &posts, run_post, i]()
+            {
+                for (size_t seq = 0; seq < NumPosts; ++seq)
+                {
+                    tr_runInEventThread(session_, run_post, &posts[i * NumPosts + seq]);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto const test = [&n_ran]()
+    {
+        return n_ran == NumThreads * NumPosts;
+    };
+    EXPECT_TRUE(waitFor(test, 5000));
+
+    auto expected = std::vector<size_t>(NumPosts);
+    std::iota(std::begin(expected), std::end(expected), 0);
+    for (auto const& seqs : ran)
+    {
+        EXPECT_EQ(expected, seqs);
+    }
+}
+
+TEST_F(SessionTest, DISABLED_runInEventThreadBenchmark)
+{
+    static auto constexpr NumPosts = size_t{ 200000 };
+    static auto constexpr NumRoundTrips = size_t{ 20000 };
+
+    // how fast can several threads post no-op calls?
+    auto const count_post = [](void* vcount)
+    {
+        ++*static_cast<std::atomic<size_t>*>(vcount);
+    };
+
+    for (size_t const n_threads : { 1, 4, 8 })
+    {
+        // each call is a whole batch of posts, split between the threads
+        auto name = std::array<char, 64>{};
+        std::snprintf(std::data(name), std::size(name), "post %zu calls from %zu thread(s)", NumPosts, n_threads);
+
+        benchmark(
+            std::data(name),
+            1,
+            [this, count_post, n_threads](size_t /*i*/)
+            {
+                auto n_ran = std::atomic<size_t>{};
+
+                auto threads = std::vector<std::thread>{};
+                for (size_t i = 0; i < n_threads; ++i)
+                {
+                    threads.emplace_back(
+                        [this, &n_ran, count_post, n_threads]()
+                        {
+                            for (size_t post = 0; post < NumPosts / n_threads; ++post)
+                            {
+                                tr_runInEventThread(session_, count_post, &n_ran);
+                            }
+                        });
+                }
+
+                for (auto& thread : threads)
+                {
+                    thread.join();
+                }
+
+                while (n_ran != NumPosts / n_threads * n_threads)
+                {
+                    std::this_thread::yield();
+                }
+            });
+    }
+
+    // how long does the event thread take to wake up and run a call?
+    auto const set_flag = [](void* vflag)
+    {
+        *static_cast<std::atomic<bool>*>(vflag) = true;
+    };
+
+    benchmark(
+        "runInEventThread round trip",
+        NumRoundTrips,
+        [this, set_flag](size_t /*i*/)
+        {
+            auto ran = std::atomic<bool>{ false };
+            tr_runInEventThread(session_, set_flag, &ran);
+
+            while (!ran)
+            {
+                std::this_thread::yield();
+            }
+        });
+}
+
 } // namespace test
 
 } // namespace libtransmission
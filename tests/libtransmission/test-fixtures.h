@@ -17,8 +17,11 @@
 #include "torrent.h"
 #include "variant.h"
 
+#include <atomic>
 #include <chrono>
+#include <cstdio> // printf()
 #include <cstring> // strlen()
+#include <functional>
 #include <memory>
 #include <thread>
 #include <mutex> // std::once_flag()
@@ -61,6 +64,22 @@ inline bool waitFor(std::function<bool()> const& test, int msec)
     }
 }
 
+// for the DISABLED_ benchmarks: calls `func(i)` for i in [0..n),
+// prints how long each call took, and returns the total in seconds
+template<typename Func>
+double benchmark(char const* name, size_t n, Func&& func)
+{
+    auto const begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        func(i);
+    }
+
+    auto const secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::printf("%s: %.3f usec per call, %.3f s for %zu calls\n", name, secs * 1e6 / n, secs, n);
+    return secs;
+}
+
 class Sandbox
 {
 public:
@@ -436,6 +455,29 @@ protected:
         }
     }
 
+    // for code that may only be called from the libevent thread
+    void runInEventThread(std::function<void()> func)
+    {
+        struct Task
+        {
+            std::function<void()> func;
+            std::atomic<bool> done = false;
+        };
+
+        auto task = Task{};
+        task.func = std::move(func);
+        tr_runInEventThread(
+            session_,
+            [](void* vtask)
+            {
+                auto* const t = static_cast<Task*>(vtask);
+                t->func();
+                t->done = true;
+            },
+            &task);
+        EXPECT_TRUE(waitFor([&task]() { return task.done.load(); }, 2000));
+    }
+
     void blockingTorrentVerify(tr_torrent* tor)
     {
         EXPECT_NE(nullptr, tor->session);
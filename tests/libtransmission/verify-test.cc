@@ -0,0 +1,401 @@
+/*
+ * This file Copyright (C) 2021 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "cache.h"
+#include "crypto-utils.h"
+#include "file.h"
+#include "session.h"
+#include "torrent.h"
+#include "utils.h"
+#include "variant.h"
+#include "verify.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class VerifyTest : public SessionTest
+{
+protected:
+    static auto constexpr PieceSize = uint32_t{ 32768 };
+
+    struct VerifyResult
+    {
+        std::atomic<bool> done = false;
+        std::atomic<bool> aborted = false;
+    };
+
+    void SetUp() override
+    {
+        // hash each torrent's pieces in several threads, and verify several torrents at once
+        tr_variantDictAddInt(settings(), TR_KEY_verify_threads, 4);
+        tr_variantDictAddInt(settings(), TR_KEY_verify_queue_size, 2);
+        SessionTest::SetUp();
+    }
+
+    // a paused single-file torrent of random data, whose file is already in the download dir
+    tr_torrent* makeTorrent(std::string const& name, size_t n_pieces)
+    {
+        auto contents = std::vector<uint8_t>(PieceSize * n_pieces - PieceSize / 3);
+        tr_rand_buffer(std::data(contents), std::size(contents));
+
+        auto const path = tr_strvPath(tr_sessionGetDownloadDir(session_), name);
+        createFileWithContents(path, std::data(contents), std::size(contents));
+
+        auto pieces = std::string{};
+        for (size_t offset = 0; offset < std::size(contents); offset += PieceSize)
+        {
+            auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+            auto const len = std::min(std::size(contents) - offset, size_t{ PieceSize });
+            EXPECT_TRUE(tr_sha1(std::data(hash), std::data(contents) + offset, int(len), nullptr));
+            pieces.append(reinterpret_cast<char const*>(std::data(hash)), std::size(hash));
+        }
+
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 1);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddStr(info, TR_KEY_name, name);
+        tr_variantDictAddInt(info, TR_KEY_length, std::size(contents));
+        tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto len = size_t{};
+        auto* const metainfo = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+        tr_variantFree(&top);
+
+        auto* const ctor = tr_ctorNew(session_);
+        tr_ctorSetMetainfo(ctor, metainfo, len);
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+        tr_free(metainfo);
+
+        auto err = int{};
+        auto* const tor = tr_torrentNew(ctor, &err, nullptr);
+        EXPECT_EQ(0, err);
+        tr_ctorFree(ctor);
+        return tor;
+    }
+
+    static void startVerify(tr_torrent* tor, VerifyResult* result)
+    {
+        auto constexpr onVerifyDone = [](tr_torrent* /*tor*/, bool aborted, void* vresult) noexcept
+        {
+            auto* const r = static_cast<VerifyResult*>(vresult);
+            r->aborted = aborted;
+            r->done = true;
+        };
+
+        tr_torrentVerify(tor, onVerifyDone, result);
+    }
+
+    [[nodiscard]] static std::vector<bool> havePieces(tr_torrent const* tor)
+    {
+        auto have = std::vector<bool>(tor->info.pieceCount);
+        for (tr_piece_index_t piece = 0; piece < tor->info.pieceCount; ++piece)
+        {
+            have[piece] = tor->hasPiece(piece);
+        }
+
+        return have;
+    }
+
+    void overwrite(tr_torrent const* tor, tr_file_index_t file, uint64_t offset, uint8_t ch)
+    {
+        auto const path = makeString(tr_torrentFindFile(tor, file));
+        auto const fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_WRITE, 0, nullptr);
+        ASSERT_NE(TR_BAD_SYS_FILE, fd);
+        EXPECT_TRUE(tr_sys_file_write_at(fd, &ch, 1, offset, nullptr, nullptr));
+        tr_sys_file_close(fd, nullptr);
+        sync();
+    }
+};
+
+TEST_F(VerifyTest, verifiesSeveralTorrentsAtOnce)
+{
+    // twice as many torrents as can be verified at once, and all the same size,
+    // so that the ones left waiting in the queue can't be mistaken for each other
+    auto constexpr NumTorrents = size_t{ 4 };
+    auto torrents = std::vector<tr_torrent*>{};
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        torrents.push_back(makeTorrent("torrent-" + std::to_string(i), 40));
+        ASSERT_NE(nullptr, torrents.back());
+    }
+
+    auto results = std::vector<VerifyResult>(NumTorrents);
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        startVerify(torrents[i], &results[i]);
+    }
+
+    auto const all_done = [&results]()
+    {
+        return std::all_of(std::begin(results), std::end(results), [](auto const& result) { return result.done.load(); });
+    };
+    EXPECT_TRUE(waitFor(all_done, 5000));
+
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        auto* const tor = torrents[i];
+        EXPECT_FALSE(results[i].aborted);
+        EXPECT_EQ(std::vector<bool>(tor->info.pieceCount, true), havePieces(tor));
+        EXPECT_EQ(0, tr_torrentStat(tor)->leftUntilDone);
+        tr_torrentRemove(tor, false, nullptr);
+    }
+}
+
+TEST_F(VerifyTest, corruptPiece)
+{
+    auto* const tor = zeroTorrentInit();
+    ASSERT_NE(nullptr, tor);
+    zeroTorrentPopulate(tor, true);
+
+    // a wrong byte in the middle of piece 5 fails that piece and no other
+    auto constexpr BadPiece = tr_piece_index_t{ 5 };
+    overwrite(tor, 0, uint64_t{ tor->info.pieceSize } * BadPiece + 100, 0xFF);
+    blockingTorrentVerify(tor);
+
+    auto expected = std::vector<bool>(tor->info.pieceCount, true);
+    expected[BadPiece] = false;
+    EXPECT_EQ(expected, havePieces(tor));
+    EXPECT_EQ(tor->info.pieceSize, tr_torrentStat(tor)->leftUntilDone);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(VerifyTest, missingAndShortFiles)
+{
+    auto* const tor = zeroTorrentInit();
+    ASSERT_NE(nullptr, tor);
+    zeroTorrentPopulate(tor, true);
+
+    // the zero torrent's 1 MiB file fills pieces [0..32) and the 4096- and 512-byte files share piece 32
+    ASSERT_EQ(33U, tor->info.pieceCount);
+    auto const n_kept = tr_piece_index_t{ 16 };
+
+    // cut the first file short, and delete the last one
+    auto path = makeString(tr_torrentFindFile(tor, 0));
+    auto fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_WRITE, 0, nullptr);
+    ASSERT_NE(TR_BAD_SYS_FILE, fd);
+    EXPECT_TRUE(tr_sys_file_truncate(fd, uint64_t{ tor->info.pieceSize } * n_kept, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    path = makeString(tr_torrentFindFile(tor, 2));
+    EXPECT_TRUE(tr_sys_path_remove(path.c_str(), nullptr));
+
+    sync();
+    blockingTorrentVerify(tor);
+
+    auto expected = std::vector<bool>(tor->info.pieceCount, false);
+    std::fill_n(std::begin(expected), n_kept, true);
+    EXPECT_EQ(expected, havePieces(tor));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(VerifyTest, removeWhileVerifying)
+{
+    auto* const tor = zeroTorrentInit();
+    ASSERT_NE(nullptr, tor);
+    zeroTorrentPopulate(tor, true);
+
+    // read about a piece a second, so the verify is still going when it's removed
+    session_->verifySpeedLimit_Bps = 1000;
+
+    auto result = VerifyResult{};
+    startVerify(tor, &result);
+    EXPECT_TRUE(waitFor([tor]() { return tor->verifyState == TR_VERIFY_NOW; }, 2000));
+    EXPECT_FALSE(result.done);
+
+    // the verify stops without waiting out its throttle
+    auto const begin = std::chrono::steady_clock::now();
+    {
+        auto const lock = tor->unique_lock();
+        tr_verifyRemove(tor);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - begin, 1s);
+
+    EXPECT_TRUE(waitFor([&result]() { return result.done.load(); }, 2000));
+    EXPECT_TRUE(result.aborted);
+    EXPECT_EQ(TR_VERIFY_NONE, tor->verifyState);
+
+    session_->verifySpeedLimit_Bps = 0;
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+// newly-downloaded pieces, which are checked in a worker thread
+class PieceCheckTest : public VerifyTest
+{
+protected:
+    void SetUp() override
+    {
+        VerifyTest::SetUp();
+
+        // everything but piece 0
+        tor_ = zeroTorrentInit();
+        ASSERT_NE(nullptr, tor_);
+        zeroTorrentPopulate(tor_, false);
+        ASSERT_FALSE(tor_->hasPiece(0));
+    }
+
+    void TearDown() override
+    {
+        runInEventThread([this]() { tr_cacheFlushTorrent(session_->cache, tor_); });
+        tr_torrentRemove(tor_, false, nullptr);
+        VerifyTest::TearDown();
+    }
+
+    // as if a peer had sent us the block. must be called from the libevent thread
+    void gotBlock(tr_block_index_t block, uint8_t fill)
+    {
+        auto const contents = std::vector<uint8_t>(tor_->blockSize(block), fill);
+        auto* const buf = evbuffer_new();
+        evbuffer_add(buf, std::data(contents), std::size(contents));
+        auto const piece = tor_->pieceForBlock(block);
+        auto const offset = uint32_t(uint64_t{ block } * tor_->block_size - tor_->offset(piece, 0));
+        EXPECT_EQ(0, tr_cacheWriteBlock(session_->cache, tor_, piece, offset, std::size(contents), buf));
+        evbuffer_free(buf);
+
+        tr_torrentGotBlock(tor_, block);
+    }
+
+    void waitForPieceCheck(tr_piece_index_t piece)
+    {
+        auto const checked = [this, piece]()
+        {
+            auto being_checked = true;
+            runInEventThread([&]() { being_checked = tor_->isPieceBeingChecked(piece); });
+            return !being_checked;
+        };
+        EXPECT_TRUE(waitFor(checked, 2000));
+    }
+
+    tr_torrent* tor_ = nullptr;
+};
+
+TEST_F(PieceCheckTest, passingPiece)
+{
+    auto const [begin, end] = tor_->blockSpanForPiece(0);
+
+    runInEventThread(
+        [&, begin = begin, end = end]()
+        {
+            for (auto block = begin; block < end; ++block)
+            {
+                gotBlock(block, 0);
+            }
+
+            // the piece isn't ours until its checksum has been tested
+            EXPECT_TRUE(tor_->isPieceBeingChecked(0));
+            EXPECT_FALSE(tor_->hasPiece(0));
+        });
+
+    waitForPieceCheck(0);
+
+    runInEventThread(
+        [&]()
+        {
+            EXPECT_TRUE(tor_->hasPiece(0));
+            EXPECT_EQ(0U, tor_->corruptCur);
+        });
+    EXPECT_EQ(0, tr_torrentStat(tor_)->leftUntilDone);
+}
+
+TEST_F(PieceCheckTest, failingPiece)
+{
+    auto const [begin, end] = tor_->blockSpanForPiece(0);
+
+    runInEventThread(
+        [&, begin = begin, end = end]()
+        {
+            for (auto block = begin; block < end; ++block)
+            {
+                gotBlock(block, 0xFF);
+            }
+        });
+
+    waitForPieceCheck(0);
+
+    // the piece's blocks are dropped so that they'll be downloaded again
+    runInEventThread(
+        [&, begin = begin, end = end]()
+        {
+            EXPECT_FALSE(tor_->hasPiece(0));
+            EXPECT_EQ(end - begin, tor_->countMissingBlocksInPiece(0));
+            EXPECT_EQ(tor_->pieceSize(0), tor_->corruptCur);
+        });
+}
+
+TEST_F(PieceCheckTest, blockArrivesWhileBeingChecked)
+{
+    auto const [begin, end] = tor_->blockSpanForPiece(0);
+
+    runInEventThread(
+        [&, begin = begin, end = end]()
+        {
+            for (auto block = begin; block < end; ++block)
+            {
+                gotBlock(block, 0);
+            }
+
+            // a block of a piece that's being checked counts as a duplicate
+            tor_->downloadedCur = uint64_t{ tor_->pieceSize(0) };
+            gotBlock(begin, 0);
+            EXPECT_EQ(tor_->pieceSize(0) - tor_->blockSize(begin), tor_->downloadedCur);
+            EXPECT_TRUE(tor_->isPieceBeingChecked(0));
+        });
+
+    waitForPieceCheck(0);
+
+    runInEventThread([&]() { EXPECT_TRUE(tor_->hasPiece(0)); });
+}
+
+TEST_F(PieceCheckTest, unreadablePiece)
+{
+    auto const [begin, end] = tor_->blockSpanForPiece(0);
+    ASSERT_LT(begin + 1, end);
+
+    runInEventThread(
+        [&, begin = begin, end = end]()
+        {
+            // the first block has been written to a file that then disappears,
+            // so the piece can't be gathered up for checking, even on a second try
+            tr_torrentGotBlock(tor_, begin);
+            auto const path = makeString(tr_torrentFindFile(tor_, 0));
+            EXPECT_TRUE(tr_sys_path_remove(path.c_str(), nullptr));
+
+            for (auto block = begin + 1; block < end; ++block)
+            {
+                gotBlock(block, 0);
+            }
+
+            // the piece is dropped, but nobody is blamed for corrupt data
+            EXPECT_FALSE(tor_->isPieceBeingChecked(0));
+            EXPECT_FALSE(tor_->hasPiece(0));
+            EXPECT_EQ(end - begin, tor_->countMissingBlocksInPiece(0));
+            EXPECT_EQ(0U, tor_->corruptCur);
+        });
+}
+
+} // namespace test
+
+} // namespace libtransmission